@@ -4,8 +4,13 @@
 #include <ros/ros.h>
 
 #include <hive/vive.h>
-// #include <hive/vive_cost.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_lm.h>
+#include <hive/vive_pnp.h>
+#include <hive/vive_ransac.h>
+#include <hive/vive_snapshot.h>
 #include <hive/vive_solver.h>
+#include <hive/vive_window.h>
 
 // Incoming measurements
 #include <hive/ViveLight.h>
@@ -23,12 +28,16 @@
 #include <Eigen/Dense>
 #include <Eigen/Geometry>
 
+// Light frames kept for one solve
+#define SOLVER_WINDOW 64
+
 // STD C++ includes
 #include <map>
 #include <mutex>
 #include <vector>
 #include <thread>
 #include <string>
+#include <memory>
 
 // typedef std::map<std::string,
 //   std::pair<hive::ViveLight,hive::ViveLight>> LightMap;
@@ -44,24 +53,60 @@ class HiveSolver : public Solver {
     LighthouseMap & lighthouses,
     Environment & environment,
     bool correction,
-    bool verbose = false);
+    bool verbose = false,
+    solve::backend backend = solve::CERES);
   // Destructor
   ~HiveSolver();
   // Process an IMU measurement
   void ProcessImu(const sensor_msgs::Imu::ConstPtr& msg);
+  using Solver::ProcessImu;
   // Process a light measurement
   void ProcessLight(const hive::ViveLight::ConstPtr& msg);
+  void ProcessLight(const hive::ViveLightRaw::ConstPtr& msg);
   // Get the current pose according to the solver
   bool GetTransform(geometry_msgs::TransformStamped &msg);
   // Solves the pose from data
   bool Solve();
+  // Solves against the budget
+  bool GetBudget(BudgetCounters * counters);
+  // Samples checked by the sweep filter
+  bool GetInliers(InlierCounters * counters);
+
+ private:
+  // The problem keeps pointers to pose, so no copies
+  HiveSolver(HiveSolver const&) = delete;
+  HiveSolver& operator=(HiveSolver const&) = delete;
+  // Filter a sweep, add it to the window and solve
+  void ProcessFrame(LightFrame & frame);
+  // Add the residual block of a light measurement
+  ceres::ResidualBlockId AddLight(LightFrame const& frame);
+  // Drop the oldest light frame and its residual block
+  void PopLight();
 
  private:
   geometry_msgs::TransformStamped pose_;
   LighthouseMap lighthouses_;
   Environment environment_;
   Tracker tracker_;
-  LightVector light_data_;
+  // Compiled calibration shared by the cost functions
+  CalibrationSnapshot::Ptr calibration_;
+  int tracker_id_;
+  // Light frames of the last 50 ms and their residual blocks
+  TimeWindow<LightFrame, SOLVER_WINDOW> light_data_;
+  TimeWindow<ceres::ResidualBlockId, SOLVER_WINDOW> blocks_;
+  // Persistent problem
+  std::unique_ptr<ceres::Problem> problem_;
+  double pose_params_[6];
+  // Limits of a solve from the light rate and recent convergence
+  SolveBudget budget_;
+  // Drops the samples the other sweep of their lighthouse disagrees with
+  ransac::SweepFilter ransac_;
+  // Copy of the budget and filter counters for other threads, under the
+  // mutex
+  std::mutex mutex_;
+  BudgetCounters counters_;
+  InlierCounters inliers_;
+  solve::backend backend_;
   bool correction_;
   bool valid_;
   bool verbose_;
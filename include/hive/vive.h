@@ -30,7 +30,10 @@
 #include <sensor_msgs/Imu.h>
 
 // Messages
+#include <hive/vive_general.h>
 #include <hive/ViveLight.h>
+#include <hive/ViveLightRaw.h>
+#include <hive/ViveImuBatch.h>
 #include <hive/ViveLightSample.h>
 #include <hive/ViveCalibration.h>
 #include <hive/ViveCalibrationLighthouseArray.h>
@@ -171,6 +174,24 @@ typedef std::pair<Eigen::Vector3d, Eigen::Vector4d> PoseVV;
 
 typedef std::vector<geometry_msgs::TransformStamped> TFVector;
 
+// Dense ids of device serials. Ids are handed out in order of first sight
+// and never reused, so arrays indexed by them stay valid as devices appear.
+class SerialIds {
+ public:
+  // Id of the serial, a new one if it was not seen before
+  size_t Intern(std::string const& serial);
+  // Id of the serial, -1 if it was not seen before
+  int Find(std::string const& serial) const;
+  // Serial of an interned id
+  std::string const& Serial(size_t id) const;
+  // Number of interned serials
+  size_t Size() const;
+
+ private:
+  std::vector<std::string> serials_;
+  std::map<std::string, size_t> ids_;
+};
+
 class Calibration {
  public:
   // Sets the enviroment structure from a calibration message.
@@ -207,10 +228,16 @@ class Calibration {
 
   void Print();
 
+  // Interns the serials of every tracker and lighthouse
+  void Intern();
+
   std::map<std::string, Tracker> trackers;
   std::map<std::string, Lighthouse> lighthouses;
   LightSpecs light_specs;
   Environment environment;
+  // Dense ids of the serials above, kept by the setters
+  SerialIds tracker_ids;
+  SerialIds lighthouse_ids;
 };
 
 
@@ -234,6 +261,19 @@ class ViveUtils {
 
   // Get static transforms in std vector
   static TFVector GetTransforms(Calibration & calibration_data);
+
+  // Lighthouse serials by the id used in the compact light message
+  static std::map<uint8_t, std::string> GetLighthouseIds(
+    LighthouseMap const& lighthouses);
+
+  // Light samples from the compact message, false for unknown lighthouses
+  static bool ConvertLight(hive::ViveLightRaw const& raw,
+    std::map<uint8_t, std::string> const& lighthouse_ids,
+    hive::ViveLight * light);
+
+  // Sample i of a batch as a single imu message
+  static void ConvertImu(hive::ViveImuBatch const& batch,
+    size_t i, sensor_msgs::Imu * imu);
 };
 
 class JsonParser {
@@ -247,6 +287,9 @@ class JsonParser {
   // Get the update rate of the pose
   double GetRate();
 
+  // Get the number of solver threads, zero for one per core
+  size_t GetThreads();
+
   // Update the calibration structure
   bool GetCalibration(Calibration * calibration);
 
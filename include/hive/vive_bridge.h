@@ -0,0 +1,190 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef HIVE_VIVE_BRIDGE_H_
+#define HIVE_VIVE_BRIDGE_H_
+
+// Libsurvive interface
+extern "C" {
+  #include <deepdive/deepdive.h>
+}
+
+// ROS includes
+#include <ros/ros.h>
+
+// Hive includes
+#include <hive/vive_clock.h>
+#include <hive/vive_ring.h>
+
+// Hive messages
+#include <hive/ViveImuBatch.h>
+
+// C++ includes
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Id of a device past the ones the messages can tell apart
+#define BRIDGE_NO_ID UINT8_MAX
+// Sensors copied per sweep
+#define BRIDGE_SENSORS 40
+// Records between each poll thread and the publisher thread
+#define BRIDGE_RING 1024
+// Age at which a record is merged even if another ring may still get an
+// older one, with more than one deepdive context
+#define BRIDGE_MERGE 100e-6      // s
+// Publisher sleep when the ring is empty
+#define BRIDGE_IDLE 200e-6       // s
+// Period of the ring report
+#define BRIDGE_REPORT 10.0       // s
+// Period of the clock fit messages
+#define BRIDGE_CLOCK 1.0         // s
+// Default imu samples per batch message, about 10 ms of data. A tracker's
+// light flushes its batch, so batches never hold samples past a sweep.
+#define BRIDGE_IMU_BATCH 10
+// Default age of the oldest sample at which a batch goes out anyway
+#define BRIDGE_IMU_LATENCY 0.01  // s
+// Empty polls spun through before backing off
+#define BRIDGE_POLL_SPINS 16
+// First and longest sleep after an empty poll, the longest bounds the
+// latency added to a sample arriving while asleep
+#define BRIDGE_POLL_MIN 2e-6     // s
+#define BRIDGE_POLL_MAX 50e-6    // s
+// Timer slack of the poll thread, so that short sleeps stay short
+#define BRIDGE_POLL_SLACK 1000   // ns
+
+// Raw sweep or imu sample, as the deepdive callbacks hand them over
+struct BridgeRecord {
+  enum {LIGHT, IMU} type;
+  struct Tracker * tracker;
+  struct Lighthouse * lighthouse;
+  ros::Time stamp;               // Arrival in the callback
+  uint32_t timecode;             // Device clock, imu timecode or synctime
+  uint8_t axis;
+  uint16_t num_sensors;
+  uint16_t sensors[BRIDGE_SENSORS];
+  uint32_t angles[BRIDGE_SENSORS];
+  uint16_t lengths[BRIDGE_SENSORS];
+  int16_t acc[3];
+  int16_t gyr[3];
+};
+
+// Publisher side state of a tracker, indexed by the id in its messages
+struct BridgeTracker {
+  std::string serial;
+  ClockModel clock;              // Clock fit
+  hive::ViveImuBatch::Ptr batch; // Pending imu batch
+};
+
+// Health of the hand-off since the last report
+struct BridgeStats {
+  size_t published;              // Messages published
+  size_t overruns;               // Records lost to a full ring
+  size_t max_depth;              // Deepest the ring has been
+  double sum_latency;            // Callback to publish delay (s)
+  double max_latency;
+};
+
+// Publishes the light, imu and calibration data of the vive devices. The
+// deepdive callbacks carry no context, so there is one bridge per process.
+// It may open several deepdive contexts, each polled on its own thread.
+// Light and imu only get copied into the poll thread's ring inside
+// deepdive_poll(), a publisher thread merges the rings in arrival order
+// and builds and publishes the messages, so USB servicing never waits on
+// ROS.
+class HiveBridge {
+ public:
+  HiveBridge();
+
+  // Destructor
+  ~HiveBridge();
+
+  // Advertises on the given node handle and starts polling, the private
+  // handle holds the context, imu batching, polling and clock parameters
+  void Initialize(ros::NodeHandle *nh, ros::NodeHandle *pnh);
+
+  // Worker thread polls one context of the survive library
+  void WorkerThread(size_t index);
+
+  // Drains the rings into the publishers
+  void PublisherThread();
+
+  // Hand-off health since the last call
+  BridgeStats GetStats();
+
+  // Callback to display light info
+  static void LightCallback(struct Tracker * tracker,
+    struct Lighthouse * lighthouse, uint8_t axis, uint32_t synctime,
+    uint16_t num_sensors, uint16_t *sensors, uint32_t *sweeptimes,
+    uint32_t *angles, uint16_t *lengths);
+
+  // Called back when new IMU data is available
+  static void ImuCallback(struct Tracker * tracker, uint32_t timecode,
+    int16_t acc[3], int16_t gyr[3], int16_t mag[3]);
+
+  // Configuration call from the vive_tool
+  static void TrackerCallback(struct Tracker * t);
+
+  // Configuration call from the vive_tool
+  static void LighthouseCallback(struct Lighthouse *l);
+
+ protected:
+  std::vector<std::thread> threads_;          // Poll thread per context
+  std::vector<std::unique_ptr<SpscRing<BridgeRecord, BRIDGE_RING>>> rings_;
+  std::thread publisher_;                     // Publisher thread
+  std::atomic<bool> polling_;                 // Poll threads keep polling
+  std::atomic<bool> active_;                  // Publisher keeps publishing
+  bool backoff_;                              // Sleep on empty polls
+  bool device_clock_;                         // Stamp from the device clock
+  std::mutex mutex_;                          // Guards stats_
+  BridgeStats stats_;                         // Hand-off health
+  size_t imu_batch_;                          // Samples per imu batch
+  double imu_latency_;                        // Max age of a batch (s)
+  std::vector<BridgeTracker> trackers_;       // By tracker id
+  std::map<struct Tracker*, uint8_t> tracker_ids_; // Id of each device
+  std::map<struct Lighthouse*, uint8_t> lighthouse_ids_; // Same
+
+ private:
+  static constexpr double GRAVITY = 9.80665;
+  static constexpr double GYRO_SCALE = 32.768;
+  static constexpr double ACC_SCALE = 4096.0;
+  static constexpr int MOTOR_AXIS_0 = 0;
+  static constexpr int MOTOR_AXIS_1 = 1;
+  // Sleeps after the given number of consecutive empty polls
+  static void Backoff(size_t empty);
+  // Oldest record of all rings, NULL if none may go out yet
+  BridgeRecord * Next(size_t * ring);
+  // Ids of a device in the data and the calibration messages, matched by
+  // serial across the contexts. BRIDGE_NO_ID past the last one, whose
+  // records are dropped.
+  uint8_t TrackerId(struct Tracker * tracker);
+  uint8_t LighthouseId(struct Lighthouse * lighthouse);
+  // Publishes one record
+  void Publish(BridgeRecord const& record);
+  // Publishes the clock fit of every tracker
+  void PublishClocks();
+  // Publishes the imu batches that are full or too old, or all of them.
+  // Publish() sends a tracker's batch before its light.
+  void FlushImu(bool all);
+};
+
+#endif // HIVE_VIVE_BRIDGE_H_
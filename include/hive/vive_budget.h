@@ -0,0 +1,72 @@
+#ifndef HIVE_VIVE_BUDGET_H_
+#define HIVE_VIVE_BUDGET_H_
+
+// ROS includes
+#include <ros/ros.h>
+
+// STD C++ includes
+#include <chrono>
+#include <cstddef>
+
+// Share of the measurement period a solve may take
+#define BUDGET_SHARE 0.5
+// Bounds of the time budget
+#define BUDGET_MIN 1e-3          // s
+#define BUDGET_MAX 0.5           // s
+// Measurement gaps longer than this are outages, not the rate
+#define BUDGET_GAP 1.0           // s
+// Weight of a new sample in the running averages
+#define BUDGET_ALPHA 0.05
+// Iteration limit as a multiple of the iterations recent solves needed
+#define BUDGET_HEADROOM 2.0
+#define BUDGET_ITERATIONS_MIN 5
+#define BUDGET_ITERATIONS_MAX 1000
+
+// Solves run under a budget
+struct BudgetCounters {
+  size_t solves;
+  size_t overruns;     // Took longer than their time budget
+  size_t truncated;    // Stopped by a limit before converging
+  double worst;        // Longest solve (s)
+  double budget;       // Time budget of the last solve (s)
+  size_t iterations;   // Iteration limit of the last solve
+};
+
+// Time and iteration budget of one solver. The time budget is a share of
+// the period between measurements, so a solve ends before the next one is
+// due, and the iteration limit follows the iterations recent solves needed
+// to converge. Both limits keep the best iterate of a cut short solve.
+class SolveBudget {
+ public:
+  SolveBudget();
+
+  // A measurement arrived, updates the rate
+  void Tick(ros::Time const& stamp);
+
+  // Starts the clock of a solve
+  void Start();
+
+  // Limits of the solve started last
+  double Seconds() const;
+  size_t Iterations() const;
+
+  // Wall time since Start (s)
+  double Elapsed() const;
+
+  // Ends the solve started last, true if it overran its time budget
+  bool Stop(size_t iterations, bool converged);
+
+  BudgetCounters GetCounters() const;
+
+  // Forgets the rate and the convergence history
+  void Reset();
+
+ private:
+  ros::Time last_;
+  double period_;       // Average measurement period (s), zero if unknown
+  double iterations_;   // Average iterations to converge, zero if unknown
+  std::chrono::steady_clock::time_point start_;
+  BudgetCounters counters_;
+};
+
+#endif // HIVE_VIVE_BUDGET_H_
@@ -0,0 +1,75 @@
+#ifndef HIVE_VIVE_CLOCK_H_
+#define HIVE_VIVE_CLOCK_H_
+
+// ROS includes
+#include <ros/ros.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+
+// STD C++ includes
+#include <stdint.h>
+
+// Device clock of the trackers
+#define CLOCK_FREQUENCY 48e6     // Hz
+// Samples over which old ones are forgotten
+#define CLOCK_WINDOW 2000
+// Samples before the model is trusted
+#define CLOCK_WARMUP 100
+// Residuals past this many spreads are down weighted
+#define CLOCK_HUBER 2.0
+// Residuals past this are rejected once warm
+#define CLOCK_REJECT 0.005       // s
+// Residuals past this are a clock jump rather than a late arrival
+#define CLOCK_JUMP 0.1           // s
+// Consecutive rejections after which the clock is assumed to have reset
+#define CLOCK_RESET 50
+
+// Quality of a clock fit
+struct ClockFit {
+  double offset;                 // Host minus device time, last sample (s)
+  double drift;                  // Device clock rate error (ppm)
+  double spread;                 // Mean absolute residual (s)
+  size_t samples;                // Used since the last reset
+  size_t outliers;               // Rejected since the last reset
+  bool valid;                    // Past the warm up
+};
+
+// Online fit of host arrival times against the ticks of one device clock,
+// host = host0 + a + b * device. Recursive least squares with forgetting,
+// Huber weights and rejection of late arrivals, so USB and poll jitter stay
+// out of the reconstructed stamps.
+class ClockModel {
+ public:
+  ClockModel();
+
+  // Adds a sample and returns its reconstructed time, the arrival time
+  // itself until the model is warm
+  ros::Time Update(uint32_t ticks, ros::Time const& arrival);
+
+  // Fit so far
+  ClockFit GetFit() const;
+
+  // Forgets everything
+  void Reset();
+
+ private:
+  // Ticks without the 32 bit wrap
+  uint64_t Unwrap(uint32_t ticks);
+
+ private:
+  bool started_;
+  uint32_t last_ticks_;
+  uint64_t ticks_;               // Unwrapped ticks of the last sample
+  uint64_t ticks0_;              // First sample
+  ros::Time host0_;
+  Eigen::Vector2d x_;            // Offset and rate
+  Eigen::Matrix2d P_;            // Its covariance
+  double spread_;
+  double device_;                // Device time of the last sample (s)
+  size_t samples_;
+  size_t outliers_;
+  size_t rejected_;              // Consecutive rejections
+};
+
+#endif // HIVE_VIVE_CLOCK_H_
@@ -0,0 +1,102 @@
+#ifndef HIVE_VIVE_COST_H_
+#define HIVE_VIVE_COST_H_
+
+// Hive includes
+#include <hive/vive.h>
+#include <hive/vive_snapshot.h>
+#include <hive/vive_window.h>
+
+// Incoming measurements
+#include <hive/ViveLight.h>
+#include <geometry_msgs/Transform.h>
+
+// Ceres and logging
+#include <ceres/ceres.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <string>
+#include <vector>
+
+namespace cost {
+  // Layout of the tracker pose parameter block
+  //  POSE_TRACKER - [position(3), angle axis(3)] of the light frame
+  //  POSE_IMU - [position(3), velocity(3), angle axis(3)] of the imu frame
+  enum PoseBlock {POSE_TRACKER = 6, POSE_IMU = 9};
+
+  // Optional parameter blocks that come after the pose block
+  //  LH_POSE - [position(3), angle axis(3)] of the lighthouse in the vive frame
+  //  LH_MOTOR - [phase, tilt, gib_phase, gib_mag, curve] of the swept motor
+  enum ExtraBlock {NO_BLOCK = 0, LH_POSE = 1, LH_MOTOR = 2};
+
+  // Rotation matrix and left jacobian of an angle axis vector,
+  // such that d(R(a) * p)/da = - [R(a) * p]x * J(a)
+  void AngleAxisJacobian(const double * aa,
+    Eigen::Matrix3d * R,
+    Eigen::Matrix3d * J);
+
+  // Light cost with closed-form jacobians for the lighthouse model.
+  // Parameter blocks are pose, [lighthouse pose], [motor] depending on
+  // the extra blocks requested. Fixed values are read from the snapshot.
+  class ViveLightCost : public ceres::CostFunction {
+  public:
+    ViveLightCost(hive::ViveLight const& data,
+      CalibrationSnapshot::Ptr const& calibration,
+      std::string const& tracker,
+      PoseBlock pose_block,
+      bool correction,
+      int extra_blocks = NO_BLOCK);
+    // Same, with the tracker and lighthouse ids of the snapshot
+    ViveLightCost(hive::ViveLight const& data,
+      CalibrationSnapshot::Ptr const& calibration,
+      int tracker,
+      int lighthouse,
+      PoseBlock pose_block,
+      bool correction,
+      int extra_blocks = NO_BLOCK);
+    // Same, from a window frame that carries its lighthouse id
+    ViveLightCost(LightFrame const& frame,
+      CalibrationSnapshot::Ptr const& calibration,
+      int tracker,
+      PoseBlock pose_block,
+      bool correction,
+      int extra_blocks = NO_BLOCK);
+    ~ViveLightCost();
+    // Ceres evaluation with analytical jacobians
+    bool Evaluate(double const* const* parameters,
+      double * residuals,
+      double ** jacobians) const;
+  private:
+    // Calibration lookups and ceres sizes, before the samples are added
+    void Setup(uint8_t axis,
+      int tracker,
+      int lighthouse,
+      size_t samples,
+      PoseBlock pose_block,
+      bool correction,
+      int extra_blocks);
+    // Adds a measured sample, invalid if the sensor is not in the tracker
+    void AddSample(uint8_t sensor, double angle);
+  private:
+    // Keeps the compiled calibration alive
+    CalibrationSnapshot::Ptr calibration_;
+    TrackerSnapshot const* tracker_;
+    LighthouseModel const* lighthouse_;
+    // Measured sensors and angles
+    std::vector<uint8_t> sensors_;
+    std::vector<double> angles_;
+    uint8_t axis_;
+    PoseBlock pose_block_;
+    int extra_blocks_;
+    bool correction_;
+    bool valid_;
+  };
+} // namespace cost
+
+#endif // HIVE_VIVE_COST_H_
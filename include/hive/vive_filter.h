@@ -6,8 +6,12 @@
 
 // Hive includes
 #include <hive/vive.h>
-// #include <hive/vive_cost.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_pnp.h>
+#include <hive/vive_ransac.h>
+#include <hive/vive_snapshot.h>
 #include <hive/vive_solver.h>
+#include <hive/vive_window.h>
 #include <hive/vive_general.h>
 
 // Incoming measurements
@@ -29,6 +33,7 @@
 #include <math.h>
 
 // STD C++ includes
+#include <algorithm>
 #include <map>
 #include <mutex>
 #include <vector>
@@ -38,13 +43,17 @@
 
 #define STATE_SIZE 16         // Size of the state vector
 #define NOISE_SIZE 12          // Size of the noise vector
+#define EXTENDED_SIZE (STATE_SIZE + NOISE_SIZE) // State and noise (UKF)
 #define LIGHT_DATA_BUFFER 4   // Size of the light data vector
+#define FILTER_WINDOW 64      // Light frames of the 40 ms window
 // #define MAHALANOBIS_MAX_DIST 3
 // Outlier thresholds
 // #define MEASUREMENT_THRESHOLD 5e-5
 // #define STATE_THRESHOLD 5e-5
 #define MEASUREMENT_THRESHOLD 5e-5
 #define STATE_THRESHOLD 5e-5
+// Sequential update gate, squared normalized innovation (3 sigma)
+#define INNOVATION_GATE 9.0
 // IEKF tuning
 #define IEFK_THRESHOLD 1e-5
 #define IEKF_STEPS 100
@@ -59,9 +68,30 @@
 
 namespace filter {
   // filter type
-  enum type {ekf, iekf, ukf};
+  enum type {ekf, iekf, ukf, srukf};
+  // light update, whole sweep at once or one sample at a time
+  enum update {batch, sequential};
 
   typedef std::vector<hive::ViveLight> LightVector;
+
+  // Fixed-size filter types
+  typedef Eigen::Matrix<double, STATE_SIZE, 1> StateVector;
+  typedef Eigen::Matrix<double, STATE_SIZE, STATE_SIZE> StateMatrix;
+  typedef Eigen::Matrix<double, NOISE_SIZE, NOISE_SIZE> NoiseMatrix;
+  typedef Eigen::Matrix<double, EXTENDED_SIZE, 1> ExtendedVector;
+  typedef Eigen::Matrix<double, EXTENDED_SIZE, EXTENDED_SIZE> ExtendedMatrix;
+  // One row of the measurement Jacobian (column of the gain) per sample
+  typedef Eigen::Matrix<double, Eigen::Dynamic, STATE_SIZE> MeasureJacobian;
+  typedef Eigen::Matrix<double, STATE_SIZE, Eigen::Dynamic> GainMatrix;
+  // Sigma points, one per column. Row major, so every state component is
+  // contiguous across the points and the models vectorize.
+  typedef Eigen::Matrix<double, EXTENDED_SIZE, 2 * EXTENDED_SIZE + 1,
+    Eigen::RowMajor> SigmaMatrix;
+  typedef Eigen::Array<double, 1, 2 * EXTENDED_SIZE + 1> SigmaRow;
+  typedef Eigen::Matrix<double, 2 * EXTENDED_SIZE + 1, 1> SigmaWeights;
+  // Sigma points of the update, the measurement noise size varies
+  typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+    Eigen::RowMajor> SigmaMatrixX;
 }
 
 // Unscented Kalman Filter
@@ -269,37 +299,52 @@ public:
     double model_noise,
     double measure_noise,
     bool correction,
-    filter::type ftype);
+    filter::type ftype,
+    filter::update mode = filter::batch);
   ViveFilter(Tracker & tracker,
     std::map<std::string, Lighthouse> & lighthouses,
     Environment & environment,
     Eigen::MatrixXd model_noise,
     Eigen::MatrixXd measure_noise,
     bool correction,
-    filter::type ftype);
+    filter::type ftype,
+    filter::update mode = filter::batch);
   // Destructor
   ~ViveFilter();
   // Process an IMU measurement
   void ProcessImu(const sensor_msgs::Imu::ConstPtr& msg);
+  // Process consecutive IMU measurements in one call
+  void ProcessImu(const hive::ViveImuBatch::ConstPtr& msg);
   // Process a light measurement
   void ProcessLight(const hive::ViveLight::ConstPtr& msg);
+  void ProcessLight(const hive::ViveLightRaw::ConstPtr& msg);
   // Get the current pose according to the solver
   bool GetTransform(geometry_msgs::TransformStamped& msg);
+  // Initializing solves against the budget
+  bool GetBudget(BudgetCounters * counters);
+  // Samples checked by the sweep filter
+  bool GetInliers(InlierCounters * counters);
   // Temporary
   void PrintState();
+  // Fixed-size Eigen members
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 private: // temporary
+  // Predict with one IMU measurement and check the result
+  void Predict(const sensor_msgs::Imu & msg);
   // EKF predict
   bool PredictEKF(const sensor_msgs::Imu & msg);
   // IEFK predict
   bool PredictIEKF(const sensor_msgs::Imu & msg);
-  // UKF predict
+  // UKF and square root UKF predict
   bool PredictUKF(const sensor_msgs::Imu & msg);
+  // Filter a sweep and update with its inliers
+  void ProcessFrame(LightFrame & frame);
   // EKF update
-  bool UpdateEKF(const hive::ViveLight & msg);
+  bool UpdateEKF(LightFrame const& frame);
   // IEKF update
-  bool UpdateIEKF(const hive::ViveLight & msg);
-  // UKF update
-  bool UpdateUKF(const hive::ViveLight & msg);
+  bool UpdateIEKF(LightFrame const& frame);
+  // UKF and square root UKF update
+  bool UpdateUKF(LightFrame const& frame);
   // Validity
   bool Valid(double cost_factor);
   // Initialize estimates
@@ -320,21 +365,31 @@ private:
   ros::Time time_;
   // Covatiances
   // Model covariance
-  Eigen::MatrixXd model_covariance_;
+  filter::NoiseMatrix model_covariance_;
+  // Lower Cholesky factor of the model covariance
+  filter::NoiseMatrix model_sqrt_;
   // Measurement covariance
   Eigen::MatrixXd measure_covariance_;
   // State covariance
-  Eigen::MatrixXd covariance_;
+  filter::StateMatrix covariance_;
+  // Lower Cholesky factor of the state covariance (square root UKF)
+  filter::StateMatrix sqrt_covariance_;
   // Lighthouse specs
   std::map<std::string, Lighthouse> lighthouses_;
   // Calibration environment
   Environment environment_;
   // The tracker it's solving for
   Tracker tracker_;
+  // Compiled calibration shared by the cost functions
+  CalibrationSnapshot::Ptr calibration_;
+  // Snapshot id of the tracker
+  int tracker_id_;
   // If the correction parameters are to be used
   bool correction_;
   // Type of filter being used
   filter::type filter_type_;
+  // Light update mode (EKF and IEKF)
+  filter::update update_mode_;
   // Validity of current state
   bool valid_;
   bool initialized_;
@@ -343,9 +398,18 @@ private:
   // Aux
   bool lastmsgwasimu_;
   // Old data for initializer
-  filter::LightVector light_data_;
+  TimeWindow<LightFrame, FILTER_WINDOW> light_data_;
+  // Limits of an initializing solve from the light rate
+  SolveBudget budget_;
+  // Drops the samples the other sweep of their lighthouse disagrees with
+  ransac::SweepFilter ransac_;
+  // Copy of the budget and filter counters for other threads, under the
+  // mutex
+  std::mutex mutex_;
+  BudgetCounters counters_;
+  InlierCounters inliers_;
   // UKF stuff
-  Eigen::MatrixXd ext_covariance_;
+  filter::ExtendedMatrix ext_covariance_;
   // Outlier counter
   size_t outlier_counter_;
 };
@@ -5,7 +5,10 @@
 #define NODE_HIVE_BRIDGE               "vive_bridge"
 
 #define TOPIC_HIVE_LIGHT               "loc/vive/light"
+#define TOPIC_HIVE_LIGHT_RAW           "loc/vive/light_raw"
 #define TOPIC_HIVE_IMU                 "loc/vive/imu"
+#define TOPIC_HIVE_IMU_BATCH           "loc/vive/imu_batch"
+#define TOPIC_HIVE_CLOCK               "loc/vive/clock"
 #define TOPIC_HIVE_TRACKERS            "loc/vive/trackers"
 #define TOPIC_HIVE_LIGHTHOUSES         "loc/vive/lighthouses"
 #define TOPIC_HIVE_GENERAL             "loc/vive/general"
@@ -18,4 +21,10 @@
 #define HIVE_CONFIG_FILE               "hive_environment.json"
 #define HIVE_CALIBRATION_FILE          "calibration.bin"
 #define HIVE_BASE_CALIBRATION_FILE     "basecalibration.bin"
+
+// Raw light: angle = (ticks - LIGHT_TICK_CENTER) * LIGHT_TICK_ANGLE
+#define LIGHT_TICK_CENTER              200000
+#define LIGHT_TICK_ANGLE               (M_PI / 400000.0)
+#define LIGHT_TICK_LENGTH              (1e6 / 48e6)  // us per tick
+#define LIGHT_MAX_ANGLE                (M_PI / 3.0)
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#ifndef HIVE_VIVE_LIGHTHOUSE_H_
+#define HIVE_VIVE_LIGHTHOUSE_H_
+
+// Hive includes
+#include <hive/vive.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <string>
+
+// Fixed point iterations to invert the motor correction
+#define LIGHTHOUSE_UNPROJECT_ITERATIONS 4
+
+// Motor constants with the SCALE_* factors applied and the tilt through tan()
+template <typename T>
+struct MotorModel {
+  T phase;
+  T tilt;
+  T tan_tilt;
+  T curve;
+  T gib_phase;
+  T gib_mag;
+};
+
+// Lighthouse calibration compiled for projection. Build it once per
+// calibration update; the kernels are shared by every solver.
+class LighthouseModel {
+ public:
+  LighthouseModel();
+  // Lighthouse without a registered pose
+  LighthouseModel(std::string const& serial,
+    Lighthouse const& lighthouse);
+  // Lighthouse registered in the vive frame
+  LighthouseModel(std::string const& serial,
+    Lighthouse const& lighthouse,
+    Transform const& vTl);
+
+  // Scaled constants from raw motor values ordered as in LIGHTHOUSE
+  template <typename T>
+  static MotorModel<T> Scale(T const* motor) {
+    MotorModel<T> scaled;
+    scaled.phase = T(SCALE_PHASE) * motor[PHASE];
+    scaled.tilt = T(SCALE_TILT) * motor[TILT];
+    scaled.tan_tilt = tan(scaled.tilt);
+    scaled.curve = T(SCALE_CURVE) * motor[CURVE];
+    scaled.gib_phase = motor[GIB_PHASE];
+    scaled.gib_mag = T(SCALE_GIB) * motor[GIB_MAG];
+    return scaled;
+  }
+  static MotorModel<double> Scale(Motor const& motor);
+
+  // Motor correction of the ideal angle atan(u), with w the orthogonal
+  // coordinate. T may be a scalar, a ceres::Jet or an Eigen array.
+  template <typename T, typename S>
+  static T Correct(T const& atan_u,
+    T const& w,
+    MotorModel<S> const& motor,
+    bool correction) {
+    if (!correction) return atan_u;
+    return atan_u - motor.phase - motor.tan_tilt * w - motor.curve * w * w
+      - sin(motor.gib_phase + atan_u) * motor.gib_mag;
+  }
+
+  // Swept angle from the swept (u) and orthogonal (w) coordinates
+  template <typename T, typename S>
+  static T Angle(T const& u,
+    T const& w,
+    MotorModel<S> const& motor,
+    bool correction) {
+    T atan_u = atan(u);
+    return Correct(atan_u, w, motor, correction);
+  }
+
+  // Angle of the horizontal sweep for a point in the lighthouse frame
+  template <typename T, typename S>
+  static T ProjectHorizontal(T const* lPs,
+    MotorModel<S> const& motor,
+    bool correction) {
+    T x = lPs[0] / lPs[2];
+    T y = lPs[1] / lPs[2];
+    return Angle(x, y, motor, correction);
+  }
+
+  // Angle of the vertical sweep for a point in the lighthouse frame
+  template <typename T, typename S>
+  static T ProjectVertical(T const* lPs,
+    MotorModel<S> const& motor,
+    bool correction) {
+    T x = lPs[0] / lPs[2];
+    T y = lPs[1] / lPs[2];
+    return Angle(y, x, motor, correction);
+  }
+
+  // Angle of a point in the vive frame with the cached calibration
+  double Project(uint8_t axis,
+    Eigen::Vector3d const& vPs,
+    bool correction) const;
+
+  // Ideal coordinates (lPs[0], lPs[1]) / lPs[2] of a sensor seen by both
+  // sweeps. The correction of each angle depends on the other coordinate,
+  // so it is inverted by fixed point iteration from the ideal angles.
+  Eigen::Vector2d Unproject(double horizontal,
+    double vertical,
+    bool correction) const;
+
+ public:
+  std::string serial;
+  // False if the environment does not register the lighthouse
+  bool has_pose;
+  // Lighthouse pose in the vive frame
+  Eigen::Vector3d vPl;
+  Eigen::Matrix3d vRl;
+  Eigen::Matrix3d lRv;
+  // Motors indexed by the axis
+  MotorModel<double> motors[2];
+};
+
+#endif // HIVE_VIVE_LIGHTHOUSE_H_
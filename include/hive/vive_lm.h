@@ -0,0 +1,115 @@
+#ifndef HIVE_VIVE_LM_H_
+#define HIVE_VIVE_LM_H_
+
+// Hive includes
+#include <hive/vive.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_snapshot.h>
+#include <hive/vive_window.h>
+
+// Incoming measurements
+#include <hive/ViveLight.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#define LM_MAX_RESIDUALS 256  // Maximum number of light samples
+#define LM_MAX_SWEEPS 32      // Maximum number of light messages
+#define LM_MAX_ITERATIONS 50  // Default iteration limit
+
+namespace solve {
+  // Backend for the 6-DoF pose problems
+  enum backend {CERES = 0, LM = 1};
+}
+
+namespace lm {
+  // Fixed capacity types - storage never touches the heap
+  typedef Eigen::Matrix<double, 6, 1> Vector6d;
+  typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 1,
+    Eigen::ColMajor, LM_MAX_RESIDUALS, 1> Residuals;
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 6,
+    Eigen::ColMajor, LM_MAX_RESIDUALS, 6> Jacobian;
+  typedef Eigen::Matrix<double, 3, Eigen::Dynamic,
+    Eigen::ColMajor, 3, LM_MAX_RESIDUALS> Points;
+
+  // Samples of a single sweep sharing lighthouse and motor
+  struct Sweep {
+    size_t start;
+    size_t size;
+    uint8_t axis;
+    Eigen::Matrix3d lRv;
+    Eigen::Vector3d vPl;
+    // Scaled motor constants - zero without correction
+    MotorModel<double> motor;
+  };
+
+  struct Summary {
+    double initial_cost;
+    double final_cost;
+    size_t iterations;
+    bool converged;
+  };
+
+  // Levenberg-Marquardt for the pose of the light frame in the vive frame.
+  // The pose is [position(3), angle axis(3)] as with cost::POSE_TRACKER and
+  // the cost is 1/2 |r|^2 as in ceres, so thresholds carry over.
+  class PoseSolver {
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    PoseSolver();
+    // Remove all samples
+    void Clear();
+    // Add a light measurement, false if it does not fit
+    bool AddLight(hive::ViveLight const& msg,
+      TrackerSnapshot const& tracker,
+      LighthouseModel const& lighthouse,
+      bool correction);
+    // Same, from a window frame
+    bool AddLight(LightFrame const& frame,
+      TrackerSnapshot const& tracker,
+      LighthouseModel const& lighthouse,
+      bool correction);
+    // Solve in place
+    bool Solve(double * pose, Summary * summary) const;
+    // Number of residuals
+    size_t NumResiduals() const;
+    // Solver settings
+    size_t max_iterations;
+    double max_time;  // Wall time limit (s), zero for none
+    double function_tolerance;
+    double parameter_tolerance;
+  private:
+    // Next sweep with its lighthouse constants, NULL if it does not fit
+    Sweep * AddSweep(uint8_t axis,
+      size_t samples,
+      LighthouseModel const& lighthouse,
+      bool correction);
+    // Appends a sample to the sweep, false if the sensor is unknown
+    bool AddSample(Sweep * sweep,
+      TrackerSnapshot const& tracker,
+      uint8_t sensor,
+      double angle);
+    // Residuals and (optionally) jacobian at a pose
+    double Evaluate(Vector6d const& pose,
+      Residuals * residuals,
+      Jacobian * jacobian) const;
+  private:
+    Points points_;
+    Residuals angles_;
+    Sweep sweeps_[LM_MAX_SWEEPS];
+    size_t num_sweeps_;
+    size_t num_samples_;
+  };
+} // namespace lm
+
+#endif // HIVE_VIVE_LM_H_
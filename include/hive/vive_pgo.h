@@ -10,7 +10,12 @@
 #include <hive/vive_general.h>
 #include <hive/vive_solver.h>
 #include <hive/vive_solve.h>
-// #include <hive/vive_cost.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_pnp.h>
+#include <hive/vive_ransac.h>
+#include <hive/vive_snapshot.h>
+#include <hive/vive_preintegration.h>
+#include <hive/vive_window.h>
 #include <hive/vive.h>
 
 // Hive msgs
@@ -28,12 +33,64 @@
 #include <unsupported/Eigen/MatrixFunctions>
 
 // Eigen C++ includes
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <map>
 #include <string>
 
 #define SMOOTHING 1e-1
 #define ROTATION_FACTOR 1.0
+#define POSE_SIZE 9
+#define PGO_BLEND 0.2  // Share of a new window solution applied to the output
+#define PGO_LIGHT_WINDOW 32  // Light frames held, bounds the window size
+#define PGO_IMU_WINDOW 1024  // Inertial samples held between two poses
+#define PGO_MIN_VARIANCE 1e-12  // Floor of the preintegrated variances
+
+namespace pgo {
+  // Residual block of the window with what is needed to linearize it
+  struct Factor {
+    ceres::ResidualBlockId id;
+    ceres::CostFunction * cost;
+    ceres::LossFunction * loss;
+    std::vector<double*> blocks;
+    bool light;
+  };
+
+  // One pose per light sweep - [vPi, vVi, vAi]
+  struct Node {
+    ros::Time stamp;
+    double * pose;
+    // Factors whose oldest pose is this one
+    std::vector<Factor> factors;
+  };
+
+  // Fixed set of pose blocks reused as the window slides
+  class PosePool {
+   public:
+    PosePool();
+    // Drop every block and allocate capacity new ones
+    void Reset(size_t capacity);
+    // NULL when every block is in use
+    double * Acquire();
+    void Release(double * pose);
+   private:
+    std::vector<double> storage_;
+    std::vector<double*> free_;
+  };
+
+  // Imu frame in the vive frame
+  struct State {
+    ros::Time stamp;
+    Eigen::Vector3d vPi;
+    Eigen::Vector3d vVi;
+    Eigen::Matrix3d vRi;
+  };
+}
 
 class PoseGraph : public Solver {
 public:
@@ -45,15 +102,23 @@ public:
   size_t window,
   double trust,
   double first_factor,
-  bool correction);
+  bool correction,
+  bool async = false);
   // Destructor
   ~PoseGraph();
   // New light data
   void ProcessLight(const hive::ViveLight::ConstPtr& msg);
+  void ProcessLight(const hive::ViveLightRaw::ConstPtr& msg);
   // New Imu data
   void ProcessImu(const sensor_msgs::Imu::ConstPtr& msg);
+  // New Imu data, consecutive samples in one call
+  void ProcessImu(const hive::ViveImuBatch::ConstPtr& msg);
   // Get the tracker's pose
   bool GetTransform(geometry_msgs::TransformStamped& msg);
+  // Warm solves against the budget
+  bool GetBudget(BudgetCounters * counters);
+  // Samples checked by the sweep filter
+  bool GetInliers(InlierCounters * counters);
   // Prinst stuff
   void PrintState();
 private:
@@ -71,20 +136,51 @@ private:
   bool Solve();
   // Validity of the pose
   bool Valid();
+  // Add the sweep to the window, true if it got a new pose
+  bool AddSweep(LightFrame const& light);
+  // Undo the last AddSweep
+  void RemoveSweep(bool new_node);
+  // Drop the used inertial data and keep the window size
+  void Slide();
+  // Fold the oldest pose into a prior on the poses it shares factors with
+  void Marginalize();
+  // Remove the prior left by the marginalized poses
+  void RemovePrior();
+  // First guess of every pose from light data alone
+  bool Initialize();
+  // Queue a sweep for the worker, or add it right away
+  void ProcessFrame(LightFrame const& frame);
+  // Add a sweep and optimize the window
+  void Update(LightFrame const& light);
+  // Optimizes the window on the sweeps queued by ProcessLight
+  void WorkerThread();
+  // Move the latest solution to the newest inertial data and blend it in
+  void Publish();
+  // Advance a state with a sample held until stamp
+  void Propagate(pgo::State & state,
+    ImuFrame const& imu,
+    ros::Time const& stamp) const;
+  // Light frame in the vive frame from the imu frame
+  void ToTransform(pgo::State const& state,
+    geometry_msgs::TransformStamped & msg) const;
   
 private:
   // The pose (light pose in vive frame)
   geometry_msgs::TransformStamped pose_;
   // Light data
-  std::vector<hive::ViveLight> light_data_;
+  TimeWindow<LightFrame, PGO_LIGHT_WINDOW> light_data_;
   // Inertial data
-  std::vector<sensor_msgs::Imu> imu_data_;
+  TimeWindow<ImuFrame, PGO_IMU_WINDOW> imu_data_;
   // Calibrated environment
   Environment environment_;
   // Tracker
   Tracker tracker_;
   // Lighthouses specs
   std::map<std::string, Lighthouse> lighthouses_;
+  // Compiled calibration shared by the cost functions
+  CalibrationSnapshot::Ptr calibration_;
+  // Snapshot id of the tracker
+  int tracker_id_;
   // Correction
   bool correction_;
   // Force the first the first pose to be close to its previous estimate.
@@ -96,15 +192,38 @@ private:
     -> Too low - consecutive poses will pushed apart
   */
   double trust_;
-  //
-  // double smoothing_ = SMOOTHING;
+  // Weight of the prior left by the marginalized poses, unit if zero
   double first_factor_;
   // Validity
   bool valid_;
-  // Internal
-  std::vector<double*> poses_;
-  bool lastposewasimu_;
+  // Fixed-lag window kept between solves
+  std::unique_ptr<ceres::Problem> problem_;
+  pgo::PosePool pool_;
+  std::vector<pgo::Node> nodes_;
+  ceres::ResidualBlockId prior_;
+  // Inertial biases - constant blocks
+  double bias_acc_[3];
+  double bias_ang_[3];
   double last_cost_;
+  // Limits of a warm solve from the light rate and recent convergence
+  SolveBudget budget_;
+  // Drops the samples the other sweep of their lighthouse disagrees with
+  ransac::SweepFilter ransac_;
+  // Background optimization - the mutex guards the inertial data, the
+  // queued sweeps and the output
+  bool async_;
+  bool active_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  TimeWindow<LightFrame, PGO_LIGHT_WINDOW> light_queue_;
+  // IMU-rate output - the latest solution propagated with newer samples
+  bool has_output_;
+  pgo::State output_;
+  ImuFrame output_imu_;
+  // Copy of the budget and filter counters for other threads
+  BudgetCounters counters_;
+  InlierCounters inliers_;
 };
 
 #endif // HIVE_VIVE_PGO
\ No newline at end of file
@@ -0,0 +1,94 @@
+#ifndef HIVE_VIVE_PNP_H_
+#define HIVE_VIVE_PNP_H_
+
+// Hive includes
+#include <hive/vive.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_lighthouse.h>
+#include <hive/vive_snapshot.h>
+#include <hive/vive_window.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#define PNP_MIN_SENSORS 5       // Fewest sensors seen on both sweeps
+#define PNP_MAX_LIGHTHOUSES 8   // Lighthouses kept by the bearing solver
+#define PNP_MAX_ERROR 5e-3      // Largest RMS error of the ideal coordinates
+#define PNP_GN_ITERATIONS 5     // Gauss-Newton steps on the EPnP betas
+
+namespace pnp {
+  // Closed form pose (EPnP) of the points bPs seen at the ideal coordinates
+  // xy = (lPs[0], lPs[1]) / lPs[2] of a lighthouse, lPs = lRb * bPs + lPb.
+  // Needs at least four points and returns the RMS error in xy, false if
+  // they are degenerate.
+  bool EPnP(Eigen::Vector3d const* bPs,
+    Eigen::Vector2d const* xy,
+    size_t n,
+    Eigen::Matrix3d * lRb,
+    Eigen::Vector3d * lPb,
+    double * error = NULL);
+
+  // First guess of a pose from light alone. The sensors a lighthouse saw on
+  // both sweeps are bearings of a central camera, so the lighthouse that saw
+  // the most of them gives the pose in closed form.
+  class BearingSolver {
+  public:
+    BearingSolver();
+    // Remove all sweeps
+    void Clear();
+    // Keep the newest sweep of each lighthouse and axis, false if it does
+    // not fit
+    bool AddLight(LightFrame const& frame,
+      LighthouseModel const& lighthouse);
+    // Pose of the block in the vive frame. Only the position and the angle
+    // axis are written, false if no lighthouse saw enough sensors or the
+    // fit is poor.
+    bool Solve(TrackerSnapshot const& tracker,
+      cost::PoseBlock pose_block,
+      bool correction,
+      double * pose) const;
+    // Solver settings
+    size_t min_sensors;
+    double max_error;
+  private:
+    // Newest sweeps of a lighthouse
+    struct View {
+      LighthouseModel const* lighthouse;
+      bool has[2];
+      LightFrame sweeps[2];
+    };
+    View views_[PNP_MAX_LIGHTHOUSES];
+    size_t num_views_;
+  };
+
+  // First guess from a window of light frames, oldest first
+  template <size_t N>
+  bool Initialize(TimeWindow<LightFrame, N> const& window,
+    CalibrationSnapshot const& calibration,
+    int tracker_id,
+    cost::PoseBlock pose_block,
+    bool correction,
+    double * pose) {
+    TrackerSnapshot const* tracker = calibration.GetTracker(tracker_id);
+    if (tracker == NULL) return false;
+    BearingSolver solver;
+    for (size_t i = 0; i < window.Size(); i++) {
+      LighthouseModel const* lighthouse =
+        calibration.GetLighthouse(window[i].lighthouse);
+      if (lighthouse == NULL) continue;
+      solver.AddLight(window[i], *lighthouse);
+    }
+    return solver.Solve(*tracker, pose_block, correction, pose);
+  }
+} // namespace pnp
+
+#endif // HIVE_VIVE_PNP_H_
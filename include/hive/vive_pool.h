@@ -0,0 +1,101 @@
+#ifndef HIVE_VIVE_POOL_H_
+#define HIVE_VIVE_POOL_H_
+
+// STD C++ includes
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Tasks run by a strand before it goes back to the pool
+#define POOL_BUDGET 16
+
+class WorkPool;
+
+namespace pool {
+  typedef std::function<void()> Task;
+
+  // Ordered task queue of one owner (a tracker). Its tasks run in the order
+  // they were posted and never concurrently, different strands run in
+  // parallel.
+  class Strand {
+   public:
+    Strand();
+
+   private:
+    friend class ::WorkPool;
+    std::mutex mutex_;
+    std::condition_variable idle_;
+    std::deque<Task> tasks_;
+    // Queued on a worker or running
+    bool scheduled_;
+  };
+}
+
+// Tasks handled by the pool
+struct PoolCounters {
+  size_t executed;  // Tasks run
+  size_t stolen;    // Strands taken from another worker's queue
+};
+
+// Work stealing thread pool. Each worker owns a deque of ready strands:
+// it runs them in order from its own front and, when empty, steals the
+// newest from the back of another worker.
+class WorkPool {
+ public:
+  // Zero threads uses one per core
+  explicit WorkPool(size_t threads = 0);
+  // Runs the remaining work before stopping
+  ~WorkPool();
+
+  // Strand bound to this pool
+  std::shared_ptr<pool::Strand> NewStrand();
+
+  // Queues a task behind the strand's previous ones
+  void Post(std::shared_ptr<pool::Strand> const& strand, pool::Task task);
+
+  // Blocks until the strand has nothing queued or running
+  void Wait(std::shared_ptr<pool::Strand> const& strand);
+
+  // Blocks until the whole pool is idle
+  void Wait();
+
+  // Number of workers
+  size_t Size() const;
+
+  // Tasks handled so far
+  PoolCounters GetCounters();
+
+ private:
+  // Worker main loop
+  void WorkerThread(size_t index);
+  // Hands a ready strand to a worker
+  void Schedule(std::shared_ptr<pool::Strand> const& strand);
+  // Takes a ready strand, from the own deque first
+  std::shared_ptr<pool::Strand> Take(size_t index);
+  // Runs up to POOL_BUDGET tasks, true if the strand has more
+  bool Run(std::shared_ptr<pool::Strand> const& strand);
+
+ private:
+  // Ready strands of one worker
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<pool::Strand>> strands;
+  };
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+  // Guards the counts below and puts idle workers to sleep
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::condition_variable idle_;
+  size_t ready_;
+  size_t busy_;
+  size_t next_;
+  bool active_;
+  PoolCounters counters_;
+};
+
+#endif // HIVE_VIVE_POOL_H_
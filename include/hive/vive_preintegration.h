@@ -0,0 +1,89 @@
+#ifndef HIVE_VIVE_PREINTEGRATION_H_
+#define HIVE_VIVE_PREINTEGRATION_H_
+
+// Incoming measurements
+#include <sensor_msgs/Imu.h>
+#include <geometry_msgs/Vector3.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// STD C includes
+#include <math.h>
+
+// Continuous time noise densities of the tracker's IMU
+#define PREINTEGRATION_ACC_NOISE 2.0e-2  // m/s^2/sqrt(Hz)
+#define PREINTEGRATION_GYR_NOISE 2.0e-3  // rad/s/sqrt(Hz)
+
+namespace preintegration {
+  typedef Eigen::Matrix<double, 9, 1> Vector9d;
+  typedef Eigen::Matrix<double, 9, 9> Matrix9d;
+
+  // Skew symmetric matrix
+  Eigen::Matrix3d Skew(Eigen::Vector3d const& v);
+  // Exponential map of SO(3)
+  Eigen::Matrix3d Exp(Eigen::Vector3d const& phi);
+  // Right Jacobian of SO(3)
+  Eigen::Matrix3d RightJacobian(Eigen::Vector3d const& phi);
+
+  // Inertial samples between two poses summarized on the manifold. The
+  // motion model is the filter's: vV' = g - vRi (iA - bA), vRi' = vRi [iW - bW]x.
+  // The deltas are expressed in the imu frame of the first pose, so
+  //   vRj = vRi dR
+  //   vVj = vVi + g dt + vRi dV
+  //   vPj = vPi + vVi dt + g dt^2 / 2 + vRi dP
+  class ImuPreintegration {
+   public:
+    ImuPreintegration();
+    ImuPreintegration(Eigen::Vector3d const& acc_bias,
+      Eigen::Vector3d const& gyr_bias);
+    // Start over with new linearization biases
+    void Reset(Eigen::Vector3d const& acc_bias,
+      Eigen::Vector3d const& gyr_bias);
+    // Integrate a sample held for dt seconds
+    void Integrate(Eigen::Vector3d const& acc,
+      Eigen::Vector3d const& gyr,
+      double dt);
+    void Integrate(sensor_msgs::Imu const& msg, double dt);
+    // Deltas for other biases, corrected to first order
+    Eigen::Matrix3d DeltaR(Eigen::Vector3d const& gyr_bias) const;
+    Eigen::Vector3d DeltaV(Eigen::Vector3d const& acc_bias,
+      Eigen::Vector3d const& gyr_bias) const;
+    Eigen::Vector3d DeltaP(Eigen::Vector3d const& acc_bias,
+      Eigen::Vector3d const& gyr_bias) const;
+    // State at the end of the interval from the state at its start
+    void Predict(Eigen::Vector3d const& vPi,
+      Eigen::Vector3d const& vVi,
+      Eigen::Matrix3d const& vRi,
+      geometry_msgs::Vector3 const& gravity,
+      Eigen::Vector3d & vPj,
+      Eigen::Vector3d & vVj,
+      Eigen::Matrix3d & vRj) const;
+
+   public:
+    // Integrated time
+    double dt;
+    // Deltas
+    Eigen::Matrix3d dR;
+    Eigen::Vector3d dV;
+    Eigen::Vector3d dP;
+    // Linearization biases
+    Eigen::Vector3d acc_bias;
+    Eigen::Vector3d gyr_bias;
+    // Jacobians of the deltas w.r.t. the biases
+    Eigen::Matrix3d dR_dbg;
+    Eigen::Matrix3d dV_dba;
+    Eigen::Matrix3d dV_dbg;
+    Eigen::Matrix3d dP_dba;
+    Eigen::Matrix3d dP_dbg;
+    // Covariance of the rotation, velocity and position deltas
+    Matrix9d covariance;
+    // Number of integrated samples
+    size_t samples;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+}
+
+#endif // HIVE_VIVE_PREINTEGRATION_H_
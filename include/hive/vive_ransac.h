@@ -0,0 +1,100 @@
+#ifndef HIVE_VIVE_RANSAC_H_
+#define HIVE_VIVE_RANSAC_H_
+
+// Hive includes
+#include <hive/vive.h>
+#include <hive/vive_lighthouse.h>
+#include <hive/vive_pnp.h>
+#include <hive/vive_snapshot.h>
+#include <hive/vive_window.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <cstddef>
+#include <cstdint>
+
+#define RANSAC_SAMPLE 4            // Minimal set of the closed form pose
+#define RANSAC_THRESHOLD 5e-3      // Largest residual of an inlier (rad)
+#define RANSAC_CONFIDENCE 0.99     // Of drawing one outlier free set
+#define RANSAC_MAX_HYPOTHESES 32   // Bound on the work per sweep
+#define RANSAC_MIN_SUPPORT 0.5     // Share of the samples the pose must fit
+
+// Samples checked against the pose of the sweeps of their lighthouse
+struct InlierCounters {
+  size_t sweeps;       // Checked
+  size_t unchecked;    // Without a partner sweep, enough sensors or support
+  size_t samples;      // In the checked sweeps
+  size_t outliers;     // Removed from the checked sweeps
+  size_t hypotheses;   // Closed form poses tried
+};
+
+namespace ransac {
+  // Reflections and multipath corrupt single samples of a sweep. The newest
+  // sweep of the other axis from the same lighthouse pairs the sensors into
+  // bearings, so minimal sets of them give closed form poses; the pose most
+  // samples agree on labels the rest as outliers.
+  class SweepFilter {
+  public:
+    SweepFilter();
+    // Removes the outliers of frame. partner is the newest sweep of the
+    // other axis from the same lighthouse and is left as is. False if the
+    // sweep could not be checked.
+    bool Filter(LightFrame * frame,
+      LightFrame const& partner,
+      TrackerSnapshot const& tracker,
+      LighthouseModel const& lighthouse,
+      bool correction);
+    // Same, finding the partner in a window of frames, oldest first
+    template <size_t N>
+    bool Filter(LightFrame * frame,
+      TimeWindow<LightFrame, N> const& window,
+      TrackerSnapshot const& tracker,
+      LighthouseModel const& lighthouse,
+      bool correction) {
+      for (size_t i = window.Size(); i > 0; i--) {
+        LightFrame const& partner = window[i - 1];
+        if (partner.lighthouse != frame->lighthouse) continue;
+        if (partner.axis == frame->axis) continue;
+        return Filter(frame, partner, tracker, lighthouse, correction);
+      }
+      counters_.unchecked++;
+      return false;
+    }
+    // Samples checked so far
+    InlierCounters GetCounters() const;
+    // Solver settings
+    double threshold;
+    double confidence;
+    size_t max_hypotheses;
+  private:
+    // Residual of a sample for a pose in the lighthouse frame
+    static double Residual(uint8_t axis,
+      double angle,
+      Eigen::Vector3d const& tPs,
+      Eigen::Matrix3d const& lRt,
+      Eigen::Vector3d const& lPt,
+      LighthouseModel const& lighthouse,
+      bool correction);
+    // Samples of both sweeps within the threshold of a pose
+    size_t Score(LightFrame const& frame,
+      LightFrame const& partner,
+      TrackerSnapshot const& tracker,
+      Eigen::Matrix3d const& lRt,
+      Eigen::Vector3d const& lPt,
+      LighthouseModel const& lighthouse,
+      bool correction,
+      bool * inliers) const;
+    // Deterministic xorshift, so runs are repeatable
+    uint32_t Random();
+  private:
+    uint32_t state_;
+    InlierCounters counters_;
+  };
+} // namespace ransac
+
+#endif // HIVE_VIVE_RANSAC_H_
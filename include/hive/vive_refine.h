@@ -9,7 +9,7 @@
 // Hive includes
 #include <hive/vive_general.h>
 #include <hive/vive_solve.h>
-// #include <hive/vive_cost.h>
+#include <hive/vive_cost.h>
 #include <hive/vive.h>
 
 // Incoming measurements
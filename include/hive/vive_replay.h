@@ -0,0 +1,31 @@
+#ifndef HIVE_VIVE_REPLAY_H_
+#define HIVE_VIVE_REPLAY_H_
+
+// STD C++ includes
+#include <string>
+
+// Stand-in for the deepdive driver that replays the light and imu of a
+// bag through the bridge callbacks at their recorded pace. Link it in
+// place of the deepdive library; like a USB poll with a zero timeout,
+// deepdive_poll() returns at once with whatever is due. The trackers are
+// split over the contexts, each deepdive_init() opens the next one.
+namespace replay {
+  // Timing of the replay so far
+  struct Stats {
+    size_t callbacks;    // Light and imu callbacks fired
+    double sum_delay;    // Delay of the callbacks past their time (s)
+    double max_delay;
+    double wall;         // Time since the first poll (s)
+    double poll_cpu;     // Cpu time of the poll threads (s)
+    bool finished;       // Every context has replayed its events
+  };
+
+  // Loads the bag, played back rate times faster and split over the given
+  // number of contexts, before deepdive_init()
+  bool Open(std::string const& bag, double rate = 1.0, size_t contexts = 1);
+
+  // Timing so far, the cpu time is updated by the poll threads
+  Stats GetStats();
+}
+
+#endif // HIVE_VIVE_REPLAY_H_
@@ -0,0 +1,89 @@
+#ifndef HIVE_VIVE_RING_H_
+#define HIVE_VIVE_RING_H_
+
+// STD C includes
+#include <stdlib.h>
+
+// STD C++ includes
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+// Keeps the producer and consumer indices on separate cache lines
+#define RING_CACHE_LINE 64
+
+// Lock-free ring for exactly one producer and one consumer thread. The
+// producer never waits: a push on a full ring fails and the caller counts
+// the overrun. N must be a power of two.
+template <typename T, size_t N>
+class SpscRing {
+  static_assert(N > 1 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  SpscRing() : head_(0), tail_(0) {}
+
+  // Producer side. Returns the slot to fill, or NULL if full
+  T * Claim() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == N) return NULL;
+    return &data_[head & (N - 1)];
+  }
+
+  // Producer side. Makes the claimed slot visible to the consumer
+  void Commit() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  }
+
+  // Producer side. Copies the value in, false if full
+  bool Push(T const& value) {
+    T * slot = Claim();
+    if (slot == NULL) return false;
+    *slot = value;
+    Commit();
+    return true;
+  }
+
+  // Consumer side. Oldest entry, or NULL if empty
+  T * Front() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head_.load(std::memory_order_acquire) == tail) return NULL;
+    return &data_[tail & (N - 1)];
+  }
+
+  // Consumer side. Releases the entry returned by Front()
+  void Pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+      std::memory_order_release);
+  }
+
+  // Entries waiting, exact only when called from one of the two threads
+  size_t Size() const {
+    return head_.load(std::memory_order_acquire)
+      - tail_.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t Capacity() {
+    return N;
+  }
+
+  // Plain new only aligns to the fundamental alignment before C++17, heap
+  // rings are allocated on the cache line
+  static void * operator new(size_t size) {
+    void * memory = NULL;
+    if (posix_memalign(&memory, RING_CACHE_LINE, size) != 0)
+      throw std::bad_alloc();
+    return memory;
+  }
+
+  static void operator delete(void * memory) {
+    free(memory);
+  }
+
+ private:
+  alignas(RING_CACHE_LINE) std::atomic<size_t> head_;
+  alignas(RING_CACHE_LINE) std::atomic<size_t> tail_;
+  alignas(RING_CACHE_LINE) T data_[N];
+};
+
+#endif // HIVE_VIVE_RING_H_
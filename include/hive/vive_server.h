@@ -0,0 +1,129 @@
+/* Copyright (c) 2017, United States Government, as represented by the
+ * Administrator of the National Aeronautics and Space Administration.
+ *
+ * All rights reserved.
+ *
+ * The Astrobee platform is licensed under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with the
+ * License. You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef HIVE_VIVE_SERVER_H_
+#define HIVE_VIVE_SERVER_H_
+
+// This package code
+#include <hive/vive_general.h>
+#include <hive/vive.h>
+#include <hive/vive_solve.h>
+#include <hive/vive_pgo.h>
+#include <hive/vive_pool.h>
+#include <hive/vive_calibrate.h>
+#include <hive/vive_visualization.h>
+
+// ROS includes
+#include <ros/ros.h>
+
+// Standard C++ includes
+#include <map>
+#include <memory>
+#include <string>
+
+// Services
+#include <hive/ViveConfig.h>
+
+// Messages
+#include <sensor_msgs/Imu.h>
+#include <hive/ViveLight.h>
+#include <hive/ViveLightRaw.h>
+#include <hive/ViveImuBatch.h>
+#include <hive/ViveCalibration.h>
+#include <hive/ViveCalibrationGeneral.h>
+#include <hive/ViveCalibrationTrackerArray.h>
+#include <hive/ViveCalibrationLighthouseArray.h>
+
+// Solvers the server runs, chosen with the solver parameter
+#define HIVE_SOLVER_VIVE "vive"   // Per lighthouse solve on the pool
+#define HIVE_SOLVER_PGO "pgo"     // Asynchronous pose graph
+
+// Pose graph settings
+#define HIVE_PGO_WINDOW 4
+#define HIVE_PGO_TRUST 7e-4
+#define HIVE_PGO_FIRST 1e0
+
+// Period of the solver report
+#define HIVE_REPORT 10.0          // s
+
+// Solver built from the calibration and the strand its callbacks run on
+struct TrackerSolver {
+  std::unique_ptr<Solver> solver;
+  std::shared_ptr<pool::Strand> strand;
+};
+
+typedef std::map<std::string, ViveSolve> TrackerMap;
+typedef std::map<std::string, TrackerSolver> SolverMap;
+typedef std::map<std::string, Visualization> VisualMap;
+
+// Tracking server, solves every tracker from the bridge's light and imu
+class Hive {
+ public:
+  // Subscribes and advertises on nh, reads its parameters from pnh
+  Hive(ros::NodeHandle & nh, ros::NodeHandle & pnh);
+  ~Hive();
+  void LightCallback(const hive::ViveLight::ConstPtr& msg);
+  void LightRawCallback(const hive::ViveLightRaw::ConstPtr& msg);
+  void ImuCallback(const sensor_msgs::Imu::ConstPtr& msg);
+  void ImuBatchCallback(const hive::ViveImuBatch::ConstPtr& msg);
+  void LighthouseCallback(const hive::ViveCalibrationLighthouseArray::ConstPtr& msg);
+  void TrackerCallback(const hive::ViveCalibrationTrackerArray::ConstPtr& msg);
+  void LightSpecsCallback(const hive::ViveCalibrationGeneral::ConstPtr& msg);
+  void TimerCallback(const ros::TimerEvent&);
+  void CalibrationCallback(Calibration const& calibration);
+  bool ConfigureCallback(hive::ViveConfig::Request & req, hive::ViveConfig::Response & res );
+ private:
+  // Rebuilds the solver and visualization arrays from the tracker ids
+  void IndexTrackers();
+  // Builds the solver of a tracker from the calibration, once its queued
+  // work is done
+  void BuildSolver(std::string const& serial);
+ private:
+  bool ready_;
+  std::string calib_file_;              // Name of the calibration file
+  Calibration calibration_;        // Structure with all the data
+  std::map<uint8_t, std::string> lighthouse_ids_;  // Serials by light id
+  // Solvers
+  std::string solver_;                  // Active solver
+  bool correction_;                     // Solve with the motor correction
+  std::unique_ptr<WorkPool> pool_;      // Threads shared by the solvers
+  TrackerMap trackers_;                 // Tracker solvers
+  SolverMap graphs_;                    // Pose graphs of the trackers
+  VisualMap vive_visualization_;        // visualization objects
+  std::vector<Solver*> solvers_;        // Solvers by tracker id
+  std::vector<std::shared_ptr<pool::Strand>> strands_;  // Their strands
+  std::vector<Visualization*> visuals_; // Visualizations by tracker id
+  int bridge_ids_[UINT8_MAX + 1];       // Tracker ids by bridge id
+  ViveCalibrate calibrator_;            // Calibrator
+  // Publishers and Subscribers
+  ros::Subscriber sub_imu_;
+  ros::Subscriber sub_light_;
+  ros::Subscriber sub_lighthouses_;
+  ros::Subscriber sub_trackers_;
+  ros::Subscriber sub_general_;
+  ros::ServiceServer service_;          // Service
+  ros::Timer timer_;                    // Tracking timer
+  ros::WallTime report_;                // Last solver report
+  ros::Publisher pub_imu_markers_;      // Imu visualization marker
+  ros::Publisher pub_light_markers_;    // light visualization markers
+  ros::Publisher pub_tracker_markers_;  // tracker visualization markers
+  // State Machine
+  StateMachine fsm_;
+};
+
+#endif // HIVE_VIVE_SERVER_H_
@@ -0,0 +1,89 @@
+#ifndef HIVE_VIVE_SNAPSHOT_H_
+#define HIVE_VIVE_SNAPSHOT_H_
+
+// Hive includes
+#include <hive/vive.h>
+#include <hive/vive_lighthouse.h>
+
+// Eigen includes
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// STD C++ includes
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <map>
+
+// Tracker calibration laid out for residual evaluation
+struct TrackerSnapshot {
+  std::string serial;
+  // Flat sensor arrays indexed by the sensor id
+  bool valid[TRACKER_SENSORS_NUMBER];
+  Eigen::Vector3d tPs[TRACKER_SENSORS_NUMBER];  // position in the light frame
+  Eigen::Vector3d tNs[TRACKER_SENSORS_NUMBER];  // normal in the light frame
+  Eigen::Vector3d iPs[TRACKER_SENSORS_NUMBER];  // position in the imu frame
+  // Transform from the imu frame to the light frame
+  Eigen::Vector3d tPi;
+  Eigen::Matrix3d tRi;
+  // True if the sensor id is part of the tracker
+  bool HasSensor(int sensor) const {
+    return sensor >= 0 && sensor < TRACKER_SENSORS_NUMBER && valid[sensor];
+  }
+};
+
+// Immutable compiled calibration shared by the cost functions of a solver.
+// Rebuild it when the calibration changes; functors keep the old one alive.
+class CalibrationSnapshot {
+ public:
+  typedef std::shared_ptr<const CalibrationSnapshot> Ptr;
+
+  // Compile every tracker and lighthouse
+  static Ptr Create(Environment const& environment,
+    LighthouseMap const& lighthouses,
+    std::map<std::string, Tracker> const& trackers);
+
+  // Compile a single tracker with every lighthouse
+  static Ptr Create(Environment const& environment,
+    LighthouseMap const& lighthouses,
+    Tracker const& tracker);
+
+  // Lookups, NULL if not part of the calibration
+  TrackerSnapshot const* GetTracker(std::string const& serial) const;
+  LighthouseModel const* GetLighthouse(std::string const& serial) const;
+
+  // Dense ids of this snapshot, -1 if not part of the calibration. Resolve
+  // a serial once and use the id lookups on the hot path.
+  int TrackerId(std::string const& serial) const;
+  int LighthouseId(std::string const& serial) const;
+  TrackerSnapshot const* GetTracker(int id) const;
+  LighthouseModel const* GetLighthouse(int id) const;
+
+  // Snapshot id of a lighthouse by its id in the compact light message,
+  // -1 if not part of the calibration or shared by several lighthouses
+  int RawLighthouseId(uint8_t id) const {
+    return raw_lighthouse_ids_[id];
+  }
+
+ private:
+  CalibrationSnapshot();
+  void AddTracker(std::string const& serial,
+    Tracker const& tracker);
+  void AddLighthouse(std::string const& serial,
+    Lighthouse const& lighthouse,
+    Environment const& environment);
+
+ private:
+  // Indexed by the ids below
+  std::vector<TrackerSnapshot> trackers_;
+  std::vector<LighthouseModel> lighthouses_;
+  SerialIds tracker_ids_;
+  SerialIds lighthouse_ids_;
+  // Indexed by the lighthouse id of the compact light message
+  int raw_lighthouse_ids_[UINT8_MAX + 1];
+  std::bitset<UINT8_MAX + 1> raw_collisions_;
+};
+
+#endif // HIVE_VIVE_SNAPSHOT_H_
@@ -22,6 +22,10 @@
 #include <ros/ros.h>
 
 #include <hive/vive.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_lighthouse.h>
+#include <hive/vive_lm.h>
+#include <hive/vive_pool.h>
 #include <hive/vive_solver.h>
 
 // Incoming measurements
@@ -42,6 +46,7 @@
 
 // STD C++ includes
 #include <map>
+#include <memory>
 #include <mutex>
 #include <vector>
 #include <thread>
@@ -80,11 +85,19 @@ struct SolvedPose {
   ros::Time stamp;
 };
 
+// Frames handled by the solver worker
+struct SolveCounters {
+  size_t solved;   // Valid pose
+  size_t failed;   // Rejected by the solver
+  size_t dropped;  // Replaced in the mailbox before being solved
+};
+
 // A class to solve for the position of a single tracker
 class ViveSolve : public Solver {
  public:
-  // Constructor
+  // Constructor - without a pool the solver runs on a private worker
   ViveSolve();
+  explicit ViveSolve(WorkPool * pool);
   ViveSolve(Tracker & tracker,
     Environment & environment,
     LighthouseMap & lighthouses,
@@ -95,9 +108,11 @@ class ViveSolve : public Solver {
 
   // Process an IMU measurement
   void ProcessImu(const sensor_msgs::Imu::ConstPtr& msg);
+  void ProcessImu(const hive::ViveImuBatch::ConstPtr& msg);
 
   // Process a light measurement
   void ProcessLight(const hive::ViveLight::ConstPtr& msg);
+  void ProcessLight(const hive::ViveLightRaw::ConstPtr& msg);
 
   // Get the current pose according to the solver
   bool GetTransform(geometry_msgs::TransformStamped &msg);
@@ -115,13 +130,21 @@ class ViveSolve : public Solver {
   // Update lighthouse extrinsics
   bool Update(LighthouseMap const& lh_extrinsics);
 
-  // Solves the pose from data
+  // Frames handled so far
+  SolveCounters GetCounters();
+
+  // Strand running this tracker's work in order
+  std::shared_ptr<pool::Strand> const& GetStrand() const;
+
+  // Solves the pose from data, in the frame of the lighthouse. The
+  // snapshot holds the tracker and the lighthouses without their poses.
   static bool SolvePose(hive::ViveLight & horizontal_observations,
   hive::ViveLight & vertical_observations,
   geometry_msgs::TransformStamped & tf,
-  Tracker & tracker,
-  Lighthouse & lighthouse,
-  bool correction);
+  CalibrationSnapshot::Ptr const& calibration,
+  int tracker,
+  bool correction,
+  solve::backend backend = solve::CERES);
 
   // static bool SolvePose(
   //   std::vector<hive::ViveLight> & observations,
@@ -131,6 +154,18 @@ class ViveSolve : public Solver {
   //   Environment & environment,
   //   bool correction);
 
+ private:
+  // Solves the latest frame in the mailbox
+  void Solve();
+  // Compiles the tracker and lighthouses for SolvePose, with the lock held
+  void Compile();
+  // Cleared samples of a lighthouse and axis, filled by the caller
+  LightVec & BeginSweep(std::string const& lighthouse, uint8_t axis);
+  // Expires old sweeps and hands a complete frame to the strand
+  void EndSweep(std::string const& lighthouse,
+    uint8_t axis,
+    ros::Time const& stamp);
+
  private:
   std::map<std::string, SolvedPose> poses_;
   SolvedPose tracker_pose_;
@@ -140,39 +175,17 @@ class ViveSolve : public Solver {
   std::mutex * solveMutex_;
   Tracker tracker_;
   LighthouseMap lh_extrinsics_;
+  // Tracker and lighthouses in the lighthouse frame, rebuilt on updates
+  CalibrationSnapshot::Ptr calibration_;
   bool correction_;
-};
-
-class PoseHorizontalCost {
-public:
-  explicit PoseHorizontalCost(hive::ViveLight data,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction);
-
-  template <typename T> bool operator()(const T* const * parameters,
-    T * residual) const;
-private:
-  bool correction_;
-  Tracker tracker_;
-  Motor lighthouse_;
-  hive::ViveLight data_;
-};
-
-class PoseVerticalCost {
-public:
-  explicit PoseVerticalCost(hive::ViveLight data,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction);
-
-  template <typename T> bool operator()(const T* const * parameters,
-    T * residual) const;
-private:
-  bool correction_;
-  Tracker tracker_;
-  Motor lighthouse_;
-  hive::ViveLight data_;
+  // Solves run on the tracker's strand with a single slot mailbox - a new
+  // frame replaces the one waiting instead of queueing behind it
+  std::unique_ptr<WorkPool> own_pool_;
+  WorkPool * pool_;
+  std::shared_ptr<pool::Strand> strand_;
+  LightData mailbox_;
+  bool pending_;
+  SolveCounters counters_;
 };
 
 // Computes the full pose of a tracker for each lighthouse
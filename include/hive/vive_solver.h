@@ -8,17 +8,45 @@
 
 // Hive imports
 #include <hive/vive.h>
+#include <hive/vive_budget.h>
 
 // ROS message imports
 #include <hive/ViveLight.h>
+#include <hive/ViveLightRaw.h>
+#include <hive/ViveImuBatch.h>
 #include <sensor_msgs/Imu.h>
 
+// STD C++ includes
+#include <map>
+#include <string>
+
+// Inlier statistics of the sweep filter
+struct InlierCounters;
 
 class Solver {
 public:
   virtual void ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) = 0;
   virtual void ProcessLight(const hive::ViveLight::ConstPtr & msg) = 0;
   virtual bool GetTransform(geometry_msgs::TransformStamped & msg) = 0;
+  // Compact light from the bridge. Solvers that take it resolve the
+  // lighthouse by its id in the message, the others ignore it.
+  virtual void ProcessLight(const hive::ViveLightRaw::ConstPtr & msg) {}
+  // Consecutive imu samples from the bridge, one at a time by default
+  virtual void ProcessImu(const hive::ViveImuBatch::ConstPtr & msg) {
+    for (size_t i = 0; i < msg->stamps.size(); i++) {
+      sensor_msgs::Imu::Ptr imu(new sensor_msgs::Imu());
+      ViveUtils::ConvertImu(*msg, i, imu.get());
+      ProcessImu(sensor_msgs::Imu::ConstPtr(imu));
+    }
+  }
+  // Solves run under a time budget, false if the solver has none
+  virtual bool GetBudget(BudgetCounters * counters) {
+    return false;
+  }
+  // Samples checked by the sweep filter, false if the solver has none
+  virtual bool GetInliers(InlierCounters * counters) {
+    return false;
+  }
 };
 
 #endif // HIVE_VIVE_SOLVER_H
\ No newline at end of file
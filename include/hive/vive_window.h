@@ -0,0 +1,174 @@
+#ifndef HIVE_VIVE_WINDOW_H_
+#define HIVE_VIVE_WINDOW_H_
+
+// ROS includes
+#include <ros/ros.h>
+
+// Hive includes
+#include <hive/vive.h>
+
+// Incoming measurements
+#include <hive/ViveLight.h>
+#include <hive/ViveLightRaw.h>
+#include <hive/ViveImuBatch.h>
+#include <sensor_msgs/Imu.h>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <cstddef>
+#include <cstdint>
+
+// Light sweep of one lighthouse. Samples are kept in flat arrays sized for
+// every sensor of a tracker, so a frame needs no heap storage.
+struct LightFrame {
+  ros::Time stamp;
+  int lighthouse;  // snapshot id of the lighthouse
+  uint8_t axis;
+  size_t size;
+  uint8_t sensors[TRACKER_SENSORS_NUMBER];
+  double angles[TRACKER_SENSORS_NUMBER];
+
+  // Copies the samples with |angle| < fov, false if none is left
+  bool Set(hive::ViveLight const& msg, int lighthouse_id,
+    double fov = M_PI / 3.0) {
+    stamp = msg.header.stamp;
+    lighthouse = lighthouse_id;
+    axis = msg.axis;
+    size = 0;
+    for (auto const& sample : msg.samples) {
+      if (size == TRACKER_SENSORS_NUMBER) break;
+      if (sample.angle <= -fov || sample.angle >= fov) continue;
+      sensors[size] = sample.sensor;
+      angles[size] = sample.angle;
+      size++;
+    }
+    return size > 0;
+  }
+
+  // Same from the compact message, angles straight from the ticks
+  bool Set(hive::ViveLightRaw const& msg, int lighthouse_id,
+    double fov = M_PI / 3.0) {
+    stamp = msg.header.stamp;
+    lighthouse = lighthouse_id;
+    axis = msg.axis;
+    size = 0;
+    for (size_t i = 0; i < msg.sensors.size(); i++) {
+      if (size == TRACKER_SENSORS_NUMBER) break;
+      double angle = LIGHT_TICK_ANGLE *
+        (static_cast<double>(msg.ticks[i]) - LIGHT_TICK_CENTER);
+      if (angle <= -fov || angle >= fov) continue;
+      sensors[size] = msg.sensors[i];
+      angles[size] = angle;
+      size++;
+    }
+    return size > 0;
+  }
+};
+
+// Inertial sample without the message around it
+struct ImuFrame {
+  double acc[3];
+  double gyr[3];
+
+  void Set(sensor_msgs::Imu const& msg) {
+    acc[0] = msg.linear_acceleration.x;
+    acc[1] = msg.linear_acceleration.y;
+    acc[2] = msg.linear_acceleration.z;
+    gyr[0] = msg.angular_velocity.x;
+    gyr[1] = msg.angular_velocity.y;
+    gyr[2] = msg.angular_velocity.z;
+  }
+
+  // Sample i of a batch
+  void Set(hive::ViveImuBatch const& batch, size_t i) {
+    for (size_t j = 0; j < 3; j++) {
+      acc[j] = batch.linear_acceleration[3 * i + j];
+      gyr[j] = batch.angular_velocity[3 * i + j];
+    }
+  }
+};
+
+// Fixed capacity window of timed entries, oldest first. Slots are allocated
+// with the window and reused, so pushing and expiring never allocate. A push
+// on a full window overwrites the oldest entry and counts the overrun.
+// N must be a power of two.
+template <typename T, size_t N>
+class TimeWindow {
+  static_assert(N > 1 && (N & (N - 1)) == 0, "N must be a power of two");
+
+ public:
+  TimeWindow() : head_(0), size_(0), overruns_(0) {}
+
+  // Slot of a new newest entry, filled by the caller
+  T & Push(ros::Time const& stamp) {
+    if (size_ == N) {
+      PopFront();
+      overruns_++;
+    }
+    size_t slot = (head_ + size_) & (N - 1);
+    stamps_[slot] = stamp;
+    size_++;
+    return data_[slot];
+  }
+
+  void PopFront() {
+    head_ = (head_ + 1) & (N - 1);
+    size_--;
+  }
+
+  void PopBack() {
+    size_--;
+  }
+
+  // Drops the entries older than stamp, returns how many
+  size_t Expire(ros::Time const& stamp) {
+    size_t expired = 0;
+    while (size_ > 0 && stamps_[head_] < stamp) {
+      PopFront();
+      expired++;
+    }
+    return expired;
+  }
+
+  void Clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  // Entry i, zero being the oldest
+  T & operator[](size_t i) {
+    return data_[(head_ + i) & (N - 1)];
+  }
+  T const& operator[](size_t i) const {
+    return data_[(head_ + i) & (N - 1)];
+  }
+  ros::Time const& Stamp(size_t i) const {
+    return stamps_[(head_ + i) & (N - 1)];
+  }
+
+  T & Front() { return (*this)[0]; }
+  T const& Front() const { return (*this)[0]; }
+  T & Back() { return (*this)[size_ - 1]; }
+  T const& Back() const { return (*this)[size_ - 1]; }
+
+  size_t Size() const { return size_; }
+  bool Empty() const { return size_ == 0; }
+  bool Full() const { return size_ == N; }
+  // Entries overwritten by a push on a full window
+  size_t Overruns() const { return overruns_; }
+
+  static constexpr size_t Capacity() {
+    return N;
+  }
+
+ private:
+  ros::Time stamps_[N];
+  T data_[N];
+  size_t head_;
+  size_t size_;
+  size_t overruns_;
+};
+
+#endif // HIVE_VIVE_WINDOW_H_
@@ -152,21 +152,9 @@ struct CalibHorizontalAngle{
       parameters[EXTRINSICS][3*horizontal_observations_[i].sensor_id + 2];
       Eigen::Matrix<T, 3, 1> lPs = lRw * (wRt * tPs + wPt) + lPw;
 
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE) * parameters[LH_EXTRINSICS-1][PHASE];
-      T tilt = T(SCALE_TILT) * parameters[LH_EXTRINSICS-1][TILT];
-      T curve = T(SCALE_CURVE) * parameters[LH_EXTRINSICS-1][CURVE];
-      T gib_mag = T(SCALE_GIB) * parameters[LH_EXTRINSICS-1][GIB_MAG];
-      T gib_phase = parameters[LH_EXTRINSICS-1][GIB_PHASE];
-
-      if (correction_) {
-        // Distortion correction
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
+      // Shared projection kernel
+      MotorModel<T> motor = LighthouseModel::Scale(parameters[LH_EXTRINSICS-1]);
+      T ang = LighthouseModel::ProjectHorizontal(lPs.data(), motor, correction_);
       // std::cout << "HOR " << ang << " - " << horizontal_observations_[i].angle << std::endl;
 
       residual[i] = T(horizontal_observations_[i].angle) - ang;
@@ -244,26 +232,9 @@ struct CalibVerticalAngle{
       // residual[i] = T(vertical_observations_[i].angle) - atan(lPs(0)/lPs(2));
     // std::cout << "H3" << std::endl;
 
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE) * parameters[LH_EXTRINSICS-1][PHASE];
-      T tilt = T(SCALE_TILT) * parameters[LH_EXTRINSICS-1][TILT];
-      T curve = T(SCALE_CURVE) * parameters[LH_EXTRINSICS-1][CURVE];
-      T gib_mag = T(SCALE_GIB) * parameters[LH_EXTRINSICS-1][GIB_MAG];
-      T gib_phase = parameters[LH_EXTRINSICS-1][GIB_PHASE];
-      // std::cout << "VExt "
-      //   << parameters[LH_EXTRINSICS-1][PHASE] << ", "
-      //   << parameters[LH_EXTRINSICS-1][TILT] << ", "
-      //   << parameters[LH_EXTRINSICS-1][GIB_PHASE] << ", "
-      //   << parameters[LH_EXTRINSICS-1][GIB_MAG] << ", "
-      //   << parameters[LH_EXTRINSICS-1][CURVE] << std::endl;
-      if (correction_) {
-        // Distortion correction
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
+      // Shared projection kernel
+      MotorModel<T> motor = LighthouseModel::Scale(parameters[LH_EXTRINSICS-1]);
+      T ang = LighthouseModel::ProjectVertical(lPs.data(), motor, correction_);
       // std::cout << "VERT " << ang << " - " << vertical_observations_[i].angle << std::endl;
 
       residual[i] = T(vertical_observations_[i].angle) - ang;
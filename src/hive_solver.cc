@@ -1,187 +1,22 @@
 #include <hive/hive_solver.h>
 
-// Light pose in the vive frame
-class BundledHorizontalCost {
-public:
-  BundledHorizontalCost(hive::ViveLight data,
-    Tracker tracker,
-    geometry_msgs::Transform lh_pose,
-    Motor lighthouse,
-    bool correction);
-
-  template <typename T> bool operator()(const T* const * parameters,
-    T * residual) const;
-private:
-  bool correction_;
-  Tracker tracker_;
-  Motor lighthouse_;
-  hive::ViveLight data_;
-  geometry_msgs::Transform lh_pose_;
-};
-
-// Light pose in the vive frame
-class BundledVerticalCost {
-public:
-  BundledVerticalCost(hive::ViveLight data,
-    Tracker tracker,
-    geometry_msgs::Transform lh_pose,
-    Motor lighthouse,
-    bool correction);
-
-  template <typename T> bool operator()(const T* const * parameters,
-    T * residual) const;
-private:
-  bool correction_;
-  Tracker tracker_;
-  Motor lighthouse_;
-  hive::ViveLight data_;
-  geometry_msgs::Transform lh_pose_;
-};
-
-BundledHorizontalCost::BundledHorizontalCost(hive::ViveLight data,
-  Tracker tracker,
-  geometry_msgs::Transform lh_pose,
-  Motor lighthouse,
-  bool correction) {
-  data_ = data;
-  correction_ = correction;
-  tracker_ = tracker;
-  lighthouse_ = lighthouse;
-  lh_pose_ = lh_pose;
-  }
-
-template <typename T> bool BundledHorizontalCost::operator()(const T* const * parameters,
-  T * residual) const {
-  // Tracker pose
-  Eigen::Matrix<T, 3, 1> vPt;
-  vPt << parameters[0][0],
-    parameters[0][1],
-    parameters[0][2];
-  Eigen::Matrix<T, 3, 3> vRt;
-  ceres::AngleAxisToRotationMatrix(&parameters[0][3], vRt.data());
-
-  // Lighthouse pose
-  Eigen::Matrix<T, 3, 1> vPl;
-  vPl << T(lh_pose_.translation.x),
-    T(lh_pose_.translation.y),
-    T(lh_pose_.translation.z);
-  Eigen::Quaternion<T> vQl(T(lh_pose_.rotation.w),
-    T(lh_pose_.rotation.x),
-    T(lh_pose_.rotation.y),
-    T(lh_pose_.rotation.z));
-  Eigen::Matrix<T, 3, 3> vRl = vQl.toRotationMatrix();
-
-  // Pose conversion
-  Eigen::Matrix<T, 3, 1> lPt = vRl.transpose() * vPt - vRl.transpose() * vPl;
-  Eigen::Matrix<T, 3, 3> lRt = vRl.transpose() * vRt;
-
-  size_t counter = 0;
-  for (auto li_it = data_.samples.begin();
-    li_it != data_.samples.end(); li_it++) {
-    auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-    if (sensor_it == tracker_.sensors.end()) return false;
-    Eigen::Matrix<T, 3, 1> tPs;
-    tPs << T(sensor_it->second.position.x),
-      T(sensor_it->second.position.y),
-      T(sensor_it->second.position.z);
-
-    Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-    T ang; // The final angle
-    T x = (lPs(0)/lPs(2)); // Horizontal angle
-    T y = (lPs(1)/lPs(2)); // Vertical angle
-    T phase = T(SCALE_PHASE * lighthouse_.phase);
-    T tilt = T(SCALE_TILT * lighthouse_.tilt);
-    T curve = T(SCALE_CURVE * lighthouse_.curve);
-    T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-    T gib_phase = T(lighthouse_.gib_phase);
-
-    if (correction_) {
-      ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-    } else {
-      ang = atan(x);
-    }
-
-
-    residual[counter] = T(li_it->angle) - ang;
-    counter++;
-  }
-  return true;
-}
-
-BundledVerticalCost::BundledVerticalCost(hive::ViveLight data,
-  Tracker tracker,
-  geometry_msgs::Transform lh_pose,
-  Motor lighthouse,
-  bool correction) {
-  data_ = data;
-  correction_ = correction;
-  tracker_ = tracker;
-  lighthouse_ = lighthouse;
-  lh_pose_ = lh_pose;
-}
-
-template <typename T> bool BundledVerticalCost::operator()(const T* const * parameters,
-  T * residual) const {
-  // Tracker pose
-  Eigen::Matrix<T, 3, 1> vPt;
-  vPt << parameters[0][0],
-    parameters[0][1],
-    parameters[0][2];
-  Eigen::Matrix<T, 3, 3> vRt;
-  ceres::AngleAxisToRotationMatrix(&parameters[0][3], vRt.data());
-
-  // Lighthouse pose
-  Eigen::Matrix<T, 3, 1> vPl;
-  vPl << T(lh_pose_.translation.x),
-    T(lh_pose_.translation.y),
-    T(lh_pose_.translation.z);
-  Eigen::Quaternion<T> vQl(T(lh_pose_.rotation.w),
-    T(lh_pose_.rotation.x),
-    T(lh_pose_.rotation.y),
-    T(lh_pose_.rotation.z));
-  Eigen::Matrix<T, 3, 3> vRl = vQl.toRotationMatrix();
-
-  // Pose conversion
-  Eigen::Matrix<T, 3, 1> lPt = vRl.transpose() * vPt - vRl.transpose() * vPl;
-  Eigen::Matrix<T, 3, 3> lRt = vRl.transpose() * vRt;
-
-  size_t counter = 0;
-  for (auto li_it = data_.samples.begin();
-    li_it != data_.samples.end(); li_it++) {
-    auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-    if (sensor_it == tracker_.sensors.end()) return false;
-    Eigen::Matrix<T, 3, 1> tPs;
-    tPs << T(sensor_it->second.position.x),
-      T(sensor_it->second.position.y),
-      T(sensor_it->second.position.z);
-
-    Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-    T ang; // The final angle
-    T x = (lPs(0)/lPs(2)); // Horizontal angle
-    T y = (lPs(1)/lPs(2)); // Vertical angle
-    T phase = T(SCALE_PHASE * lighthouse_.phase);
-    T tilt = T(SCALE_TILT * lighthouse_.tilt);
-    T curve = T(SCALE_CURVE * lighthouse_.curve);
-    T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-    T gib_phase = T(lighthouse_.gib_phase);
-
-    if (correction_) {
-      ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-    } else {
-      ang = atan(y);
-    }
-
-    residual[counter] = T(li_it->angle) - ang;
-    counter++;
+namespace {
+  // Problem that allows removing residual blocks in constant time
+  ceres::Problem * NewProblem() {
+    ceres::Problem::Options options;
+    options.enable_fast_removal = true;
+    return new ceres::Problem(options);
   }
-  return true;
 }
 
-
-
-HiveSolver::HiveSolver() {
+HiveSolver::HiveSolver() : problem_(NewProblem()) {
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
+  backend_ = solve::CERES;
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
   return;
 }
 
@@ -189,13 +24,21 @@ HiveSolver::HiveSolver(Tracker & tracker,
   LighthouseMap & lighthouses,
   Environment & environment,
   bool correction,
-  bool verbose) {
+  bool verbose,
+  solve::backend backend) : problem_(NewProblem()) {
   tracker_ = tracker;
   lighthouses_ = lighthouses;
   environment_ = environment;
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
   correction_ = correction;
   valid_ = false;
   verbose_ = verbose;
+  backend_ = backend;
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
   // first pose
   pose_.transform.translation.x = 0.0;
   pose_.transform.translation.y = 0.0;
@@ -204,6 +47,8 @@ HiveSolver::HiveSolver(Tracker & tracker,
   pose_.transform.rotation.x = 0.0;
   pose_.transform.rotation.y = 0.0;
   pose_.transform.rotation.z = 0.0;
+  for (size_t i = 0; i < 6; i++) pose_params_[i] = 0.0;
+  pose_params_[2] = 1.0;
   return;
 }
 
@@ -222,109 +67,171 @@ void HiveSolver::ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) {
 void HiveSolver::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
   if (msg == NULL) return;
 
-  hive::ViveLight * clean_msg = new hive::ViveLight(*msg);
+  // Samples outside the field of view are left out
+  LightFrame frame;
+  frame.Set(*msg, calibration_->LighthouseId(msg->lighthouse));
+  ProcessFrame(frame);
+  return;
+}
 
-  light_data_.push_back(*msg);
+void HiveSolver::ProcessLight(const hive::ViveLightRaw::ConstPtr& msg) {
+  if (msg == NULL) return;
 
-  while ((msg->header.stamp -
-    light_data_.front().header.stamp).toNSec() >= 50e6) {
-    light_data_.erase(light_data_.begin());
-  }
+  // Same, indexed by the lighthouse id of the message
+  LightFrame frame;
+  frame.Set(*msg, calibration_->RawLighthouseId(msg->lighthouse));
+  ProcessFrame(frame);
+  return;
+}
 
+void HiveSolver::ProcessFrame(LightFrame & frame) {
+  budget_.Tick(frame.stamp);
+  // Reflections are left out before they reach the problem
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(frame.lighthouse);
+  if (tracker != NULL && lighthouse != NULL)
+    ransac_.Filter(&frame, light_data_, *tracker, *lighthouse, correction_);
+
+  // A full window drops the oldest frame with its residual block
+  if (light_data_.Full()) PopLight();
+  light_data_.Push(frame.stamp) = frame;
+  if (backend_ == solve::CERES)
+    blocks_.Push(frame.stamp) = AddLight(frame);
+  else
+    blocks_.Push(frame.stamp) = NULL;
+
+  // Expire old measurements and their residuals
+  while ((frame.stamp - light_data_.Front().stamp).toNSec() >= 50e6)
+    PopLight();
 
-  if (light_data_.size() > 2) {
+  if (light_data_.Size() > 2) {
     valid_ = Solve();
   }
 
+  // Copy of the counters for other threads
+  std::lock_guard<std::mutex> lock(mutex_);
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
+  return;
+}
+
+void HiveSolver::PopLight() {
+  if (blocks_.Front() != NULL)
+    problem_->RemoveResidualBlock(blocks_.Front());
+  blocks_.PopFront();
+  light_data_.PopFront();
   return;
 }
 
+bool HiveSolver::GetBudget(BudgetCounters * counters) {
+  if (counters == NULL) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  *counters = counters_;
+  return true;
+}
+
+bool HiveSolver::GetInliers(InlierCounters * counters) {
+  if (counters == NULL) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  *counters = inliers_;
+  return true;
+}
+
 bool HiveSolver::GetTransform(geometry_msgs::TransformStamped &msg) {
   msg = pose_;
   return valid_;
 }
 
-bool HiveSolver::Solve() {
-  ceres::Problem problem;
-  ceres::Solver::Options options;
-  ceres::Solver::Summary summary;
+ceres::ResidualBlockId HiveSolver::AddLight(LightFrame const& frame) {
+  if (frame.size < 1) return NULL;
+  if (frame.axis != HORIZONTAL && frame.axis != VERTICAL) return NULL;
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(frame.lighthouse);
+  if (lighthouse == NULL || !lighthouse->has_pose) return NULL;
+  ceres::CostFunction * lcost = new cost::ViveLightCost(frame,
+    calibration_,
+    tracker_id_,
+    cost::POSE_TRACKER,
+    correction_);
+  return problem_->AddResidualBlock(lcost, NULL, pose_params_);
+}
 
+bool HiveSolver::Solve() {
   // Other
   ros::Time time(0);
   double n_sensors = 0;
+  double final_cost = 0;
+
+  // Warm start from the last valid pose, closed form after a loss
+  double * pose = pose_params_;
+  if (valid_ || !pnp::Initialize(light_data_, *calibration_, tracker_id_,
+    cost::POSE_TRACKER, correction_, pose)) {
+    pose[0] = pose_.transform.translation.x;
+    pose[1] = pose_.transform.translation.y;
+    pose[2] = pose_.transform.translation.z;
+    Eigen::Quaterniond vQt_1(pose_.transform.rotation.w,
+      pose_.transform.rotation.x,
+      pose_.transform.rotation.y,
+      pose_.transform.rotation.z);
+    Eigen::AngleAxisd vAAt_1(vQt_1);
+    pose[3] = vAAt_1.angle() * vAAt_1.axis()(0);
+    pose[4] = vAAt_1.angle() * vAAt_1.axis()(1);
+    pose[5] = vAAt_1.angle() * vAAt_1.axis()(2);
+  }
 
-  // Load pose
-  double pose[6];
-  pose[0] = pose_.transform.translation.x;
-  pose[1] = pose_.transform.translation.y;
-  pose[2] = pose_.transform.translation.z;
-  Eigen::Quaterniond vQt_1(pose_.transform.rotation.w,
-    pose_.transform.rotation.x,
-    pose_.transform.rotation.y,
-    pose_.transform.rotation.z);
-  Eigen::AngleAxisd vAAt_1(vQt_1);
-  pose[3] = vAAt_1.angle() * vAAt_1.axis()(0);
-  pose[4] = vAAt_1.angle() * vAAt_1.axis()(1);
-  pose[5] = vAAt_1.angle() * vAAt_1.axis()(2);
-
-  for (auto lh_it : light_data_) {
-    hive::ViveLight clean_msg = lh_it;
-    auto sample_it = clean_msg.samples.begin();
-    while (sample_it != clean_msg.samples.end()) {
-      if (sample_it->angle > -M_PI/3.0 && sample_it->angle < M_PI / 3.0) {
-        sample_it++;
-      } else {
-        clean_msg.samples.erase(sample_it);
-      }
-    }
-    if (clean_msg.samples.size() < 1) {
-      continue;
+  if (backend_ == solve::LM) {
+    // Fixed size solver
+    lm::PoseSolver solver;
+    solver.max_iterations = std::min(solver.max_iterations,
+      budget_.Iterations());
+    TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+    if (tracker == NULL) return false;
+    for (size_t i = 0; i < light_data_.Size(); i++) {
+      LightFrame const& light = light_data_[i];
+      if (light.size < 1) continue;
+      LighthouseModel const* lighthouse =
+        calibration_->GetLighthouse(light.lighthouse);
+      if (lighthouse == NULL) continue;
+      if (!solver.AddLight(light, *tracker, *lighthouse, correction_))
+        continue;
+      if (light.stamp > time)
+        time = light.stamp;
     }
-    // Convert lighthouse transform
-    geometry_msgs::Transform lighthouse;
-    lighthouse.translation = environment_.lighthouses[clean_msg.lighthouse].translation;
-    lighthouse.rotation = environment_.lighthouses[clean_msg.lighthouse].rotation;
-    // Horizontal sweep
-    if (clean_msg.axis == HORIZONTAL) {
-      ceres::DynamicAutoDiffCostFunction<BundledHorizontalCost, 4> * hcost =
-        new ceres::DynamicAutoDiffCostFunction<BundledHorizontalCost, 4>
-        (new BundledHorizontalCost(clean_msg,
-          tracker_,
-          lighthouse,
-          lighthouses_[clean_msg.lighthouse].horizontal_motor,
-          correction_));
-      hcost->AddParameterBlock(6);
-      hcost->SetNumResiduals(clean_msg.samples.size());
-      problem.AddResidualBlock(hcost, NULL, pose);
-      if (clean_msg.header.stamp > time)
-        time = clean_msg.header.stamp;
-      n_sensors += clean_msg.samples.size();
+    lm::Summary summary;
+    budget_.Start();
+    solver.max_time = budget_.Seconds();
+    if (!solver.Solve(pose, &summary)) {
+      // Nothing to iterate on, but the started solve still counts
+      budget_.Stop(0, false);
+      return false;
     }
-    // Vertical sweep
-    if (clean_msg.axis == VERTICAL) {
-      ceres::DynamicAutoDiffCostFunction<BundledVerticalCost, 4> * vcost =
-        new ceres::DynamicAutoDiffCostFunction<BundledVerticalCost, 4>
-        (new BundledVerticalCost(clean_msg,
-          tracker_,
-          lighthouse,
-          lighthouses_[clean_msg.lighthouse].vertical_motor,
-          correction_));
-      vcost->AddParameterBlock(6);
-      vcost->SetNumResiduals(clean_msg.samples.size());
-      problem.AddResidualBlock(vcost, NULL, pose);
-      if (clean_msg.header.stamp > time)
-        time = clean_msg.header.stamp;
-      n_sensors += clean_msg.samples.size();
+    budget_.Stop(summary.iterations, summary.converged);
+    n_sensors = solver.NumResiduals();
+    final_cost = summary.final_cost;
+  } else {
+    if (problem_->NumResidualBlocks() == 0) return false;
+    n_sensors = problem_->NumResiduals();
+    for (size_t i = 0; i < light_data_.Size(); i++) {
+      if (blocks_[i] != NULL && light_data_[i].stamp > time)
+        time = light_data_[i].stamp;
     }
+    ceres::Solver::Options options;
+    ceres::Solver::Summary summary;
+    options.minimizer_progress_to_stdout = false;
+    // Ceres keeps the best iterate when a limit stops it
+    budget_.Start();
+    options.max_num_iterations = budget_.Iterations();
+    options.max_solver_time_in_seconds = budget_.Seconds();
+    ceres::Solve(options, problem_.get(), &summary);
+    budget_.Stop(summary.num_successful_steps
+      + summary.num_unsuccessful_steps,
+      summary.termination_type == ceres::CONVERGENCE);
+    final_cost = summary.final_cost;
   }
 
-  options.minimizer_progress_to_stdout = false;
-  options.max_num_iterations = 1000;
-  options.max_solver_time_in_seconds = 0.5;
-  ceres::Solve(options, &problem, &summary);
-
   if (verbose_) {
-    std::cout << summary.final_cost <<  " - "
+    std::cout << final_cost <<  " - "
       << pose[0] << ", "
       << pose[1] << ", "
       << pose[2] << ", "
@@ -335,7 +242,7 @@ bool HiveSolver::Solve() {
 
   // Check pose
   double pose_norm = sqrt(pose[0]*pose[0] + pose[1]*pose[1] + pose[2]*pose[2]);
-  if (summary.final_cost > 1e-5* n_sensors
+  if (final_cost > 1e-5* n_sensors
     || pose_norm > 20
     || pose[2] <= 0 ) {
     return false;
@@ -127,6 +127,8 @@ bool ViveUtils::ReadConfig(std::string file_name, Calibration * calibration) {
     (*calibration).environment.lighthouses[lh_it->child_frame_id] = lighthouse;
   }
 
+  (*calibration).Intern();
+
   return true;
 }
 
@@ -212,6 +214,78 @@ size_t ViveUtils::ConvertExtrinsics(Tracker const& tracker, double * extrinsics)
   return tracker.sensors.size();
 }
 
+std::map<uint8_t, std::string> ViveUtils::GetLighthouseIds(
+  LighthouseMap const& lighthouses) {
+  std::map<uint8_t, std::string> lighthouse_ids;
+  for (auto const& lighthouse : lighthouses)
+    lighthouse_ids[lighthouse.second.id] = lighthouse.first;
+  return lighthouse_ids;
+}
+
+bool ViveUtils::ConvertLight(hive::ViveLightRaw const& raw,
+  std::map<uint8_t, std::string> const& lighthouse_ids,
+  hive::ViveLight * light) {
+  auto lh_it = lighthouse_ids.find(raw.lighthouse);
+  if (lh_it == lighthouse_ids.end()) return false;
+  light->header = raw.header;
+  light->lighthouse = lh_it->second;
+  light->axis = raw.axis;
+  light->samples.resize(raw.sensors.size());
+  for (size_t i = 0; i < raw.sensors.size(); i++) {
+    light->samples[i].sensor = raw.sensors[i];
+    light->samples[i].timecode = raw.timecode;
+    light->samples[i].angle = LIGHT_TICK_ANGLE *
+      (static_cast<double>(raw.ticks[i]) - LIGHT_TICK_CENTER);
+    light->samples[i].length = LIGHT_TICK_LENGTH * raw.lengths[i];
+  }
+  return true;
+}
+
+void ViveUtils::ConvertImu(hive::ViveImuBatch const& batch,
+  size_t i, sensor_msgs::Imu * imu) {
+  imu->header.frame_id = batch.header.frame_id;
+  imu->header.stamp = batch.stamps[i];
+  imu->linear_acceleration.x = batch.linear_acceleration[3 * i];
+  imu->linear_acceleration.y = batch.linear_acceleration[3 * i + 1];
+  imu->linear_acceleration.z = batch.linear_acceleration[3 * i + 2];
+  imu->angular_velocity.x = batch.angular_velocity[3 * i];
+  imu->angular_velocity.y = batch.angular_velocity[3 * i + 1];
+  imu->angular_velocity.z = batch.angular_velocity[3 * i + 2];
+  return;
+}
+
+size_t SerialIds::Intern(std::string const& serial) {
+  auto it = ids_.find(serial);
+  if (it != ids_.end()) return it->second;
+  ids_[serial] = serials_.size();
+  serials_.push_back(serial);
+  return serials_.size() - 1;
+}
+
+int SerialIds::Find(std::string const& serial) const {
+  auto it = ids_.find(serial);
+  if (it == ids_.end()) return -1;
+  return it->second;
+}
+
+std::string const& SerialIds::Serial(size_t id) const {
+  return serials_[id];
+}
+
+size_t SerialIds::Size() const {
+  return serials_.size();
+}
+
+void Calibration::Intern() {
+  for (auto const& tracker : trackers)
+    tracker_ids.Intern(tracker.first);
+  for (auto const& lighthouse : lighthouses)
+    lighthouse_ids.Intern(lighthouse.first);
+  for (auto const& lighthouse : environment.lighthouses)
+    lighthouse_ids.Intern(lighthouse.first);
+  return;
+}
+
 bool Calibration::SetEnvironment(hive::ViveCalibration const& msg) {
   environment.vive.parent_frame = "world";
   environment.vive.child_frame = "vive";
@@ -254,6 +328,7 @@ bool Calibration::SetEnvironment(hive::ViveCalibration const& msg) {
     environment.bodies[bd_it->header.frame_id].rotation.y = bd_it->transform.rotation.y;
     environment.bodies[bd_it->header.frame_id].rotation.z = bd_it->transform.rotation.z;
   }
+  Intern();
   return true;
 }
 
@@ -346,6 +421,7 @@ bool Calibration::SetLighthouses(hive::ViveCalibrationLighthouseArray const& msg
     lighthouses[lh_it->serial].horizontal_motor.gib_magnitude = lh_it->horizontal.gibmag;
     lighthouses[lh_it->serial].horizontal_motor.curve = lh_it->horizontal.curve;
   }
+  Intern();
   return true;
 }
 
@@ -483,6 +559,7 @@ bool Calibration::SetTrackers(hive::ViveCalibrationTrackerArray const& msg) {
     }
   }
 
+  Intern();
   return true;
 }
 
@@ -530,6 +607,7 @@ bool Calibration::SetTrackers(hive::ViveCalibrationTrackerArray2 const& msg) {
   }
 
 
+  Intern();
   return true;
 }
 
@@ -651,6 +729,13 @@ double JsonParser::GetRate() {
   return 10.0;
 }
 
+size_t JsonParser::GetThreads() {
+  if (document_->HasMember("threads") && (*document_)["threads"].IsUint()) {
+    return (*document_)["threads"].GetUint();
+  }
+  return 0;
+}
+
 bool JsonParser::GetCalibration(Calibration * calibration) {
   // Lighthouses
   if (document_->HasMember("lighthouses") && (*document_)["lighthouses"].IsArray()) {
@@ -757,6 +842,7 @@ bool JsonParser::GetCalibration(Calibration * calibration) {
     calibration->environment.offset.rotation.y = calibration->environment.offset.rotation.y / norm;
     calibration->environment.offset.rotation.z = calibration->environment.offset.rotation.z / norm;
   }
+  calibration->Intern();
   return true;
 }
 
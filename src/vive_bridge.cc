@@ -16,19 +16,21 @@
  * under the License.
  */
 
-// Libsurvive interface
-extern "C" {
-  #include <deepdive/deepdive.h>
-}
+// Hive bridge
+#include <hive/vive_bridge.h>
 
 // Standard C includes
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <sys/prctl.h>
 
 // ROS includes
 #include <ros/ros.h>
 #include <nodelet/nodelet.h>
-#include <tf2_ros/transform_broadcaster.h>
+#include <pluginlib/class_list_macros.h>
 
 // Standard C++ includes
 #include <iostream>
@@ -38,6 +40,9 @@ extern "C" {
 #include <hive/ViveCalibrationLighthouseArray.h>
 #include <hive/ViveCalibrationGeneral.h>
 #include <hive/ViveLight.h>
+#include <hive/ViveLightRaw.h>
+#include <hive/ViveImuBatch.h>
+#include <hive/ViveClock.h>
 #include <sensor_msgs/Imu.h>
 #include <geometry_msgs/Vector3.h>
 
@@ -45,14 +50,39 @@ extern "C" {
 #include <hive/vive_general.h>
 
 // C++ includes
-#include <thread>
+#include <algorithm>
+#include <chrono>
 #include <functional>
 
 static ros::Publisher pub_light_;               // Light publisher
+static ros::Publisher pub_light_raw_;           // Compact light publisher
 static ros::Publisher pub_imu_;                 // Imu publisher
+static ros::Publisher pub_imu_batch_;           // Batched imu publisher
+static ros::Publisher pub_clock_;               // Clock fit publisher
 static ros::Publisher pub_lighthouses_;         // Lighthouse calibration
 static ros::Publisher pub_trackers_;            // Tracker calibration
 static ros::Publisher pub_general_;             // General calibration
+static std::atomic<size_t> overruns_(0);        // Records lost to a full ring
+static std::mutex calibration_mutex_;           // Guards the calibration arrays
+static std::vector<std::string> tracker_serials_;    // By tracker id
+static std::vector<std::string> lighthouse_serials_; // By lighthouse id
+// Ring and callback count of the context polled on this thread
+static thread_local SpscRing<BridgeRecord, BRIDGE_RING> * ring_ = NULL;
+static thread_local size_t received_ = 0;
+
+// Bridge-wide id of a device serial, called under calibration_mutex_. Each
+// context numbers the devices it sees on its own.
+static uint8_t Intern(std::vector<std::string> & serials,
+  char const* serial) {
+  size_t id = 0;
+  while (id < serials.size() && serials[id] != serial)
+    id++;
+  if (id == serials.size()) {
+    if (id >= BRIDGE_NO_ID) return BRIDGE_NO_ID;
+    serials.push_back(serial);
+  }
+  return static_cast<uint8_t>(id);
+}
 
 geometry_msgs::Vector3 array_to_ros_vector(float* array) {
   geometry_msgs::Vector3 v;
@@ -77,209 +107,499 @@ void Convert(const T from[4], geometry_msgs::Quaternion & to) {
   to.w = from[3];
 }
 
-class HiveBridge {
- public:
-  HiveBridge() {
-    active_ = true;
-  }
+HiveBridge::HiveBridge() {
+  polling_ = true;
+  active_ = true;
+  stats_.published = 0;
+  stats_.overruns = 0;
+  stats_.max_depth = 0;
+  stats_.sum_latency = 0.0;
+  stats_.max_latency = 0.0;
+  imu_batch_ = BRIDGE_IMU_BATCH;
+  imu_latency_ = BRIDGE_IMU_LATENCY;
+  backoff_ = true;
+  device_clock_ = true;
+}
+
+// Destructor
+HiveBridge::~HiveBridge() {
+  // The poll threads drain their rings through the publisher before they
+  // close their contexts, so the publisher stops only once they are done
+  polling_ = false;
+  for (auto & thread : threads_)
+    if (thread.joinable()) thread.join();
+  active_ = false;
+  if (publisher_.joinable()) publisher_.join();
+}
+
+void HiveBridge::Initialize(ros::NodeHandle *nh, ros::NodeHandle *pnh) {
+  // Deepdive contexts, each with its own poll thread
+  int contexts;
+  pnh->param<int>("contexts", contexts, 1);
+  contexts = std::max(contexts, 1);
+  for (int i = 0; i < contexts; i++)
+    rings_.push_back(std::unique_ptr<SpscRing<BridgeRecord, BRIDGE_RING>>(
+      new SpscRing<BridgeRecord, BRIDGE_RING>()));
+  // Batching of the imu samples, a batch of one sends every sample
+  int imu_batch;
+  pnh->param<int>("imu_batch", imu_batch, BRIDGE_IMU_BATCH);
+  pnh->param<double>("imu_latency", imu_latency_, BRIDGE_IMU_LATENCY);
+  imu_batch_ = std::max(imu_batch, 1);
+  // Spinning on deepdive_poll() is only worth a core for the last few us
+  pnh->param<bool>("poll_backoff", backoff_, true);
+  // Stamps from the device clock fit, rather than the arrival on the host
+  pnh->param<bool>("device_clock", device_clock_, true);
+
+  // Create data publishers
+  pub_light_ = nh->advertise<hive::ViveLight>(
+    TOPIC_HIVE_LIGHT, 1000);
+  pub_light_raw_ = nh->advertise<hive::ViveLightRaw>(
+    TOPIC_HIVE_LIGHT_RAW, 1000);
+  pub_imu_ = nh->advertise<sensor_msgs::Imu>(
+    TOPIC_HIVE_IMU, 1000);
+  pub_imu_batch_ = nh->advertise<hive::ViveImuBatch>(
+    TOPIC_HIVE_IMU_BATCH, 1000);
+  pub_clock_ = nh->advertise<hive::ViveClock>(
+    TOPIC_HIVE_CLOCK, 100);
+
+  // Create calibration publishers as latched
+  pub_lighthouses_ = nh->advertise<hive::ViveCalibrationLighthouseArray>(
+    TOPIC_HIVE_LIGHTHOUSES, 1000, true);
+  pub_trackers_ = nh->advertise<hive::ViveCalibrationTrackerArray>(
+    TOPIC_HIVE_TRACKERS, 1000, true);
+  pub_general_ = nh->advertise<hive::ViveCalibrationGeneral>(
+    TOPIC_HIVE_GENERAL, 1000, true);
 
-  // Destructor
-  ~HiveBridge() {
-    active_ = false;
-    thread_.join();
+  // Start a thread to publish and one per context to listen to vive
+  publisher_ = std::thread(&HiveBridge::PublisherThread, this);
+  for (size_t i = 0; i < rings_.size(); i++)
+    threads_.push_back(std::thread(&HiveBridge::WorkerThread, this, i));
+}
+
+// Worker thread polls one context of the survive library
+void HiveBridge::WorkerThread(size_t index) {
+  // Try to initialize vive
+  struct Driver * driver = deepdive_init();
+  if (!driver) {
+    ROS_FATAL("Vive context %zu init failed", index);
+    return;
   }
+  // The callbacks of this context go to its ring
+  ring_ = rings_[index].get();
+  // Install the light callback
+  deepdive_install_light_fn(driver, LightCallback);
+  deepdive_install_imu_fn(driver, ImuCallback);
+  deepdive_install_lighthouse_fn(driver, LighthouseCallback);
+  deepdive_install_tracker_fn(driver, TrackerCallback);
+  // deepdive_install_general_fn(driver, GeneralCallback);
+  // Keep polling until we are no longer active. Deepdive gives no handle to
+  // wait on, so an empty poll is followed by a short spin and then sleeps
+  // growing up to BRIDGE_POLL_MAX.
+  if (backoff_) prctl(PR_SET_TIMERSLACK, BRIDGE_POLL_SLACK, 0, 0, 0);
+  size_t empty = 0;
+  while (polling_) {
+    size_t received = received_;
+    if (deepdive_poll(driver) != 0) break;
+    if (!backoff_ || received_ != received) {
+      empty = 0;
+      continue;
+    }
+    Backoff(++empty);
+  }
+  // The queued records point into the context, let them go out first. The
+  // publisher runs until this thread is joined.
+  while (rings_[index]->Size() > 0)
+    std::this_thread::sleep_for(std::chrono::duration<double>(BRIDGE_IDLE));
+  // Close the vive context
+  deepdive_close(driver);
+}
+
+void HiveBridge::Backoff(size_t empty) {
+  if (empty <= BRIDGE_POLL_SPINS) return;
+  // Double the sleep on every empty poll past the spins
+  size_t doublings = std::min<size_t>(empty - BRIDGE_POLL_SPINS - 1, 16);
+  double sleep = std::min(BRIDGE_POLL_MIN * (1 << doublings),
+    BRIDGE_POLL_MAX);
+  std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
+}
 
-  void Initialize(ros::NodeHandle *nh) {
-    // Create data publishers
-    pub_light_ = nh->advertise<hive::ViveLight>(
-      TOPIC_HIVE_LIGHT, 1000);
-    pub_imu_ = nh->advertise<sensor_msgs::Imu>(
-      TOPIC_HIVE_IMU, 1000);
-
-    // Create calibration publishers as latched
-    pub_lighthouses_ = nh->advertise<hive::ViveCalibrationLighthouseArray>(
-      TOPIC_HIVE_LIGHTHOUSES, 1000, true);
-    pub_trackers_ = nh->advertise<hive::ViveCalibrationTrackerArray>(
-      TOPIC_HIVE_TRACKERS, 1000, true);
-    pub_general_ = nh->advertise<hive::ViveCalibrationGeneral>(
-      TOPIC_HIVE_GENERAL, 1000, true);
-
-    // Start a thread to listen to vive
-    thread_ = std::thread(&HiveBridge::WorkerThread, this);
+// Drains the rings into the publishers
+void HiveBridge::PublisherThread() {
+  ros::WallTime report = ros::WallTime::now();
+  ros::WallTime clock = report;
+  // Once stopped, publish what the poll threads left behind
+  while (true) {
+    size_t ring = 0;
+    BridgeRecord * record = Next(&ring);
+    if (record == NULL) {
+      if (!active_ && Next(&ring) == NULL) break;
+      FlushImu(false);
+      std::this_thread::sleep_for(std::chrono::duration<double>(BRIDGE_IDLE));
+    } else {
+      size_t depth = rings_[ring]->Size();
+      ros::Time stamp = record->stamp;
+      Publish(*record);
+      rings_[ring]->Pop();
+      double latency = (ros::Time::now() - stamp).toSec();
+      mutex_.lock();
+      stats_.published++;
+      stats_.max_depth = std::max(stats_.max_depth, depth);
+      stats_.sum_latency += latency;
+      stats_.max_latency = std::max(stats_.max_latency, latency);
+      mutex_.unlock();
+      FlushImu(false);
+    }
+    // Periodic fit of the device clocks
+    if ((ros::WallTime::now() - clock).toSec() >= BRIDGE_CLOCK) {
+      clock = ros::WallTime::now();
+      PublishClocks();
+    }
+    // Periodic report of the hand-off
+    if ((ros::WallTime::now() - report).toSec() < BRIDGE_REPORT) continue;
+    report = ros::WallTime::now();
+    BridgeStats stats = GetStats();
+    ROS_INFO("Bridge: %zu published, %zu overruns, ring depth %zu of %zu,"
+      " latency %.3f ms mean %.3f ms max", stats.published, stats.overruns,
+      stats.max_depth, SpscRing<BridgeRecord, BRIDGE_RING>::Capacity(),
+      1e3 * stats.sum_latency / std::max<size_t>(stats.published, 1),
+      1e3 * stats.max_latency);
   }
+  FlushImu(true);
+}
 
-  // Worker thread polls on survive library
-  void WorkerThread() {
-    // Try to initialize vive
-    driver_ = deepdive_init();
-    if (!driver_) {
-      ROS_FATAL("Vive context init failed");
-      return;
+BridgeRecord * HiveBridge::Next(size_t * ring) {
+  BridgeRecord * next = NULL;
+  bool empty = false;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    BridgeRecord * record = rings_[i]->Front();
+    if (record == NULL) {
+      empty = true;
+    } else if (next == NULL || record->stamp < next->stamp) {
+      next = record;
+      *ring = i;
     }
-    // Set active to true on initialization
-    active_ = true;
-    // Install the light callback
-    deepdive_install_light_fn(driver_, LightCallback);
-    deepdive_install_imu_fn(driver_, ImuCallback);
-    deepdive_install_lighthouse_fn(driver_, LighthouseCallback);
-    deepdive_install_tracker_fn(driver_, TrackerCallback);
-    // deepdive_install_general_fn(driver_, GeneralCallback);
-    // Keep polling until we are no longer active
-    while (active_ && (deepdive_poll(driver_) == 0)) {}
-    // Close the vive context
-    deepdive_close(driver_);
   }
+  // An empty ring may still be committing an older record
+  if (next != NULL && empty && rings_.size() > 1 && polling_ &&
+    (ros::Time::now() - next->stamp).toSec() < BRIDGE_MERGE) return NULL;
+  return next;
+}
 
+BridgeStats HiveBridge::GetStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  BridgeStats stats = stats_;
+  stats.overruns = overruns_.exchange(0);
+  stats_.published = 0;
+  stats_.max_depth = 0;
+  stats_.sum_latency = 0.0;
+  stats_.max_latency = 0.0;
+  return stats;
+}
 
-  // Callback to display light info
-  static void LightCallback(struct Tracker * tracker,
-    struct Lighthouse * lighthouse, uint8_t axis, uint32_t synctime,
-    uint16_t num_sensors, uint16_t *sensors, uint32_t *sweeptimes,
-    uint32_t *angles, uint16_t *lengths) {
-    static hive::ViveLight msg;
-    msg.header.frame_id = tracker->serial;
-    msg.header.stamp = ros::Time::now();
-    msg.lighthouse = lighthouse->serial;
-    msg.axis = axis;
-    msg.samples.resize(num_sensors);
-    for (uint16_t i = 0; i < num_sensors; i++) {
-      msg.samples[i].sensor = sensors[i];
-      msg.samples[i].angle =
-        (M_PI / 400000.0) * (static_cast<float>(angles[i]) - 200000.0);
-      msg.samples[i].length =
-        static_cast<float>(lengths[i]) / 48000000.0 * 1000000.0;
-    }
-    // Publish the data
-    pub_light_.publish(msg);
+void HiveBridge::PublishClocks() {
+  for (auto const& tracker : trackers_) {
+    if (tracker.serial.empty()) continue;
+    ClockFit fit = tracker.clock.GetFit();
+    hive::ViveClock::Ptr msg(new hive::ViveClock());
+    msg->header.frame_id = tracker.serial;
+    msg->header.stamp = ros::Time::now();
+    msg->offset = fit.offset;
+    msg->drift = fit.drift;
+    msg->spread = fit.spread;
+    msg->samples = fit.samples;
+    msg->outliers = fit.outliers;
+    msg->valid = fit.valid;
+    pub_clock_.publish(msg);
   }
+}
 
-  // Called back when new IMU data is available
-  static void ImuCallback(struct Tracker * tracker, uint32_t timecode,
-  int16_t acc[3], int16_t gyr[3], int16_t mag[3]) {
-    // Package up the IMU data
-    static sensor_msgs::Imu msg;
-    msg.header.frame_id = tracker->serial;
-    msg.header.stamp = ros::Time::now();
-    msg.linear_acceleration.x =
-      static_cast<float>(acc[0]) * GRAVITY / ACC_SCALE;
-    msg.linear_acceleration.y =
-      static_cast<float>(acc[1]) * GRAVITY / ACC_SCALE;
-    msg.linear_acceleration.z =
-      static_cast<float>(acc[2]) * GRAVITY / ACC_SCALE;
-    msg.angular_velocity.x =
-      static_cast<float>(gyr[0]) * (1./GYRO_SCALE) * (M_PI/180.);
-    msg.angular_velocity.y =
-      static_cast<float>(gyr[1]) * (1./GYRO_SCALE) * (M_PI/180.);
-    msg.angular_velocity.z =
-      static_cast<float>(gyr[2]) * (1./GYRO_SCALE) * (M_PI/180.);
-    // Publish the data
-    pub_imu_.publish(msg);
+uint8_t HiveBridge::TrackerId(struct Tracker * tracker) {
+  auto it = tracker_ids_.find(tracker);
+  if (it != tracker_ids_.end())
+    return it->second;
+  std::lock_guard<std::mutex> lock(calibration_mutex_);
+  uint8_t id = Intern(tracker_serials_, tracker->serial);
+  if (id == BRIDGE_NO_ID) {
+    ROS_ERROR("Too many trackers, dropping the data of %s", tracker->serial);
+  } else {
+    // Ids may be handed out by the calibration first
+    if (id >= trackers_.size()) trackers_.resize(id + 1);
+    trackers_[id].serial = tracker->serial;
   }
+  return tracker_ids_[tracker] = id;
+}
+
+uint8_t HiveBridge::LighthouseId(struct Lighthouse * lighthouse) {
+  auto it = lighthouse_ids_.find(lighthouse);
+  if (it != lighthouse_ids_.end())
+    return it->second;
+  std::lock_guard<std::mutex> lock(calibration_mutex_);
+  uint8_t id = Intern(lighthouse_serials_, lighthouse->serial);
+  if (id == BRIDGE_NO_ID)
+    ROS_ERROR("Too many lighthouses, dropping the light of %s",
+      lighthouse->serial);
+  return lighthouse_ids_[lighthouse] = id;
+}
 
-  // Configuration call from the vive_tool
-  static void TrackerCallback(struct Tracker * t) {
-    if (!t) return;
-    static hive::ViveCalibrationTrackerArray msg;
-    // Check if the serial number exists, and if not, create a new record
-    std::vector<hive::ViveCalibrationTracker>::iterator it;
-    for (it = msg.trackers.begin(); it != msg.trackers.end(); it++)
-      if (!it->serial.compare(t->serial)) break;
-    if (it == msg.trackers.end())
-      it = msg.trackers.insert(msg.trackers.end(),
-        hive::ViveCalibrationTracker());
-    // Now modify the record
-    it->serial = t->serial;
-    it->timestamp = ros::Time::now();
-    it->extrinsics.resize(t->cal.num_channels);
-    for (size_t i = 0; i < t->cal.num_channels; i++) {
-      it->extrinsics[i].id = t->cal.channels[i];
-      it->extrinsics[i].position =
-        array_to_ros_vector(t->cal.positions[i]);
-      it->extrinsics[i].normal =
-        array_to_ros_vector(t->cal.normals[i]);
+void HiveBridge::Publish(BridgeRecord const& record) {
+  uint8_t id = TrackerId(record.tracker);
+  if (id == BRIDGE_NO_ID) return;
+  BridgeTracker & tracker = trackers_[id];
+  // Device time mapped to the host, free of the USB and poll jitter
+  ros::Time stamp = record.stamp;
+  if (device_clock_)
+    stamp = tracker.clock.Update(record.timecode, record.stamp);
+  // A new message per record, so that nodelets in the same manager get the
+  // pointer instead of a serialized copy
+  if (record.type == BridgeRecord::LIGHT) {
+    uint8_t lighthouse = LighthouseId(record.lighthouse);
+    if (lighthouse == BRIDGE_NO_ID) return;
+    // The samples before the sweep go out first, so that each tracker's
+    // messages stay in stamp order
+    if (tracker.batch) {
+      pub_imu_batch_.publish(tracker.batch);
+      tracker.batch.reset();
+    }
+    // Compact sweep for the solvers, without the samples they would reject
+    hive::ViveLightRaw::Ptr raw(new hive::ViveLightRaw());
+    raw->header.frame_id = tracker.serial;
+    raw->header.stamp = stamp;
+    raw->tracker = id;
+    raw->lighthouse = lighthouse;
+    raw->axis = record.axis;
+    raw->timecode = record.timecode;
+    raw->sensors.reserve(record.num_sensors);
+    raw->ticks.reserve(record.num_sensors);
+    raw->lengths.reserve(record.num_sensors);
+    for (uint16_t i = 0; i < record.num_sensors; i++) {
+      if (record.sensors[i] > UINT8_MAX) continue;
+      double angle = LIGHT_TICK_ANGLE *
+        (static_cast<double>(record.angles[i]) - LIGHT_TICK_CENTER);
+      if (fabs(angle) > LIGHT_MAX_ANGLE) continue;
+      raw->sensors.push_back(record.sensors[i]);
+      raw->ticks.push_back(record.angles[i]);
+      raw->lengths.push_back(record.lengths[i]);
     }
-    it->acc_bias = array_to_ros_vector(t->cal.acc_bias);
-    it->acc_scale = array_to_ros_vector(t->cal.acc_scale);
-    it->gyr_bias = array_to_ros_vector(t->cal.gyr_bias);
-    it->gyr_scale = array_to_ros_vector(t->cal.gyr_scale);
-    // Set the default IMU transform
-    // Convert(&t->cal.imu_transform[0], it->imu_transform.rotation);
-    // Convert(&t->cal.imu_transform[4], it->imu_transform.translation);
-    // Set the default HEAD transform
-    // Convert(&t->cal.head_transform[0], it->head_transform.rotation);
-    // Convert(&t->cal.head_transform[4], it->head_transform.translation);
-
-    // Republish the complete array with the new record
-    pub_trackers_.publish(msg);
+    pub_light_raw_.publish(raw);
+    // Full sweep only for those who still listen to it
+    if (pub_light_.getNumSubscribers() == 0) return;
+    hive::ViveLight::Ptr msg(new hive::ViveLight());
+    msg->header.frame_id = tracker.serial;
+    msg->header.stamp = stamp;
+    msg->lighthouse = record.lighthouse->serial;
+    msg->axis = record.axis;
+    msg->samples.resize(record.num_sensors);
+    for (uint16_t i = 0; i < record.num_sensors; i++) {
+      msg->samples[i].sensor = record.sensors[i];
+      msg->samples[i].timecode = record.timecode;
+      msg->samples[i].angle = LIGHT_TICK_ANGLE *
+        (static_cast<float>(record.angles[i]) - LIGHT_TICK_CENTER);
+      msg->samples[i].length =
+        static_cast<float>(record.lengths[i]) * LIGHT_TICK_LENGTH;
+    }
+    pub_light_.publish(msg);
+    return;
+  }
+  // Append the sample to its tracker's batch
+  float acc[3], gyr[3];
+  for (size_t i = 0; i < 3; i++) {
+    acc[i] = static_cast<float>(record.acc[i]) * GRAVITY / ACC_SCALE;
+    gyr[i] = static_cast<float>(record.gyr[i]) *
+      (1./GYRO_SCALE) * (M_PI/180.);
   }
+  hive::ViveImuBatch::Ptr & batch = tracker.batch;
+  if (!batch) {
+    batch.reset(new hive::ViveImuBatch());
+    batch->header.frame_id = tracker.serial;
+    batch->tracker = id;
+    batch->stamps.reserve(imu_batch_);
+    batch->timecodes.reserve(imu_batch_);
+    batch->linear_acceleration.reserve(3 * imu_batch_);
+    batch->angular_velocity.reserve(3 * imu_batch_);
+  }
+  batch->header.stamp = stamp;
+  batch->stamps.push_back(stamp);
+  batch->timecodes.push_back(record.timecode);
+  batch->linear_acceleration.insert(
+    batch->linear_acceleration.end(), acc, acc + 3);
+  batch->angular_velocity.insert(
+    batch->angular_velocity.end(), gyr, gyr + 3);
+  // Single samples only for those who still listen to them
+  if (pub_imu_.getNumSubscribers() == 0) return;
+  sensor_msgs::Imu::Ptr msg(new sensor_msgs::Imu());
+  msg->header.frame_id = tracker.serial;
+  msg->header.stamp = stamp;
+  msg->linear_acceleration.x = acc[0];
+  msg->linear_acceleration.y = acc[1];
+  msg->linear_acceleration.z = acc[2];
+  msg->angular_velocity.x = gyr[0];
+  msg->angular_velocity.y = gyr[1];
+  msg->angular_velocity.z = gyr[2];
+  pub_imu_.publish(msg);
+}
 
-  // Configuration call from the vive_tool
-  static void LighthouseCallback(struct Lighthouse *l) {
-    if (!l) return;
-    static hive::ViveCalibrationLighthouseArray msg;
-    // Check if the serial number exists, and if not, create a new record
-    std::vector<hive::ViveCalibrationLighthouse>::iterator it;
-    for (it = msg.lighthouses.begin(); it != msg.lighthouses.end(); it++)
-      if (!it->serial.compare(l->serial)) break;
-    if (it == msg.lighthouses.end())
-      it = msg.lighthouses.insert(msg.lighthouses.end(),
-        hive::ViveCalibrationLighthouse());
-    // Now modify the record
-    it->serial = l->serial;
-    it->id = l->id;
-    it->timestamp = ros::Time::now();
-    it->vertical.phase        = l->motors[MOTOR_AXIS_0].phase;
-    it->vertical.tilt         = l->motors[MOTOR_AXIS_0].tilt;
-    it->vertical.gibphase     = l->motors[MOTOR_AXIS_0].gibphase;
-    it->vertical.gibmag       = l->motors[MOTOR_AXIS_0].gibmag;
-    it->vertical.curve        = l->motors[MOTOR_AXIS_0].curve;
-    it->horizontal.phase      = l->motors[MOTOR_AXIS_1].phase;
-    it->horizontal.tilt       = l->motors[MOTOR_AXIS_1].tilt;
-    it->horizontal.gibphase   = l->motors[MOTOR_AXIS_1].gibphase;
-    it->horizontal.gibmag     = l->motors[MOTOR_AXIS_1].gibmag;
-    it->horizontal.curve      = l->motors[MOTOR_AXIS_1].curve;
-    // Republish the complete array with the new record
-    pub_lighthouses_.publish(msg);
+void HiveBridge::FlushImu(bool all) {
+  ros::Time now = ros::Time::now();
+  for (auto & tracker : trackers_) {
+    hive::ViveImuBatch::Ptr & batch = tracker.batch;
+    if (!batch) continue;
+    if (!all && batch->stamps.size() < imu_batch_ &&
+      (now - batch->stamps.front()).toSec() < imu_latency_) continue;
+    // Handed over to ROS, the next sample starts a new message
+    pub_imu_batch_.publish(batch);
+    batch.reset();
   }
+}
 
-  // Query for general vive data and convert to a ROS message
-  // static void GeneralCallback(struct General *g) {
-  //   if (!g) return;
-  //   static hive::ViveCalibrationGeneral msg;
-  //   msg.timebase_hz            = g->timebase_hz;
-  //   msg.timecenter_ticks       = g->timecenter_ticks;
-  //   msg.pulsedist_max_ticks    = g->pulsedist_max_ticks;
-  //   msg.pulselength_min_sync   = g->pulselength_min_sync;
-  //   msg.pulse_in_clear_time    = g->pulse_in_clear_time;
-  //   msg.pulse_max_for_sweep    = g->pulse_max_for_sweep;
-  //   msg.pulse_synctime_offset  = g->pulse_synctime_offset;
-  //   msg.pulse_synctime_slack   = g->pulse_synctime_slack;
-  //   // Republish
-  //   pub_general_.publish(msg);
-  // }
+// Callback to display light info
+void HiveBridge::LightCallback(struct Tracker * tracker,
+  struct Lighthouse * lighthouse, uint8_t axis, uint32_t synctime,
+  uint16_t num_sensors, uint16_t *sensors, uint32_t *sweeptimes,
+  uint32_t *angles, uint16_t *lengths) {
+  received_++;
+  // Only copy the raw data, the publisher thread does the rest
+  BridgeRecord * record = ring_->Claim();
+  if (record == NULL) {
+    overruns_++;
+    return;
+  }
+  record->type = BridgeRecord::LIGHT;
+  record->tracker = tracker;
+  record->lighthouse = lighthouse;
+  record->stamp = ros::Time::now();
+  record->timecode = synctime;
+  record->axis = axis;
+  record->num_sensors = std::min<uint16_t>(num_sensors, BRIDGE_SENSORS);
+  memcpy(record->sensors, sensors, record->num_sensors * sizeof(uint16_t));
+  memcpy(record->angles, angles, record->num_sensors * sizeof(uint32_t));
+  memcpy(record->lengths, lengths, record->num_sensors * sizeof(uint16_t));
+  ring_->Commit();
+}
 
- protected:
-  struct Driver *driver_;                     // Vive interface
-  std::thread thread_;                        // Thread
-  bool active_;                               // Active
+// Called back when new IMU data is available
+void HiveBridge::ImuCallback(struct Tracker * tracker, uint32_t timecode,
+  int16_t acc[3], int16_t gyr[3], int16_t mag[3]) {
+  received_++;
+  // Only copy the raw data, the publisher thread does the rest
+  BridgeRecord * record = ring_->Claim();
+  if (record == NULL) {
+    overruns_++;
+    return;
+  }
+  record->type = BridgeRecord::IMU;
+  record->tracker = tracker;
+  record->lighthouse = NULL;
+  record->stamp = ros::Time::now();
+  record->timecode = timecode;
+  memcpy(record->acc, acc, 3 * sizeof(int16_t));
+  memcpy(record->gyr, gyr, 3 * sizeof(int16_t));
+  ring_->Commit();
+}
 
- private:
-  static constexpr double GRAVITY = 9.80665;
-  static constexpr double GYRO_SCALE = 32.768;
-  static constexpr double ACC_SCALE = 4096.0;
-  static constexpr int MOTOR_AXIS_0 = 0;
-  static constexpr int MOTOR_AXIS_1 = 1;
-};
+// Configuration call from the vive_tool
+void HiveBridge::TrackerCallback(struct Tracker * t) {
+  if (!t) return;
+  // Contexts announce their devices from their own poll threads
+  std::lock_guard<std::mutex> lock(calibration_mutex_);
+  static hive::ViveCalibrationTrackerArray msg;
+  // The id of the tracker's light and imu messages
+  uint8_t id = Intern(tracker_serials_, t->serial);
+  if (id == BRIDGE_NO_ID) return;
+  // Check if the serial number exists, and if not, create a new record
+  std::vector<hive::ViveCalibrationTracker>::iterator it;
+  for (it = msg.trackers.begin(); it != msg.trackers.end(); it++)
+    if (!it->serial.compare(t->serial)) break;
+  if (it == msg.trackers.end())
+    it = msg.trackers.insert(msg.trackers.end(),
+      hive::ViveCalibrationTracker());
+  // Now modify the record
+  it->serial = t->serial;
+  it->id = id;
+  it->timestamp = ros::Time::now();
+  it->extrinsics.resize(t->cal.num_channels);
+  for (size_t i = 0; i < t->cal.num_channels; i++) {
+    it->extrinsics[i].id = t->cal.channels[i];
+    it->extrinsics[i].position =
+      array_to_ros_vector(t->cal.positions[i]);
+    it->extrinsics[i].normal =
+      array_to_ros_vector(t->cal.normals[i]);
+  }
+  it->acc_bias = array_to_ros_vector(t->cal.acc_bias);
+  it->acc_scale = array_to_ros_vector(t->cal.acc_scale);
+  it->gyr_bias = array_to_ros_vector(t->cal.gyr_bias);
+  it->gyr_scale = array_to_ros_vector(t->cal.gyr_scale);
+  // Set the default IMU transform
+  // Convert(&t->cal.imu_transform[0], it->imu_transform.rotation);
+  // Convert(&t->cal.imu_transform[4], it->imu_transform.translation);
+  // Set the default HEAD transform
+  // Convert(&t->cal.head_transform[0], it->head_transform.rotation);
+  // Convert(&t->cal.head_transform[4], it->head_transform.translation);
 
+  // Republish the complete array with the new record
+  pub_trackers_.publish(msg);
+}
 
-int main(int argc, char ** argv) {
-  ros::init(argc, argv, "bridge");
-  ros::NodeHandle nh;
-  HiveBridge bridge;
+// Configuration call from the vive_tool
+void HiveBridge::LighthouseCallback(struct Lighthouse *l) {
+  if (!l) return;
+  // Contexts announce their devices from their own poll threads
+  std::lock_guard<std::mutex> lock(calibration_mutex_);
+  static hive::ViveCalibrationLighthouseArray msg;
+  // The context's own index may name another lighthouse in another context
+  uint8_t id = Intern(lighthouse_serials_, l->serial);
+  if (id == BRIDGE_NO_ID) return;
+  // Check if the serial number exists, and if not, create a new record
+  std::vector<hive::ViveCalibrationLighthouse>::iterator it;
+  for (it = msg.lighthouses.begin(); it != msg.lighthouses.end(); it++)
+    if (!it->serial.compare(l->serial)) break;
+  if (it == msg.lighthouses.end())
+    it = msg.lighthouses.insert(msg.lighthouses.end(),
+      hive::ViveCalibrationLighthouse());
+  // Now modify the record
+  it->serial = l->serial;
+  it->id = id;
+  it->timestamp = ros::Time::now();
+  it->vertical.phase        = l->motors[MOTOR_AXIS_0].phase;
+  it->vertical.tilt         = l->motors[MOTOR_AXIS_0].tilt;
+  it->vertical.gibphase     = l->motors[MOTOR_AXIS_0].gibphase;
+  it->vertical.gibmag       = l->motors[MOTOR_AXIS_0].gibmag;
+  it->vertical.curve        = l->motors[MOTOR_AXIS_0].curve;
+  it->horizontal.phase      = l->motors[MOTOR_AXIS_1].phase;
+  it->horizontal.tilt       = l->motors[MOTOR_AXIS_1].tilt;
+  it->horizontal.gibphase   = l->motors[MOTOR_AXIS_1].gibphase;
+  it->horizontal.gibmag     = l->motors[MOTOR_AXIS_1].gibmag;
+  it->horizontal.curve      = l->motors[MOTOR_AXIS_1].curve;
+  // Republish the complete array with the new record
+  pub_lighthouses_.publish(msg);
+}
 
-  bridge.Initialize(&nh);
+// Query for general vive data and convert to a ROS message
+// static void GeneralCallback(struct General *g) {
+//   if (!g) return;
+//   static hive::ViveCalibrationGeneral msg;
+//   msg.timebase_hz            = g->timebase_hz;
+//   msg.timecenter_ticks       = g->timecenter_ticks;
+//   msg.pulsedist_max_ticks    = g->pulsedist_max_ticks;
+//   msg.pulselength_min_sync   = g->pulselength_min_sync;
+//   msg.pulse_in_clear_time    = g->pulse_in_clear_time;
+//   msg.pulse_max_for_sweep    = g->pulse_max_for_sweep;
+//   msg.pulse_synctime_offset  = g->pulse_synctime_offset;
+//   msg.pulse_synctime_slack   = g->pulse_synctime_slack;
+//   // Republish
+//   pub_general_.publish(msg);
+// }
 
-  ros::spin();
+// Bridge loaded into a nodelet manager
+namespace hive {
+class BridgeNodelet : public nodelet::Nodelet {
+ protected:
+  void onInit() {
+    bridge_.Initialize(&getNodeHandle(), &getPrivateNodeHandle());
+  }
 
-  return 0;
+ private:
+  HiveBridge bridge_;
+};
 }
+
+PLUGINLIB_EXPORT_CLASS(hive::BridgeNodelet, nodelet::Nodelet)
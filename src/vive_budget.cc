@@ -0,0 +1,85 @@
+#include <hive/vive_budget.h>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <algorithm>
+
+SolveBudget::SolveBudget() {
+  Reset();
+}
+
+void SolveBudget::Reset() {
+  last_ = ros::Time(0);
+  period_ = 0.0;
+  iterations_ = 0.0;
+  counters_.solves = 0;
+  counters_.overruns = 0;
+  counters_.truncated = 0;
+  counters_.worst = 0.0;
+  counters_.budget = BUDGET_MAX;
+  counters_.iterations = BUDGET_ITERATIONS_MAX;
+  return;
+}
+
+void SolveBudget::Tick(ros::Time const& stamp) {
+  double dt = (stamp - last_).toSec();
+  // Out of order, repeated or after an outage
+  if (last_.isZero() || dt <= 0.0 || dt > BUDGET_GAP) {
+    if (last_.isZero() || dt > 0.0) last_ = stamp;
+    return;
+  }
+  last_ = stamp;
+  if (period_ == 0.0)
+    period_ = dt;
+  else
+    period_ += BUDGET_ALPHA * (dt - period_);
+  return;
+}
+
+void SolveBudget::Start() {
+  start_ = std::chrono::steady_clock::now();
+  counters_.budget = Seconds();
+  counters_.iterations = Iterations();
+  return;
+}
+
+double SolveBudget::Seconds() const {
+  if (period_ == 0.0) return BUDGET_MAX;
+  return std::min(BUDGET_MAX, std::max(BUDGET_MIN, BUDGET_SHARE * period_));
+}
+
+size_t SolveBudget::Iterations() const {
+  if (iterations_ == 0.0) return BUDGET_ITERATIONS_MAX;
+  double limit = ceil(BUDGET_HEADROOM * iterations_);
+  return std::min<size_t>(BUDGET_ITERATIONS_MAX,
+    std::max<size_t>(BUDGET_ITERATIONS_MIN, limit));
+}
+
+double SolveBudget::Elapsed() const {
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start_).count();
+}
+
+bool SolveBudget::Stop(size_t iterations, bool converged) {
+  double elapsed = Elapsed();
+  counters_.solves++;
+  counters_.worst = std::max(counters_.worst, elapsed);
+  bool overrun = elapsed > counters_.budget;
+  if (overrun) counters_.overruns++;
+  if (!converged) counters_.truncated++;
+  // A solve cut short by the iteration limit needed at least that many,
+  // which raises the limit; one cut short by time says nothing
+  if (converged || iterations >= counters_.iterations) {
+    if (iterations_ == 0.0)
+      iterations_ = iterations;
+    else
+      iterations_ += BUDGET_ALPHA * (iterations - iterations_);
+  }
+  return overrun;
+}
+
+BudgetCounters SolveBudget::GetCounters() const {
+  return counters_;
+}
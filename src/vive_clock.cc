@@ -0,0 +1,83 @@
+#include <hive/vive_clock.h>
+
+ClockModel::ClockModel() {
+  Reset();
+}
+
+void ClockModel::Reset() {
+  started_ = false;
+  last_ticks_ = 0;
+  ticks_ = 0;
+  ticks0_ = 0;
+  x_ << 0.0, 1.0;
+  P_ = Eigen::Matrix2d::Identity();
+  spread_ = CLOCK_REJECT;
+  device_ = 0.0;
+  samples_ = 0;
+  outliers_ = 0;
+  rejected_ = 0;
+  return;
+}
+
+uint64_t ClockModel::Unwrap(uint32_t ticks) {
+  // Unsigned difference is right across one wrap
+  ticks_ += static_cast<uint32_t>(ticks - last_ticks_);
+  last_ticks_ = ticks;
+  return ticks_;
+}
+
+ros::Time ClockModel::Update(uint32_t ticks, ros::Time const& arrival) {
+  if (!started_) {
+    started_ = true;
+    last_ticks_ = ticks;
+    ticks_ = ticks0_ = ticks;
+    host0_ = arrival;
+  }
+  double device = (Unwrap(ticks) - ticks0_) / CLOCK_FREQUENCY;
+  double host = (arrival - host0_).toSec();
+  Eigen::Vector2d phi(1.0, device);
+  double residual = host - phi.dot(x_);
+  bool warm = samples_ >= CLOCK_WARMUP;
+
+  if (warm && fabs(residual) > CLOCK_REJECT) {
+    outliers_++;
+    // The device restarted or the host clock jumped
+    if (++rejected_ >= CLOCK_RESET) {
+      Reset();
+      return Update(ticks, arrival);
+    }
+    // A late arrival still has a good device time
+    if (fabs(residual) > CLOCK_JUMP) return arrival;
+    return host0_ + ros::Duration(phi.dot(x_));
+  }
+  rejected_ = 0;
+
+  // Huber weight, arrivals delayed by the bus count less
+  double weight = 1.0;
+  if (warm && fabs(residual) > CLOCK_HUBER * spread_)
+    weight = CLOCK_HUBER * spread_ / fabs(residual);
+  double lambda = 1.0 - 1.0 / CLOCK_WINDOW;
+  Eigen::Vector2d K = P_ * phi / (lambda / weight + phi.dot(P_ * phi));
+  x_ += K * residual;
+  P_ = (P_ - K * phi.transpose() * P_) / lambda;
+  // Spread of the residuals, floored so that weights stay finite
+  double alpha = warm ? 1.0 / CLOCK_WINDOW : 1.0 / (samples_ + 1);
+  spread_ = std::max((1.0 - alpha) * spread_ + alpha * fabs(residual), 1e-7);
+
+  device_ = device;
+  samples_++;
+  if (samples_ < CLOCK_WARMUP) return arrival;
+  return host0_ + ros::Duration(phi.dot(x_));
+}
+
+ClockFit ClockModel::GetFit() const {
+  ClockFit fit;
+  fit.offset = host0_.toSec() + x_(0) + (x_(1) - 1.0) * device_
+    - static_cast<double>(ticks0_) / CLOCK_FREQUENCY;
+  fit.drift = 1e6 * (x_(1) - 1.0);
+  fit.spread = spread_;
+  fit.samples = samples_;
+  fit.outliers = outliers_;
+  fit.valid = samples_ >= CLOCK_WARMUP;
+  return fit;
+}
@@ -0,0 +1,226 @@
+#include <hive/vive_cost.h>
+
+namespace cost {
+  // Skew symmetric matrix
+  inline Eigen::Matrix3d Skew(Eigen::Vector3d const& v) {
+    Eigen::Matrix3d S;
+    S << 0.0, -v(2), v(1),
+      v(2), 0.0, -v(0),
+      -v(1), v(0), 0.0;
+    return S;
+  }
+
+  void AngleAxisJacobian(const double * aa,
+    Eigen::Matrix3d * R,
+    Eigen::Matrix3d * J) {
+    Eigen::Vector3d a(aa[0], aa[1], aa[2]);
+    Eigen::Matrix3d K = Skew(a);
+    double theta2 = a.squaredNorm();
+    // Taylor expansion close to the identity
+    if (theta2 < 1e-12) {
+      if (R) *R = Eigen::Matrix3d::Identity() + K;
+      if (J) *J = Eigen::Matrix3d::Identity() + 0.5 * K + K * K / 6.0;
+      return;
+    }
+    double theta = sqrt(theta2);
+    if (R) *R = Eigen::AngleAxisd(theta, a / theta).toRotationMatrix();
+    if (J) *J = Eigen::Matrix3d::Identity()
+      + (1.0 - cos(theta)) / theta2 * K
+      + (theta - sin(theta)) / (theta2 * theta) * K * K;
+    return;
+  }
+
+  ViveLightCost::ViveLightCost(hive::ViveLight const& data,
+    CalibrationSnapshot::Ptr const& calibration,
+    std::string const& tracker,
+    PoseBlock pose_block,
+    bool correction,
+    int extra_blocks) : ViveLightCost(data,
+      calibration,
+      calibration->TrackerId(tracker),
+      calibration->LighthouseId(data.lighthouse),
+      pose_block,
+      correction,
+      extra_blocks) {
+    // Do nothing
+  }
+
+  ViveLightCost::ViveLightCost(hive::ViveLight const& data,
+    CalibrationSnapshot::Ptr const& calibration,
+    int tracker,
+    int lighthouse,
+    PoseBlock pose_block,
+    bool correction,
+    int extra_blocks) : calibration_(calibration) {
+    Setup(data.axis, tracker, lighthouse, data.samples.size(),
+      pose_block, correction, extra_blocks);
+    for (auto li_it = data.samples.begin();
+      li_it != data.samples.end(); li_it++)
+      AddSample(li_it->sensor, li_it->angle);
+    return;
+  }
+
+  ViveLightCost::ViveLightCost(LightFrame const& frame,
+    CalibrationSnapshot::Ptr const& calibration,
+    int tracker,
+    PoseBlock pose_block,
+    bool correction,
+    int extra_blocks) : calibration_(calibration) {
+    Setup(frame.axis, tracker, frame.lighthouse, frame.size,
+      pose_block, correction, extra_blocks);
+    for (size_t i = 0; i < frame.size; i++)
+      AddSample(frame.sensors[i], frame.angles[i]);
+    return;
+  }
+
+  void ViveLightCost::Setup(uint8_t axis,
+    int tracker,
+    int lighthouse,
+    size_t samples,
+    PoseBlock pose_block,
+    bool correction,
+    int extra_blocks) {
+    axis_ = axis;
+    pose_block_ = pose_block;
+    extra_blocks_ = extra_blocks;
+    correction_ = correction;
+    tracker_ = calibration_->GetTracker(tracker);
+    lighthouse_ = calibration_->GetLighthouse(lighthouse);
+    valid_ = (tracker_ != NULL && lighthouse_ != NULL
+      && (axis_ == HORIZONTAL || axis_ == VERTICAL)
+      && (lighthouse_->has_pose || (extra_blocks_ & LH_POSE)));
+    // Measurements
+    sensors_.reserve(samples);
+    angles_.reserve(samples);
+    // Ceres sizes
+    set_num_residuals(samples);
+    mutable_parameter_block_sizes()->push_back(pose_block_);
+    if (extra_blocks_ & LH_POSE)
+      mutable_parameter_block_sizes()->push_back(6);
+    if (extra_blocks_ & LH_MOTOR)
+      mutable_parameter_block_sizes()->push_back(5);
+    return;
+  }
+
+  void ViveLightCost::AddSample(uint8_t sensor, double angle) {
+    if (tracker_ == NULL || !tracker_->HasSensor(sensor)) {
+      valid_ = false;
+      return;
+    }
+    sensors_.push_back(sensor);
+    angles_.push_back(angle);
+    return;
+  }
+
+  ViveLightCost::~ViveLightCost() {
+    // Do nothing
+    return;
+  }
+
+  bool ViveLightCost::Evaluate(double const* const* parameters,
+    double * residuals,
+    double ** jacobians) const {
+    if (!valid_) return false;
+    // Parameter block indices
+    size_t lh_idx = 1;
+    size_t motor_idx = (extra_blocks_ & LH_POSE) ? 2 : 1;
+
+    // Pose of the tracker (or imu) in the vive frame
+    Eigen::Vector3d vPb(parameters[0][0],
+      parameters[0][1],
+      parameters[0][2]);
+    Eigen::Matrix3d vRb, vJb;
+    AngleAxisJacobian(&parameters[0][pose_block_ - 3], &vRb, &vJb);
+
+    // Pose of the lighthouse in the vive frame
+    Eigen::Vector3d vPl = lighthouse_->vPl;
+    Eigen::Matrix3d lRv = lighthouse_->lRv, vJl;
+    if (extra_blocks_ & LH_POSE) {
+      Eigen::Matrix3d vRl;
+      vPl = Eigen::Vector3d(parameters[lh_idx][0],
+        parameters[lh_idx][1],
+        parameters[lh_idx][2]);
+      AngleAxisJacobian(&parameters[lh_idx][3], &vRl, &vJl);
+      lRv = vRl.transpose();
+    }
+
+    // Motor parameters
+    MotorModel<double> motor = (extra_blocks_ & LH_MOTOR) ?
+      LighthouseModel::Scale(parameters[motor_idx]) :
+      lighthouse_->motors[axis_];
+
+    // Sensors in the frame of the pose block
+    Eigen::Vector3d const* points = (pose_block_ == POSE_IMU) ?
+      tracker_->iPs : tracker_->tPs;
+
+    for (size_t i = 0; i < sensors_.size(); i++) {
+      Eigen::Vector3d vPs = vRb * points[sensors_[i]];
+      Eigen::Vector3d lPs = lRv * (vPs + vPb - vPl);
+
+      double x = (lPs(0)/lPs(2)); // Horizontal angle
+      double y = (lPs(1)/lPs(2)); // Vertical angle
+      // Swept and orthogonal coordinates
+      double u = (axis_ == HORIZONTAL) ? x : y;
+      double w = (axis_ == HORIZONTAL) ? y : x;
+      double atan_u = atan(u);
+      residuals[i] = angles_[i] -
+        LighthouseModel::Correct(atan_u, w, motor, correction_);
+
+      if (jacobians == NULL) continue;
+
+      // Derivative of the residual w.r.t. the swept coordinates
+      double dr_du = - 1.0 / (1.0 + u * u);
+      double dr_dw = 0.0;
+      if (correction_) {
+        dr_du *= 1.0 - cos(motor.gib_phase + atan_u) * motor.gib_mag;
+        dr_dw = motor.tan_tilt + 2.0 * motor.curve * w;
+      }
+      // Derivative of the residual w.r.t. the sensor in the lighthouse frame
+      Eigen::RowVector3d dx(1.0 / lPs(2), 0.0, - x / lPs(2));
+      Eigen::RowVector3d dy(0.0, 1.0 / lPs(2), - y / lPs(2));
+      Eigen::RowVector3d dr_dlPs = (axis_ == HORIZONTAL) ?
+        Eigen::RowVector3d(dr_du * dx + dr_dw * dy) :
+        Eigen::RowVector3d(dr_du * dy + dr_dw * dx);
+      Eigen::RowVector3d dr_dvPs = dr_dlPs * lRv;
+
+      // Pose block
+      if (jacobians[0] != NULL) {
+        double * J = jacobians[0] + i * pose_block_;
+        Eigen::RowVector3d dr_dA = - dr_dvPs * Skew(vPs) * vJb;
+        for (size_t j = 0; j < 3; j++) {
+          J[j] = dr_dvPs(j);
+          J[pose_block_ - 3 + j] = dr_dA(j);
+        }
+        // Velocity is not observed by light
+        if (pose_block_ == POSE_IMU) {
+          J[3] = 0.0;
+          J[4] = 0.0;
+          J[5] = 0.0;
+        }
+      }
+      // Lighthouse pose block
+      if ((extra_blocks_ & LH_POSE) && jacobians[lh_idx] != NULL) {
+        double * J = jacobians[lh_idx] + i * 6;
+        Eigen::RowVector3d dr_dA = dr_dlPs * Skew(lPs) * vJl.transpose();
+        for (size_t j = 0; j < 3; j++) {
+          J[j] = - dr_dvPs(j);
+          J[3 + j] = dr_dA(j);
+        }
+      }
+      // Motor block
+      if ((extra_blocks_ & LH_MOTOR) && jacobians[motor_idx] != NULL) {
+        double * J = jacobians[motor_idx] + i * 5;
+        if (correction_) {
+          J[PHASE] = SCALE_PHASE;
+          J[TILT] = SCALE_TILT * w * (1.0 + motor.tan_tilt * motor.tan_tilt);
+          J[GIB_PHASE] = cos(motor.gib_phase + atan_u) * motor.gib_mag;
+          J[GIB_MAG] = SCALE_GIB * sin(motor.gib_phase + atan_u);
+          J[CURVE] = SCALE_CURVE * w * w;
+        } else {
+          for (size_t j = 0; j < 5; j++) J[j] = 0.0;
+        }
+      }
+    }
+    return true;
+  }
+} // namespace cost
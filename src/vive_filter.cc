@@ -43,7 +43,7 @@ namespace filter {
   }
 
   // Auxility matrix
-  Eigen::MatrixXd GetOmega(Eigen::Quaterniond Q) {
+  Eigen::Matrix<double, 4, 3> GetOmega(Eigen::Quaterniond const& Q) {
     Eigen::Matrix<double, 4, 3> Omega;
     Omega(0,0) = -Q.x();
     Omega(0,1) = -Q.y();
@@ -76,259 +76,87 @@ namespace filter {
     return slicedR;
   }
 
-  class ViveHorizontalCost
-  {
-  public:
-    // Constructor
-    ViveHorizontalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl, // vive to lighthouse
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveHorizontalCost();
-    // Ceres operator
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-    geometry_msgs::Transform vTl_;
-  };
-
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveVerticalCost
-  {
-  public:
-    // Constructor
-    ViveVerticalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl, // Vive to lighthouse
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveVerticalCost();
-    // Ceres operator
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-    geometry_msgs::Transform vTl_;
-  };
-
-  ViveHorizontalCost::ViveHorizontalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    vTl_ = vTl;
-    return;
-  }
-
-  ViveHorizontalCost::~ViveHorizontalCost() {
-    // Do nothing
-    return;
-  }
-
-  template <typename T>
-  bool ViveHorizontalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << T(vTl_.translation.x),
-      T(vTl_.translation.y),
-      T(vTl_.translation.z);
-    Eigen::Quaternion<T> vQl(
-      T(vTl_.rotation.w),
-      T(vTl_.rotation.x),
-      T(vTl_.rotation.y),
-      T(vTl_.rotation.z));
-    Eigen::Matrix<T, 3, 3> vRl;
-    vRl = vQl.toRotationMatrix();
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
+  // Scalar Kalman updates, one per row of H, for a diagonal R with
+  // entries r. The linearization point is kept, so without gating the
+  // result is the batch update. Samples whose squared normalized
+  // innovation exceeds gate are skipped. Returns the samples used.
+  size_t SequentialUpdate(MeasureJacobian const& H,
+    Eigen::VectorXd const& Y,
+    Eigen::VectorXd const& r,
+    double gate,
+    StateVector & dX,
+    StateMatrix & P) {
+    size_t used = 0;
+    StateVector PHt;
+    dX.setZero();
+    for (Eigen::Index i = 0; i < H.rows(); i++) {
+      PHt.noalias() = P * H.row(i).transpose();
+      double S = H.row(i).dot(PHt) + r(i);
+      if (S <= 0.0) continue;
+      // Innovation w.r.t. the samples already applied
+      double y = Y(i) - H.row(i).dot(dX);
+      if (y * y > gate * S) continue;
+      dX += (y / S) * PHt;
+      P.noalias() -= (PHt / S) * PHt.transpose();
+      used++;
     }
-    return true;
+    return used;
   }
 
-  ViveVerticalCost::ViveVerticalCost(hive::ViveLight data,
-    geometry_msgs::Transform vTl,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    vTl_ = vTl;
-    return;
+  // Mean and covariance weights of the sigma points. Returns the spread
+  // sqrt(L + lambda) for the augmented size L.
+  template <typename Vector>
+  double GetWeights(Vector & mean_weights, Vector & cov_weights) {
+    double L = static_cast<double>((mean_weights.size() - 1) / 2);
+    double lambda = ALPHA * ALPHA * (L + UKF_FACTOR) - L;
+    mean_weights.setConstant(1.0 / (2.0 * (L + lambda)));
+    cov_weights.setConstant(1.0 / (2.0 * (L + lambda)));
+    mean_weights(0) = lambda / (lambda + L);
+    cov_weights(0) = lambda / (lambda + L) + (1.0 - ALPHA * ALPHA + BETA);
+    return sqrt(L + lambda);
   }
 
-  ViveVerticalCost::~ViveVerticalCost() {
-    // Do nothing
+  // Lower triangular S with S S' = A' A, from the QR decomposition of A
+  template <typename Derived, typename Matrix>
+  void TriangularFactor(Eigen::MatrixBase<Derived> const& A, Matrix & S) {
+    Eigen::HouseholderQR<typename Derived::PlainObject> qr(A);
+    S = qr.matrixQR().topRows(A.cols()).template
+      triangularView<Eigen::Upper>().transpose();
+    // Positive diagonal, as a Cholesky factor
+    for (Eigen::Index k = 0; k < S.rows(); k++)
+      if (S(k,k) < 0.0) S.col(k) = -S.col(k);
     return;
   }
 
-  template <typename T>
-  bool ViveVerticalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << T(vTl_.translation.x),
-      T(vTl_.translation.y),
-      T(vTl_.translation.z);
-    Eigen::Quaternion<T> vQl(
-      T(vTl_.rotation.w),
-      T(vTl_.rotation.x),
-      T(vTl_.rotation.y),
-      T(vTl_.rotation.z));
-    Eigen::Matrix<T, 3, 3> vRl;
-    vRl = vQl.toRotationMatrix();
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
-
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
+  // Rank one update of a lower Cholesky factor, S S' + sign x x'. False
+  // if the downdated matrix is not positive definite.
+  template <typename Matrix>
+  bool CholeskyUpdate(Matrix & S,
+    Eigen::Matrix<double, Matrix::RowsAtCompileTime, 1> x,
+    double sign) {
+    for (Eigen::Index k = 0; k < S.rows(); k++) {
+      double r2 = S(k,k) * S(k,k) + sign * x(k) * x(k);
+      if (r2 <= 0.0 || S(k,k) <= 0.0) return false;
+      double r = sqrt(r2);
+      double c = r / S(k,k);
+      double sn = x(k) / S(k,k);
+      S(k,k) = r;
+      Eigen::Index n = S.rows() - k - 1;
+      S.col(k).tail(n) = (S.col(k).tail(n) + sign * sn * x.tail(n)) / c;
+      x.tail(n) = c * x.tail(n) - sn * S.col(k).tail(n);
     }
     return true;
   }
-
 }
 
-ViveFilter::ViveFilter() {}
+ViveFilter::ViveFilter() {
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
+}
 
 ViveFilter::ViveFilter(Tracker & tracker,
   std::map<std::string, Lighthouse> & lighthouses,
@@ -336,7 +164,8 @@ ViveFilter::ViveFilter(Tracker & tracker,
   double model_noise, // time update
   double measure_noise, // measurements
   bool correction,
-  filter::type ftype) {
+  filter::type ftype,
+  filter::update mode) {
   position_ = Eigen::Vector3d(0.0, 0.0, 1.0);
   rotation_ = Eigen::Quaterniond::Identity();
   velocity_ = Eigen::Vector3d::Zero();
@@ -347,12 +176,18 @@ ViveFilter::ViveFilter(Tracker & tracker,
   tracker_ = tracker;
   lighthouses_ = lighthouses;
   environment_ = environment;
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
   valid_ = false;
   initialized_ = false;
   correction_ = correction;
   outlier_counter_ = MAX_OUTLIERS;
-  model_covariance_ = model_noise *
-    Eigen::MatrixXd::Identity(NOISE_SIZE, NOISE_SIZE);
+  model_covariance_ = model_noise * filter::NoiseMatrix::Identity();
+  model_sqrt_ = sqrt(model_noise) * filter::NoiseMatrix::Identity();
   // measure_covariance_ - double the size for both sweeps. The
   // first half of the matrix is for the horizontal, the second half
   // of the matrix is for the vertical sweep
@@ -360,10 +195,11 @@ ViveFilter::ViveFilter(Tracker & tracker,
   //    [ 0 V ]
   measure_covariance_ = measure_noise * Eigen::MatrixXd::Identity(
     2*tracker_.sensors.size(), 2*tracker_.sensors.size());
-  covariance_ = Eigen::MatrixXd::Zero(STATE_SIZE, STATE_SIZE);
+  covariance_ = filter::StateMatrix::Zero();
+  sqrt_covariance_ = filter::StateMatrix::Zero();
   filter_type_ = ftype;
-  ext_covariance_ = Eigen::MatrixXd::Zero(STATE_SIZE + NOISE_SIZE,
-    STATE_SIZE + NOISE_SIZE);
+  update_mode_ = mode;
+  ext_covariance_ = filter::ExtendedMatrix::Zero();
   ext_covariance_.block<STATE_SIZE, STATE_SIZE>(0,0) = covariance_;
   ext_covariance_.block<NOISE_SIZE, NOISE_SIZE>(
     STATE_SIZE, STATE_SIZE) = model_covariance_;
@@ -376,7 +212,8 @@ ViveFilter::ViveFilter(Tracker & tracker,
   Eigen::MatrixXd model_noise, // time update
   Eigen::MatrixXd measure_noise, // measurements
   bool correction,
-  filter::type ftype) {
+  filter::type ftype,
+  filter::update mode) {
   position_ = Eigen::Vector3d(0.0, 0.0, 1.0);
   rotation_ = Eigen::Quaterniond::Identity();
   velocity_ = Eigen::Vector3d::Zero();
@@ -387,6 +224,12 @@ ViveFilter::ViveFilter(Tracker & tracker,
   tracker_ = tracker;
   lighthouses_ = lighthouses;
   environment_ = environment;
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
   valid_ = false;
   initialized_ = false;
   correction_ = correction;
@@ -394,6 +237,7 @@ ViveFilter::ViveFilter(Tracker & tracker,
   if (model_noise.cols() != NOISE_SIZE ||
     model_noise.rows() != NOISE_SIZE) throw;
   model_covariance_ = model_noise;
+  model_sqrt_ = Eigen::LLT<filter::NoiseMatrix>(model_covariance_).matrixL();
   // measure_covariance_ - double the size for both sweeps. The
   // first half of the matrix is for the horizontal, the second half
   // of the matrix is for the vertical sweep
@@ -402,14 +246,15 @@ ViveFilter::ViveFilter(Tracker & tracker,
   if (measure_noise.cols() != 2*tracker_.sensors.size() ||
     measure_noise.rows() != 2*tracker_.sensors.size()) throw;
   measure_covariance_ = measure_noise;
-  covariance_ = Eigen::MatrixXd::Zero(STATE_SIZE, STATE_SIZE);
+  covariance_ = filter::StateMatrix::Zero();
+  sqrt_covariance_ = filter::StateMatrix::Zero();
   // UKF's extended covariance.
-  ext_covariance_ = Eigen::MatrixXd::Zero(STATE_SIZE + NOISE_SIZE,
-    STATE_SIZE + NOISE_SIZE);
+  ext_covariance_ = filter::ExtendedMatrix::Zero();
   ext_covariance_.block<STATE_SIZE, STATE_SIZE>(0,0) = covariance_;
   ext_covariance_.block<NOISE_SIZE, NOISE_SIZE>(
     STATE_SIZE, STATE_SIZE) = model_covariance_;
   filter_type_ = ftype;
+  update_mode_ = mode;
   return;
 }
 
@@ -428,6 +273,9 @@ bool ViveFilter::Initialize() {
   pose[6] = 0.0;
   pose[7] = 0.0;
   pose[8] = 0.0;
+  // Closed form guess from the sweeps, refined below
+  pnp::Initialize(light_data_, *calibration_, tracker_id_,
+    cost::POSE_IMU, correction_, pose);
 
 
   ceres::Problem problem;
@@ -435,50 +283,39 @@ bool ViveFilter::Initialize() {
   ceres::Solver::Summary summary;
   double light_samples = 0;
 
-  for (auto sample : light_data_) {
-    geometry_msgs::Transform lhTF;
-    lhTF.translation.x = environment_.lighthouses[sample.lighthouse].translation.x;
-    lhTF.translation.y = environment_.lighthouses[sample.lighthouse].translation.y;
-    lhTF.translation.z = environment_.lighthouses[sample.lighthouse].translation.z;
-    lhTF.rotation.w = environment_.lighthouses[sample.lighthouse].rotation.w;
-    lhTF.rotation.x = environment_.lighthouses[sample.lighthouse].rotation.x;
-    lhTF.rotation.y = environment_.lighthouses[sample.lighthouse].rotation.y;
-    lhTF.rotation.z = environment_.lighthouses[sample.lighthouse].rotation.z;
+  for (size_t i = 0; i < light_data_.Size(); i++) {
+    LightFrame const& sample = light_data_[i];
     // Horizontal
     if (sample.axis == HORIZONTAL) {
       // Horizontal data
-      ceres::DynamicAutoDiffCostFunction<filter::ViveHorizontalCost, 4> * hcost =
-        new ceres::DynamicAutoDiffCostFunction<filter::ViveHorizontalCost, 4>
-        (new filter::ViveHorizontalCost(sample,
-          lhTF,
-          tracker_,
-          lighthouses_[sample.lighthouse].horizontal_motor,
-          correction_));
-      hcost->AddParameterBlock(9);
-      hcost->SetNumResiduals(sample.samples.size());
+      ceres::CostFunction * hcost = new cost::ViveLightCost(sample,
+        calibration_,
+        tracker_id_,
+        cost::POSE_IMU,
+        correction_);
       problem.AddResidualBlock(hcost, NULL, pose);
     }
     // Vertical
     if (sample.axis == VERTICAL) {
       // Vertical data
-      ceres::DynamicAutoDiffCostFunction<filter::ViveVerticalCost, 4> * vcost =
-        new ceres::DynamicAutoDiffCostFunction<filter::ViveVerticalCost, 4>
-        (new filter::ViveVerticalCost(sample,
-          lhTF,
-          tracker_,
-          lighthouses_[sample.lighthouse].vertical_motor,
-          correction_));
-      vcost->AddParameterBlock(9);
-      vcost->SetNumResiduals(sample.samples.size());
+      ceres::CostFunction * vcost = new cost::ViveLightCost(sample,
+        calibration_,
+        tracker_id_,
+        cost::POSE_IMU,
+        correction_);
       problem.AddResidualBlock(vcost, NULL, pose);
     }
-    light_samples += sample.samples.size();
+    light_samples += sample.size;
   }
 
   options.minimizer_progress_to_stdout = false;
-  options.max_num_iterations = 1000;
-  options.max_solver_time_in_seconds = 0.5;
+  budget_.Start();
+  options.max_num_iterations = budget_.Iterations();
+  options.max_solver_time_in_seconds = budget_.Seconds();
   ceres::Solve(options, &problem, &summary);
+  budget_.Stop(summary.num_successful_steps
+    + summary.num_unsuccessful_steps,
+    summary.termination_type == ceres::CONVERGENCE);
 
   if (summary.final_cost > 1e-5 * light_samples) return false;
 
@@ -496,31 +333,47 @@ bool ViveFilter::Initialize() {
   gravity_ = Eigen::Vector3d(environment_.gravity.x,
     environment_.gravity.y,
     environment_.gravity.z);
-  covariance_ = HIVE_APE_ACC * Eigen::MatrixXd::Identity(STATE_SIZE, STATE_SIZE);
+  covariance_ = HIVE_APE_ACC * filter::StateMatrix::Identity();
+  sqrt_covariance_ = sqrt(HIVE_APE_ACC) * filter::StateMatrix::Identity();
   // UKF's extended covariance.
-  ext_covariance_ = Eigen::MatrixXd::Zero(STATE_SIZE + NOISE_SIZE,
-    STATE_SIZE + NOISE_SIZE);
+  ext_covariance_ = filter::ExtendedMatrix::Zero();
   ext_covariance_.block<STATE_SIZE, STATE_SIZE>(0,0) = covariance_;
   ext_covariance_.block<NOISE_SIZE, NOISE_SIZE>(
     STATE_SIZE, STATE_SIZE) = model_covariance_;
   // Change this
-  time_ = light_data_.back().header.stamp;
+  time_ = light_data_.Back().stamp;
   return true;
 }
 
 void ViveFilter::ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) {
   if (msg == NULL) return;
   // if (!valid_) return;
+  Predict(*msg);
+  return;
+}
+
+void ViveFilter::ProcessImu(const hive::ViveImuBatch::ConstPtr& msg) {
+  if (msg == NULL) return;
+  // One message reused for all the samples
+  sensor_msgs::Imu imu;
+  for (size_t i = 0; i < msg->stamps.size(); i++) {
+    ViveUtils::ConvertImu(*msg, i, &imu);
+    Predict(imu);
+  }
+  return;
+}
 
+void ViveFilter::Predict(const sensor_msgs::Imu & msg) {
   switch(filter_type_) {
     case filter::ekf:
-      PredictEKF(*msg);
+      PredictEKF(msg);
       break;
     case filter::iekf:
-      PredictIEKF(*msg);
+      PredictIEKF(msg);
       break;
     case filter::ukf:
-      PredictUKF(*msg);
+    case filter::srukf:
+      PredictUKF(msg);
       break;
     default:
       std::cout << "Method not available\n";
@@ -550,34 +403,47 @@ void ViveFilter::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
 
   // std::cout << "NEW " << msg->lighthouse << " - " << (int)msg->axis << std::endl;
 
-  hive::ViveLight * clone_msg = new hive::ViveLight(*msg);
-  // Erase outliers
-  auto sample_it = clone_msg->samples.begin();
-    while (sample_it != clone_msg->samples.end()) {
-    if (sample_it->angle > -M_PI/3.0 && sample_it->angle < M_PI / 3.0) {
-      sample_it++;
-    } else {
-      clone_msg->samples.erase(sample_it);
-    }
-  }
-  if (clone_msg->samples.size() == 0) {
+  // Save the samples inside the field of view
+  LightFrame frame;
+  if (!frame.Set(*msg, calibration_->LighthouseId(msg->lighthouse)))
     return;
-  }
-  // Save the copy
-  light_data_.push_back(*clone_msg);
+  ProcessFrame(frame);
+  return;
+}
+
+void ViveFilter::ProcessLight(const hive::ViveLightRaw::ConstPtr& msg) {
+  if (msg == NULL) return;
+
+  // Same, indexed by the lighthouse id of the message
+  LightFrame frame;
+  if (!frame.Set(*msg, calibration_->RawLighthouseId(msg->lighthouse)))
+    return;
+  ProcessFrame(frame);
+  return;
+}
 
-  while (abs(light_data_.back().header.stamp.toNSec() -
-    light_data_.front().header.stamp.toNSec()) > 40e6) {
-    light_data_.erase(light_data_.begin());
+void ViveFilter::ProcessFrame(LightFrame & frame) {
+  budget_.Tick(frame.stamp);
+  // Reflections are left out of the update as well
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(frame.lighthouse);
+  if (tracker != NULL && lighthouse != NULL)
+    ransac_.Filter(&frame, light_data_, *tracker, *lighthouse, correction_);
+  light_data_.Push(frame.stamp) = frame;
+
+  while (abs(light_data_.Back().stamp.toNSec() -
+    light_data_.Front().stamp.toNSec()) > 40e6) {
+    light_data_.PopFront();
   }
   // while (light_data_.size() > LIGHT_DATA_BUFFER) {
   //   light_data_.erase(light_data_.begin());
   // }
-  if (light_data_.size() <= 1) {
+  if (light_data_.Size() <= 1) {
     initialized_ = false;
   }
 
-  if (!initialized_ && light_data_.size() >= LIGHT_DATA_BUFFER) {
+  if (!initialized_ && light_data_.Size() >= LIGHT_DATA_BUFFER) {
   // Solve rapidly
     Initialize();
   }
@@ -586,13 +452,14 @@ void ViveFilter::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
     // Update estimate
     switch (filter_type_) {
       case filter::ekf:
-        UpdateEKF(*msg);
+        UpdateEKF(frame);
         break;
       case filter::iekf:
-        UpdateIEKF(*msg);
+        UpdateIEKF(frame);
         break;
       case filter::ukf:
-        UpdateUKF(*msg);
+      case filter::srukf:
+        UpdateUKF(frame);
         break;
       default:
         std::cout << "Method not available\n";
@@ -620,9 +487,27 @@ void ViveFilter::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
     lastmsgwasimu_ = false;
   }
 
+  // Copy of the counters for other threads
+  std::lock_guard<std::mutex> lock(mutex_);
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
   return;
 }
 
+bool ViveFilter::GetBudget(BudgetCounters * counters) {
+  if (counters == NULL) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  *counters = counters_;
+  return true;
+}
+
+bool ViveFilter::GetInliers(InlierCounters * counters) {
+  if (counters == NULL) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  *counters = inliers_;
+  return true;
+}
+
 bool ViveFilter::GetTransform(geometry_msgs::TransformStamped& msg) {
   if (!valid_ || used_) return false;
 
@@ -662,10 +547,10 @@ bool ViveFilter::GetTransform(geometry_msgs::TransformStamped& msg) {
 }
 
 // Derivative of the Vive's inertial model
-Eigen::MatrixXd GetF(Eigen::Quaterniond rotation,
-  Eigen::Vector3d linear_acceleration,
-  Eigen::Vector3d angular_velocity,
-  Eigen::Vector3d bias) {
+filter::StateMatrix GetF(Eigen::Quaterniond const& rotation,
+  Eigen::Vector3d const& linear_acceleration,
+  Eigen::Vector3d const& angular_velocity,
+  Eigen::Vector3d const& bias) {
 
   double vQt_w = rotation.w();
   double vQt_x = rotation.x();
@@ -684,28 +569,13 @@ Eigen::MatrixXd GetF(Eigen::Quaterniond rotation,
   double tB_y = bias(1);
   double tB_z = bias(2);
 
-  // Set matrix
-  Eigen::MatrixXd F(STATE_SIZE, STATE_SIZE);
-  F.block<3,3>(0,0) = Eigen::Matrix3d::Zero();
+  // Set matrix. Only dp/dv, dv/dq, dv/dg, dq/dq and dq/db are non zero,
+  // MultiplyF relies on this structure.
+  filter::StateMatrix F = filter::StateMatrix::Zero();
   F.block<3,3>(0,3) = Eigen::Matrix3d::Identity();
-  F.block<3,4>(0,6) = Eigen::MatrixXd::Zero(3,4);
-  F.block<3,3>(0,10) = Eigen::MatrixXd::Zero(3,3);
-  F.block<3,3>(3,0) = Eigen::MatrixXd::Zero(3,3);
-  F.block<3,3>(3,3) = Eigen::MatrixXd::Zero(3,3);
-  F.block<3,3>(3,10) = Eigen::MatrixXd::Zero(3,3);
-  F.block<4,3>(6,0) = Eigen::MatrixXd::Zero(4,3);
-  F.block<4,3>(6,3) = Eigen::MatrixXd::Zero(4,3);
   F.block<4,3>(6,10) = -0.5 * filter::GetOmega(rotation);
-  F.block<3,3>(10,0) = Eigen::MatrixXd::Zero(3,3);
-  F.block<3,3>(10,3) = Eigen::MatrixXd::Zero(3,3);
-  F.block<3,4>(10,6) = Eigen::MatrixXd::Zero(3,4);
-  F.block<3,3>(10,10) = Eigen::MatrixXd::Zero(3,3);
   // g
-  F.block<3,3>(0,13) = Eigen::MatrixXd::Zero(3,3);
-  F.block<3,3>(3,13) = Eigen::MatrixXd::Identity(3,3);
-  F.block<10,3>(6,13) = Eigen::MatrixXd::Zero(10,3);
-  F.block<7,3>(6,13) = Eigen::MatrixXd::Zero(7,3);
-  F.block<3,16>(13,0) = Eigen::MatrixXd::Zero(3,16);
+  F.block<3,3>(3,13) = Eigen::Matrix3d::Identity();
 
   // TODO check this over here
   // new d\dot{V}/d_qw
@@ -750,14 +620,13 @@ Eigen::MatrixXd GetF(Eigen::Quaterniond rotation,
 }
 
 // Derivative of the measurement model - Horizontal measures
-Eigen::MatrixXd GetHorizontalH(Eigen::Vector3d translation,
-  Eigen::Quaterniond rotation,
-  std::vector<int> sensors,
-  Tracker tracker,
-  Transform lhTransform,
-  Lighthouse lhSpecs,
+filter::MeasureJacobian GetHorizontalH(Eigen::Vector3d const& translation,
+  Eigen::Quaterniond const& rotation,
+  std::vector<int> const& sensors,
+  TrackerSnapshot const& tracker,
+  LighthouseModel const& lighthouse,
   bool correction) {
-  Eigen::MatrixXd H(sensors.size(), STATE_SIZE);
+  filter::MeasureJacobian H(sensors.size(), STATE_SIZE);
   // Position of the tracker in the vive frame
   double vPt_x = translation(0);
   double vPt_y = translation(1);
@@ -767,14 +636,9 @@ Eigen::MatrixXd GetHorizontalH(Eigen::Vector3d translation,
   double vQt_x = rotation.x();
   double vQt_y = rotation.y();
   double vQt_z = rotation.z();
-  // Get transform from light frame to imu frame
-  Eigen::Vector3d light_P_imu = filter::ConvertMessage(
-    tracker.imu_transform.translation);
-  Eigen::Quaterniond light_Q_imu = filter::ConvertMessage(
-    tracker.imu_transform.rotation);
-  Eigen::Vector3d imu_P_light =
-    - light_Q_imu.toRotationMatrix().transpose() * light_P_imu;
-  Eigen::Matrix3d imu_R_light = light_Q_imu.toRotationMatrix().transpose();
+  // Transform from the tracker's light frame to the imu frame
+  Eigen::Matrix3d imu_R_light = tracker.tRi.transpose();
+  Eigen::Vector3d imu_P_light = - imu_R_light * tracker.tPi;
   // Position of the tracker's light frame in the IMU frame (default)
   double tPtl_x = imu_P_light(0);
   double tPtl_y = imu_P_light(1);
@@ -789,14 +653,12 @@ Eigen::MatrixXd GetHorizontalH(Eigen::Vector3d translation,
   double tRtl_31 = imu_R_light(2,0);
   double tRtl_32 = imu_R_light(2,1);
   double tRtl_33 = imu_R_light(2,2);
-  // Convert lighthouse orientation
-  Eigen::Matrix3d vRl = filter::ConvertMessage(
-    lhTransform.rotation).toRotationMatrix();
   // Position of the lighthouse in vive
-  double vPl_x = lhTransform.translation.x;
-  double vPl_y = lhTransform.translation.y;
-  double vPl_z = lhTransform.translation.z;
+  double vPl_x = lighthouse.vPl(0);
+  double vPl_y = lighthouse.vPl(1);
+  double vPl_z = lighthouse.vPl(2);
   // Orientation of the lighthouse in vive
+  Eigen::Matrix3d const& vRl = lighthouse.vRl;
   double vRl_11 = vRl(0,0);
   double vRl_12 = vRl(0,1);
   double vRl_13 = vRl(0,2);
@@ -806,21 +668,14 @@ Eigen::MatrixXd GetHorizontalH(Eigen::Vector3d translation,
   double vRl_31 = vRl(2,0);
   double vRl_32 = vRl(2,1);
   double vRl_33 = vRl(2,2);
-  // Lighthouse parameters
-  double phase = SCALE_PHASE * lhSpecs.horizontal_motor.phase;
-  double tilt = SCALE_TILT * lhSpecs.horizontal_motor.tilt;
-  double curve = SCALE_CURVE * lhSpecs.horizontal_motor.curve;
-  double gib_mag = SCALE_GIB * lhSpecs.horizontal_motor.gib_magnitude;
-  double gib_phase = lhSpecs.horizontal_motor.gib_phase;
+  // Lighthouse parameters (already scaled)
+  MotorModel<double> const& motor = lighthouse.motors[HORIZONTAL];
 
   size_t row = 0;
   // Iterate over all photodiodes
   for (auto sensor : sensors) {
     // Position of the photodiode in the tracker's light frame
-    double tlPs_x = tracker.sensors[sensor].position.x;
-    double tlPs_y = tracker.sensors[sensor].position.y;
-    double tlPs_z = tracker.sensors[sensor].position.z;
-
+    Eigen::Vector3d const& tlPs = tracker.tPs[sensor];
     H.block<1,STATE_SIZE>(row,0) = HorizontalMeasureModelDiff(vPt_x, vPt_y, vPt_z,
       vQt_w, vQt_x, vQt_y, vQt_z,
       tPtl_x, tPtl_y, tPtl_z,
@@ -831,8 +686,8 @@ Eigen::MatrixXd GetHorizontalH(Eigen::Vector3d translation,
       vRl_11, vRl_12, vRl_13,
       vRl_21, vRl_22, vRl_23,
       vRl_31, vRl_32, vRl_33,
-      tlPs_x, tlPs_y, tlPs_z,
-      phase, tilt, gib_phase, gib_mag, curve,
+      tlPs(0), tlPs(1), tlPs(2),
+      motor.phase, motor.tilt, motor.gib_phase, motor.gib_mag, motor.curve,
       correction);
 
     // row
@@ -842,14 +697,13 @@ Eigen::MatrixXd GetHorizontalH(Eigen::Vector3d translation,
 }
 
 // Derivative of the measurement model - Vertical measures
-Eigen::MatrixXd GetVerticalH(Eigen::Vector3d translation,
-  Eigen::Quaterniond rotation,
-  std::vector<int> sensors,
-  Tracker tracker,
-  Transform lhTransform,
-  Lighthouse lhSpecs,
+filter::MeasureJacobian GetVerticalH(Eigen::Vector3d const& translation,
+  Eigen::Quaterniond const& rotation,
+  std::vector<int> const& sensors,
+  TrackerSnapshot const& tracker,
+  LighthouseModel const& lighthouse,
   bool correction) {
-  Eigen::MatrixXd H = Eigen::MatrixXd(sensors.size(), STATE_SIZE);
+  filter::MeasureJacobian H(sensors.size(), STATE_SIZE);
   // Position of the tracker in the vive frame
   double vPt_x = translation(0);
   double vPt_y = translation(1);
@@ -859,14 +713,9 @@ Eigen::MatrixXd GetVerticalH(Eigen::Vector3d translation,
   double vQt_x = rotation.x();
   double vQt_y = rotation.y();
   double vQt_z = rotation.z();
-  // Get transform from light frame to imu frame
-  Eigen::Vector3d light_P_imu = filter::ConvertMessage(
-    tracker.imu_transform.translation);
-  Eigen::Quaterniond light_Q_imu = filter::ConvertMessage(
-    tracker.imu_transform.rotation);
-  Eigen::Vector3d imu_P_light =
-    - light_Q_imu.toRotationMatrix().transpose() * light_P_imu;
-  Eigen::Matrix3d imu_R_light = light_Q_imu.toRotationMatrix().transpose();
+  // Transform from the tracker's light frame to the imu frame
+  Eigen::Matrix3d imu_R_light = tracker.tRi.transpose();
+  Eigen::Vector3d imu_P_light = - imu_R_light * tracker.tPi;
   // Position of the tracker's light frame in the IMU frame (default)
   double tPtl_x = imu_P_light(0);
   double tPtl_y = imu_P_light(1);
@@ -881,14 +730,12 @@ Eigen::MatrixXd GetVerticalH(Eigen::Vector3d translation,
   double tRtl_31 = imu_R_light(2,0);
   double tRtl_32 = imu_R_light(2,1);
   double tRtl_33 = imu_R_light(2,2);
-  // Convert lighthouse orientation
-  Eigen::Matrix3d vRl = filter::ConvertMessage(
-    lhTransform.rotation).toRotationMatrix();
   // Position of the lighthouse in vive
-  double vPl_x = lhTransform.translation.x;
-  double vPl_y = lhTransform.translation.y;
-  double vPl_z = lhTransform.translation.z;
+  double vPl_x = lighthouse.vPl(0);
+  double vPl_y = lighthouse.vPl(1);
+  double vPl_z = lighthouse.vPl(2);
   // Orientation of the lighthouse in vive
+  Eigen::Matrix3d const& vRl = lighthouse.vRl;
   double vRl_11 = vRl(0,0);
   double vRl_12 = vRl(0,1);
   double vRl_13 = vRl(0,2);
@@ -898,20 +745,14 @@ Eigen::MatrixXd GetVerticalH(Eigen::Vector3d translation,
   double vRl_31 = vRl(2,0);
   double vRl_32 = vRl(2,1);
   double vRl_33 = vRl(2,2);
-  // Lighthouse parameters
-  double phase = SCALE_PHASE * lhSpecs.vertical_motor.phase;
-  double tilt = SCALE_TILT * lhSpecs.vertical_motor.tilt;
-  double curve = SCALE_CURVE * lhSpecs.vertical_motor.curve;
-  double gib_mag = SCALE_GIB * lhSpecs.vertical_motor.gib_magnitude;
-  double gib_phase = lhSpecs.vertical_motor.gib_phase;
+  // Lighthouse parameters (already scaled)
+  MotorModel<double> const& motor = lighthouse.motors[VERTICAL];
 
   size_t row = 0;
   // Iterate over all photodiodes
   for (auto sensor : sensors) {
     // Position of the photodiode in the tracker's light frame
-    double tlPs_x = tracker.sensors[sensor].position.x;
-    double tlPs_y = tracker.sensors[sensor].position.y;
-    double tlPs_z = tracker.sensors[sensor].position.z;
+    Eigen::Vector3d const& tlPs = tracker.tPs[sensor];
     H.block<1,STATE_SIZE>(row,0) = VerticalMeasureModelDiff(vPt_x, vPt_y, vPt_z,
       vQt_w, vQt_x, vQt_y, vQt_z,
       tPtl_x, tPtl_y, tPtl_z,
@@ -922,8 +763,8 @@ Eigen::MatrixXd GetVerticalH(Eigen::Vector3d translation,
       vRl_11, vRl_12, vRl_13,
       vRl_21, vRl_22, vRl_23,
       vRl_31, vRl_32, vRl_33,
-      tlPs_x, tlPs_y, tlPs_z,
-      phase, tilt, gib_phase, gib_mag, curve,
+      tlPs(0), tlPs(1), tlPs(2),
+      motor.phase, motor.tilt, motor.gib_phase, motor.gib_mag, motor.curve,
       correction);
 
     // row
@@ -932,64 +773,64 @@ Eigen::MatrixXd GetVerticalH(Eigen::Vector3d translation,
   return H;
 }
 
-Eigen::MatrixXd GetG(Eigen::Quaterniond rotation) {
-  Eigen::MatrixXd G = Eigen::MatrixXd(STATE_SIZE, NOISE_SIZE);
-  // np
-  // G.block<3,3>(0,0) = Eigen::MatrixXd::Identity(3,3);
-  // G.block<3,3>(3,0) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<4,3>(6,0) = Eigen::MatrixXd::Zero(4,3);
-  // G.block<3,3>(10,0) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(13,0) = Eigen::MatrixXd::Zero(3,3);
-  // // na
-  // G.block<3,3>(0,3) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(3,3) = rotation.toRotationMatrix();
-  // G.block<4,3>(6,3) = Eigen::MatrixXd::Zero(4,3);
-  // G.block<3,3>(10,3) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(13,3) = Eigen::MatrixXd::Zero(3,3);
-  // // nw
-  // G.block<3,3>(0,6) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(3,6) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<4,3>(6,6) = filter::GetOmega(rotation);
-  // G.block<3,3>(10,6) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(13,6) = Eigen::MatrixXd::Zero(3,3);
-  // // nbw
-  // G.block<3,3>(0,9) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(3,9) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<4,3>(6,9) = Eigen::MatrixXd::Zero(4,3);
-  // G.block<3,3>(10,9) = Eigen::MatrixXd::Identity(3,3);
-  // G.block<3,3>(13,9) = Eigen::MatrixXd::Zero(3,3);
-  // // ng
-  // G.block<3,3>(0,12) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(3,12) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<4,3>(6,12) = Eigen::MatrixXd::Zero(4,3);
-  // G.block<3,3>(10,12) = Eigen::MatrixXd::Zero(3,3);
-  // G.block<3,3>(13,12) = Eigen::MatrixXd::Identity(3,3);
-  // Old
-  G.block<3,9>(0,0) = Eigen::MatrixXd::Zero(3,9);
-  G.block<3,3>(3,0) = Eigen::MatrixXd::Zero(3,3);
-  G.block<3,3>(3,3) = rotation.toRotationMatrix();
-  G.block<4,3>(6,0) = filter::GetOmega(rotation);
-  G.block<4,3>(6,3) = Eigen::MatrixXd::Zero(4,3);
-  G.block<7,3>(3,6) = Eigen::MatrixXd::Zero(7,3);
-  G.block<3,6>(10,0) = Eigen::MatrixXd::Zero(3,6);
-  G.block<3,3>(10,6) = Eigen::MatrixXd::Identity(3,3);
-  // g
-  G.block<13,3>(0,9) = Eigen::MatrixXd::Zero(13,3);
-  G.block<3,9>(13,0) = Eigen::MatrixXd::Zero(3,9);
-  G.block<3,3>(13,9) = Eigen::MatrixXd::Identity(3,3);
-  return G;
+// F * M without the blocks of GetF that are always zero
+void MultiplyF(filter::StateMatrix const& F,
+  filter::StateMatrix const& M,
+  filter::StateMatrix & FM) {
+  // dp/dv is the identity
+  FM.block<3,STATE_SIZE>(0,0) = M.block<3,STATE_SIZE>(3,0);
+  // dv/dq and dv/dg (identity)
+  FM.block<3,STATE_SIZE>(3,0).noalias() =
+    F.block<3,4>(3,6) * M.block<4,STATE_SIZE>(6,0);
+  FM.block<3,STATE_SIZE>(3,0) += M.block<3,STATE_SIZE>(13,0);
+  // dq/dq and dq/db
+  FM.block<4,STATE_SIZE>(6,0).noalias() =
+    F.block<4,4>(6,6) * M.block<4,STATE_SIZE>(6,0);
+  FM.block<4,STATE_SIZE>(6,0).noalias() +=
+    F.block<4,3>(6,10) * M.block<3,STATE_SIZE>(10,0);
+  // Bias and gravity are constant
+  FM.block<6,STATE_SIZE>(10,0).setZero();
+  return;
+}
+
+// P += scale * G * Q * G' with the noise Jacobian
+//    [ 0     0  0  0 ]  p
+//    [ 0   vRi  0  0 ]  v
+//    [ Omega 0  0  0 ]  q
+//    [ 0     0  I  0 ]  bias
+//    [ 0     0  0  I ]  gravity
+void AddProcessNoise(Eigen::Matrix3d const& vRi,
+  Eigen::Matrix<double, 4, 3> const& Omega,
+  filter::NoiseMatrix const& Q,
+  double scale,
+  filter::StateMatrix & P) {
+  // G * Q
+  Eigen::Matrix<double, STATE_SIZE, NOISE_SIZE> GQ;
+  GQ.block<3,NOISE_SIZE>(0,0).setZero();
+  GQ.block<3,NOISE_SIZE>(3,0).noalias() = vRi * Q.block<3,NOISE_SIZE>(3,0);
+  GQ.block<4,NOISE_SIZE>(6,0).noalias() = Omega * Q.block<3,NOISE_SIZE>(0,0);
+  GQ.block<3,NOISE_SIZE>(10,0) = Q.block<3,NOISE_SIZE>(6,0);
+  GQ.block<3,NOISE_SIZE>(13,0) = Q.block<3,NOISE_SIZE>(9,0);
+  // (G * Q) * G'
+  P.block<STATE_SIZE,3>(0,3).noalias() +=
+    scale * GQ.block<STATE_SIZE,3>(0,3) * vRi.transpose();
+  P.block<STATE_SIZE,4>(0,6).noalias() +=
+    scale * GQ.block<STATE_SIZE,3>(0,0) * Omega.transpose();
+  P.block<STATE_SIZE,3>(0,10) += scale * GQ.block<STATE_SIZE,3>(0,6);
+  P.block<STATE_SIZE,3>(0,13) += scale * GQ.block<STATE_SIZE,3>(0,9);
+  return;
 }
 
 // Vector that represents the evolution of the system is continuous time
-Eigen::VectorXd GetDState(Eigen::Vector3d velocity,
-  Eigen::Quaterniond rotation,
-  Eigen::Vector3d linear_acceleration,
-  Eigen::Vector3d angular_velocity,
-  Eigen::Vector3d gravity,
-  Eigen::Vector3d acc_bias,
-  Eigen::Vector3d ang_bias,
+filter::StateVector GetDState(Eigen::Vector3d const& velocity,
+  Eigen::Quaterniond const& rotation,
+  Eigen::Vector3d const& linear_acceleration,
+  Eigen::Vector3d const& angular_velocity,
+  Eigen::Vector3d const& gravity,
+  Eigen::Vector3d const& acc_bias,
+  Eigen::Vector3d const& ang_bias,
   double sample_time) {
-  Eigen::VectorXd dotX(STATE_SIZE);
+  filter::StateVector dotX;
   // Position
   dotX.segment<3>(0) = sample_time * velocity + 0.5 * sample_time * sample_time *
     (-rotation.toRotationMatrix() * (linear_acceleration - acc_bias) + gravity);
@@ -997,62 +838,34 @@ Eigen::VectorXd GetDState(Eigen::Vector3d velocity,
   dotX.segment<3>(3) = sample_time * (
     - rotation.toRotationMatrix() * (linear_acceleration - acc_bias) + gravity);
   // Orientation
-  Eigen::MatrixXd Omega = filter::GetOmega(rotation);
+  Eigen::Matrix<double, 4, 3> Omega = filter::GetOmega(rotation);
   dotX.segment<4>(6) = sample_time * 0.5 * (Omega * (angular_velocity - ang_bias));
   // biases
-  dotX.segment<3>(10) = Eigen::VectorXd::Zero(3);
-  dotX.segment<3>(13) = Eigen::VectorXd::Zero(3);
+  dotX.segment<3>(10).setZero();
+  dotX.segment<3>(13).setZero();
   return dotX;
 }
 
 // Vector that represents the horizontal predicted measurements according to the
 // system's state
-Eigen::MatrixXd GetHorizontalZ(Eigen::Vector3d position,
-  Eigen::Quaterniond rotation,
-  std::vector<int> sensors,
-  Tracker tracker,
-  Transform lhTransform,
-  Lighthouse lhSpecs,
+Eigen::MatrixXd GetHorizontalZ(Eigen::Vector3d const& position,
+  Eigen::Quaterniond const& rotation,
+  std::vector<int> const& sensors,
+  TrackerSnapshot const& tracker,
+  LighthouseModel const& lighthouse,
   bool correction) {
   // Declaring measurements vector
   Eigen::VectorXd Z = Eigen::VectorXd(sensors.size());
 
-  // Data conversion
-  Eigen::Vector3d vPt = position;
-  Eigen::Matrix3d vRt = rotation.toRotationMatrix();
-  Eigen::Vector3d vPl = filter::ConvertMessage(lhTransform.translation);
-  Eigen::Matrix3d vRl = filter::ConvertMessage(lhTransform.rotation).toRotationMatrix();
-  Eigen::Vector3d lPv = - vRl.transpose() * vPl;
-  Eigen::Matrix3d lRv = vRl.transpose();
-  // lightPimu - transform the imu frame to the light frame
-  Eigen::Vector3d tlPt = filter::ConvertMessage(
-    tracker.imu_transform.translation);
-  // lightRimu - transform the imu frame to the light frame
-  Eigen::Matrix3d tlRt = filter::ConvertMessage(
-    tracker.imu_transform.rotation).toRotationMatrix();
-  // conversion from tlTt to tTtl
-  Eigen::Vector3d tPtl = - tlRt.transpose() * tlPt;
-  Eigen::Matrix3d tRtl = tlRt.transpose();
-  // Lighthouse parameters
-  double phase = SCALE_PHASE * lhSpecs.horizontal_motor.phase;
-  double tilt = SCALE_TILT * lhSpecs.horizontal_motor.tilt;
-  double curve = SCALE_CURVE * lhSpecs.horizontal_motor.curve;
-  double gib_mag = SCALE_GIB * lhSpecs.horizontal_motor.gib_magnitude;
-  double gib_phase = lhSpecs.horizontal_motor.gib_phase;
+  // Pose of the imu in the lighthouse frame
+  Eigen::Matrix3d lRi = lighthouse.lRv * rotation.toRotationMatrix();
+  Eigen::Vector3d lPi = lighthouse.lRv * (position - lighthouse.vPl);
 
   size_t row = 0;
   for (auto sensor : sensors) {
-    Eigen::Vector3d tlPs = filter::ConvertMessage(tracker.sensors[sensor].position);
-    Eigen::Vector3d lPs = lRv * ( vRt * (tRtl * tlPs + tPtl) + vPt ) + lPv;
-
-    double x = (lPs(0)/lPs(2));
-    double y = (lPs(1)/lPs(2));
-
-    if (correction) {
-      Z(row) = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-    } else {
-      Z(row) = atan(x);
-    }
+    Eigen::Vector3d lPs = lRi * tracker.iPs[sensor] + lPi;
+    Z(row) = LighthouseModel::ProjectHorizontal(lPs.data(),
+      lighthouse.motors[HORIZONTAL], correction);
     row++;
   }
   return Z;
@@ -1060,63 +873,24 @@ Eigen::MatrixXd GetHorizontalZ(Eigen::Vector3d position,
 
 // Vector that represents the vertical predicted measurements according to the
 // system's state
-Eigen::MatrixXd GetVerticalZ(Eigen::Vector3d position,
-  Eigen::Quaterniond rotation,
-  std::vector<int> sensors,
-  Tracker tracker,
-  Transform lhTransform,
-  Lighthouse lhSpecs,
+Eigen::MatrixXd GetVerticalZ(Eigen::Vector3d const& position,
+  Eigen::Quaterniond const& rotation,
+  std::vector<int> const& sensors,
+  TrackerSnapshot const& tracker,
+  LighthouseModel const& lighthouse,
   bool correction) {
   // Declaring measurements vector
   Eigen::VectorXd Z = Eigen::VectorXd(sensors.size());
 
-  // Data conversion
-  Eigen::Vector3d vPi = position;
-  Eigen::Matrix3d vRi = rotation.toRotationMatrix();
-  Eigen::Vector3d vPl = filter::ConvertMessage(lhTransform.translation);
-  Eigen::Matrix3d vRl = filter::ConvertMessage(lhTransform.rotation).toRotationMatrix();
-  Eigen::Vector3d lPv = - vRl.transpose() * vPl;
-  Eigen::Matrix3d lRv = vRl.transpose();
-  // lightPimu - transform the imu frame to the light frame
-  Eigen::Vector3d tPi = filter::ConvertMessage(
-    tracker.imu_transform.translation);
-  // lightRimu - transform the imu frame to the light frame
-  Eigen::Matrix3d tRi = filter::ConvertMessage(
-    tracker.imu_transform.rotation).toRotationMatrix();
-  // conversion from tlTt to tTtl
-  Eigen::Vector3d tPt = - tRi.transpose() * tPi;
-  Eigen::Matrix3d tRt = tRi.transpose();
-  // Lighthouse parameters
-  double phase = SCALE_PHASE * lhSpecs.vertical_motor.phase;
-  double tilt = SCALE_TILT * lhSpecs.vertical_motor.tilt;
-  double curve = SCALE_CURVE * lhSpecs.vertical_motor.curve;
-  double gib_mag = SCALE_GIB * lhSpecs.vertical_motor.gib_magnitude;
-  double gib_phase = lhSpecs.vertical_motor.gib_phase;
+  // Pose of the imu in the lighthouse frame
+  Eigen::Matrix3d lRi = lighthouse.lRv * rotation.toRotationMatrix();
+  Eigen::Vector3d lPi = lighthouse.lRv * (position - lighthouse.vPl);
 
   size_t row = 0;
   for (auto sensor : sensors) {
-    Eigen::Vector3d tPs = filter::ConvertMessage(tracker.sensors[sensor].position);
-    Eigen::Vector3d lPs = lRv * ( vRi * (tRt * tPs + tPt) + vPi ) + lPv;
-
-    // std::cout << "lPs " << sensor << ": " << lPs(0) << ", " << lPs(1) << ", " << lPs(2) << std::endl;
-
-    double x = (lPs(0)/lPs(2));
-    double y = (lPs(1)/lPs(2));
-
-    // std::cout << "x: " << x << std::endl;
-    // std::cout << "y: " << y << std::endl;
-
-    // std::cout << "phase: " << phase << std::endl;
-    // std::cout << "tilt: " << tilt << std::endl;
-    // std::cout << "curve: " << curve << std::endl;
-    // std::cout << "gib_phase: " << gib_phase << std::endl;
-    // std::cout << "gib_mag: " << gib_mag << std::endl;
-    if (correction) {
-      Z(row) = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      // std::cout << "Z: " << Z(row) << std::endl;
-    } else {
-      Z(row) = atan(y);
-    }
+    Eigen::Vector3d lPs = lRi * tracker.iPs[sensor] + lPi;
+    Z(row) = LighthouseModel::ProjectVertical(lPs.data(),
+      lighthouse.motors[VERTICAL], correction);
     row++;
   }
   return Z;
@@ -1140,150 +914,39 @@ bool ViveFilter::Valid(double cost_factor) {
 
   if (covariance_.trace() == 0) return false;
 
-  if (light_data_.size() < 2) return false;
+  if (light_data_.Size() < 2) return false;
 
   // Pose of the imu in the vive frame
   Eigen::Vector3d vPi = position_;
   Eigen::Matrix3d vRi = rotation_.toRotationMatrix();
   // std::cout << "vPi: " << vPi.transpose() << std::endl;
   // std::cout << "vRi: " << vRi << std::endl;
-  // Pose of the imu in the light frame
-  Eigen::Vector3d tPi(tracker_.imu_transform.translation.x,
-    tracker_.imu_transform.translation.y,
-    tracker_.imu_transform.translation.z);
-  Eigen::Matrix3d tRi = Eigen::Quaterniond(tracker_.imu_transform.rotation.w,
-    tracker_.imu_transform.rotation.x,
-    tracker_.imu_transform.rotation.y,
-    tracker_.imu_transform.rotation.z).toRotationMatrix();
-  // std::cout << "tPi: " << tPi.transpose() << std::endl;
-  // std::cout << "tRi: " << tRi << std::endl;
+  // Compiled calibration of the tracker
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  if (tracker == NULL) return false;
 
   double cost = 0;
   double light_counter = 0;
-  for (auto light_msg : light_data_) {
-    // Pose of the lighthouse in the vive frame
-    Eigen::Vector3d vPl(
-      environment_.lighthouses[light_msg.lighthouse].translation.x,
-      environment_.lighthouses[light_msg.lighthouse].translation.y,
-      environment_.lighthouses[light_msg.lighthouse].translation.z);
-    Eigen::Matrix3d vRl = Eigen::Quaterniond(
-      environment_.lighthouses[light_msg.lighthouse].rotation.w,
-      environment_.lighthouses[light_msg.lighthouse].rotation.x,
-      environment_.lighthouses[light_msg.lighthouse].rotation.y,
-      environment_.lighthouses[light_msg.lighthouse].rotation.z).toRotationMatrix();
-    // Pose of the light frame in the lighthouse frame
-    Eigen::Vector3d lPt = vRl.transpose() * (
-      vRi * ( - tRi.transpose() * tPi) + vPi) + (- vRl.transpose() * vPl);
-    Eigen::Matrix3d lRt = vRl.transpose() * vRi * tRi.transpose();
-  // std::cout << "lPt: " << lPt.transpose() << std::endl;
-  // std::cout << "lRt: " << lRt << std::endl;
-
-    // Mahalanobis distance
-    // USed sensors
-    std::vector<int> sensors;
-    // Measured Angle
-    std::vector<double> msAngle;
-    // Predicted Angle
-    std::vector<double> prAngle;
-
-    for (auto sample : light_msg.samples) {
+  for (size_t i = 0; i < light_data_.Size(); i++) {
+    LightFrame const& light_msg = light_data_[i];
+    LighthouseModel const* lighthouse =
+      calibration_->GetLighthouse(light_msg.lighthouse);
+    if (lighthouse == NULL || !lighthouse->has_pose) continue;
+    if (light_msg.axis != HORIZONTAL && light_msg.axis != VERTICAL) continue;
+
+    // Squared angle error, accumulated in place to keep the IMU path free
+    // of allocations. A Mahalanobis cost would also need H and R.
+    for (size_t j = 0; j < light_msg.size; j++) {
       // Check for outliers
       // if (sample.angle > M_PI / 3 || sample.angle < - M_PI / 3) continue;
-      // Sensor in the light frame
-      Eigen::Vector3d tPs(tracker_.sensors[sample.sensor].position.x,
-        tracker_.sensors[sample.sensor].position.y,
-        tracker_.sensors[sample.sensor].position.z);
-      // Sensor in lighthouse frame
-      Eigen::Vector3d lPs = lRt * tPs + lPt;
-      // Horizontal Angle
-      if (light_msg.axis == HORIZONTAL) {
-        // Angles
-        double ang;
-        double x = (lPs(0)/lPs(2)); // Horizontal angle
-        double y = (lPs(1)/lPs(2)); // Vertical angle
-        double phase =  SCALE_PHASE * lighthouses_[light_msg.lighthouse].horizontal_motor.phase;
-        double tilt = SCALE_TILT * lighthouses_[light_msg.lighthouse].horizontal_motor.tilt;
-        double curve = SCALE_CURVE * lighthouses_[light_msg.lighthouse].horizontal_motor.curve;
-        double gib_mag = SCALE_GIB * lighthouses_[light_msg.lighthouse].horizontal_motor.gib_magnitude;
-        double gib_phase = lighthouses_[light_msg.lighthouse].horizontal_motor.gib_phase;
-        // Correction
-        if (correction_) {
-          ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-        } else {
-          ang = atan(x);
-        }
-        // Adding to cost
-        msAngle.push_back(sample.angle);
-        prAngle.push_back(ang);
-        sensors.push_back(sample.sensor);
-      // Vertical Angle
-      } else if (light_msg.axis == VERTICAL) {
-        // Angles
-        double ang;
-        double x = (lPs(0)/lPs(2)); // Horizontal angle
-        double y = (lPs(1)/lPs(2)); // Vertical angle
-        double phase = SCALE_PHASE *  lighthouses_[light_msg.lighthouse].vertical_motor.phase;
-        double tilt = SCALE_TILT * lighthouses_[light_msg.lighthouse].vertical_motor.tilt;
-        double curve = SCALE_CURVE * lighthouses_[light_msg.lighthouse].vertical_motor.curve;
-        double gib_mag = SCALE_GIB * lighthouses_[light_msg.lighthouse].vertical_motor.gib_magnitude;
-        double gib_phase = lighthouses_[light_msg.lighthouse].vertical_motor.gib_phase;
-        // Correction
-        if (correction_) {
-          ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-        } else {
-          ang = atan(y);
-        }
-        // Adding to cost
-        msAngle.push_back(sample.angle);
-        prAngle.push_back(ang);
-        sensors.push_back(sample.sensor);
-      }
-    }
-    Eigen::MatrixXd H;
-    Eigen::MatrixXd R;
-    Eigen::VectorXd msEigenAngle(msAngle.size());
-    Eigen::VectorXd prEigenAngle(prAngle.size());
-    for (size_t i = 0; i < msAngle.size(); i++)
-      msEigenAngle(i) = msAngle[i];
-    for (size_t i = 0; i < prAngle.size(); i++)
-      prEigenAngle(i) = prAngle[i];
-    int total_sensors = tracker_.sensors.size();
-    if (light_msg.axis == HORIZONTAL) {
-      // Derivative of measurement model
-      H = GetHorizontalH(position_, rotation_, sensors,
-        tracker_, environment_.lighthouses[light_msg.lighthouse],
-        lighthouses_[light_msg.lighthouse], correction_);
-      // Sliced measurement covariance matrix
-      R = filter::SliceR(measure_covariance_.block(total_sensors * HORIZONTAL,
-        total_sensors * HORIZONTAL, total_sensors, total_sensors), sensors);
-    } else {
-      // Derivative of measurement model
-      H = GetVerticalH(position_, rotation_, sensors,
-        tracker_, environment_.lighthouses[light_msg.lighthouse],
-        lighthouses_[light_msg.lighthouse], correction_);
-      // Sliced measurement covariance matrix
-      R = filter::SliceR(measure_covariance_.block(total_sensors * VERTICAL,
-        total_sensors * VERTICAL, total_sensors, total_sensors), sensors);
+      if (!tracker->HasSensor(light_msg.sensors[j])) continue;
+      // Sensor in the vive frame
+      Eigen::Vector3d vPs = vRi * tracker->iPs[light_msg.sensors[j]] + vPi;
+      double error = light_msg.angles[j] -
+        lighthouse->Project(light_msg.axis, vPs, correction_);
+      cost += error * error;
+      light_counter++;
     }
-    // Mahalanobis cost right here
-    // Eigen::MatrixXd V = R + H * covariance_ * H.transpose();
-    // std::cout << "R: " << R << std::endl;
-    // std::cout << "Cov: " << covariance_ << std::endl;
-    // std::cout << "H: " << H << std::endl;
-    // std::cout << "V: " << V << std::endl;
-    // Temporary
-    // V = Eigen::MatrixXd::Identity(V.rows(), V.cols());
-    // cost += (msEigenAngle  - prEigenAngle).transpose() * V.inverse() * (msEigenAngle - prEigenAngle);
-    cost += (msEigenAngle - prEigenAngle).transpose() * (msEigenAngle - prEigenAngle);
-    // std::cout << "singleCost: " << 
-    //   (msEigenAngle - prEigenAngle).transpose() * (msEigenAngle - prEigenAngle) << std::endl;
-    light_counter += msAngle.size();
-    // std::cout << "V^-1: " << V.inverse() << std::endl;
-    // std::cout << "Cost: " << (msEigenAngle - prEigenAngle).transpose() * (msEigenAngle - prEigenAngle) << std::endl;
-    // std::cout << "msEigenAngle: " << msEigenAngle.transpose() << std::endl;
-    // std::cout << "prEigenAngle: " << prEigenAngle.transpose() << std::endl;
-    // std::cout << light_msg.lighthouse << " - " << (int)light_msg.axis << std::endl;
-    // std::cout << "thisCost: " << (msEigenAngle - prEigenAngle).transpose() * V.inverse() * (msEigenAngle - prEigenAngle) << std::endl;
   }
 
   // std::cout << light_data_.back().header.stamp << 
@@ -1323,7 +986,7 @@ bool ViveFilter::PredictEKF(const sensor_msgs::Imu & msg) {
     tracker_.acc_bias.y,
     tracker_.acc_bias.z);
   // Derivative of the state in time
-  Eigen::VectorXd dState = GetDState(velocity_,
+  filter::StateVector dState = GetDState(velocity_,
     rotation_,
     linear_acceleration,
     angular_velocity,
@@ -1336,7 +999,7 @@ bool ViveFilter::PredictEKF(const sensor_msgs::Imu & msg) {
   // std::cout << "mG: " << (rotation_.toRotationMatrix() * linear_acceleration).transpose() << std::endl;
   // std::cout << "dState: " << dState.transpose() << std::endl;
   // Old state
-  Eigen::VectorXd oldX(STATE_SIZE);
+  filter::StateVector oldX;
   oldX.segment<3>(0) = position_;
   oldX.segment<3>(3) = velocity_;
   oldX.segment<4>(6) = Eigen::Vector4d(
@@ -1348,28 +1011,27 @@ bool ViveFilter::PredictEKF(const sensor_msgs::Imu & msg) {
   oldX.segment<3>(13) = gravity_;
 
   // Covariance update
-  Eigen::MatrixXd oldP = covariance_;
-  Eigen::MatrixXd F = GetF(rotation_,
+  // P = (I + dT F) P (I + dT F)' + dT^2 G Q G', with the sparse F and G
+  filter::StateMatrix oldP = covariance_;
+  filter::StateMatrix F = GetF(rotation_,
     linear_acceleration,
     angular_velocity,
     bias_);
-  Eigen::MatrixXd G = GetG(rotation_);
-  Eigen::MatrixXd Q = model_covariance_;
-  Eigen::MatrixXd I = Eigen::MatrixXd::Identity(STATE_SIZE,
-    STATE_SIZE);
-  Eigen::MatrixXd Pnoise = Eigen::MatrixXd::Zero(STATE_SIZE,
-    STATE_SIZE);
-  // Pnoise(0,0) = 1e-2;
-  // Pnoise(1,1) = 1e-2;
-  // Pnoise(2,2) = 1e-2;
-  // Pnoise(3,3) = 1e-2;
-  // Pnoise(4,4) = 1e-2;
-  // Pnoise(5,5) = 1e-2;
-  Eigen::MatrixXd newP = (I + dT * F) *
-    oldP * (I + dT * F).transpose() + (dT * dT) * (G * Q * G.transpose()) + Pnoise;
+  filter::StateMatrix FP, FPhiP;
+  // Phi * P
+  MultiplyF(F, oldP, FP);
+  filter::StateMatrix PhiP = oldP + dT * FP;
+  // (Phi * P) * Phi'
+  MultiplyF(F, PhiP.transpose(), FPhiP);
+  filter::StateMatrix newP = PhiP + dT * FPhiP.transpose();
+  AddProcessNoise(rotation_.toRotationMatrix(),
+    filter::GetOmega(rotation_),
+    model_covariance_,
+    dT * dT,
+    newP);
 
   // New state
-  Eigen::VectorXd newX = oldX + dState;
+  filter::StateVector newX = oldX + dState;
   // std::cout << "oldX: " << oldX.transpose() << std::endl;
   // std::cout << "dT * dState: " << dT * dState.transpose() << std::endl;
   // std::cout << "newX: " << newX.transpose() << std::endl;
@@ -1423,10 +1085,24 @@ bool ViveFilter::PredictEKF(const sensor_msgs::Imu & msg) {
 }
 
 // Measure upate (Light data)
-bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
+bool ViveFilter::UpdateEKF(LightFrame const& frame) {
   // std::cout << "Update" << std::endl;
   // Search for outliers
-  hive::ViveLight clean_msg = msg;
+  LightFrame clean_msg = frame;
+  // Compiled calibration of the observation
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(clean_msg.lighthouse);
+  if (tracker == NULL || lighthouse == NULL || !lighthouse->has_pose)
+    return false;
+  // Samples of sensors that are not part of the tracker
+  clean_msg.size = 0;
+  for (size_t i = 0; i < frame.size; i++) {
+    if (!tracker->HasSensor(frame.sensors[i])) continue;
+    clean_msg.sensors[clean_msg.size] = frame.sensors[i];
+    clean_msg.angles[clean_msg.size] = frame.angles[i];
+    clean_msg.size++;
+  }
   // auto msg_it = clean_msg.samples.begin();
   // while (msg_it != clean_msg.samples.end()) {
   //   if (msg_it->angle > M_PI / 3 || msg_it->angle < -M_PI / 3)
@@ -1437,23 +1113,27 @@ bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
   // if (clean_msg.samples.size() == 0) return false;
 
   size_t row = 0;
-  Eigen::VectorXd Z(clean_msg.samples.size());
+  Eigen::VectorXd Z(clean_msg.size);
   Eigen::VectorXd pZ;
   std::vector<int> sensors;
-  for (auto sample : clean_msg.samples) {
+  for (size_t i = 0; i < clean_msg.size; i++) {
     // Put angle in Vector
-    Z(row, 0) = sample.angle;
+    Z(row, 0) = clean_msg.angles[i];
     row++;
     // For later usage
-    sensors.push_back(sample.sensor);
+    sensors.push_back(clean_msg.sensors[i]);
     // std::cout << sample.sensor << " - "
     //   << tracker_.sensors[sample.sensor].position.x << " "
     //   << tracker_.sensors[sample.sensor].position.y << " "
     //   << tracker_.sensors[sample.sensor].position.z << std::endl;
   }
   // EKF update
-  Eigen::MatrixXd H, R, K, oldP, newP;
-  Eigen::VectorXd oldX = Eigen::VectorXd(STATE_SIZE), newX, Y;
+  filter::MeasureJacobian H;
+  filter::GainMatrix K;
+  Eigen::MatrixXd R;
+  filter::StateMatrix oldP, newP;
+  filter::StateVector oldX, newX;
+  Eigen::VectorXd Y;
   oldX.segment<3>(0) = position_;
   oldX.segment<3>(3) = velocity_;
   oldX.segment<4>(6) = Eigen::Vector4d(
@@ -1490,12 +1170,10 @@ bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
     //   << "curve: " << lighthouses_[clean_msg.lighthouse].horizontal_motor.curve << "\n";
     // Derivative of measurement model
     H = GetHorizontalH(position_, rotation_, sensors,
-      tracker_, environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_);
+      *tracker, *lighthouse, correction_);
     // Difference between prediction and real measures
     pZ = GetHorizontalZ(position_, rotation_, sensors,
-      tracker_, environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_);
+      *tracker, *lighthouse, correction_);
     Y = Z - pZ;
     // Sliced measurement covariance matrix
     R = filter::SliceR(measure_covariance_.block(total_sensors * HORIZONTAL,
@@ -1523,12 +1201,10 @@ bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
     //   << "curve: " << lighthouses_[clean_msg.lighthouse].vertical_motor.curve << "\n";
     // Derivative of measurement model
     H = GetVerticalH(position_, rotation_, sensors,
-      tracker_, environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_);
+      *tracker, *lighthouse, correction_);
     // Difference between prediction and real measures
     pZ = GetVerticalZ(position_, rotation_, sensors,
-      tracker_, environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_);
+      *tracker, *lighthouse, correction_);
     Y = Z - pZ;
     // Sliced measurement covariance matrix
     R = filter::SliceR(measure_covariance_.block(total_sensors * VERTICAL,
@@ -1540,8 +1216,18 @@ bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
   // Eigen::MatrixXd AUX = 1e-6 * Eigen::MatrixXd::Identity(STATE_SIZE, STATE_SIZE);
   // K = AUX * H.transpose() * (H * AUX * H.transpose() + R).inverse();
   // R = Eigen::MatrixXd::Identity(R.rows(), R.cols());
-  K = oldP * H.transpose() * (H * oldP * H.transpose() + R).inverse();
-  newX = oldX + K * Y;
+  if (update_mode_ == filter::sequential && R.isDiagonal(0.0)) {
+    // One sample at a time, no inverse
+    filter::StateVector dX;
+    newP = oldP;
+    if (filter::SequentialUpdate(H, Y, R.diagonal(), INNOVATION_GATE,
+      dX, newP) == 0) return false;
+    newX = oldX + dX;
+  } else {
+    K = oldP * H.transpose() * (H * oldP * H.transpose() + R).inverse();
+    newX = oldX + K * Y;
+    newP = (filter::StateMatrix::Identity() - K * H) * oldP;
+  }
   // std::cout << "oldP:\n" << oldP << std::endl;
   // std::cout << "H:\n" << H << std::endl;
   // std::cout << "Z: " << (Z).transpose() << std::endl;
@@ -1550,7 +1236,6 @@ bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
   // std::cout << "K*Y: " << (K*Y).transpose() << std::endl;
   // std::cout << "oldX: " << oldX.transpose() << std::endl;
   // std::cout << "newX: " << newX.transpose() << std::endl;
-  newP = (Eigen::MatrixXd::Identity(STATE_SIZE, STATE_SIZE) - K * H) * oldP;
   // std::cout << "newP " << newP << std::endl;
 
   // Save new state
@@ -1621,15 +1306,29 @@ bool ViveFilter::UpdateEKF(const hive::ViveLight & msg) {
   }
 
 
-  time_ = clean_msg.header.stamp;
+  time_ = clean_msg.stamp;
   return true;
 }
 
-bool ViveFilter::UpdateIEKF(const hive::ViveLight & msg) {
+bool ViveFilter::UpdateIEKF(LightFrame const& frame) {
   int total_sensors = tracker_.sensors.size();
 
   // Search for outliers
-  hive::ViveLight clean_msg = msg;
+  LightFrame clean_msg = frame;
+  // Compiled calibration of the observation
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(clean_msg.lighthouse);
+  if (tracker == NULL || lighthouse == NULL || !lighthouse->has_pose)
+    return false;
+  // Samples of sensors that are not part of the tracker
+  clean_msg.size = 0;
+  for (size_t i = 0; i < frame.size; i++) {
+    if (!tracker->HasSensor(frame.sensors[i])) continue;
+    clean_msg.sensors[clean_msg.size] = frame.sensors[i];
+    clean_msg.angles[clean_msg.size] = frame.angles[i];
+    clean_msg.size++;
+  }
   // auto sample_it = clean_msg.samples.begin();
   // while (sample_it != clean_msg.samples.end()) {
   //   if (sample_it->angle > M_PI / 3 || sample_it->angle < -M_PI / 3)
@@ -1640,19 +1339,23 @@ bool ViveFilter::UpdateIEKF(const hive::ViveLight & msg) {
   // if (clean_msg.samples.size() == 0) return false;
 
   size_t row = 0;
-  Eigen::VectorXd Z(clean_msg.samples.size());
+  Eigen::VectorXd Z(clean_msg.size);
   std::vector<int> sensors;
-  for (auto sample : clean_msg.samples) {
+  for (size_t i = 0; i < clean_msg.size; i++) {
     // Put angle in Vector
-    Z(row, 0) = sample.angle;
+    Z(row, 0) = clean_msg.angles[i];
     row++;
     // For later usage
-    sensors.push_back(sample.sensor);
+    sensors.push_back(clean_msg.sensors[i]);
   }
 
   // EKF update
-  Eigen::MatrixXd H, R, K, oldP, newP;
-  Eigen::VectorXd oldX = Eigen::VectorXd(STATE_SIZE), newX, Y;
+  filter::MeasureJacobian H;
+  filter::GainMatrix K;
+  Eigen::MatrixXd R;
+  filter::StateMatrix oldP, newP;
+  filter::StateVector oldX, newX;
+  Eigen::VectorXd Y;
   oldX.segment<3>(0) = position_;
   oldX.segment<3>(3) = velocity_;
   oldX.segment<4>(6) = Eigen::Vector4d(
@@ -1662,29 +1365,32 @@ bool ViveFilter::UpdateIEKF(const hive::ViveLight & msg) {
     rotation_.z());
   oldX.segment<3>(10) = bias_;
   oldX.segment<3>(13) = gravity_;
-  Eigen::VectorXd next_tmpX = oldX;
-  Eigen::VectorXd prev_tmpX = oldX;
-  oldP = Eigen::MatrixXd(covariance_);
+  filter::StateVector next_tmpX = oldX;
+  filter::StateVector prev_tmpX = oldX;
+  oldP = covariance_;
 
   // Choose the model according to the orientation
   if (clean_msg.axis == HORIZONTAL) {
     // Difference between prediction and real measures
     Y = Z - GetHorizontalZ(position_, rotation_, sensors,
-      tracker_, environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_);
+      *tracker, *lighthouse, correction_);
     // Sliced measurement covariance matrix
     R = filter::SliceR(measure_covariance_.block(total_sensors * HORIZONTAL,
       total_sensors * HORIZONTAL, total_sensors, total_sensors), sensors);
   } else {
     // Difference between prediction and real measures
     Y = Z - GetVerticalZ(position_, rotation_, sensors,
-      tracker_, environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_);
+      *tracker, *lighthouse, correction_);
     // Sliced measurement covariance matrix
     R = filter::SliceR(measure_covariance_.block(total_sensors * VERTICAL,
       total_sensors  *VERTICAL, total_sensors, total_sensors), sensors);
   }
 
+  // One sample at a time, no inverse
+  bool sequential = update_mode_ == filter::sequential && R.isDiagonal(0.0);
+  filter::StateVector dX;
+  size_t used = 0;
+
   double error = 9e9;
   size_t counter = 0;
   while(error > IEFK_THRESHOLD) {
@@ -1702,18 +1408,24 @@ bool ViveFilter::UpdateIEKF(const hive::ViveLight & msg) {
     if (clean_msg.axis == HORIZONTAL) {
       // Derivative of measurement model
       H = GetHorizontalH(tmp_position, tmp_rotation, sensors,
-        tracker_, environment_.lighthouses[clean_msg.lighthouse],
-        lighthouses_[clean_msg.lighthouse], correction_);
+        *tracker, *lighthouse, correction_);
     } else {
       // Derivative of measurement model
       H = GetVerticalH(tmp_position, tmp_rotation, sensors,
-        tracker_, environment_.lighthouses[clean_msg.lighthouse],
-        lighthouses_[clean_msg.lighthouse], correction_);
+        *tracker, *lighthouse, correction_);
+    }
+    if (sequential) {
+      newP = oldP;
+      used = filter::SequentialUpdate(H, Y, R.diagonal(), INNOVATION_GATE,
+        dX, newP);
+      // Update intermediate X
+      next_tmpX = oldX + dX;
+    } else {
+      // Kalman Gain
+      K = oldP * H.transpose() * (H * oldP * H.transpose() + R).inverse();
+      // Update intermediate X
+      next_tmpX = oldX + K * Y;
     }
-    // Kalman Gain
-    K = oldP * H.transpose() * (H * oldP * H.transpose() + R).inverse();
-    // Update intermediate X
-    next_tmpX = oldX + K * Y;
     // Error to check if it ends cycle
     error = (next_tmpX - prev_tmpX).norm();
 
@@ -1722,9 +1434,13 @@ bool ViveFilter::UpdateIEKF(const hive::ViveLight & msg) {
     if (counter >= IEKF_STEPS) break;
   }
 
-  newX = oldX + K * Y;
-  newP = Eigen::MatrixXd(
-    (Eigen::MatrixXd::Identity(STATE_SIZE, STATE_SIZE) - K * H) * oldP);
+  if (sequential) {
+    if (used == 0) return false;
+    newX = oldX + dX;
+  } else {
+    newX = oldX + K * Y;
+    newP = (filter::StateMatrix::Identity() - K * H) * oldP;
+  }
 
   // Save new state
   position_ = newX.segment<3>(0);
@@ -1774,42 +1490,117 @@ bool ViveFilter::UpdateIEKF(const hive::ViveLight & msg) {
     return false;
   }
 
-  time_ = clean_msg.header.stamp;
+  time_ = clean_msg.stamp;
   return true;
 }
 
-// Vector that represents the evolution of the system is continuous time
-Eigen::VectorXd GetExtendedDState(Eigen::Vector3d velocity,
-  Eigen::Quaterniond rotation,
-  Eigen::Vector3d linear_acceleration,
-  Eigen::Vector3d angular_velocity,
-  Eigen::Vector3d gravity,
-  Eigen::Vector3d acc_bias,
-  Eigen::Vector3d ang_bias,
-  Eigen::Vector3d acc_noise,
-  Eigen::Vector3d ang_noise,
-  Eigen::Vector3d bias_noise,
-  Eigen::Vector3d grav_noise,
-  double sample_time) {
-  Eigen::VectorXd dotX(STATE_SIZE + NOISE_SIZE);
-  // Position
-  dotX.segment<3>(0) = sample_time * velocity +
-    0.5 * sample_time * sample_time * (
-    - rotation.toRotationMatrix() * (linear_acceleration
-    - acc_bias + acc_noise) + gravity);
-  // Velocity - assumed constant
-  dotX.segment<3>(3) = sample_time * (
-    -rotation.toRotationMatrix() * (linear_acceleration
-    - acc_bias + acc_noise) + gravity);
-  // Orientation
-  Eigen::MatrixXd Omega = filter::GetOmega(rotation);
-  dotX.segment<4>(6) = sample_time * 0.5 * (Omega * (angular_velocity + ang_noise - ang_bias));
-  dotX.segment<3>(10) = sample_time * bias_noise;
-  dotX.segment<3>(13) = sample_time * grav_noise;
-  dotX.segment<NOISE_SIZE>(STATE_SIZE) =
-    Eigen::VectorXd::Zero(NOISE_SIZE);
-  // std::cout << "dotX: " << dotX.transpose() << std::endl;
-  return dotX;
+// Inertial model evaluated for every sigma point at once. Each row holds
+// one component of the extended state across all the points.
+void PropagateSigmaPoints(filter::SigmaMatrix const& X,
+  Eigen::Vector3d const& linear_acceleration,
+  Eigen::Vector3d const& angular_velocity,
+  Eigen::Vector3d const& acc_bias,
+  double sample_time,
+  filter::SigmaMatrix & Y) {
+  typedef filter::SigmaRow Row;
+  Row qw = X.row(6).array();
+  Row qx = X.row(7).array();
+  Row qy = X.row(8).array();
+  Row qz = X.row(9).array();
+  // Specific force and angular velocity with noise and bias
+  Row ax = X.row(16).array() + (linear_acceleration(0) - acc_bias(0));
+  Row ay = X.row(17).array() + (linear_acceleration(1) - acc_bias(1));
+  Row az = X.row(18).array() + (linear_acceleration(2) - acc_bias(2));
+  Row wx = X.row(19).array() - X.row(10).array() + angular_velocity(0);
+  Row wy = X.row(20).array() - X.row(11).array() + angular_velocity(1);
+  Row wz = X.row(21).array() - X.row(12).array() + angular_velocity(2);
+  // Acceleration in the vive frame, - R(q) a + g
+  Row acc[3];
+  acc[0] = X.row(13).array() - ((1.0 - 2.0 * (qy * qy + qz * qz)) * ax
+    + 2.0 * (qx * qy - qw * qz) * ay + 2.0 * (qx * qz + qw * qy) * az);
+  acc[1] = X.row(14).array() - (2.0 * (qx * qy + qw * qz) * ax
+    + (1.0 - 2.0 * (qx * qx + qz * qz)) * ay + 2.0 * (qy * qz - qw * qx) * az);
+  acc[2] = X.row(15).array() - (2.0 * (qx * qz - qw * qy) * ax
+    + 2.0 * (qy * qz + qw * qx) * ay + (1.0 - 2.0 * (qx * qx + qy * qy)) * az);
+  for (size_t i = 0; i < 3; i++) {
+    // Position
+    Y.row(i).array() = X.row(i).array() + sample_time * X.row(3 + i).array()
+      + 0.5 * sample_time * sample_time * acc[i];
+    // Velocity
+    Y.row(3 + i).array() = X.row(3 + i).array() + sample_time * acc[i];
+    // Bias and gravity
+    Y.row(10 + i).array() = X.row(10 + i).array()
+      + sample_time * X.row(22 + i).array();
+    Y.row(13 + i).array() = X.row(13 + i).array()
+      + sample_time * X.row(25 + i).array();
+  }
+  // Orientation, q + dT/2 Omega(q) w
+  double half = 0.5 * sample_time;
+  Y.row(6).array() = qw + half * (- qx * wx - qy * wy - qz * wz);
+  Y.row(7).array() = qx + half * (qw * wx - qz * wy + qy * wz);
+  Y.row(8).array() = qy + half * (qz * wx + qw * wy - qx * wz);
+  Y.row(9).array() = qz + half * (- qy * wx + qx * wy + qw * wz);
+  Row norm = Y.block<4, 2 * EXTENDED_SIZE + 1>(6, 0).colwise().norm().array();
+  for (size_t i = 6; i < 10; i++)
+    Y.row(i).array() /= norm;
+  // Noise
+  Y.bottomRows<NOISE_SIZE>() = X.bottomRows<NOISE_SIZE>();
+  return;
+}
+
+// Measurement model evaluated for every sigma point at once, one row per
+// sensor and one column per point
+void ProjectSigmaPoints(filter::SigmaMatrixX const& X,
+  uint8_t axis,
+  std::vector<int> const& sensors,
+  TrackerSnapshot const& tracker,
+  LighthouseModel const& lighthouse,
+  bool correction,
+  filter::SigmaMatrixX & Z) {
+  typedef Eigen::Array<double, 1, Eigen::Dynamic> Row;
+  Row norm = X.block(6, 0, 4, X.cols()).colwise().norm().array();
+  Row qw = X.row(6).array() / norm;
+  Row qx = X.row(7).array() / norm;
+  Row qy = X.row(8).array() / norm;
+  Row qz = X.row(9).array() / norm;
+  // Orientation of the imu in the vive frame
+  Row vRi[3][3];
+  vRi[0][0] = 1.0 - 2.0 * (qy * qy + qz * qz);
+  vRi[0][1] = 2.0 * (qx * qy - qw * qz);
+  vRi[0][2] = 2.0 * (qx * qz + qw * qy);
+  vRi[1][0] = 2.0 * (qx * qy + qw * qz);
+  vRi[1][1] = 1.0 - 2.0 * (qx * qx + qz * qz);
+  vRi[1][2] = 2.0 * (qy * qz - qw * qx);
+  vRi[2][0] = 2.0 * (qx * qz - qw * qy);
+  vRi[2][1] = 2.0 * (qy * qz + qw * qx);
+  vRi[2][2] = 1.0 - 2.0 * (qx * qx + qy * qy);
+  // Pose of the imu in the lighthouse frame
+  Eigen::Matrix3d const& lRv = lighthouse.lRv;
+  Row lRi[3][3], lPi[3];
+  for (size_t i = 0; i < 3; i++) {
+    lPi[i] = lRv(i,0) * (X.row(0).array() - lighthouse.vPl(0))
+      + lRv(i,1) * (X.row(1).array() - lighthouse.vPl(1))
+      + lRv(i,2) * (X.row(2).array() - lighthouse.vPl(2));
+    for (size_t j = 0; j < 3; j++)
+      lRi[i][j] = lRv(i,0) * vRi[0][j] + lRv(i,1) * vRi[1][j]
+        + lRv(i,2) * vRi[2][j];
+  }
+  // Sensors
+  Z.resize(sensors.size(), X.cols());
+  Row lPs[3];
+  for (size_t k = 0; k < sensors.size(); k++) {
+    Eigen::Vector3d const& iPs = tracker.iPs[sensors[k]];
+    for (size_t i = 0; i < 3; i++)
+      lPs[i] = lRi[i][0] * iPs(0) + lRi[i][1] * iPs(1)
+        + lRi[i][2] * iPs(2) + lPi[i];
+    if (axis == HORIZONTAL)
+      Z.row(k) = LighthouseModel::ProjectHorizontal(lPs,
+        lighthouse.motors[HORIZONTAL], correction).matrix();
+    else
+      Z.row(k) = LighthouseModel::ProjectVertical(lPs,
+        lighthouse.motors[VERTICAL], correction).matrix();
+  }
+  return;
 }
 
 bool ViveFilter::PredictUKF(const sensor_msgs::Imu & msg) {
@@ -1824,8 +1615,7 @@ bool ViveFilter::PredictUKF(const sensor_msgs::Imu & msg) {
   if (!lastmsgwasimu_) dT = 2*dT;
 
   // Extended State
-  Eigen::VectorXd ExtendedState(STATE_SIZE+NOISE_SIZE);
-  Eigen::MatrixXd ExtendedCovariance(STATE_SIZE+NOISE_SIZE, STATE_SIZE+NOISE_SIZE);
+  filter::ExtendedVector ExtendedState;
 
   // Fill in state
   ExtendedState.segment<3>(0) = position_;
@@ -1836,87 +1626,67 @@ bool ViveFilter::PredictUKF(const sensor_msgs::Imu & msg) {
   ExtendedState(9) = rotation_.z();
   ExtendedState.segment<3>(10) = bias_;
   ExtendedState.segment<3>(13) = gravity_;
-  ExtendedState.segment<3>(16) = Eigen::Vector3d::Zero();
-  ExtendedState.segment<3>(19) = Eigen::Vector3d::Zero();
-  ExtendedState.segment<3>(22) = Eigen::Vector3d::Zero();
-  ExtendedState.segment<3>(25) = Eigen::Vector3d::Zero();
-
-  // Fill in covariance
-  ExtendedCovariance.block<STATE_SIZE, STATE_SIZE>(0,0) = covariance_;
-  ExtendedCovariance.block<STATE_SIZE, NOISE_SIZE>(0,STATE_SIZE) =
-    Eigen::MatrixXd::Zero(STATE_SIZE, NOISE_SIZE);
-  ExtendedCovariance.block<NOISE_SIZE, STATE_SIZE>(STATE_SIZE,0) =
-    Eigen::MatrixXd::Zero(NOISE_SIZE, STATE_SIZE);
-  ExtendedCovariance.block<NOISE_SIZE, NOISE_SIZE>(STATE_SIZE, STATE_SIZE) = model_covariance_;
-
-  // Internal factor
-  double L = STATE_SIZE + NOISE_SIZE;
-  double lambda = ALPHA * ALPHA * (L + UKF_FACTOR) - L;
-  double UKF_FACTOR_MEAN_0 = lambda / (lambda + L);
-  double UKF_FACTOR_COV_0 = lambda / (lambda + L) + (1 - ALPHA*ALPHA + BETA);
-  double UKF_FACTOR_MEAN = 1 / (2 * (L + lambda));
-  double UKF_FACTOR_COV = UKF_FACTOR_MEAN;
-  // double UKF_FACTOR_PREDICT = 3 * (1 - UKF_FACTOR) - (STATE_SIZE + NOISE_SIZE);
-
-  // Sigma points
-  Eigen::MatrixXd Sigma = Eigen::LLT<Eigen::MatrixXd>(
-    (L + lambda) * ExtendedCovariance).matrixL();
-  std::vector<Eigen::VectorXd> SigmaPoints;
-  SigmaPoints.push_back(ExtendedState);
-  for (size_t i = 0; i < Sigma.cols(); i++) {
-    SigmaPoints.push_back(ExtendedState + Sigma.col(i));
-    SigmaPoints.push_back(ExtendedState - Sigma.col(i));
+  ExtendedState.segment<NOISE_SIZE>(STATE_SIZE).setZero();
+  filter::StateMatrix oldP = covariance_;
+  filter::StateMatrix oldS = sqrt_covariance_;
+
+  // Factor of the extended covariance. It is block diagonal, so only the
+  // state block is factored here, the noise one is cached.
+  filter::ExtendedMatrix Sigma = filter::ExtendedMatrix::Zero();
+  if (filter_type_ == filter::srukf)
+    Sigma.block<STATE_SIZE, STATE_SIZE>(0,0) = sqrt_covariance_;
+  else
+    Sigma.block<STATE_SIZE, STATE_SIZE>(0,0) =
+      Eigen::LLT<filter::StateMatrix>(covariance_).matrixL();
+  Sigma.block<NOISE_SIZE, NOISE_SIZE>(STATE_SIZE, STATE_SIZE) = model_sqrt_;
+
+  // Weights
+  filter::SigmaWeights mean_weights, cov_weights;
+  double spread = filter::GetWeights(mean_weights, cov_weights);
+
+  // Sigma points, one per column
+  filter::SigmaMatrix SigmaPoints;
+  SigmaPoints.col(0) = ExtendedState;
+  for (size_t i = 0; i < EXTENDED_SIZE; i++) {
+    SigmaPoints.col(2*i + 1) = ExtendedState + spread * Sigma.col(i);
+    SigmaPoints.col(2*i + 2) = ExtendedState - spread * Sigma.col(i);
   }
 
   // Predicted Extended State
-  std::vector<Eigen::VectorXd> NextSigmaPoints;
-  for (size_t i = 0; i < SigmaPoints.size(); i++) {
-    // Format change
-    Eigen::Vector3d velocity = SigmaPoints[i].segment<3>(3);
-    Eigen::Quaterniond rotation(SigmaPoints[i](6),
-      SigmaPoints[i](7),
-      SigmaPoints[i](8),
-      SigmaPoints[i](9));
-    Eigen::Vector3d bias = SigmaPoints[i].segment<3>(10);
-    Eigen::Vector3d gravity = SigmaPoints[i].segment<3>(13);
-    Eigen::Vector3d acc_bias(tracker_.acc_bias.x,
-      tracker_.acc_bias.y,
-      tracker_.acc_bias.z);
-    Eigen::Vector3d acc_noise = SigmaPoints[i].segment<3>(16);
-    Eigen::Vector3d ang_noise = SigmaPoints[i].segment<3>(19);
-    Eigen::Vector3d bias_noise = SigmaPoints[i].segment<3>(22);
-    Eigen::Vector3d grav_noise = SigmaPoints[i].segment<3>(25);
-    // Get time derivative
-    Eigen::VectorXd dState = GetExtendedDState(
-      velocity, rotation, linear_acceleration,
-      angular_velocity, gravity, acc_bias, bias,
-      acc_noise, ang_noise, bias_noise, grav_noise, dT);
-    // Get next state and save it
-    Eigen::VectorXd NextSigmaPoint = SigmaPoints[i] + dState;
-    NextSigmaPoint.segment<4>(6) = NextSigmaPoint.segment<4>(6).normalized();
-    NextSigmaPoints.push_back(NextSigmaPoint);
-  }
-
+  Eigen::Vector3d acc_bias(tracker_.acc_bias.x,
+    tracker_.acc_bias.y,
+    tracker_.acc_bias.z);
+  filter::SigmaMatrix NextSigmaPoints;
+  PropagateSigmaPoints(SigmaPoints, linear_acceleration,
+    angular_velocity, acc_bias, dT, NextSigmaPoints);
 
   // ux_k+1 - mean predicted state
-  Eigen::VectorXd NextExtendedState;
-  NextExtendedState = UKF_FACTOR_MEAN_0 * NextSigmaPoints[0];
-  for (size_t i = 1; i < NextSigmaPoints.size(); i++) {
-    NextExtendedState += UKF_FACTOR_MEAN * NextSigmaPoints[i];
-  }
-
-  // uP_k+1 - covariance of the predicted state
-  Eigen::MatrixXd NextExtendedCovariance = Eigen::MatrixXd::Zero(L, L);
-  // if (UKF_FACTOR_PREDICT >= 0.0) {
-  NextExtendedCovariance = UKF_FACTOR_COV_0 * (NextSigmaPoints[0] - NextExtendedState) *
-    (NextSigmaPoints[0] - NextExtendedState).transpose();
-  // }
-  for (size_t i = 1; i < NextSigmaPoints.size(); i++) {
-    NextExtendedCovariance += UKF_FACTOR_COV * (NextSigmaPoints[i] - NextExtendedState) *
-    (NextSigmaPoints[i] - NextExtendedState).transpose();
+  filter::ExtendedVector NextExtendedState;
+  NextExtendedState.noalias() = NextSigmaPoints * mean_weights;
+
+  // uP_k+1 - covariance of the predicted state, only the state block
+  Eigen::Matrix<double, STATE_SIZE, 2 * EXTENDED_SIZE + 1> Deviation =
+    NextSigmaPoints.topRows<STATE_SIZE>().colwise() -
+    NextExtendedState.head<STATE_SIZE>();
+  filter::StateMatrix NextCovariance;
+  if (filter_type_ == filter::srukf) {
+    // Factor of the weighted deviations, then the central point, whose
+    // weight may be negative
+    Eigen::Matrix<double, 2 * EXTENDED_SIZE, STATE_SIZE> A =
+      sqrt(cov_weights(1)) * Deviation.rightCols<2 * EXTENDED_SIZE>().transpose();
+    filter::StateMatrix NextSqrtCovariance;
+    filter::TriangularFactor(A, NextSqrtCovariance);
+    if (!filter::CholeskyUpdate(NextSqrtCovariance,
+      sqrt(std::abs(cov_weights(0))) * Deviation.col(0),
+      cov_weights(0) < 0.0 ? -1.0 : 1.0)) return false;
+    sqrt_covariance_ = NextSqrtCovariance;
+    NextCovariance.noalias() =
+      NextSqrtCovariance * NextSqrtCovariance.transpose();
+  } else {
+    NextCovariance.noalias() =
+      Deviation * cov_weights.asDiagonal() * Deviation.transpose();
   }
 
-
   // Save new state
   position_ = NextExtendedState.segment<3>(0);
   velocity_ = NextExtendedState.segment<3>(3);
@@ -1926,7 +1696,7 @@ bool ViveFilter::PredictUKF(const sensor_msgs::Imu & msg) {
     NextExtendedState(9)).normalized();
   bias_ = NextExtendedState.segment<3>(10);
   gravity_ = NextExtendedState.segment<3>(13);
-  covariance_ = NextExtendedCovariance.block<STATE_SIZE, STATE_SIZE>(0,0);
+  covariance_ = NextCovariance;
 
   if (DEBUG) {
     std::cout << "IMU" << std::endl;
@@ -1962,7 +1732,8 @@ bool ViveFilter::PredictUKF(const sensor_msgs::Imu & msg) {
       ExtendedState(9)).normalized();
     bias_ = ExtendedState.segment<3>(10);
     gravity_ = ExtendedState.segment<3>(13);
-    covariance_ = ExtendedCovariance.block<STATE_SIZE, STATE_SIZE>(0,0);
+    covariance_ = oldP;
+    sqrt_covariance_ = oldS;
     return false;
   }
   time_ = msg.header.stamp;
@@ -1970,11 +1741,25 @@ bool ViveFilter::PredictUKF(const sensor_msgs::Imu & msg) {
   return true;
 }
 
-bool ViveFilter::UpdateUKF(const hive::ViveLight & msg) {
+bool ViveFilter::UpdateUKF(LightFrame const& frame) {
   // ROS_INFO("UpdateUKF");
 
   // Clean meassage outliers
-  hive::ViveLight clean_msg = msg;
+  LightFrame clean_msg = frame;
+  // Compiled calibration of the observation
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(clean_msg.lighthouse);
+  if (tracker == NULL || lighthouse == NULL || !lighthouse->has_pose)
+    return false;
+  // Samples of sensors that are not part of the tracker
+  clean_msg.size = 0;
+  for (size_t i = 0; i < frame.size; i++) {
+    if (!tracker->HasSensor(frame.sensors[i])) continue;
+    clean_msg.sensors[clean_msg.size] = frame.sensors[i];
+    clean_msg.angles[clean_msg.size] = frame.angles[i];
+    clean_msg.size++;
+  }
   // auto sample_it = clean_msg.samples.begin();
   // while (sample_it != clean_msg.samples.end()) {
   //   if (sample_it->angle > M_PI / 3 || sample_it->angle < -M_PI / 3)
@@ -1984,36 +1769,33 @@ bool ViveFilter::UpdateUKF(const hive::ViveLight & msg) {
   // }
   // if (clean_msg.samples.size() == 0) return false;
 
+  if (clean_msg.axis != HORIZONTAL && clean_msg.axis != VERTICAL)
+    return false;
+
   // Count measurements
   size_t row = 0;
   std::vector<int> sensors;
-  Eigen::VectorXd Z(clean_msg.samples.size());
-  for (auto sample : clean_msg.samples) {
-    sensors.push_back(sample.sensor);
-    Z(row) = sample.angle;
+  Eigen::VectorXd Z(clean_msg.size);
+  for (size_t i = 0; i < clean_msg.size; i++) {
+    sensors.push_back(clean_msg.sensors[i]);
+    Z(row) = clean_msg.angles[i];
     row++;
   }
 
   // Internal Parameters
   size_t MEASURE_NOISE_SIZE = sensors.size();
   size_t L = STATE_SIZE + MEASURE_NOISE_SIZE;
-  double lambda = ALPHA * ALPHA * ((double)L + UKF_FACTOR) - (double)L;
-  double UKF_FACTOR_MEAN_0 = lambda / (lambda + (double)L);
-  double UKF_FACTOR_COV_0 = lambda / (lambda + (double)L) + (1 - ALPHA*ALPHA + BETA);
-  double UKF_FACTOR_MEAN = 1 / (2 * ((double)L + lambda));
-  double UKF_FACTOR_COV = UKF_FACTOR_MEAN;
-  // double UKF_FACTOR_UPDATE = 3.0 * (1.0 - (double)UKF_FACTOR) -
-  //   ((double)MEASURE_NOISE_SIZE + (double)STATE_SIZE);
 
   // Crop measurement noise matrix
   Eigen::MatrixXd MeasurementNoise;
   int total_sensors = tracker_.sensors.size();
   MeasurementNoise = filter::SliceR(measure_covariance_.block(total_sensors * clean_msg.axis,
     total_sensors  * clean_msg.axis, total_sensors, total_sensors), sensors);
+  Eigen::MatrixXd MeasurementSqrt =
+    Eigen::LLT<Eigen::MatrixXd>(MeasurementNoise).matrixL();
 
   // Extended State
   Eigen::VectorXd ExtendedState(L);
-  Eigen::MatrixXd ExtendedCovariance(L, L);
 
   // Fill state mean
   ExtendedState.segment<3>(0) = position_;
@@ -2024,120 +1806,101 @@ bool ViveFilter::UpdateUKF(const hive::ViveLight & msg) {
   ExtendedState(9) = rotation_.z();
   ExtendedState.segment<3>(10) = bias_;
   ExtendedState.segment<3>(13) = gravity_;
-  ExtendedState.segment(STATE_SIZE, MEASURE_NOISE_SIZE) =
-    Eigen::VectorXd::Zero(MEASURE_NOISE_SIZE);
-
-  // Fill in state covariance
-  ExtendedCovariance.block<STATE_SIZE, STATE_SIZE>(0,0) = covariance_;
-  ExtendedCovariance.block(0, STATE_SIZE, STATE_SIZE, MEASURE_NOISE_SIZE) =
-    Eigen::MatrixXd::Zero(STATE_SIZE, MEASURE_NOISE_SIZE);
-  ExtendedCovariance.block(STATE_SIZE, 0, MEASURE_NOISE_SIZE,STATE_SIZE) =
-    Eigen::MatrixXd::Zero(MEASURE_NOISE_SIZE,STATE_SIZE);
-  ExtendedCovariance.block(STATE_SIZE, STATE_SIZE, MEASURE_NOISE_SIZE,
-    MEASURE_NOISE_SIZE) = MeasurementNoise;
-
-  // Sigma points
-  std::vector<Eigen::VectorXd> SigmaPoints;
-  Eigen::MatrixXd Sigma = Eigen::LLT<Eigen::MatrixXd>(
-    (lambda + L) * ExtendedCovariance).matrixL();
-  SigmaPoints.push_back(ExtendedState);
-  for (size_t i = 0; i < Sigma.cols(); i++) {
-    SigmaPoints.push_back(ExtendedState + Sigma.col(i));
-    SigmaPoints.push_back(ExtendedState - Sigma.col(i));
+  ExtendedState.segment(STATE_SIZE, MEASURE_NOISE_SIZE).setZero();
+  filter::StateMatrix oldP = covariance_;
+  filter::StateMatrix oldS = sqrt_covariance_;
+
+  // Factor of the (block diagonal) extended covariance
+  Eigen::MatrixXd Sigma = Eigen::MatrixXd::Zero(L, L);
+  if (filter_type_ == filter::srukf)
+    Sigma.block<STATE_SIZE, STATE_SIZE>(0,0) = sqrt_covariance_;
+  else
+    Sigma.block<STATE_SIZE, STATE_SIZE>(0,0) =
+      Eigen::LLT<filter::StateMatrix>(covariance_).matrixL();
+  Sigma.block(STATE_SIZE, STATE_SIZE, MEASURE_NOISE_SIZE,
+    MEASURE_NOISE_SIZE) = MeasurementSqrt;
+
+  // Weights
+  Eigen::VectorXd mean_weights(2 * L + 1), cov_weights(2 * L + 1);
+  double spread = filter::GetWeights(mean_weights, cov_weights);
+
+  // Sigma points, one per column
+  filter::SigmaMatrixX SigmaPoints(L, 2 * L + 1);
+  SigmaPoints.col(0) = ExtendedState;
+  for (size_t i = 0; i < L; i++) {
+    SigmaPoints.col(2*i + 1) = ExtendedState + spread * Sigma.col(i);
+    SigmaPoints.col(2*i + 2) = ExtendedState - spread * Sigma.col(i);
   }
 
-  // Unscented measurements
-  std::vector<Eigen::VectorXd> UnscentedMeasurements;
-  for (size_t i = 0; i < SigmaPoints.size(); i++) {
-    // Format change
-    Eigen::Vector3d position = SigmaPoints[i].segment<3>(0);
-    Eigen::Quaterniond rotation(SigmaPoints[i](6),
-      SigmaPoints[i](7),
-      SigmaPoints[i](8),
-      SigmaPoints[i](9));
-    rotation.normalize();
-    if (clean_msg.axis == HORIZONTAL) {
-      // Measurement model + Noise
-      UnscentedMeasurements.push_back(GetHorizontalZ(
-      position, rotation, sensors, tracker_,
-      environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_) +
-      SigmaPoints[i].segment(STATE_SIZE, MEASURE_NOISE_SIZE));
-    } else if (clean_msg.axis == VERTICAL) {
-      // Measurement model + Noise
-      UnscentedMeasurements.push_back(GetVerticalZ(
-      position, rotation, sensors, tracker_,
-      environment_.lighthouses[clean_msg.lighthouse],
-      lighthouses_[clean_msg.lighthouse], correction_) +
-      SigmaPoints[i].segment(STATE_SIZE, MEASURE_NOISE_SIZE));
-    }
-  }
+  // Unscented measurements, measurement model + Noise
+  filter::SigmaMatrixX UnscentedMeasurements;
+  ProjectSigmaPoints(SigmaPoints, clean_msg.axis, sensors,
+    *tracker, *lighthouse, correction_, UnscentedMeasurements);
+  UnscentedMeasurements += SigmaPoints.bottomRows(MEASURE_NOISE_SIZE);
 
- // Expected measurement
-  Eigen::VectorXd MeasurementMean;
-  MeasurementMean = UKF_FACTOR_MEAN_0 * UnscentedMeasurements[0];
-  for (size_t i = 1; i < UnscentedMeasurements.size(); i++) {
-    MeasurementMean += UKF_FACTOR_MEAN * UnscentedMeasurements[i];
-  }
-  // MeasurementMean = 1 / ((double)UKF_FACTOR_UPDATE + (double)STATE_SIZE + (double)MEASURE_NOISE_SIZE) *
-    // MeasurementMean;
-
-  // Measurement covariance
-  Eigen::MatrixXd MeasurementVar;
-  MeasurementVar = Eigen::MatrixXd::Zero(MEASURE_NOISE_SIZE,MEASURE_NOISE_SIZE);
-  // if (UKF_FACTOR_UPDATE >= 0.0) {
-  MeasurementVar = UKF_FACTOR_COV_0 *
-    (UnscentedMeasurements[0] - MeasurementMean) *
-    (UnscentedMeasurements[0] - MeasurementMean).transpose();
-  // }
-  for (size_t i = 1; i < UnscentedMeasurements.size(); i++) {
-    MeasurementVar += UKF_FACTOR_COV *
-    (UnscentedMeasurements[i] - MeasurementMean) *
-    (UnscentedMeasurements[i] - MeasurementMean).transpose();
-  }
-  // MeasurementVar = 1 / ((double)UKF_FACTOR_UPDATE + (double)STATE_SIZE + (double)MEASURE_NOISE_SIZE) *
-  //   MeasurementVar;
-  MeasurementVar += MeasurementNoise; // Inovation covariance
+  // Expected measurement
+  Eigen::VectorXd MeasurementMean = UnscentedMeasurements * mean_weights;
+  Eigen::MatrixXd MeasurementDeviation =
+    UnscentedMeasurements.colwise() - MeasurementMean;
 
   // State-Measurement Covariance
-  Eigen::MatrixXd MeasurementCov;
-  MeasurementCov = Eigen::MatrixXd::Zero(L, MEASURE_NOISE_SIZE);
-  // if (UKF_FACTOR_UPDATE >= 0.0) {
-  MeasurementCov = UKF_FACTOR_COV_0 *
-    (SigmaPoints[0] - ExtendedState) *
-    (UnscentedMeasurements[0] - MeasurementMean).transpose();
-  // }
-  for (size_t i = 1; i < SigmaPoints.size(); i++) {
-    MeasurementCov += UKF_FACTOR_COV *
-      (SigmaPoints[i] - ExtendedState) *
-      (UnscentedMeasurements[i] - MeasurementMean).transpose();
+  Eigen::MatrixXd MeasurementCov =
+    (SigmaPoints.topRows<STATE_SIZE>().colwise() -
+    ExtendedState.head<STATE_SIZE>()) * cov_weights.asDiagonal() *
+    MeasurementDeviation.transpose();
+
+  filter::StateVector NextState;
+  filter::StateMatrix NextCovariance;
+  if (filter_type_ == filter::srukf) {
+    // Factor of the inovation covariance, R is added once more as in
+    // the UKF below
+    Eigen::MatrixXd A(2 * L + MEASURE_NOISE_SIZE, MEASURE_NOISE_SIZE);
+    A.topRows(2 * L) = sqrt(cov_weights(1)) *
+      MeasurementDeviation.rightCols(2 * L).transpose();
+    A.bottomRows(MEASURE_NOISE_SIZE) = MeasurementSqrt.transpose();
+    Eigen::MatrixXd MeasurementSqrtVar;
+    filter::TriangularFactor(A, MeasurementSqrtVar);
+    if (!filter::CholeskyUpdate(MeasurementSqrtVar,
+      sqrt(std::abs(cov_weights(0))) * MeasurementDeviation.col(0),
+      cov_weights(0) < 0.0 ? -1.0 : 1.0)) return false;
+    // K = Pxz (Sy Sy')^-1 through two triangular solves
+    Eigen::MatrixXd KalmanGain = MeasurementSqrtVar.transpose().
+      triangularView<Eigen::Upper>().solve(MeasurementSqrtVar.
+      triangularView<Eigen::Lower>().solve(MeasurementCov.transpose())).
+      transpose();
+    NextState = ExtendedState.head<STATE_SIZE>() +
+      KalmanGain * (Z - MeasurementMean);
+    // Downdate by the columns of K Sy
+    Eigen::MatrixXd U = KalmanGain * MeasurementSqrtVar;
+    filter::StateMatrix NextSqrtCovariance = sqrt_covariance_;
+    for (size_t j = 0; j < MEASURE_NOISE_SIZE; j++)
+      if (!filter::CholeskyUpdate(NextSqrtCovariance, U.col(j), -1.0))
+        return false;
+    sqrt_covariance_ = NextSqrtCovariance;
+    NextCovariance.noalias() =
+      NextSqrtCovariance * NextSqrtCovariance.transpose();
+  } else {
+    // Measurement covariance
+    Eigen::MatrixXd MeasurementVar = MeasurementDeviation *
+      cov_weights.asDiagonal() * MeasurementDeviation.transpose();
+    MeasurementVar += MeasurementNoise; // Inovation covariance
+    Eigen::MatrixXd KalmanGain = MeasurementCov * MeasurementVar.inverse();
+    NextState = ExtendedState.head<STATE_SIZE>() +
+      KalmanGain * (Z - MeasurementMean);
+    NextCovariance = covariance_ -
+      KalmanGain * MeasurementVar * KalmanGain.transpose();
   }
-  // MeasurementCov = 1 / ((double)UKF_FACTOR_UPDATE + (double)STATE_SIZE + (double)MEASURE_NOISE_SIZE) *
-  //   MeasurementCov;
-
-  // std::cout << "MC: " << MeasurementCov << std::endl;
-  // std::cout << "MV: " << MeasurementVar << std::endl;
-  Eigen::MatrixXd KalmanGain = MeasurementCov * MeasurementVar.inverse();
-
-  // std::cout << "MM: " << MeasurementMean.transpose() << std::endl;
-  // std::cout << "KG: " << KalmanGain << std::endl;
-  Eigen::VectorXd NextExtendedState = ExtendedState + KalmanGain * (Z - MeasurementMean);
-  Eigen::MatrixXd NextExtendedCovariance = ExtendedCovariance - KalmanGain * MeasurementVar * KalmanGain.transpose();
-  // std::cout << "PES: " << ExtendedState.transpose() << std::endl;
-  // std::cout << "Z: " << Z.transpose() << std::endl;
-  // std::cout << "DES: " << (KalmanGain * (Z - MeasurementMean)).transpose() << std::endl;
-  // std::cout << "NES: " << NextExtendedState.transpose() << std::endl;
 
   // Save new state
-  position_ = NextExtendedState.segment<3>(0);
-  velocity_ = NextExtendedState.segment<3>(3);
-  rotation_ = Eigen::Quaterniond(NextExtendedState(6),
-    NextExtendedState(7),
-    NextExtendedState(8),
-    NextExtendedState(9)).normalized();
-  bias_ = NextExtendedState.segment<3>(10);
-  gravity_ = NextExtendedState.segment<3>(13);
-  covariance_ = NextExtendedCovariance.block<STATE_SIZE, STATE_SIZE>(0,0);
+  position_ = NextState.segment<3>(0);
+  velocity_ = NextState.segment<3>(3);
+  rotation_ = Eigen::Quaterniond(NextState(6),
+    NextState(7),
+    NextState(8),
+    NextState(9)).normalized();
+  bias_ = NextState.segment<3>(10);
+  gravity_ = NextState.segment<3>(13);
+  covariance_ = NextCovariance;
 
   if (DEBUG) {
     std::cout << "Light" << std::endl;
@@ -2187,12 +1950,13 @@ bool ViveFilter::UpdateUKF(const hive::ViveLight & msg) {
       ExtendedState(9)).normalized();
     bias_ = ExtendedState.segment<3>(10);
     gravity_ = ExtendedState.segment<3>(13);
-    covariance_ = ExtendedCovariance.block<STATE_SIZE, STATE_SIZE>(0,0);
+    covariance_ = oldP;
+    sqrt_covariance_ = oldS;
     // light_data_.pop_back();
     return false;
   }
 
-  time_ = msg.header.stamp;
+  time_ = frame.stamp;
 
   return true;
 
@@ -0,0 +1,77 @@
+#include <hive/vive_lighthouse.h>
+
+LighthouseModel::LighthouseModel() {
+  has_pose = false;
+  vPl.setZero();
+  vRl.setIdentity();
+  lRv.setIdentity();
+  for (size_t i = 0; i < 2; i++) {
+    motors[i].phase = 0.0;
+    motors[i].tilt = 0.0;
+    motors[i].tan_tilt = 0.0;
+    motors[i].curve = 0.0;
+    motors[i].gib_phase = 0.0;
+    motors[i].gib_mag = 0.0;
+  }
+}
+
+LighthouseModel::LighthouseModel(std::string const& serial,
+  Lighthouse const& lighthouse) : LighthouseModel() {
+  this->serial = serial;
+  motors[HORIZONTAL] = Scale(lighthouse.horizontal_motor);
+  motors[VERTICAL] = Scale(lighthouse.vertical_motor);
+}
+
+LighthouseModel::LighthouseModel(std::string const& serial,
+  Lighthouse const& lighthouse,
+  Transform const& vTl) : LighthouseModel(serial, lighthouse) {
+  has_pose = true;
+  vPl = Eigen::Vector3d(vTl.translation.x,
+    vTl.translation.y,
+    vTl.translation.z);
+  vRl = Eigen::Quaterniond(vTl.rotation.w,
+    vTl.rotation.x,
+    vTl.rotation.y,
+    vTl.rotation.z).toRotationMatrix();
+  lRv = vRl.transpose();
+}
+
+MotorModel<double> LighthouseModel::Scale(Motor const& motor) {
+  double raw[5];
+  raw[PHASE] = motor.phase;
+  raw[TILT] = motor.tilt;
+  raw[GIB_PHASE] = motor.gib_phase;
+  raw[GIB_MAG] = motor.gib_magnitude;
+  raw[CURVE] = motor.curve;
+  return Scale<double>(raw);
+}
+
+double LighthouseModel::Project(uint8_t axis,
+  Eigen::Vector3d const& vPs,
+  bool correction) const {
+  Eigen::Vector3d lPs = lRv * (vPs - vPl);
+  if (axis == HORIZONTAL)
+    return ProjectHorizontal(lPs.data(), motors[HORIZONTAL], correction);
+  return ProjectVertical(lPs.data(), motors[VERTICAL], correction);
+}
+
+Eigen::Vector2d LighthouseModel::Unproject(double horizontal,
+  double vertical,
+  bool correction) const {
+  double atan_x = horizontal;
+  double atan_y = vertical;
+  double x = tan(atan_x);
+  double y = tan(atan_y);
+  if (!correction) return Eigen::Vector2d(x, y);
+  MotorModel<double> const& h = motors[HORIZONTAL];
+  MotorModel<double> const& v = motors[VERTICAL];
+  for (size_t i = 0; i < LIGHTHOUSE_UNPROJECT_ITERATIONS; i++) {
+    atan_x = horizontal + h.phase + h.tan_tilt * y + h.curve * y * y
+      + sin(h.gib_phase + atan_x) * h.gib_mag;
+    atan_y = vertical + v.phase + v.tan_tilt * x + v.curve * x * x
+      + sin(v.gib_phase + atan_y) * v.gib_mag;
+    x = tan(atan_x);
+    y = tan(atan_y);
+  }
+  return Eigen::Vector2d(x, y);
+}
@@ -0,0 +1,217 @@
+#include <hive/vive_lm.h>
+
+namespace lm {
+  // Row of per-sample values
+  typedef Eigen::Array<double, 1, Eigen::Dynamic,
+    Eigen::RowMajor, 1, LM_MAX_RESIDUALS> Row;
+  // Derivative of the residuals w.r.t. a 3 vector
+  typedef Eigen::Matrix<double, Eigen::Dynamic, 3,
+    Eigen::ColMajor, LM_MAX_RESIDUALS, 3> Derivative;
+
+  PoseSolver::PoseSolver() {
+    max_iterations = LM_MAX_ITERATIONS;
+    max_time = 0.0;
+    function_tolerance = 1e-6;
+    parameter_tolerance = 1e-8;
+    points_.resize(3, LM_MAX_RESIDUALS);
+    angles_.resize(LM_MAX_RESIDUALS);
+    Clear();
+    return;
+  }
+
+  void PoseSolver::Clear() {
+    num_sweeps_ = 0;
+    num_samples_ = 0;
+    return;
+  }
+
+  size_t PoseSolver::NumResiduals() const {
+    return num_samples_;
+  }
+
+  bool PoseSolver::AddLight(hive::ViveLight const& msg,
+    TrackerSnapshot const& tracker,
+    LighthouseModel const& lighthouse,
+    bool correction) {
+    if (msg.samples.size() < 1) return true;
+    Sweep * sweep = AddSweep(msg.axis, msg.samples.size(),
+      lighthouse, correction);
+    if (sweep == NULL) return false;
+    for (auto li_it = msg.samples.begin();
+      li_it != msg.samples.end(); li_it++)
+      if (!AddSample(sweep, tracker, li_it->sensor, li_it->angle))
+        return false;
+    num_samples_ += sweep->size;
+    num_sweeps_++;
+    return true;
+  }
+
+  bool PoseSolver::AddLight(LightFrame const& frame,
+    TrackerSnapshot const& tracker,
+    LighthouseModel const& lighthouse,
+    bool correction) {
+    if (frame.size < 1) return true;
+    Sweep * sweep = AddSweep(frame.axis, frame.size, lighthouse, correction);
+    if (sweep == NULL) return false;
+    for (size_t i = 0; i < frame.size; i++)
+      if (!AddSample(sweep, tracker, frame.sensors[i], frame.angles[i]))
+        return false;
+    num_samples_ += sweep->size;
+    num_sweeps_++;
+    return true;
+  }
+
+  Sweep * PoseSolver::AddSweep(uint8_t axis,
+    size_t samples,
+    LighthouseModel const& lighthouse,
+    bool correction) {
+    if (num_sweeps_ >= LM_MAX_SWEEPS) return NULL;
+    if (num_samples_ + samples > LM_MAX_RESIDUALS) return NULL;
+    if (axis != HORIZONTAL && axis != VERTICAL) return NULL;
+    if (!lighthouse.has_pose) return NULL;
+    Sweep & sweep = sweeps_[num_sweeps_];
+    sweep.start = num_samples_;
+    sweep.size = 0;
+    sweep.axis = axis;
+    // Lighthouse pose
+    sweep.vPl = lighthouse.vPl;
+    sweep.lRv = lighthouse.lRv;
+    // Motor constants - zero without correction
+    if (correction) {
+      sweep.motor = lighthouse.motors[axis];
+    } else {
+      sweep.motor.phase = 0.0;
+      sweep.motor.tan_tilt = 0.0;
+      sweep.motor.curve = 0.0;
+      sweep.motor.gib_phase = 0.0;
+      sweep.motor.gib_mag = 0.0;
+    }
+    return &sweep;
+  }
+
+  bool PoseSolver::AddSample(Sweep * sweep,
+    TrackerSnapshot const& tracker,
+    uint8_t sensor,
+    double angle) {
+    if (!tracker.HasSensor(sensor)) return false;
+    size_t i = sweep->start + sweep->size;
+    points_.col(i) = tracker.tPs[sensor];
+    angles_(i) = angle;
+    sweep->size++;
+    return true;
+  }
+
+  double PoseSolver::Evaluate(Vector6d const& pose,
+    Residuals * residuals,
+    Jacobian * jacobian) const {
+    Eigen::Vector3d vPt = pose.head<3>();
+    Eigen::Matrix3d vRt, vJt;
+    cost::AngleAxisJacobian(pose.data() + 3, &vRt, &vJt);
+    residuals->resize(num_samples_);
+    if (jacobian) jacobian->resize(num_samples_, 6);
+    for (size_t k = 0; k < num_sweeps_; k++) {
+      Sweep const& sweep = sweeps_[k];
+      // Sensors in the vive (rotated) and lighthouse frames
+      Points vPs = vRt * points_.middleCols(sweep.start, sweep.size);
+      Points lPs = sweep.lRv * (vPs.colwise() + (vPt - sweep.vPl));
+      Row iz = lPs.row(2).array().inverse();
+      Row x = lPs.row(0).array() * iz;
+      Row y = lPs.row(1).array() * iz;
+      // Swept and orthogonal coordinates
+      Row const& u = (sweep.axis == HORIZONTAL) ? x : y;
+      Row const& w = (sweep.axis == HORIZONTAL) ? y : x;
+      Row atan_u = u.atan();
+      Row ang = LighthouseModel::Correct(atan_u, w, sweep.motor, true);
+      residuals->segment(sweep.start, sweep.size) =
+        angles_.segment(sweep.start, sweep.size) - ang.matrix().transpose();
+      if (jacobian == NULL) continue;
+      // Derivative w.r.t. swept and orthogonal coordinates
+      Row gib = atan_u + sweep.motor.gib_phase;
+      Row dr_du = (gib.cos() * sweep.motor.gib_mag - 1.0) / (1.0 + u.square());
+      Row dr_dw = sweep.motor.tan_tilt + 2.0 * sweep.motor.curve * w;
+      Row const& dr_dx = (sweep.axis == HORIZONTAL) ? dr_du : dr_dw;
+      Row const& dr_dy = (sweep.axis == HORIZONTAL) ? dr_dw : dr_du;
+      // Derivative w.r.t. sensor in the lighthouse frame
+      Derivative dr_dlPs(sweep.size, 3);
+      dr_dlPs.col(0) = (dr_dx * iz).matrix().transpose();
+      dr_dlPs.col(1) = (dr_dy * iz).matrix().transpose();
+      dr_dlPs.col(2) = (- (dr_dx * x + dr_dy * y) * iz).matrix().transpose();
+      // Position
+      Derivative D = dr_dlPs * sweep.lRv;
+      jacobian->block(sweep.start, 0, sweep.size, 3) = D;
+      // Orientation - (vPs x D) * J per sample
+      Derivative C(sweep.size, 3);
+      C.col(0) = vPs.row(1).transpose().cwiseProduct(D.col(2))
+        - vPs.row(2).transpose().cwiseProduct(D.col(1));
+      C.col(1) = vPs.row(2).transpose().cwiseProduct(D.col(0))
+        - vPs.row(0).transpose().cwiseProduct(D.col(2));
+      C.col(2) = vPs.row(0).transpose().cwiseProduct(D.col(1))
+        - vPs.row(1).transpose().cwiseProduct(D.col(0));
+      jacobian->block(sweep.start, 3, sweep.size, 3) = C * vJt;
+    }
+    return 0.5 * residuals->squaredNorm();
+  }
+
+  bool PoseSolver::Solve(double * pose, Summary * summary) const {
+    if (num_samples_ == 0) return false;
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    Residuals residuals, new_residuals;
+    Jacobian jacobian;
+    Vector6d x = Eigen::Map<Vector6d>(pose);
+    double cost = Evaluate(x, &residuals, &jacobian);
+    if (!std::isfinite(cost)) return false;
+    if (summary) {
+      summary->initial_cost = cost;
+      summary->converged = false;
+    }
+    // Damping
+    double lambda = 1e-4;
+    double nu = 2.0;
+    size_t iteration = 0;
+    bool converged = false;
+    while (iteration < max_iterations && !converged) {
+      // x only moves on a decrease, so a stop keeps the best iterate
+      if (max_time > 0.0 && iteration > 0 && std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count() > max_time)
+        break;
+      iteration++;
+      // Normal equations
+      Matrix6d H = jacobian.transpose() * jacobian;
+      Vector6d g = jacobian.transpose() * residuals;
+      if (g.lpNorm<Eigen::Infinity>() < 1e-10) {
+        converged = true;
+        break;
+      }
+      Matrix6d A = H;
+      A.diagonal() += lambda * H.diagonal().cwiseMax(1e-6);
+      Vector6d dx = A.ldlt().solve(-g);
+      if (dx.norm() <= parameter_tolerance * (x.norm() + parameter_tolerance)) {
+        converged = true;
+        break;
+      }
+      // Step quality
+      Vector6d x_new = x + dx;
+      double new_cost = Evaluate(x_new, &new_residuals, NULL);
+      double predicted = - (dx.dot(g) + 0.5 * dx.dot(H * dx));
+      if (std::isfinite(new_cost) && new_cost < cost && predicted > 0) {
+        double rho = (cost - new_cost) / predicted;
+        converged = (cost - new_cost) <= function_tolerance * cost;
+        x = x_new;
+        cost = Evaluate(x, &residuals, &jacobian);
+        lambda *= std::max(1.0 / 3.0, 1.0 - pow(2.0 * rho - 1.0, 3));
+        nu = 2.0;
+      } else {
+        lambda *= nu;
+        nu *= 2.0;
+      }
+    }
+    for (size_t i = 0; i < 6; i++) pose[i] = x(i);
+    if (summary) {
+      summary->final_cost = cost;
+      summary->iterations = iteration;
+      summary->converged = converged;
+    }
+    return true;
+  }
+} // namespace lm
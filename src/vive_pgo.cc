@@ -2,541 +2,218 @@
 
 #define TRUST 0.4
 
-enum DataType {imu, light};
-
 namespace pgo {
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveHorizontalCost
-  {
+  // Preintegrated inertial cost between consecutive light sweeps
+  class PreintegratedCost {
   public:
-    // Constructor
-    ViveHorizontalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl, // vive to lighthouse
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveHorizontalCost();
-    // Ceres operator
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-    geometry_msgs::Transform vTl_;
-  };
-
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveVerticalCost
-  {
-  public:
-    // Constructor
-    ViveVerticalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl, // Vive to lighthouse
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveVerticalCost();
-    // Ceres operator
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-    geometry_msgs::Transform vTl_;
-  };
-
-  // Inertial cost function
-  class InertialCost {
-  public:
-    InertialCost(sensor_msgs::Imu imu,
+    PreintegratedCost(preintegration::ImuPreintegration const& imu,
       geometry_msgs::Vector3 gravity,
-      double time_step,
-      double trust_weight,
-      bool verbose = false);
-    ~InertialCost();
+      double trust_weight);
+    ~PreintegratedCost();
     template <typename T> bool operator()(const T* const prev_vTi,
       const T* const next_vTi,
       const T* const acc_bias,
       const T* const ang_bias,
       T * residual) const;
   private:
-    // Inertial data
-    sensor_msgs::Imu imu_;
-    // Light data
-    hive::ViveLight prev_, next_;
+    // Summarized inertial data
+    preintegration::ImuPreintegration imu_;
     // Gravity
-    geometry_msgs::Vector3 gravity_;
-    // Time step and weight
-    double time_step_, trust_weight_;
-    // Other
-    bool verbose_;
+    Eigen::Vector3d gravity_;
+    // Square root information of the deltas scaled by the trust
+    preintegration::Matrix9d sqrt_information_;
+  public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
   };
 
-  ViveHorizontalCost::ViveHorizontalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    vTl_ = vTl;
+  PreintegratedCost::PreintegratedCost(
+    preintegration::ImuPreintegration const& imu,
+    geometry_msgs::Vector3 gravity,
+    double trust_weight) : imu_(imu) {
+    gravity_ = Eigen::Vector3d(gravity.x, gravity.y, gravity.z);
+    // Whitening - rT (trust * C^-1) r = |U r|^2. A single sample leaves
+    // the covariance rank deficient, so the variances get a floor.
+    preintegration::Matrix9d covariance = imu_.covariance +
+      PGO_MIN_VARIANCE * preintegration::Matrix9d::Identity();
+    preintegration::Matrix9d information = trust_weight *
+      covariance.inverse();
+    Eigen::LLT<preintegration::Matrix9d> llt(information);
+    if (llt.info() == Eigen::Success && information.allFinite()) {
+      sqrt_information_ = llt.matrixU();
+    } else {
+      // Better no inertial constraint than a NaN in the window
+      ROS_WARN("Preintegrated covariance is not positive definite");
+      sqrt_information_.setZero();
+    }
     return;
   }
 
-  ViveHorizontalCost::~ViveHorizontalCost() {
-    // Do nothing
+  PreintegratedCost::~PreintegratedCost() {
+    // Nothing happens
     return;
   }
 
   template <typename T>
-  bool ViveHorizontalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << T(vTl_.translation.x),
-      T(vTl_.translation.y),
-      T(vTl_.translation.z);
-    Eigen::Quaternion<T> vQl(
-      T(vTl_.rotation.w),
-      T(vTl_.rotation.x),
-      T(vTl_.rotation.y),
-      T(vTl_.rotation.z));
-    Eigen::Matrix<T, 3, 3> vRl;
-    vRl = vQl.toRotationMatrix();
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
+  bool PreintegratedCost::operator()(const T* const prev_vTi,
+    const T* const next_vTi,
+    const T* const bias_acc,
+    const T* const bias_ang,
+    T * residual) const {
+    // Poses
+    Eigen::Matrix<T,3,1> prev_vPi(prev_vTi[0], prev_vTi[1], prev_vTi[2]);
+    Eigen::Matrix<T,3,1> prev_vVi(prev_vTi[3], prev_vTi[4], prev_vTi[5]);
+    Eigen::Matrix<T,3,3> prev_vRi;
+    ceres::AngleAxisToRotationMatrix(&prev_vTi[6], prev_vRi.data());
+    Eigen::Matrix<T,3,1> next_vPi(next_vTi[0], next_vTi[1], next_vTi[2]);
+    Eigen::Matrix<T,3,1> next_vVi(next_vTi[3], next_vTi[4], next_vTi[5]);
+    Eigen::Matrix<T,3,3> next_vRi;
+    ceres::AngleAxisToRotationMatrix(&next_vTi[6], next_vRi.data());
 
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
+    // Bias change since the integration
+    Eigen::Matrix<T,3,1> d_iA(bias_acc[0] - T(imu_.acc_bias(0)),
+      bias_acc[1] - T(imu_.acc_bias(1)),
+      bias_acc[2] - T(imu_.acc_bias(2)));
+    Eigen::Matrix<T,3,1> d_iW(bias_ang[0] - T(imu_.gyr_bias(0)),
+      bias_ang[1] - T(imu_.gyr_bias(1)),
+      bias_ang[2] - T(imu_.gyr_bias(2)));
+
+    // Deltas corrected to first order
+    Eigen::Matrix<T,3,1> phi = imu_.dR_dbg.cast<T>() * d_iW;
+    Eigen::Matrix<T,3,3> cR;
+    ceres::AngleAxisToRotationMatrix(phi.data(), cR.data());
+    Eigen::Matrix<T,3,3> dR = imu_.dR.cast<T>() * cR;
+    Eigen::Matrix<T,3,1> dV = imu_.dV.cast<T>()
+      + imu_.dV_dba.cast<T>() * d_iA + imu_.dV_dbg.cast<T>() * d_iW;
+    Eigen::Matrix<T,3,1> dP = imu_.dP.cast<T>()
+      + imu_.dP_dba.cast<T>() * d_iA + imu_.dP_dbg.cast<T>() * d_iW;
+
+    // Residuals in the frame of the previous pose
+    T dt = T(imu_.dt);
+    Eigen::Matrix<T,3,1> vG = gravity_.cast<T>();
+    Eigen::Matrix<T,9,1> error;
+    Eigen::Matrix<T,3,3> eR = dR.transpose() * prev_vRi.transpose() * next_vRi;
+    ceres::RotationMatrixToAngleAxis(eR.data(), error.data());
+    error.template segment<3>(3) = prev_vRi.transpose()
+      * (next_vVi - prev_vVi - vG * dt) - dV;
+    error.template segment<3>(6) = prev_vRi.transpose()
+      * (next_vPi - prev_vPi - prev_vVi * dt - T(0.5) * vG * dt * dt) - dP;
+    Eigen::Map<Eigen::Matrix<T,9,1>> whitened(residual);
+    whitened = sqrt_information_.cast<T>() * error;
     return true;
   }
 
-  ViveVerticalCost::ViveVerticalCost(hive::ViveLight data,
-    geometry_msgs::Transform vTl,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    vTl_ = vTl;
+  // Gaussian prior left by the marginalized poses, linearized where they
+  // left the window
+  class MarginalizationCost : public ceres::CostFunction {
+  public:
+    MarginalizationCost(std::vector<double*> const& blocks,
+      std::vector<int> const& sizes,
+      Eigen::MatrixXd const& H,
+      Eigen::VectorXd const& b,
+      double weight);
+    ~MarginalizationCost();
+    bool Evaluate(double const* const* parameters,
+      double * residuals,
+      double ** jacobians) const;
+  private:
+    // Block sizes
+    std::vector<int> sizes_;
+    // Linearization point
+    Eigen::VectorXd x0_;
+    // Prior as |J (x - x0) + r|^2
+    Eigen::MatrixXd J_;
+    Eigen::VectorXd r_;
+  };
+
+  MarginalizationCost::MarginalizationCost(std::vector<double*> const& blocks,
+    std::vector<int> const& sizes,
+    Eigen::MatrixXd const& H,
+    Eigen::VectorXd const& b,
+    double weight) {
+    sizes_ = sizes;
+    x0_.resize(H.rows());
+    size_t offset = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      mutable_parameter_block_sizes()->push_back(sizes_[i]);
+      for (int j = 0; j < sizes_[i]; j++)
+        x0_(offset + j) = blocks[i][j];
+      offset += sizes_[i];
+    }
+    set_num_residuals(H.rows());
+    // Factor H = JT J and b = JT r dropping the unobservable directions
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(0.5 * (H + H.transpose()));
+    Eigen::VectorXd S = (es.eigenvalues().array() > 1e-8).select(
+      es.eigenvalues().array(), 0.0);
+    Eigen::VectorXd S_inv = (es.eigenvalues().array() > 1e-8).select(
+      es.eigenvalues().array().inverse(), 0.0);
+    J_ = sqrt(weight) * S.cwiseSqrt().asDiagonal()
+      * es.eigenvectors().transpose();
+    r_ = sqrt(weight) * S_inv.cwiseSqrt().asDiagonal()
+      * es.eigenvectors().transpose() * b;
     return;
   }
 
-  ViveVerticalCost::~ViveVerticalCost() {
-    // Do nothing
+  MarginalizationCost::~MarginalizationCost() {
+    // Nothing happens
     return;
   }
 
-  template <typename T>
-  bool ViveVerticalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << T(vTl_.translation.x),
-      T(vTl_.translation.y),
-      T(vTl_.translation.z);
-    Eigen::Quaternion<T> vQl(
-      T(vTl_.rotation.w),
-      T(vTl_.rotation.x),
-      T(vTl_.rotation.y),
-      T(vTl_.rotation.z));
-    Eigen::Matrix<T, 3, 3> vRl;
-    vRl = vQl.toRotationMatrix();
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
+  bool MarginalizationCost::Evaluate(double const* const* parameters,
+    double * residuals,
+    double ** jacobians) const {
+    Eigen::VectorXd dx(x0_.size());
+    size_t offset = 0;
+    for (size_t i = 0; i < sizes_.size(); i++) {
+      for (int j = 0; j < sizes_[i]; j++)
+        dx(offset + j) = parameters[i][j] - x0_(offset + j);
+      offset += sizes_[i];
+    }
+    Eigen::Map<Eigen::VectorXd> residual(residuals, r_.size());
+    residual = J_ * dx + r_;
+    if (jacobians == NULL) return true;
+    offset = 0;
+    for (size_t i = 0; i < sizes_.size(); i++) {
+      if (jacobians[i] != NULL) {
+        Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+          Eigen::RowMajor>> jacobian(jacobians[i], r_.size(), sizes_[i]);
+        jacobian = J_.middleCols(offset, sizes_[i]);
       }
-
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
+      offset += sizes_[i];
     }
     return true;
   }
 
-  InertialCost::InertialCost(sensor_msgs::Imu imu,
-    geometry_msgs::Vector3 gravity,
-    // geometry_msgs::Vector3 gyr_bias,
-    double time_step,
-    double trust_weight,
-    bool verbose) {
-    imu_ = imu;
-    gravity_ = gravity;
-    time_step_ = time_step;
-    trust_weight_ = trust_weight;
-    // gyr_bias_ = gyr_bias;
-    verbose_ = verbose;
+  PosePool::PosePool() {
+    // Nothing happens
     return;
   }
 
-  InertialCost::~InertialCost() {
-    // Nothing happens
+  void PosePool::Reset(size_t capacity) {
+    storage_.assign(POSE_SIZE * capacity, 0.0);
+    free_.clear();
+    for (size_t i = capacity; i > 0; i--)
+      free_.push_back(&storage_[POSE_SIZE * (i - 1)]);
     return;
   }
 
-  template <typename T>
-  bool InertialCost::operator()(const T* const prev_vTi,
-    const T* const next_vTi,
-    const T* const bias_acc,
-    const T* const bias_ang,
-    T * residual) const {
-    // Biases
-    Eigen::Matrix<T,3,1> b_iA;
-    b_iA << T(bias_acc[0]),
-      T(bias_acc[1]),
-      T(bias_acc[2]);
-    Eigen::Matrix<T,3,1> b_iW;
-    b_iW << T(bias_ang[0]),
-      T(bias_ang[1]),
-      T(bias_ang[2]);
-
-    // prev_vTt's state
-    // Position
-    Eigen::Matrix<T,3,1> prev_vPi;
-    prev_vPi << prev_vTi[0],
-      prev_vTi[1],
-      prev_vTi[2];
-    // Velocity
-    Eigen::Matrix<T,3,1> prev_vVi;
-    prev_vVi << prev_vTi[3],
-      prev_vTi[4],
-      prev_vTi[5];
-    // Angle axis in vector
-    Eigen::Matrix<T,3,1> prev_vAi;
-    prev_vAi << prev_vTi[6],
-      prev_vTi[7],
-      prev_vTi[8];
-    // Rotation matrix
-    Eigen::Matrix<T,3,3> prev_vRi;// = prev_vQi.toRotationMatrix();
-    ceres::AngleAxisToRotationMatrix(&prev_vTi[6], prev_vRi.data());
-    // Angle axis eigen structure
-    // Eigen::AngleAxis<T> prev_vAAi(prev_vRi);
-
-    // Eigen Quaternion
-    Eigen::Quaternion<T> prev_vQi(prev_vRi);
-    // std::cout << prev_vAAi.axis()(0) << ", "
-    //   << prev_vAAi.axis()(1) << ", "
-    //   << prev_vAAi.axis()(2) << ", "
-    //   << prev_vAAi.angle() << std::endl;
-
-    // next_vTt's state
-    // Position
-    Eigen::Matrix<T,3,1> next_vPi;
-    next_vPi << next_vTi[0],
-      next_vTi[1],
-      next_vTi[2];
-    // Velocity
-    Eigen::Matrix<T,3,1> next_vVi;
-    next_vVi << next_vTi[3],
-      next_vTi[4],
-      next_vTi[5];
-    // Angle axis in vector
-    Eigen::Matrix<T,3,1> next_vAi;
-    next_vAi << next_vTi[6],
-      next_vTi[7],
-      next_vTi[8];
-    // Rotation matrix
-    Eigen::Matrix<T,3,3> next_vRi;// = next_vQi.toRotationMatrix();
-    ceres::AngleAxisToRotationMatrix(&next_vTi[6], next_vRi.data());
-    // Angle axis eigen structure
-    // Eigen::AngleAxis<T> next_vAAi(next_vAi.norm(),
-    //   next_vAi.normalized());
-    // Eigen Quaternion
-    Eigen::Quaternion<T> next_vQi(next_vRi);
-
-    // Inertial measurements
-    Eigen::Matrix<T,3,1> iW;
-    iW << T(imu_.angular_velocity.x),
-      T(imu_.angular_velocity.y),
-      T(imu_.angular_velocity.z);
-    Eigen::Matrix<T,3,1> iA;
-    iA << T(imu_.linear_acceleration.x),
-      T(imu_.linear_acceleration.y),
-      T(imu_.linear_acceleration.z);
-
-    // Inertial bias
-    // Eigen::Matrix<T,3,1> iB;
-    // iB << T(gyr_bias_.x),
-    //   T(gyr_bias_.y),
-    //   T(gyr_bias_.z);
-
-    // Gravity
-    Eigen::Matrix<T,3,1> vG;
-    vG << T(gravity_.x),
-      T(gravity_.y),
-      T(gravity_.z);
-
-    // Inertial predictions
-    // Position prediction
-    Eigen::Matrix<T,3,1> est_vPi;
-    est_vPi = prev_vPi + T(time_step_) * prev_vVi + T(0.5 * time_step_ * time_step_) * (vG - prev_vRi * iA);
-    // Velocity prediction
-    Eigen::Matrix<T,3,1> est_vVi;
-    est_vVi = prev_vVi + T(time_step_) * (vG - (prev_vRi * (iA - b_iA)));
-
-    // std::cout << (prev_vRi * iA)(0) << ", " << (prev_vRi * iA)(1) << ", " << (prev_vRi * iA)(2) << std::endl;
-    // Quaternion derivative matrix
-    Eigen::Matrix<T,4,3> Omega;
-    Omega << -prev_vQi.x(), -prev_vQi.y(), -prev_vQi.z(),
-      prev_vQi.w(), -prev_vQi.z(), prev_vQi.y(),
-      prev_vQi.z(), prev_vQi.w(), -prev_vQi.x(),
-      -prev_vQi.y(), prev_vQi.x(), prev_vQi.w();
-    // Temporary previous orientation in vector
-    Eigen::Matrix<T,4,1> trev_vQi; // temporary previous
-    trev_vQi << prev_vQi.w(),
-      prev_vQi.x(),
-      prev_vQi.y(),
-      prev_vQi.z();
-    Eigen::Matrix<T,4,1> text_vQi; // temporary next
-    // Temporary next orientation in vector
-    text_vQi = trev_vQi + T(time_step_) * T(0.5) * Omega * (iW - b_iW);
-    // std::cout << "trev_vQi " << trev_vQi(0) << ", "
-    //   << trev_vQi(1) << ", "
-    //   << trev_vQi(2) << ", "
-    //   << trev_vQi(3) << std::endl;
-    // std::cout << "iW " << iW(0) << ", "
-    //   << iW(1) << ", "
-    //   << iW(2) << std::endl;
-    // std::cout << "iB " << iB(0) << ", "
-    //   << iB(1) << ", "
-    //   << iB(2) << std::endl;
-    // text_vQi.normalize(); // maybe remove
-    // Fix small errors
-    Eigen::Quaternion<T> est_vQi(text_vQi(0),
-      text_vQi(1),
-      text_vQi(2),
-      text_vQi(3));
-    Eigen::Matrix<T,3,3> est_vRi = est_vQi.normalized().toRotationMatrix();
-
-    // Estimated from inertia vs next
-    Eigen::Matrix<T,3,1> dP;
-    Eigen::Matrix<T,3,1> dV;
-    Eigen::Matrix<T,3,3> dR;
-    dP = next_vPi - est_vPi;
-    dV = next_vVi - est_vVi;
-    dR = next_vRi.transpose() * est_vRi;
-    // std::cout << est_vRi(0,0) << ", " << est_vRi(0,1) << ", " << est_vRi(0,2) << ", ";
-    // std::cout << est_vRi(1,0) << ", " << est_vRi(1,1) << ", " << est_vRi(1,2) << ", ";
-    // std::cout << est_vRi(2,0) << ", " << est_vRi(2,1) << ", " << est_vRi(2,2) << std::endl;
-
-    // Position cost
-    residual[0] = T(sqrt(trust_weight_)) * dP(0);
-    residual[1] = T(sqrt(trust_weight_)) * dP(1);
-    residual[2] = T(sqrt(trust_weight_)) * dP(2);
-    // Velocity cost
-    // residual[3] = prev_vPi(0) - next_vPi(0);
-    // residual[4] = prev_vPi(1) - next_vPi(1);
-    // residual[5] = prev_vPi(2) - next_vPi(2);
-    residual[3] = T(sqrt(trust_weight_)) * dV(0);
-    residual[4] = T(sqrt(trust_weight_)) * dV(1);
-    residual[5] = T(sqrt(trust_weight_)) * dV(2);
-    // Orientation cost
-    T aa[3];
-    ceres::RotationMatrixToAngleAxis(dR.data(), aa);
-    // std::cout << aa[0] << ", " << aa[1] << ", " << aa[2] << std::endl;
-    residual[6] = T(sqrt(trust_weight_)) *
-      sqrt(0.001 + aa[0] * aa[0] + aa[1] * aa[1] + aa[2] * aa[2]); // WATCH OUT FOR THIS
-      // Watch out for bias
-    return true;
+  double * PosePool::Acquire() {
+    if (free_.empty()) return NULL;
+    double * pose = free_.back();
+    free_.pop_back();
+    return pose;
   }
 
-  // How close the poses should be to each other
-  class ClosenessCost {
-  public:
-    // Constructor to pass data
-    // A good smoothing factor is 0.1, but it may be changed
-    explicit ClosenessCost(double smoothing,
-      double vel_smooth);
-
-    // Function for ceres solver with parameters (different frames)
-    template <typename T> bool operator()(const T* const prev_vTt,
-      const T* const next_vTt,
-      T * residual) const;
-
-  private:
-    double smoothing_;
-    double vel_smooth_;
-  };
-
-  // Constructor to pass data
-  ClosenessCost::ClosenessCost(double smoothing,
-    double vel_smooth) {
-    smoothing_ = smoothing;
-    vel_smooth_ = vel_smooth;
-  }
-  // Function for ceres solver with parameters
-  template <typename T> bool ClosenessCost::operator()(const T* const prev_vTt,
-    const T* const next_vTt,
-    T * residual) const {
-    // cost function here
-
-    // Frame conversion
-    Eigen::Matrix<T, 3, 1> prev_vPt;
-    prev_vPt << prev_vTt[0],
-      prev_vTt[1],
-      prev_vTt[2];
-    Eigen::Matrix<T, 3, 1> next_vPt;
-    next_vPt << next_vTt[0],
-      next_vTt[1],
-      next_vTt[2];
-    Eigen::Matrix<T, 3, 1> prev_vVt;
-    prev_vVt << prev_vTt[3],
-      prev_vTt[4],
-      prev_vTt[5];
-    Eigen::Matrix<T, 3, 1> next_vVt;
-    next_vVt << next_vTt[3],
-      next_vTt[4],
-      next_vTt[5];
-    Eigen::Matrix<T, 3, 3> prev_vRt;
-    ceres::AngleAxisToRotationMatrix(&prev_vTt[6], prev_vRt.data());
-    Eigen::Matrix<T, 3, 3> next_vRt;
-    ceres::AngleAxisToRotationMatrix(&next_vTt[6], next_vRt.data());
-
-    // // Translation cost with smoothing
-    residual[0] = T(sqrt(smoothing_)) * (prev_vPt(0) - next_vPt(0));
-    residual[1] = T(sqrt(smoothing_)) * (prev_vPt(1) - next_vPt(1));
-    residual[2] = T(sqrt(smoothing_)) * (prev_vPt(2) - next_vPt(2));
-    residual[3] = T(sqrt(1.0e0 * vel_smooth_*smoothing_)) * (prev_vVt(0) - next_vVt(0));
-    residual[4] = T(sqrt(1.0e0 * vel_smooth_*smoothing_)) * (prev_vVt(1) - next_vVt(1));
-    residual[5] = T(sqrt(1.0e0 * vel_smooth_*smoothing_)) * (prev_vVt(2) - next_vVt(2));
-    // // Rotation cost with smoothing
-    T aa[3];
-    Eigen::Matrix<T, 3, 3> R = next_vRt.transpose() * prev_vRt;
-    ceres::RotationMatrixToAngleAxis(R.data(), aa);
-    residual[6] = T(1.0e0 * ROTATION_FACTOR) * T(sqrt(smoothing_))*
-      sqrt(0.001 + aa[0] * aa[0] + aa[1] * aa[1] + aa[2] * aa[2]);
-    return true;
+  void PosePool::Release(double * pose) {
+    free_.push_back(pose);
+    return;
   }
 
+  // Problem kept across solves - blocks are removed as the window slides
+  ceres::Problem * NewProblem() {
+    ceres::Problem::Options options;
+    options.enable_fast_removal = true;
+    return new ceres::Problem(options);
+  }
 };
 
 PoseGraph::PoseGraph(Environment environment,
@@ -545,32 +222,85 @@ PoseGraph::PoseGraph(Environment environment,
   size_t window,
   double trust,
   double first_factor,
-  bool correction) {
+  bool correction,
+  bool async) {
   if (window < 2) {
     std::cout << "Bad window size. Using 2." << std::endl;
     window_ = 2;
+  } else if (window >= PGO_LIGHT_WINDOW) {
+    // One more sweep is held before sliding
+    std::cout << "Bad window size. Using " << PGO_LIGHT_WINDOW - 1
+      << "." << std::endl;
+    window_ = PGO_LIGHT_WINDOW - 1;
   } else {
     window_ = window;
   }
   valid_ = false;
-  lastposewasimu_ = false;
   correction_ = correction;
   trust_ = trust;
   tracker_ = tracker;
   environment_ = environment;
   lighthouses_ = lighthouses;
-  // force_first_ = force_first;
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
   first_factor_ = first_factor;
+  // One more pose than the window before sliding
+  problem_.reset(pgo::NewProblem());
+  pool_.Reset(window_ + 1);
+  prior_ = NULL;
+  bias_acc_[0] = tracker_.acc_bias.x;
+  bias_acc_[1] = tracker_.acc_bias.y;
+  bias_acc_[2] = tracker_.acc_bias.z;
+  bias_ang_[0] = tracker_.gyr_bias.x;
+  bias_ang_[1] = tracker_.gyr_bias.y;
+  bias_ang_[2] = tracker_.gyr_bias.z;
+  has_output_ = false;
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
+  // Start a thread to optimize the window
+  async_ = async;
+  active_ = async_;
+  if (async_)
+    thread_ = std::thread(&PoseGraph::WorkerThread, this);
   return;
 }
 
 PoseGraph::PoseGraph() {
+  calibration_ = CalibrationSnapshot::Create(environment_,
+    lighthouses_,
+    tracker_);
+  tracker_id_ = calibration_->TrackerId(tracker_.serial);
   valid_ = true;
+  window_ = 2;
+  problem_.reset(pgo::NewProblem());
+  pool_.Reset(window_ + 1);
+  prior_ = NULL;
+  for (size_t i = 0; i < 3; i++) {
+    bias_acc_[i] = 0.0;
+    bias_ang_[i] = 0.0;
+  }
+  has_output_ = false;
+  counters_ = budget_.GetCounters();
+  inliers_ = ransac_.GetCounters();
+  async_ = false;
+  active_ = false;
   return;
 }
 
 PoseGraph::~PoseGraph() {
-  // pass
+  // Stop the worker
+  if (async_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      active_ = false;
+    }
+    condition_.notify_one();
+    thread_.join();
+  }
+  // The problem is released before the pool
+  problem_.reset();
   return;
 }
 
@@ -598,86 +328,25 @@ bool PoseGraph::Valid() {
   //   << vQt.y() << ", "
   //   << vQt.z() << std::endl;
 
-  for (auto light_sample : light_data_) {
-    // Lighthouse in the vive frame
-    Eigen::Vector3d vPl(
-      environment_.lighthouses[light_sample.lighthouse].translation.x,
-      environment_.lighthouses[light_sample.lighthouse].translation.y,
-      environment_.lighthouses[light_sample.lighthouse].translation.z);
-    Eigen::Quaterniond vQl(
-      environment_.lighthouses[light_sample.lighthouse].rotation.w,
-      environment_.lighthouses[light_sample.lighthouse].rotation.x,
-      environment_.lighthouses[light_sample.lighthouse].rotation.y,
-      environment_.lighthouses[light_sample.lighthouse].rotation.z);
-    Eigen::Matrix3d vRl = vQl.toRotationMatrix();
-
-    // std::cout << "Val L: "
-    //   << vPl(0) << ", "
-    //   << vPl(1) << ", "
-    //   << vPl(2) << ", "
-    //   << vQl.w() << ", "
-    //   << vQl.x() << ", "
-    //   << vQl.y() << ", "
-    //   << vQl.z() << std::endl;
-
-    // Convert pose to lighthouse frame
-    Eigen::Vector3d lPt = vRl.transpose() * (vPt) + ( - vRl.transpose() * vPl);
-    Eigen::Matrix3d lRt = vRl.transpose() * vRt;
-
-
-    // std::cout << "Val lT: "
-    //   << lPt(0) << ", "
-    //   << lPt(1) << ", "
-    //   << lPt(2) << ", "
-    //   << Eigen::Quaterniond(lRt).w() << ", "
-    //   << Eigen::Quaterniond(lRt).x() << ", "
-    //   << Eigen::Quaterniond(lRt).y() << ", "
-    //   << Eigen::Quaterniond(lRt).z() << std::endl;
-    for (auto sample : light_sample.samples) {
-      Eigen::Vector3d tPs(tracker_.sensors[sample.sensor].position.x,
-        tracker_.sensors[sample.sensor].position.y,
-        tracker_.sensors[sample.sensor].position.z);
-      // Sensor in lighthouse frame
-      Eigen::Vector3d lPs = lRt * tPs + lPt;
-      // Horizontal Angle
-      if (light_sample.axis == HORIZONTAL) {
-        double ang;
-        double x = (lPs(0)/lPs(2)); // Horizontal angle
-        double y = (lPs(1)/lPs(2)); // Vertical angle
-        double phase = SCALE_PHASE * lighthouses_[light_sample.lighthouse].horizontal_motor.phase;
-        double tilt = SCALE_TILT * lighthouses_[light_sample.lighthouse].horizontal_motor.tilt;
-        double curve = SCALE_CURVE * lighthouses_[light_sample.lighthouse].horizontal_motor.curve;
-        double gib_mag = SCALE_GIB * lighthouses_[light_sample.lighthouse].horizontal_motor.gib_magnitude;
-        double gib_phase = lighthouses_[light_sample.lighthouse].horizontal_motor.gib_phase;
-        // Correction
-        if (correction_) {
-          ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-        } else {
-          ang = atan(x);
-        }
-        // Adding to cost
-        cost += pow(sample.angle - ang,2);
-        sample_counter++;
-      // Vertical Angle
-      } else if (light_sample.axis == VERTICAL) {
-        double ang;
-        double x = (lPs(0)/lPs(2)); // Horizontal angle
-        double y = (lPs(1)/lPs(2)); // Vertical angle
-        double phase = SCALE_PHASE * lighthouses_[light_sample.lighthouse].vertical_motor.phase;
-        double tilt = SCALE_TILT * lighthouses_[light_sample.lighthouse].vertical_motor.tilt;
-        double curve = SCALE_CURVE * lighthouses_[light_sample.lighthouse].vertical_motor.curve;
-        double gib_mag = SCALE_GIB * lighthouses_[light_sample.lighthouse].vertical_motor.gib_magnitude;
-        double gib_phase = lighthouses_[light_sample.lighthouse].vertical_motor.gib_phase;
-        // Correction
-        if (correction_) {
-          ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-        } else {
-          ang = atan(y);
-        }
-        // Adding to cost
-        cost += pow(sample.angle - ang,2);
-        sample_counter++;
-      }
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  if (tracker == NULL) return false;
+  for (size_t i = 0; i < light_data_.Size(); i++) {
+    LightFrame const& light_sample = light_data_[i];
+    // Compiled lighthouse
+    LighthouseModel const* lighthouse =
+      calibration_->GetLighthouse(light_sample.lighthouse);
+    if (lighthouse == NULL || !lighthouse->has_pose) continue;
+    if (light_sample.axis != HORIZONTAL && light_sample.axis != VERTICAL)
+      continue;
+    for (size_t j = 0; j < light_sample.size; j++) {
+      uint8_t sensor = light_sample.sensors[j];
+      if (!tracker->HasSensor(sensor)) continue;
+      // Sensor in the vive frame
+      Eigen::Vector3d vPs = vRt * tracker->tPs[sensor] + vPt;
+      double ang = lighthouse->Project(light_sample.axis, vPs, correction_);
+      // Adding to cost
+      cost += pow(light_sample.angles[j] - ang,2);
+      sample_counter++;
     }
   }
 
@@ -690,55 +359,210 @@ bool PoseGraph::Valid() {
 }
 
 void PoseGraph::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
-  // Create copy to clean
-  hive::ViveLight * clone_msg = new hive::ViveLight(*msg);
-  // Erase outliers
-  auto sample_it = clone_msg->samples.begin();
-    while (sample_it != clone_msg->samples.end()) {
-    if (sample_it->angle > -M_PI/3.0 && sample_it->angle < M_PI / 3.0) {
-      sample_it++;
-    } else {
-      clone_msg->samples.erase(sample_it);
-    }
-  }
-  if (clone_msg->samples.size() == 0) {
+  // Samples inside the field of view
+  LightFrame frame;
+  if (!frame.Set(*msg, calibration_->LighthouseId(msg->lighthouse)))
     return;
-  }
-  // Save the copy
-  light_data_.push_back(*clone_msg);
+  ProcessFrame(frame);
+  return;
+}
 
-  while (light_data_.size() > window_) {
-    light_data_.erase(light_data_.begin());
-    if (poses_.size() > 0) {
-      poses_.erase(poses_.begin());
-    }
-    size_t imu_counter = 0;
-    while (imu_data_.size() > 0 
-      && imu_data_.front().header.stamp < light_data_.front().header.stamp) {
-      imu_counter++;
-      imu_data_.erase(imu_data_.begin());
-      if (poses_.size() > 0 && imu_counter > 1) {
-        poses_.erase(poses_.begin());
-      }
+void PoseGraph::ProcessLight(const hive::ViveLightRaw::ConstPtr& msg) {
+  // Same, indexed by the lighthouse id of the message
+  LightFrame frame;
+  if (!frame.Set(*msg, calibration_->RawLighthouseId(msg->lighthouse)))
+    return;
+  ProcessFrame(frame);
+  return;
+}
+
+void PoseGraph::ProcessFrame(LightFrame const& frame) {
+  // Queue it for the worker - keep the newest sweeps if it falls behind
+  if (async_) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      light_queue_.Push(frame.stamp) = frame;
+      while (light_queue_.Size() > window_)
+        light_queue_.PopFront();
     }
+    condition_.notify_one();
+  } else {
+    Update(frame);
+  }
+  return;
+}
+
+void PoseGraph::Update(LightFrame const& light) {
+  budget_.Tick(light.stamp);
+  // Reflections are left out before they reach the window
+  LightFrame frame = light;
+  TrackerSnapshot const* tracker = calibration_->GetTracker(tracker_id_);
+  LighthouseModel const* lighthouse =
+    calibration_->GetLighthouse(frame.lighthouse);
+  if (tracker != NULL && lighthouse != NULL) {
+    ransac_.Filter(&frame, light_data_, *tracker, *lighthouse, correction_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    inliers_ = ransac_.GetCounters();
   }
 
+  // Add it to the window
+  bool new_node = AddSweep(frame);
+
   // Solve the problem
   if (!Solve()) {
-    light_data_.pop_back();
+    RemoveSweep(new_node);
+  } else {
+    Slide();
   }
 
   valid_ = Valid();
 
+  if (async_) Publish();
+  return;
+}
+
+void PoseGraph::WorkerThread() {
+  while (true) {
+    LightFrame light;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this] {
+        return !active_ || !light_queue_.Empty();
+      });
+      if (!active_) return;
+      light = light_queue_.Front();
+      light_queue_.PopFront();
+    }
+    Update(light);
+  }
+}
+
+void PoseGraph::Publish() {
+  // Latest solution
+  pgo::State state;
+  if (valid_ && !nodes_.empty()) {
+    double * pose = nodes_.back().pose;
+    state.stamp = nodes_.back().stamp;
+    state.vPi = Eigen::Vector3d(pose[0], pose[1], pose[2]);
+    state.vVi = Eigen::Vector3d(pose[3], pose[4], pose[5]);
+    ceres::AngleAxisToRotationMatrix(&pose[6], state.vRi.data());
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!valid_ || nodes_.empty()) {
+    has_output_ = false;
+    return;
+  }
+  // Catch up with the samples received while solving
+  for (size_t i = 0; i < imu_data_.Size(); i++)
+    Propagate(state, imu_data_[i > 0 ? i - 1 : 0], imu_data_.Stamp(i));
+  if (!has_output_ || output_.stamp < state.stamp) {
+    output_ = state;
+    if (!imu_data_.Empty()) output_imu_ = imu_data_.Back();
+  } else {
+    // Blend to avoid jumps in the output
+    Propagate(state, output_imu_, output_.stamp);
+    output_.vPi += PGO_BLEND * (state.vPi - output_.vPi);
+    output_.vVi += PGO_BLEND * (state.vVi - output_.vVi);
+    output_.vRi = Eigen::Quaterniond(output_.vRi).slerp(PGO_BLEND,
+      Eigen::Quaterniond(state.vRi)).toRotationMatrix();
+  }
+  has_output_ = true;
+  return;
+}
+
+void PoseGraph::Propagate(pgo::State & state,
+  ImuFrame const& imu,
+  ros::Time const& stamp) const {
+  if (stamp <= state.stamp) return;
+  preintegration::ImuPreintegration delta(
+    Eigen::Vector3d(bias_acc_[0], bias_acc_[1], bias_acc_[2]),
+    Eigen::Vector3d(bias_ang_[0], bias_ang_[1], bias_ang_[2]));
+  delta.Integrate(Eigen::Vector3d(imu.acc), Eigen::Vector3d(imu.gyr),
+    (stamp - state.stamp).toSec());
+  pgo::State next;
+  delta.Predict(state.vPi, state.vVi, state.vRi, environment_.gravity,
+    next.vPi, next.vVi, next.vRi);
+  state.vPi = next.vPi;
+  state.vVi = next.vVi;
+  state.vRi = next.vRi;
+  state.stamp = stamp;
+  return;
+}
+
+void PoseGraph::ToTransform(pgo::State const& state,
+  geometry_msgs::TransformStamped & msg) const {
+  msg.header.stamp = state.stamp;
+  msg.header.frame_id = "vive";
+  msg.child_frame_id = tracker_.serial;
+  // Imu to light
+  Eigen::Vector3d tPi(tracker_.imu_transform.translation.x,
+    tracker_.imu_transform.translation.y,
+    tracker_.imu_transform.translation.z);
+  Eigen::Quaterniond tQi(tracker_.imu_transform.rotation.w,
+    tracker_.imu_transform.rotation.x,
+    tracker_.imu_transform.rotation.y,
+    tracker_.imu_transform.rotation.z);
+  Eigen::Matrix3d tRi = tQi.toRotationMatrix();
+
+  // Convert frames
+  Eigen::Vector3d vPt = state.vRi * ( - tRi.transpose() * tPi ) + state.vPi;
+  Eigen::Matrix3d vRt = state.vRi * tRi.transpose();
+  Eigen::Quaterniond vQt(vRt);
+  // Save to ROS msg
+  msg.transform.translation.x = vPt(0);
+  msg.transform.translation.y = vPt(1);
+  msg.transform.translation.z = vPt(2);
+  msg.transform.rotation.w = vQt.w();
+  msg.transform.rotation.x = vQt.x();
+  msg.transform.rotation.y = vQt.y();
+  msg.transform.rotation.z = vQt.z();
   return;
 }
 
 void PoseGraph::ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) {
-  // Create copy to clean
-  sensor_msgs::Imu * clone_msg = new sensor_msgs::Imu(*msg);
-  // Save the copy
-  imu_data_.push_back(*clone_msg);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Save a copy
+  ImuFrame & imu = imu_data_.Push(msg->header.stamp);
+  imu.Set(*msg);
+  // Move the output to the new sample
+  if (async_ && has_output_) {
+    Propagate(output_, output_imu_, msg->header.stamp);
+    output_imu_ = imu;
+  }
+  return;
+}
 
+void PoseGraph::ProcessImu(const hive::ViveImuBatch::ConstPtr& msg) {
+  if (msg == NULL || msg->stamps.empty()) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Save a copy of every sample
+  for (size_t i = 0; i < msg->stamps.size(); i++)
+    imu_data_.Push(msg->stamps[i]).Set(*msg, i);
+  if (!async_ || !has_output_) return;
+  // Move the output to the last sample with a single preintegration, each
+  // sample held until the next one as in Propagate
+  preintegration::ImuPreintegration delta(
+    Eigen::Vector3d(bias_acc_[0], bias_acc_[1], bias_acc_[2]),
+    Eigen::Vector3d(bias_ang_[0], bias_ang_[1], bias_ang_[2]));
+  ros::Time stamp = output_.stamp;
+  size_t first = imu_data_.Size() - std::min(msg->stamps.size(),
+    imu_data_.Size());
+  for (size_t i = first; i < imu_data_.Size(); i++) {
+    if (imu_data_.Stamp(i) > stamp) {
+      delta.Integrate(Eigen::Vector3d(output_imu_.acc),
+        Eigen::Vector3d(output_imu_.gyr),
+        (imu_data_.Stamp(i) - stamp).toSec());
+      stamp = imu_data_.Stamp(i);
+    }
+    output_imu_ = imu_data_[i];
+  }
+  pgo::State next;
+  delta.Predict(output_.vPi, output_.vVi, output_.vRi, environment_.gravity,
+    next.vPi, next.vVi, next.vRi);
+  output_.vPi = next.vPi;
+  output_.vVi = next.vVi;
+  output_.vRi = next.vRi;
+  output_.stamp = stamp;
   return;
 }
 
@@ -802,347 +626,394 @@ void PoseGraph::ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) {
 //   return;
 // }
 
+bool PoseGraph::GetBudget(BudgetCounters * counters) {
+  if (counters == NULL) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  *counters = counters_;
+  return true;
+}
+
+bool PoseGraph::GetInliers(InlierCounters * counters) {
+  if (counters == NULL) return false;
+  std::lock_guard<std::mutex> lock(mutex_);
+  *counters = inliers_;
+  return true;
+}
+
 bool PoseGraph::GetTransform(geometry_msgs::TransformStamped& msg) {
+  // Latest solution at the rate of the inertial data
+  if (async_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!has_output_) return false;
+    ToTransform(output_, msg);
+    return true;
+  }
   if (!valid_) return false;
   // Set the output
   msg = pose_;
   // Change the time stamp
-  msg.header.stamp == light_data_.back().header.stamp;
+  msg.header.stamp == light_data_.Back().stamp;
   return true;
 }
 
-bool PoseGraph::Solve() {
-  // Test if we have enough data
-  if (light_data_.size() < window_) return true;
-  // Lighthouse and pose
-  DataType prev_type;
-  double prev_time = 0;
-  size_t counter = 0;
-  // std::string next_lighthouse;
-
-  ceres::Problem problem;
-  ceres::Solver::Options options;
-  ceres::Solver::Summary summary;
+bool PoseGraph::AddSweep(LightFrame const& light) {
+  bool new_node = false;
+  // Inertial measurements since the last pose - each sample is held until
+  // the next one or the sweep
+  Eigen::Vector3d acc_bias(bias_acc_[0], bias_acc_[1], bias_acc_[2]);
+  Eigen::Vector3d gyr_bias(bias_ang_[0], bias_ang_[1], bias_ang_[2]);
+  preintegration::ImuPreintegration imu(acc_bias, gyr_bias);
+  if (nodes_.size() > 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ros::Time prev_time = nodes_.back().stamp;
+    for (size_t i = 0; i < imu_data_.Size() &&
+      imu_data_.Stamp(i) < light.stamp; i++) {
+      ros::Time end = light.stamp;
+      if (i + 1 < imu_data_.Size() && imu_data_.Stamp(i + 1) < end)
+        end = imu_data_.Stamp(i + 1);
+      imu.Integrate(Eigen::Vector3d(imu_data_[i].acc),
+        Eigen::Vector3d(imu_data_[i].gyr),
+        (end - prev_time).toSec());
+      if (end > prev_time) prev_time = end;
+    }
+  }
 
-  // Iterators
-  auto li_it = light_data_.begin();
-  auto imu_it = imu_data_.begin();
-  bool lastposewasimu = false;
-
-  // Preliminary light data - first HORIZONTAL / second VERTICAL
-  std::map<std::string, std::pair<hive::ViveLight*,hive::ViveLight*>> pre_data;
-
-  std::vector<double*> new_poses;
-  new_poses.push_back(new double[9]);
-  lastposewasimu_ = true;
-  size_t pose_index = 0;
-  double bias_acc[3];
-  bias_acc[0] = tracker_.acc_bias.x;
-  bias_acc[1] = tracker_.acc_bias.y;
-  bias_acc[2] = tracker_.acc_bias.z;
-  double bias_ang[3];
-  bias_ang[0] = tracker_.gyr_bias.x;
-  bias_ang[1] = tracker_.gyr_bias.y;
-  bias_ang[2] = tracker_.gyr_bias.z;
-
-  while (li_it != light_data_.end()) {
-
-    // Convert lighthouse to geometry_msgs
-    geometry_msgs::Transform lhTF;
-    lhTF.translation.x = environment_.lighthouses[li_it->lighthouse].translation.x;
-    lhTF.translation.y = environment_.lighthouses[li_it->lighthouse].translation.y;
-    lhTF.translation.z = environment_.lighthouses[li_it->lighthouse].translation.z;
-    lhTF.rotation.w = environment_.lighthouses[li_it->lighthouse].rotation.w;
-    lhTF.rotation.x = environment_.lighthouses[li_it->lighthouse].rotation.x;
-    lhTF.rotation.y = environment_.lighthouses[li_it->lighthouse].rotation.y;
-    lhTF.rotation.z = environment_.lighthouses[li_it->lighthouse].rotation.z;
-
-    // Inertial measurements
-    while(imu_it != imu_data_.end() &&
-      imu_it->header.stamp < li_it->header.stamp) {
-      // Time difference for iteration
-      double dt;
-      if (prev_type == imu)
-        dt = imu_it->header.stamp.toSec() - prev_time;
-      else if (prev_type == light)
-        dt = 2 * (imu_it->header.stamp.toSec() - prev_time);
-      else
-        dt = 0.0;
-      // auto prev_pose = new_poses.back();
-      new_poses.push_back(new double[9]);
-      size_t prev = new_poses.size() - 2;
-      size_t next = new_poses.size() - 1;
-      // auto next_pose = new_poses.back();
-      ceres::CostFunction * cost =
-        new ceres::AutoDiffCostFunction<pgo::InertialCost, 7, 9, 9, 3, 3  >
-        (new pgo::InertialCost(*imu_it,
+  // New pose tied to the previous one by a single inertial factor
+  double * pose = NULL;
+  if (nodes_.empty() || imu.samples > 0) {
+    pose = pool_.Acquire();
+    if (pose == NULL) ROS_WARN("No free pose in the window.");
+  }
+  if (pose != NULL) {
+    pgo::Node node;
+    node.stamp = light.stamp;
+    node.pose = pose;
+    if (nodes_.empty()) {
+      for (size_t i = 0; i < POSE_SIZE; i++) pose[i] = 0.0;
+      pose[2] = 1.0;
+    } else {
+      // Warm start from the inertial prediction
+      double * prev_pose = nodes_.back().pose;
+      Eigen::Matrix3d vRi, next_vRi;
+      ceres::AngleAxisToRotationMatrix(&prev_pose[6], vRi.data());
+      Eigen::Vector3d vPi(prev_pose[0], prev_pose[1], prev_pose[2]);
+      Eigen::Vector3d vVi(prev_pose[3], prev_pose[4], prev_pose[5]);
+      Eigen::Vector3d next_vPi, next_vVi;
+      imu.Predict(vPi, vVi, vRi, environment_.gravity,
+        next_vPi, next_vVi, next_vRi);
+      for (size_t i = 0; i < 3; i++) {
+        pose[i] = next_vPi(i);
+        pose[3 + i] = next_vVi(i);
+      }
+      ceres::RotationMatrixToAngleAxis(next_vRi.data(), &pose[6]);
+      // Inertial factor
+      pgo::Factor factor;
+      factor.cost =
+        new ceres::AutoDiffCostFunction<pgo::PreintegratedCost, 9, 9, 9, 3, 3>
+        (new pgo::PreintegratedCost(imu,
           environment_.gravity,
-          dt,
           trust_));
-      // std::cout << "IMU " << imu_it->header.stamp << " - " << prev << " - " << next << " : " << dt << " - " << trust_ << std::endl;
-      problem.AddResidualBlock(cost, new ceres::CauchyLoss(0.05), new_poses[prev],
-        new_poses[next],
-        bias_acc,
-        bias_ang);
-      lastposewasimu_ = true;
-      prev_type = imu;
-      prev_time = imu_it->header.stamp.toSec();
-      imu_it++;
-    }
-    // Cost related to light measurements
-    // if (!lastposewasimu_) {
-    //   new_poses.push_back(new double[9]);
-    //   lastposewasimu_ = false;
-    // }
-    if (li_it->axis == HORIZONTAL) {
-      ceres::DynamicAutoDiffCostFunction<pgo::ViveHorizontalCost, 4> * hcost =
-        new ceres::DynamicAutoDiffCostFunction<pgo::ViveHorizontalCost, 4>
-        (new pgo::ViveHorizontalCost(*li_it,
-          lhTF,
-          tracker_,
-          lighthouses_[li_it->lighthouse].horizontal_motor,
-          correction_));
-      hcost->AddParameterBlock(9);
-      hcost->SetNumResiduals(li_it->samples.size());
-      size_t light_pointer = new_poses.size() - 1;
-      // std::cout << "Light " << li_it->header.stamp << " - " << light_pointer << std::endl;
-      problem.AddResidualBlock(hcost, new ceres::CauchyLoss(0.05), new_poses[light_pointer]);
-      // Delta time
-      prev_type = light;
-      prev_time = li_it->header.stamp.toSec();
-    } else if (li_it->axis == VERTICAL) {
-      ceres::DynamicAutoDiffCostFunction<pgo::ViveVerticalCost, 4> * vcost =
-        new ceres::DynamicAutoDiffCostFunction<pgo::ViveVerticalCost, 4>
-        (new pgo::ViveVerticalCost(*li_it,
-          lhTF,
-          tracker_,
-          lighthouses_[li_it->lighthouse].vertical_motor,
-          correction_));
-      vcost->AddParameterBlock(9);
-      vcost->SetNumResiduals(li_it->samples.size());
-      size_t light_pointer = new_poses.size() - 1;
-      // std::cout << "Light " << li_it->header.stamp << " - " << light_pointer << std::endl;
-      problem.AddResidualBlock(vcost, new ceres::CauchyLoss(0.05), new_poses[light_pointer]);
-      // Delta time
-      prev_type = light;
-      prev_time = li_it->header.stamp.toSec();
+      factor.loss = new ceres::CauchyLoss(0.05);
+      factor.blocks = {prev_pose, pose, bias_acc_, bias_ang_};
+      factor.light = false;
+      factor.id = problem_->AddResidualBlock(factor.cost, factor.loss,
+        factor.blocks);
+      nodes_.back().factors.push_back(factor);
+      problem_->SetParameterBlockConstant(bias_acc_);
+      problem_->SetParameterBlockConstant(bias_ang_);
     }
+    nodes_.push_back(node);
+    new_node = true;
+  }
 
+  // Cost related to light measurements
+  light_data_.Push(light.stamp) = light;
+  if (light.axis == HORIZONTAL || light.axis == VERTICAL) {
+    pgo::Factor factor;
+    factor.cost = new cost::ViveLightCost(light,
+      calibration_,
+      tracker_id_,
+      cost::POSE_IMU,
+      correction_);
+    factor.loss = new ceres::CauchyLoss(0.05);
+    factor.blocks = {nodes_.back().pose};
+    factor.light = true;
+    factor.id = problem_->AddResidualBlock(factor.cost, factor.loss,
+      factor.blocks);
+    nodes_.back().factors.push_back(factor);
+  }
+  return new_node;
+}
 
-    // Preliminary solver data
-    if (li_it->axis == HORIZONTAL)
-      pre_data[li_it->lighthouse].first = &(*li_it);
-    else if (li_it->axis == VERTICAL)
-      pre_data[li_it->lighthouse].second = &(*li_it);
-    // Solve preliminary data
-    if (!valid_ && pre_data[li_it->lighthouse].first != NULL
-      && pre_data[li_it->lighthouse].second != NULL) {
-      double pre_pose[9];
-      pre_pose[0] = 0.0;
-      pre_pose[1] = 0.0;
-      pre_pose[2] = 1.0;
-      pre_pose[3] = 0.0;
-      pre_pose[4] = 0.0;
-      pre_pose[5] = 0.0;
-      pre_pose[6] = 0.0;
-      pre_pose[7] = 0.0;
-      pre_pose[8] = 0.0;
-
-      ceres::Problem pre_problem;
-      ceres::Solver::Options pre_options;
-      ceres::Solver::Summary pre_summary;
-      // Horizontal data
-      ceres::DynamicAutoDiffCostFunction<pgo::ViveHorizontalCost, 4> * hcost =
-        new ceres::DynamicAutoDiffCostFunction<pgo::ViveHorizontalCost, 4>
-        (new pgo::ViveHorizontalCost(*pre_data[li_it->lighthouse].first,
-          lhTF,
-          // tracker_.imu_transform,
-          tracker_,
-          lighthouses_[li_it->lighthouse].horizontal_motor,
-          correction_));
-      hcost->AddParameterBlock(9);
-      hcost->SetNumResiduals(pre_data[li_it->lighthouse].first->samples.size());
-      pre_problem.AddResidualBlock(hcost, NULL, pre_pose);
-      // Vertical data
-      ceres::DynamicAutoDiffCostFunction<pgo::ViveVerticalCost, 4> * vcost =
-        new ceres::DynamicAutoDiffCostFunction<pgo::ViveVerticalCost, 4>
-        (new pgo::ViveVerticalCost(*pre_data[li_it->lighthouse].second,
-          lhTF,
-          // tracker_.imu_transform,
-          tracker_,
-          lighthouses_[li_it->lighthouse].vertical_motor,
-          correction_));
-      vcost->AddParameterBlock(9);
-      vcost->SetNumResiduals(pre_data[li_it->lighthouse].second->samples.size());
-      pre_problem.AddResidualBlock(vcost, NULL, pre_pose);
-      pre_options.minimizer_progress_to_stdout = false;
-      pre_options.max_num_iterations = 1000;
-      pre_options.max_solver_time_in_seconds = 1.0;
-      // std::cout << "PreSolve " << light_data_.size() << " "
-      //   << pre_data[li_it->lighthouse].first->samples.size() << " "
-      //   << pre_data[li_it->lighthouse].second->samples.size() << std::endl;
-      ceres::Solve(pre_options, &pre_problem, &pre_summary);
-      // Copy paste
-
-      // counter = 0;
-      // std::cout << "PRE_POSE" << std::endl;
-      // std::cout << counter << " "
-      //   << pre_summary.final_cost <<  " - "
-      //   << pre_pose[0] << ", "
-      //   << pre_pose[1] << ", "
-      //   << pre_pose[2] << ", "
-      //   << pre_pose[3] << ", "
-      //   << pre_pose[4] << ", "
-      //   << pre_pose[5] << ", "
-      //   << pre_pose[6] << ", "
-      //   << pre_pose[7] << ", "
-      //   << pre_pose[8] << std::endl;
-      //   counter++;
-
-      // Check it is a good pose
-      if (pre_summary.final_cost < 1e-5 * 
-        (pre_data[li_it->lighthouse].second->samples.size() +
-        pre_data[li_it->lighthouse].first->samples.size())) {
-        // Fill poses
-        while (pose_index < new_poses.size()) {
-          for (size_t i = 0; i < 9; i++)
-            new_poses[pose_index][i] = pre_pose[i];
-          pose_index++;
-        }
-        // pose_index = new_poses.size()-1;
-      }
-    }
-    li_it++;
+void PoseGraph::RemoveSweep(bool new_node) {
+  if (light_data_.Empty()) return;
+  LightFrame const& light = light_data_.Back();
+  if (new_node) {
+    // Its factors go with the pose, including the inertial one
+    pgo::Node & node = nodes_.back();
+    problem_->RemoveParameterBlock(node.pose);
+    pool_.Release(node.pose);
+    nodes_.pop_back();
+    if (!nodes_.empty()) nodes_.back().factors.pop_back();
+  } else if ((light.axis == HORIZONTAL || light.axis == VERTICAL)
+    && !nodes_.empty()) {
+    problem_->RemoveResidualBlock(nodes_.back().factors.back().id);
+    nodes_.back().factors.pop_back();
   }
+  light_data_.PopBack();
+  return;
+}
 
-  // If we want to force the first pose to be close
-  // to its previous estimate
-  if (valid_) {
-    for (size_t pose_idx = 0; pose_idx < poses_.size(); pose_idx++) {
-      for(size_t i = 0; i < 9; i++) {
-        new_poses[pose_idx][i] = poses_[pose_idx][i];
-      }
+void PoseGraph::Slide() {
+  // Inertial data already summarized
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (nodes_.size() > 0) imu_data_.Expire(nodes_.back().stamp);
+  lock.unlock();
+  // Window size
+  while (light_data_.Size() > window_) {
+    if (nodes_.size() > 1) {
+      Marginalize();
+      continue;
     }
-    for (size_t pose_idx = poses_.size(); pose_idx < new_poses.size(); pose_idx++) {
-      for(size_t i = 0; i < 9; i++) {
-        new_poses[pose_idx][i] = poses_.back()[i];
-      }
+    // A single pose - drop its oldest sweep
+    if (nodes_.empty()) break;
+    auto & factors = nodes_.front().factors;
+    auto factor_it = std::find_if(factors.begin(), factors.end(),
+      [](pgo::Factor const& f) { return f.light; });
+    if (factor_it != factors.end()) {
+      problem_->RemoveResidualBlock(factor_it->id);
+      factors.erase(factor_it);
     }
-    if (first_factor_ != 0) {
-      ceres::CostFunction * cost =
-        new ceres::AutoDiffCostFunction<pgo::ClosenessCost, 7, 9, 9>
-        (new pgo::ClosenessCost(first_factor_, 1.0));
-      problem.AddResidualBlock(cost, new ceres::CauchyLoss(0.05), poses_.front(), new_poses.front());
-      problem.SetParameterBlockConstant(poses_.front());
+    light_data_.PopFront();
+  }
+  return;
+}
+
+void PoseGraph::Marginalize() {
+  pgo::Node & node = nodes_.front();
+  // Free blocks sharing a factor with the marginalized pose
+  std::vector<double*> kept;
+  std::vector<int> sizes;
+  std::map<double*, size_t> offsets;
+  offsets[node.pose] = 0;
+  size_t size = POSE_SIZE;
+  for (auto const& factor : node.factors) {
+    for (auto block : factor.blocks) {
+      if (offsets.count(block) || problem_->IsParameterBlockConstant(block))
+        continue;
+      offsets[block] = size;
+      kept.push_back(block);
+      sizes.push_back(problem_->ParameterBlockSize(block));
+      size += sizes.back();
     }
-  } else if (pose_index != 0) {
-      while (pose_index < new_poses.size()) {
-        for (size_t i = 0; i < 9; i++)
-          new_poses[pose_index][i] = new_poses.front()[i];
-        pose_index++;
+  }
+
+  // Linearize its factors at the current estimate. The prior is kept even
+  // without a weight, or the window would lose its anchor.
+  if (kept.size() > 0) {
+    Eigen::MatrixXd H = Eigen::MatrixXd::Zero(size, size);
+    Eigen::VectorXd b = Eigen::VectorXd::Zero(size);
+    for (auto const& factor : node.factors) {
+      size_t num_blocks = factor.blocks.size();
+      Eigen::VectorXd residual(factor.cost->num_residuals());
+      std::vector<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+        Eigen::RowMajor>> J(num_blocks);
+      std::vector<double*> jacobians(num_blocks);
+      for (size_t i = 0; i < num_blocks; i++) {
+        J[i].resize(residual.size(), factor.cost->parameter_block_sizes()[i]);
+        jacobians[i] = J[i].data();
       }
+      if (!factor.cost->Evaluate(factor.blocks.data(),
+        residual.data(), jacobians.data())) continue;
+      // Robust loss as a weight
+      if (factor.loss != NULL) {
+        double rho[3];
+        factor.loss->Evaluate(residual.squaredNorm(), rho);
+        double weight = sqrt(rho[1]);
+        residual *= weight;
+        for (size_t i = 0; i < num_blocks; i++) J[i] *= weight;
+      }
+      for (size_t i = 0; i < num_blocks; i++) {
+        auto i_it = offsets.find(factor.blocks[i]);
+        if (i_it == offsets.end()) continue;
+        b.segment(i_it->second, J[i].cols()) += J[i].transpose() * residual;
+        for (size_t j = 0; j < num_blocks; j++) {
+          auto j_it = offsets.find(factor.blocks[j]);
+          if (j_it == offsets.end()) continue;
+          H.block(i_it->second, j_it->second, J[i].cols(), J[j].cols()) +=
+            J[i].transpose() * J[j];
+        }
+      }
+    }
+    // Schur complement of the marginalized pose
+    size_t rest = size - POSE_SIZE;
+    Eigen::MatrixXd Hmm = 0.5 * (H.topLeftCorner(POSE_SIZE, POSE_SIZE)
+      + H.topLeftCorner(POSE_SIZE, POSE_SIZE).transpose());
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(Hmm);
+    Eigen::VectorXd S_inv = (es.eigenvalues().array() > 1e-8).select(
+      es.eigenvalues().array().inverse(), 0.0);
+    Eigen::MatrixXd Hmm_inv = es.eigenvectors() * S_inv.asDiagonal()
+      * es.eigenvectors().transpose();
+    Eigen::MatrixXd Hrm = H.bottomLeftCorner(rest, POSE_SIZE);
+    Eigen::MatrixXd Hp = H.bottomRightCorner(rest, rest)
+      - Hrm * Hmm_inv * Hrm.transpose();
+    Eigen::VectorXd bp = b.tail(rest) - Hrm * Hmm_inv * b.head(POSE_SIZE);
+
+    // Replace the pose by the prior
+    problem_->RemoveParameterBlock(node.pose);
+    pool_.Release(node.pose);
+    nodes_.erase(nodes_.begin());
+    pgo::Factor factor;
+    factor.cost = new pgo::MarginalizationCost(kept, sizes, Hp, bp,
+      first_factor_ > 0 ? first_factor_ : 1.0);
+    factor.loss = NULL;
+    factor.blocks = kept;
+    factor.light = false;
+    factor.id = problem_->AddResidualBlock(factor.cost, NULL, factor.blocks);
+    nodes_.front().factors.push_back(factor);
+    prior_ = factor.id;
   } else {
-    return false;
+    problem_->RemoveParameterBlock(node.pose);
+    pool_.Release(node.pose);
+    nodes_.erase(nodes_.begin());
+    prior_ = NULL;
+  }
+
+  // Light data of the remaining poses
+  if (nodes_.size() > 0) light_data_.Expire(nodes_.front().stamp);
+  return;
+}
+
+void PoseGraph::RemovePrior() {
+  if (prior_ == NULL || nodes_.empty()) return;
+  auto & factors = nodes_.front().factors;
+  for (auto factor_it = factors.begin(); factor_it != factors.end();
+    factor_it++) {
+    if (factor_it->id != prior_) continue;
+    problem_->RemoveResidualBlock(prior_);
+    factors.erase(factor_it);
+    break;
+  }
+  prior_ = NULL;
+  return;
+}
+
+bool PoseGraph::Initialize() {
+  // The prior belongs to a lost estimate
+  RemovePrior();
+
+  // Preliminary light data - latest HORIZONTAL / VERTICAL of each lighthouse
+  std::map<int, std::pair<LightFrame*,LightFrame*>> pre_data;
+  for (size_t i = 0; i < light_data_.Size(); i++) {
+    LightFrame & light = light_data_[i];
+    if (light.axis == HORIZONTAL)
+      pre_data[light.lighthouse].first = &light;
+    else if (light.axis == VERTICAL)
+      pre_data[light.lighthouse].second = &light;
   }
 
+  // Closed form guess from the sweeps, refined per lighthouse below
+  double guess[9];
+  guess[0] = 0.0;
+  guess[1] = 0.0;
+  guess[2] = 1.0;
+  guess[3] = 0.0;
+  guess[4] = 0.0;
+  guess[5] = 0.0;
+  guess[6] = 0.0;
+  guess[7] = 0.0;
+  guess[8] = 0.0;
+  pnp::Initialize(light_data_, *calibration_, tracker_id_,
+    cost::POSE_IMU, correction_, guess);
+
+  for (auto const& pre : pre_data) {
+    if (pre.second.first == NULL || pre.second.second == NULL)
+      continue;
+    double pre_pose[9];
+    for (size_t i = 0; i < 9; i++)
+      pre_pose[i] = guess[i];
+
+    ceres::Problem pre_problem;
+    ceres::Solver::Options pre_options;
+    ceres::Solver::Summary pre_summary;
+    // Horizontal data
+    ceres::CostFunction * hcost = new cost::ViveLightCost(
+      *pre.second.first,
+      calibration_,
+      tracker_id_,
+      cost::POSE_IMU,
+      correction_);
+    pre_problem.AddResidualBlock(hcost, NULL, pre_pose);
+    // Vertical data
+    ceres::CostFunction * vcost = new cost::ViveLightCost(
+      *pre.second.second,
+      calibration_,
+      tracker_id_,
+      cost::POSE_IMU,
+      correction_);
+    pre_problem.AddResidualBlock(vcost, NULL, pre_pose);
+    pre_options.minimizer_progress_to_stdout = false;
+    pre_options.max_num_iterations = 1000;
+    pre_options.max_solver_time_in_seconds = 1.0;
+    ceres::Solve(pre_options, &pre_problem, &pre_summary);
+
+    // Check it is a good pose
+    if (pre_summary.final_cost < 1e-5 *
+      (pre.second.second->size +
+      pre.second.first->size)) {
+      // Fill poses
+      for (auto & node : nodes_)
+        for (size_t i = 0; i < POSE_SIZE; i++)
+          node.pose[i] = pre_pose[i];
+      return true;
+    }
+  }
+  return false;
+}
 
-  // counter = 0;
-  // std::cout << "PRE" << std::endl;
-  // for (auto pose : new_poses) {
-  //   std::cout << counter << " "
-  //     << summary.final_cost <<  " - "
-  //     << pose[0] << ", "
-  //     << pose[1] << ", "
-  //     << pose[2] << ", "
-  //     << pose[3] << ", "
-  //     << pose[4] << ", "
-  //     << pose[5] << ", "
-  //     << pose[6] << ", "
-  //     << pose[7] << ", "
-  //     << pose[8] << std::endl;
-  //     counter++;
-  // }
+bool PoseGraph::Solve() {
+  // Test if we have enough data
+  if (light_data_.Size() < window_) return true;
+  // First guess from light data alone
+  bool initialized = valid_;
+  if (!initialized && !Initialize()) return false;
 
+  ceres::Solver::Options options;
+  ceres::Solver::Summary summary;
   options.minimizer_progress_to_stdout = false;
-  options.minimizer_type = ceres::LINE_SEARCH;
-  options.line_search_direction_type = ceres::LBFGS;
-  if (valid_) {
-    options.max_num_iterations = 500;
-    options.max_solver_time_in_seconds = 5.0;
+  if (initialized) {
+    // Warm started - only the newest pose is far from its optimum, so the
+    // solve has to end before the next sweep is due
+    budget_.Start();
+    options.max_num_iterations = std::min<size_t>(50, budget_.Iterations());
+    options.max_solver_time_in_seconds = budget_.Seconds();
   } else {
+    options.minimizer_type = ceres::LINE_SEARCH;
+    options.line_search_direction_type = ceres::LBFGS;
     options.max_num_iterations = 2000;
     options.max_solver_time_in_seconds = 20.0;
   }
-  // std::cout << "Solve " << new_poses.size() << " " << light_data_.size() << std::endl;
-  problem.SetParameterBlockConstant(bias_acc);
-  problem.SetParameterBlockConstant(bias_ang);
-  ceres::Solve(options, &problem, &summary);
-  // std::cout << summary.BriefReport() << std::endl;
-
-
-  // counter = 0;
-  // std::cout << "POS" << std::endl;
-  // for (auto pose : new_poses) {
-  //   std::cout << counter << " "
-  //     << summary.final_cost <<  " - "
-  //     << pose[0] << ", "
-  //     << pose[1] << ", "
-  //     << pose[2] << ", "
-  //     << pose[3] << ", "
-  //     << pose[4] << ", "
-  //     << pose[5] << ", "
-  //     << pose[6] << ", "
-  //     << pose[7] << ", "
-  //     << pose[8] << std::endl;
-  //     counter++;
-  // }
-
+  ceres::Solve(options, problem_.get(), &summary);
+  if (initialized) {
+    budget_.Stop(summary.num_successful_steps
+      + summary.num_unsuccessful_steps,
+      summary.termination_type == ceres::CONVERGENCE);
+    std::lock_guard<std::mutex> lock(mutex_);
+    counters_ = budget_.GetCounters();
+  }
 
   last_cost_ = summary.final_cost;
 
   // Save pose -- light frame in the vive frame
-  pose_.header.stamp = light_data_.back().header.stamp;
-  pose_.header.frame_id = "vive";
-  pose_.child_frame_id = tracker_.serial;
-  // The computed pose
-  Eigen::Vector3d vPi(new_poses.back()[0],
-    new_poses.back()[1],
-    new_poses.back()[2]);
-  Eigen::Vector3d vAi(new_poses.back()[6],
-    new_poses.back()[7],
-    new_poses.back()[8]);
-  Eigen::AngleAxisd vAAi(vAi.norm(), vAi.normalized());
-  Eigen::Matrix3d vRi = vAAi.toRotationMatrix();
-  // Imu to light
-  Eigen::Vector3d tPi(tracker_.imu_transform.translation.x,
-    tracker_.imu_transform.translation.y,
-    tracker_.imu_transform.translation.z);
-  Eigen::Quaterniond tQi(tracker_.imu_transform.rotation.w,
-    tracker_.imu_transform.rotation.x,
-    tracker_.imu_transform.rotation.y,
-    tracker_.imu_transform.rotation.z);
-  Eigen::Matrix3d tRi = tQi.toRotationMatrix();
-
-  // Convert frames
-  Eigen::Vector3d vPt = vRi * ( - tRi.transpose() * tPi ) + vPi;
-  Eigen::Matrix3d vRt = vRi * tRi.transpose();
-  Eigen::Quaterniond vQt(vRt);
-  // Save to ROS msg
-  pose_.transform.translation.x = vPt(0);
-  pose_.transform.translation.y = vPt(1);
-  pose_.transform.translation.z = vPt(2);
-  pose_.transform.rotation.w = vQt.w();
-  pose_.transform.rotation.x = vQt.x();
-  pose_.transform.rotation.y = vQt.y();
-  pose_.transform.rotation.z = vQt.z();
-
-  if (!Valid()) return false;
-
-  poses_.clear();
-  for (size_t i = 0; i < new_poses.size(); i++)
-    poses_.push_back(new_poses[i]);
-
-  return true;
+  double * last_pose = nodes_.back().pose;
+  pgo::State state;
+  state.stamp = light_data_.Back().stamp;
+  state.vPi = Eigen::Vector3d(last_pose[0], last_pose[1], last_pose[2]);
+  state.vVi = Eigen::Vector3d(last_pose[3], last_pose[4], last_pose[5]);
+  ceres::AngleAxisToRotationMatrix(&last_pose[6], state.vRi.data());
+  ToTransform(state, pose_);
+
+  return Valid();
 }
 
 void PoseGraph::PrintState() {
@@ -1150,13 +1021,15 @@ void PoseGraph::PrintState() {
   //   std::cout << "NOT VALID" << std::endl;
   //   return;
   // }
+  if (nodes_.empty()) return;
+  double * pose = nodes_.back().pose;
   std::cout << last_cost_ <<  " - "
-    << poses_.back()[0] << ", "
-    << poses_.back()[1] << ", "
-    << poses_.back()[2] << ", "
-    << poses_.back()[6] << ", "
-    << poses_.back()[7] << ", "
-    << poses_.back()[8] << std::endl;
+    << pose[0] << ", "
+    << pose[1] << ", "
+    << pose[2] << ", "
+    << pose[6] << ", "
+    << pose[7] << ", "
+    << pose[8] << std::endl;
   return;
 }
 
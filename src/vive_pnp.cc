@@ -0,0 +1,303 @@
+#include <hive/vive_pnp.h>
+
+namespace pnp {
+  namespace {
+    typedef Eigen::Matrix<double, 12, 1> Vector12d;
+    typedef Eigen::Matrix<double, 12, 12> Matrix12d;
+    typedef Eigen::Matrix<double, 6, 1> Vector6d;
+    typedef Eigen::Matrix<double, 6, 10> Matrix6x10d;
+
+    // Pairs of control points with a distance constraint
+    const size_t kPairs[6][2] = {{0, 1}, {0, 2}, {0, 3},
+      {1, 2}, {1, 3}, {2, 3}};
+
+    // Distances of the control points as a linear function of the products
+    // of the betas [b00 b01 b11 b02 b12 b22 b03 b13 b23 b33]
+    void Distances(Vector12d const* v, Matrix6x10d * L) {
+      for (size_t p = 0; p < 6; p++) {
+        Eigen::Vector3d dv[4];
+        for (size_t k = 0; k < 4; k++)
+          dv[k] = v[k].segment<3>(3 * kPairs[p][0])
+            - v[k].segment<3>(3 * kPairs[p][1]);
+        (*L)(p, 0) = dv[0].dot(dv[0]);
+        (*L)(p, 1) = 2.0 * dv[0].dot(dv[1]);
+        (*L)(p, 2) = dv[1].dot(dv[1]);
+        (*L)(p, 3) = 2.0 * dv[0].dot(dv[2]);
+        (*L)(p, 4) = 2.0 * dv[1].dot(dv[2]);
+        (*L)(p, 5) = dv[2].dot(dv[2]);
+        (*L)(p, 6) = 2.0 * dv[0].dot(dv[3]);
+        (*L)(p, 7) = 2.0 * dv[1].dot(dv[3]);
+        (*L)(p, 8) = 2.0 * dv[2].dot(dv[3]);
+        (*L)(p, 9) = dv[3].dot(dv[3]);
+      }
+      return;
+    }
+
+    // First guess of the betas with one, two or three null vectors
+    bool Approximate(size_t dims,
+      Matrix6x10d const& L,
+      Vector6d const& rho,
+      Eigen::Vector4d * b) {
+      b->setZero();
+      if (dims == 1) {
+        Eigen::Matrix<double, 6, 4> A;
+        A << L.col(0), L.col(1), L.col(3), L.col(6);
+        Eigen::Vector4d x = A.colPivHouseholderQr().solve(rho);
+        double sign = (x(0) < 0.0) ? -1.0 : 1.0;
+        (*b)(0) = sqrt(sign * x(0));
+        if ((*b)(0) <= 0.0) return false;
+        for (size_t k = 1; k < 4; k++) (*b)(k) = sign * x(k) / (*b)(0);
+        return true;
+      }
+      Eigen::Matrix<double, 6, 5> A;
+      A << L.col(0), L.col(1), L.col(2), L.col(3), L.col(4);
+      Eigen::Matrix<double, 5, 1> x;
+      if (dims == 2)
+        x << A.leftCols<3>().colPivHouseholderQr().solve(rho), 0.0, 0.0;
+      else
+        x = A.colPivHouseholderQr().solve(rho);
+      if (x(0) < 0.0) {
+        (*b)(0) = sqrt(-x(0));
+        (*b)(1) = (x(2) < 0.0) ? sqrt(-x(2)) : 0.0;
+      } else {
+        (*b)(0) = sqrt(x(0));
+        (*b)(1) = (x(2) > 0.0) ? sqrt(x(2)) : 0.0;
+      }
+      if (x(1) < 0.0) (*b)(0) = - (*b)(0);
+      if ((*b)(0) == 0.0) return false;
+      if (dims == 3) (*b)(2) = x(3) / (*b)(0);
+      return true;
+    }
+
+    // Refine the betas on the distance constraints
+    void GaussNewton(Matrix6x10d const& L,
+      Vector6d const& rho,
+      Eigen::Vector4d * beta) {
+      Eigen::Vector4d & b = *beta;
+      for (size_t it = 0; it < PNP_GN_ITERATIONS; it++) {
+        Eigen::Matrix<double, 6, 4> A;
+        Vector6d r;
+        for (size_t i = 0; i < 6; i++) {
+          Eigen::Matrix<double, 1, 10> l = L.row(i);
+          A(i, 0) = 2 * l(0) * b(0) + l(1) * b(1) + l(3) * b(2) + l(6) * b(3);
+          A(i, 1) = l(1) * b(0) + 2 * l(2) * b(1) + l(4) * b(2) + l(7) * b(3);
+          A(i, 2) = l(3) * b(0) + l(4) * b(1) + 2 * l(5) * b(2) + l(8) * b(3);
+          A(i, 3) = l(6) * b(0) + l(7) * b(1) + l(8) * b(2) + 2 * l(9) * b(3);
+          r(i) = rho(i) - (l(0) * b(0) * b(0) + l(1) * b(0) * b(1)
+            + l(2) * b(1) * b(1) + l(3) * b(0) * b(2)
+            + l(4) * b(1) * b(2) + l(5) * b(2) * b(2)
+            + l(6) * b(0) * b(3) + l(7) * b(1) * b(3)
+            + l(8) * b(2) * b(3) + l(9) * b(3) * b(3));
+        }
+        b += A.colPivHouseholderQr().solve(r);
+      }
+      return;
+    }
+
+    // Pose from the betas and its RMS error, infinite if behind
+    double Recover(Vector12d const* v,
+      Eigen::Vector4d const& b,
+      Eigen::Vector4d const* alphas,
+      Eigen::Vector3d const* bPs,
+      Eigen::Vector2d const* xy,
+      size_t n,
+      Eigen::Matrix3d * lRb,
+      Eigen::Vector3d * lPb) {
+      // Control points in the lighthouse frame
+      Eigen::Vector3d cc[4];
+      for (size_t j = 0; j < 4; j++) {
+        cc[j].setZero();
+        for (size_t k = 0; k < 4; k++)
+          cc[j] += b(k) * v[k].segment<3>(3 * j);
+      }
+      // Points in front of the lighthouse
+      Eigen::Vector3d lPs[TRACKER_SENSORS_NUMBER];
+      double depth = 0.0;
+      for (size_t i = 0; i < n; i++) {
+        lPs[i] = alphas[i](0) * cc[0] + alphas[i](1) * cc[1]
+          + alphas[i](2) * cc[2] + alphas[i](3) * cc[3];
+        depth += lPs[i](2);
+      }
+      if (depth < 0.0)
+        for (size_t i = 0; i < n; i++) lPs[i] = - lPs[i];
+      // Rigid transform between both point sets
+      Eigen::Vector3d bc = Eigen::Vector3d::Zero();
+      Eigen::Vector3d lc = Eigen::Vector3d::Zero();
+      for (size_t i = 0; i < n; i++) {
+        bc += bPs[i];
+        lc += lPs[i];
+      }
+      bc /= n;
+      lc /= n;
+      Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+      for (size_t i = 0; i < n; i++)
+        H += (bPs[i] - bc) * (lPs[i] - lc).transpose();
+      Eigen::JacobiSVD<Eigen::Matrix3d> svd(H,
+        Eigen::ComputeFullU | Eigen::ComputeFullV);
+      Eigen::Matrix3d D = Eigen::Matrix3d::Identity();
+      D(2, 2) = (svd.matrixV() * svd.matrixU().transpose()).determinant();
+      *lRb = svd.matrixV() * D * svd.matrixU().transpose();
+      *lPb = lc - *lRb * bc;
+      // Error of the ideal coordinates
+      double error = 0.0;
+      for (size_t i = 0; i < n; i++) {
+        Eigen::Vector3d q = *lRb * bPs[i] + *lPb;
+        if (q(2) <= 0.0) return INFINITY;
+        error += (q.head<2>() / q(2) - xy[i]).squaredNorm();
+      }
+      return sqrt(error / n);
+    }
+  }
+
+  bool EPnP(Eigen::Vector3d const* bPs,
+    Eigen::Vector2d const* xy,
+    size_t n,
+    Eigen::Matrix3d * lRb,
+    Eigen::Vector3d * lPb,
+    double * error) {
+    if (n < 4 || n > TRACKER_SENSORS_NUMBER) return false;
+    // Control points - centroid and principal directions of the points
+    Eigen::Vector3d cw[4];
+    cw[0].setZero();
+    for (size_t i = 0; i < n; i++) cw[0] += bPs[i];
+    cw[0] /= n;
+    Eigen::Matrix3d C = Eigen::Matrix3d::Zero();
+    for (size_t i = 0; i < n; i++)
+      C += (bPs[i] - cw[0]) * (bPs[i] - cw[0]).transpose();
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> pca(C);
+    double largest = pca.eigenvalues()(2);
+    if (!(largest > 0.0)) return false;
+    // Planar sets keep a small third direction
+    Eigen::Matrix3d B;
+    for (size_t j = 0; j < 3; j++) {
+      double lambda = std::max(pca.eigenvalues()(2 - j), 1e-4 * largest);
+      B.col(j) = sqrt(lambda / n) * pca.eigenvectors().col(2 - j);
+      cw[j + 1] = cw[0] + B.col(j);
+    }
+    // Barycentric coordinates and the projection constraints
+    Eigen::Matrix3d Binv = B.inverse();
+    Eigen::Vector4d alphas[TRACKER_SENSORS_NUMBER];
+    Matrix12d MtM = Matrix12d::Zero();
+    for (size_t i = 0; i < n; i++) {
+      Eigen::Vector3d a = Binv * (bPs[i] - cw[0]);
+      alphas[i] << 1.0 - a.sum(), a;
+      Vector12d r1 = Vector12d::Zero();
+      Vector12d r2 = Vector12d::Zero();
+      for (size_t j = 0; j < 4; j++) {
+        r1(3 * j) = alphas[i](j);
+        r1(3 * j + 2) = - alphas[i](j) * xy[i](0);
+        r2(3 * j + 1) = alphas[i](j);
+        r2(3 * j + 2) = - alphas[i](j) * xy[i](1);
+      }
+      MtM += r1 * r1.transpose() + r2 * r2.transpose();
+    }
+    // Control points in the lighthouse frame span the null space
+    Eigen::SelfAdjointEigenSolver<Matrix12d> null(MtM);
+    Vector12d v[4];
+    for (size_t k = 0; k < 4; k++) v[k] = null.eigenvectors().col(k);
+    Matrix6x10d L;
+    Distances(v, &L);
+    Vector6d rho;
+    for (size_t p = 0; p < 6; p++)
+      rho(p) = (cw[kPairs[p][0]] - cw[kPairs[p][1]]).squaredNorm();
+    // Best of the null space dimensions
+    double best = INFINITY;
+    for (size_t dims = 1; dims <= 3; dims++) {
+      Eigen::Vector4d b;
+      if (!Approximate(dims, L, rho, &b)) continue;
+      GaussNewton(L, rho, &b);
+      Eigen::Matrix3d R;
+      Eigen::Vector3d t;
+      double e = Recover(v, b, alphas, bPs, xy, n, &R, &t);
+      if (e < best) {
+        best = e;
+        *lRb = R;
+        *lPb = t;
+      }
+    }
+    if (!std::isfinite(best)) return false;
+    if (error) *error = best;
+    return true;
+  }
+
+  BearingSolver::BearingSolver() {
+    min_sensors = PNP_MIN_SENSORS;
+    max_error = PNP_MAX_ERROR;
+    Clear();
+    return;
+  }
+
+  void BearingSolver::Clear() {
+    num_views_ = 0;
+    return;
+  }
+
+  bool BearingSolver::AddLight(LightFrame const& frame,
+    LighthouseModel const& lighthouse) {
+    if (frame.axis != HORIZONTAL && frame.axis != VERTICAL) return false;
+    if (!lighthouse.has_pose) return false;
+    size_t k = 0;
+    while (k < num_views_ && views_[k].lighthouse != &lighthouse) k++;
+    if (k == num_views_) {
+      if (num_views_ == PNP_MAX_LIGHTHOUSES) return false;
+      views_[k].lighthouse = &lighthouse;
+      views_[k].has[HORIZONTAL] = false;
+      views_[k].has[VERTICAL] = false;
+      num_views_++;
+    }
+    views_[k].sweeps[frame.axis] = frame;
+    views_[k].has[frame.axis] = true;
+    return true;
+  }
+
+  bool BearingSolver::Solve(TrackerSnapshot const& tracker,
+    cost::PoseBlock pose_block,
+    bool correction,
+    double * pose) const {
+    Eigen::Vector3d const* points = (pose_block == cost::POSE_IMU) ?
+      tracker.iPs : tracker.tPs;
+    double best = max_error;
+    Eigen::Matrix3d vRb;
+    Eigen::Vector3d vPb;
+    for (size_t k = 0; k < num_views_; k++) {
+      View const& view = views_[k];
+      if (!view.has[HORIZONTAL] || !view.has[VERTICAL]) continue;
+      LightFrame const& horizontal = view.sweeps[HORIZONTAL];
+      LightFrame const& vertical = view.sweeps[VERTICAL];
+      // Vertical angle of each sensor
+      int match[TRACKER_SENSORS_NUMBER];
+      for (size_t s = 0; s < TRACKER_SENSORS_NUMBER; s++) match[s] = -1;
+      for (size_t i = 0; i < vertical.size; i++)
+        if (tracker.HasSensor(vertical.sensors[i]))
+          match[vertical.sensors[i]] = i;
+      // Sensors seen on both sweeps
+      Eigen::Vector3d bPs[TRACKER_SENSORS_NUMBER];
+      Eigen::Vector2d xy[TRACKER_SENSORS_NUMBER];
+      size_t n = 0;
+      for (size_t i = 0; i < horizontal.size; i++) {
+        uint8_t sensor = horizontal.sensors[i];
+        if (!tracker.HasSensor(sensor) || match[sensor] < 0) continue;
+        bPs[n] = points[sensor];
+        xy[n] = view.lighthouse->Unproject(horizontal.angles[i],
+          vertical.angles[match[sensor]], correction);
+        match[sensor] = -1;
+        n++;
+      }
+      if (n < min_sensors) continue;
+      Eigen::Matrix3d lRb;
+      Eigen::Vector3d lPb;
+      double error;
+      if (!EPnP(bPs, xy, n, &lRb, &lPb, &error) || error >= best) continue;
+      best = error;
+      vRb = view.lighthouse->vRl * lRb;
+      vPb = view.lighthouse->vRl * lPb + view.lighthouse->vPl;
+    }
+    if (best >= max_error) return false;
+    Eigen::AngleAxisd vAb(vRb);
+    for (size_t i = 0; i < 3; i++) {
+      pose[i] = vPb(i);
+      pose[pose_block - 3 + i] = vAb.angle() * vAb.axis()(i);
+    }
+    return true;
+  }
+} // namespace pnp
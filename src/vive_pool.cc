@@ -0,0 +1,174 @@
+#include <hive/vive_pool.h>
+
+// Worker running on this thread, used to keep rescheduled strands local
+static thread_local WorkPool * current_pool = NULL;
+static thread_local size_t current_index = 0;
+
+namespace pool {
+  Strand::Strand() {
+    scheduled_ = false;
+  }
+}
+
+WorkPool::WorkPool(size_t threads) {
+  if (threads == 0) threads = std::thread::hardware_concurrency();
+  if (threads == 0) threads = 1;
+  ready_ = 0;
+  busy_ = 0;
+  next_ = 0;
+  active_ = true;
+  counters_.executed = 0;
+  counters_.stolen = 0;
+  for (size_t i = 0; i < threads; i++)
+    queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+  for (size_t i = 0; i < threads; i++)
+    threads_.push_back(std::thread(&WorkPool::WorkerThread, this, i));
+}
+
+WorkPool::~WorkPool() {
+  mutex_.lock();
+  active_ = false;
+  mutex_.unlock();
+  condition_.notify_all();
+  for (auto & thread : threads_)
+    thread.join();
+}
+
+std::shared_ptr<pool::Strand> WorkPool::NewStrand() {
+  return std::make_shared<pool::Strand>();
+}
+
+void WorkPool::Post(std::shared_ptr<pool::Strand> const& strand,
+  pool::Task task) {
+  strand->mutex_.lock();
+  strand->tasks_.push_back(std::move(task));
+  // Only an idle strand needs a worker, a scheduled one picks the task up
+  bool schedule = !strand->scheduled_;
+  strand->scheduled_ = true;
+  strand->mutex_.unlock();
+  if (schedule) Schedule(strand);
+  return;
+}
+
+void WorkPool::Wait(std::shared_ptr<pool::Strand> const& strand) {
+  std::unique_lock<std::mutex> lock(strand->mutex_);
+  strand->idle_.wait(lock, [&strand] { return !strand->scheduled_; });
+  return;
+}
+
+void WorkPool::Wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return ready_ == 0 && busy_ == 0; });
+  return;
+}
+
+size_t WorkPool::Size() const {
+  return threads_.size();
+}
+
+PoolCounters WorkPool::GetCounters() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return counters_;
+}
+
+void WorkPool::Schedule(std::shared_ptr<pool::Strand> const& strand) {
+  size_t index;
+  // Counted before it is queued, so that Wait() never sees the pool idle
+  // with the strand in a queue. A worker reserving it early waits in Take.
+  mutex_.lock();
+  if (current_pool == this) {
+    // Posted from a task, keep it on this worker
+    index = current_index;
+  } else {
+    index = next_++ % queues_.size();
+  }
+  ready_++;
+  mutex_.unlock();
+  queues_[index]->mutex.lock();
+  queues_[index]->strands.push_back(strand);
+  queues_[index]->mutex.unlock();
+  condition_.notify_one();
+  return;
+}
+
+std::shared_ptr<pool::Strand> WorkPool::Take(size_t index) {
+  std::shared_ptr<pool::Strand> strand;
+  // A reserved strand is in some queue, it may take a few rounds to find
+  // it if others are stealing at the same time
+  while (true) {
+    Queue & own = *queues_[index];
+    own.mutex.lock();
+    if (!own.strands.empty()) {
+      strand = own.strands.front();
+      own.strands.pop_front();
+    }
+    own.mutex.unlock();
+    if (strand) return strand;
+    for (size_t i = 1; i < queues_.size(); i++) {
+      Queue & victim = *queues_[(index + i) % queues_.size()];
+      victim.mutex.lock();
+      if (!victim.strands.empty()) {
+        strand = victim.strands.back();
+        victim.strands.pop_back();
+      }
+      victim.mutex.unlock();
+      if (strand) {
+        mutex_.lock();
+        counters_.stolen++;
+        mutex_.unlock();
+        return strand;
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+
+bool WorkPool::Run(std::shared_ptr<pool::Strand> const& strand) {
+  for (size_t i = 0; i < POOL_BUDGET; i++) {
+    strand->mutex_.lock();
+    if (strand->tasks_.empty()) {
+      strand->scheduled_ = false;
+      strand->mutex_.unlock();
+      strand->idle_.notify_all();
+      return false;
+    }
+    pool::Task task = std::move(strand->tasks_.front());
+    strand->tasks_.pop_front();
+    strand->mutex_.unlock();
+    task();
+    mutex_.lock();
+    counters_.executed++;
+    mutex_.unlock();
+  }
+  return true;
+}
+
+void WorkPool::WorkerThread(size_t index) {
+  current_pool = this;
+  current_index = index;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    // Leave only once the remaining work is done
+    condition_.wait(lock, [this] { return !active_ || ready_ > 0; });
+    if (ready_ == 0) break;
+    // Reserve a strand
+    ready_--;
+    busy_++;
+    lock.unlock();
+    std::shared_ptr<pool::Strand> strand = Take(index);
+    // Out of budget, back of the line behind the other strands
+    if (Run(strand)) {
+      queues_[index]->mutex.lock();
+      queues_[index]->strands.push_back(strand);
+      queues_[index]->mutex.unlock();
+      lock.lock();
+      ready_++;
+      condition_.notify_one();
+    } else {
+      lock.lock();
+    }
+    busy_--;
+    if (ready_ == 0 && busy_ == 0) idle_.notify_all();
+  }
+  return;
+}
@@ -0,0 +1,144 @@
+#include <hive/vive_preintegration.h>
+
+namespace preintegration {
+  Eigen::Matrix3d Skew(Eigen::Vector3d const& v) {
+    Eigen::Matrix3d S;
+    S << 0.0, -v(2), v(1),
+      v(2), 0.0, -v(0),
+      -v(1), v(0), 0.0;
+    return S;
+  }
+
+  Eigen::Matrix3d Exp(Eigen::Vector3d const& phi) {
+    double theta = phi.norm();
+    // Taylor expansion close to the identity
+    if (theta < 1e-10)
+      return Eigen::Matrix3d::Identity() + Skew(phi);
+    return Eigen::AngleAxisd(theta, phi / theta).toRotationMatrix();
+  }
+
+  Eigen::Matrix3d RightJacobian(Eigen::Vector3d const& phi) {
+    Eigen::Matrix3d K = Skew(phi);
+    double theta2 = phi.squaredNorm();
+    // Taylor expansion close to the identity
+    if (theta2 < 1e-12)
+      return Eigen::Matrix3d::Identity() - 0.5 * K + K * K / 6.0;
+    double theta = sqrt(theta2);
+    return Eigen::Matrix3d::Identity()
+      - (1.0 - cos(theta)) / theta2 * K
+      + (theta - sin(theta)) / (theta2 * theta) * K * K;
+  }
+
+  ImuPreintegration::ImuPreintegration() {
+    Reset(Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero());
+  }
+
+  ImuPreintegration::ImuPreintegration(Eigen::Vector3d const& acc_bias,
+    Eigen::Vector3d const& gyr_bias) {
+    Reset(acc_bias, gyr_bias);
+  }
+
+  void ImuPreintegration::Reset(Eigen::Vector3d const& acc_bias,
+    Eigen::Vector3d const& gyr_bias) {
+    this->acc_bias = acc_bias;
+    this->gyr_bias = gyr_bias;
+    dt = 0.0;
+    samples = 0;
+    dR.setIdentity();
+    dV.setZero();
+    dP.setZero();
+    dR_dbg.setZero();
+    dV_dba.setZero();
+    dV_dbg.setZero();
+    dP_dba.setZero();
+    dP_dbg.setZero();
+    covariance.setZero();
+    return;
+  }
+
+  void ImuPreintegration::Integrate(Eigen::Vector3d const& acc,
+    Eigen::Vector3d const& gyr,
+    double dt) {
+    if (dt <= 0.0) return;
+    double dt2 = dt * dt;
+    // Acceleration in the imu frame, vV' = g + vRi iA'
+    Eigen::Vector3d iA = acc_bias - acc;
+    // Rotation during the sample
+    Eigen::Vector3d phi = (gyr - gyr_bias) * dt;
+    Eigen::Matrix3d Rk = Exp(phi);
+    Eigen::Matrix3d Jr = RightJacobian(phi);
+    Eigen::Matrix3d dRA = dR * Skew(iA);
+
+    // Noise propagation of [dtheta, dV, dP]
+    Matrix9d A = Matrix9d::Identity();
+    A.block<3, 3>(0, 0) = Rk.transpose();
+    A.block<3, 3>(3, 0) = - dRA * dt;
+    A.block<3, 3>(6, 0) = - 0.5 * dRA * dt2;
+    A.block<3, 3>(6, 3) = Eigen::Matrix3d::Identity() * dt;
+    Eigen::Matrix<double, 9, 3> Bg = Eigen::Matrix<double, 9, 3>::Zero();
+    Bg.block<3, 3>(0, 0) = Jr * dt;
+    Eigen::Matrix<double, 9, 3> Ba = Eigen::Matrix<double, 9, 3>::Zero();
+    Ba.block<3, 3>(3, 0) = dR * dt;
+    Ba.block<3, 3>(6, 0) = 0.5 * dR * dt2;
+    covariance = A * covariance * A.transpose()
+      + pow(PREINTEGRATION_GYR_NOISE, 2) / dt * Bg * Bg.transpose()
+      + pow(PREINTEGRATION_ACC_NOISE, 2) / dt * Ba * Ba.transpose();
+
+    // Bias Jacobians - they use the deltas before this sample
+    dP_dba += dV_dba * dt + 0.5 * dR * dt2;
+    dP_dbg += dV_dbg * dt - 0.5 * dRA * dR_dbg * dt2;
+    dV_dba += dR * dt;
+    dV_dbg -= dRA * dR_dbg * dt;
+    dR_dbg = Rk.transpose() * dR_dbg - Jr * dt;
+
+    // Deltas
+    dP += dV * dt + 0.5 * dR * iA * dt2;
+    dV += dR * iA * dt;
+    dR = dR * Rk;
+    this->dt += dt;
+    samples++;
+    return;
+  }
+
+  void ImuPreintegration::Integrate(sensor_msgs::Imu const& msg, double dt) {
+    Integrate(Eigen::Vector3d(msg.linear_acceleration.x,
+        msg.linear_acceleration.y,
+        msg.linear_acceleration.z),
+      Eigen::Vector3d(msg.angular_velocity.x,
+        msg.angular_velocity.y,
+        msg.angular_velocity.z),
+      dt);
+    return;
+  }
+
+  Eigen::Matrix3d ImuPreintegration::DeltaR(
+    Eigen::Vector3d const& gyr_bias) const {
+    return dR * Exp(dR_dbg * (gyr_bias - this->gyr_bias));
+  }
+
+  Eigen::Vector3d ImuPreintegration::DeltaV(Eigen::Vector3d const& acc_bias,
+    Eigen::Vector3d const& gyr_bias) const {
+    return dV + dV_dba * (acc_bias - this->acc_bias)
+      + dV_dbg * (gyr_bias - this->gyr_bias);
+  }
+
+  Eigen::Vector3d ImuPreintegration::DeltaP(Eigen::Vector3d const& acc_bias,
+    Eigen::Vector3d const& gyr_bias) const {
+    return dP + dP_dba * (acc_bias - this->acc_bias)
+      + dP_dbg * (gyr_bias - this->gyr_bias);
+  }
+
+  void ImuPreintegration::Predict(Eigen::Vector3d const& vPi,
+    Eigen::Vector3d const& vVi,
+    Eigen::Matrix3d const& vRi,
+    geometry_msgs::Vector3 const& gravity,
+    Eigen::Vector3d & vPj,
+    Eigen::Vector3d & vVj,
+    Eigen::Matrix3d & vRj) const {
+    Eigen::Vector3d vG(gravity.x, gravity.y, gravity.z);
+    vPj = vPi + vVi * dt + 0.5 * vG * dt * dt + vRi * dP;
+    vVj = vVi + vG * dt + vRi * dV;
+    vRj = vRi * dR;
+    return;
+  }
+}
@@ -0,0 +1,190 @@
+#include <hive/vive_ransac.h>
+
+namespace ransac {
+  SweepFilter::SweepFilter() {
+    threshold = RANSAC_THRESHOLD;
+    confidence = RANSAC_CONFIDENCE;
+    max_hypotheses = RANSAC_MAX_HYPOTHESES;
+    state_ = 2463534242u;
+    counters_.sweeps = 0;
+    counters_.unchecked = 0;
+    counters_.samples = 0;
+    counters_.outliers = 0;
+    counters_.hypotheses = 0;
+    return;
+  }
+
+  InlierCounters SweepFilter::GetCounters() const {
+    return counters_;
+  }
+
+  uint32_t SweepFilter::Random() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 17;
+    state_ ^= state_ << 5;
+    return state_;
+  }
+
+  double SweepFilter::Residual(uint8_t axis,
+    double angle,
+    Eigen::Vector3d const& tPs,
+    Eigen::Matrix3d const& lRt,
+    Eigen::Vector3d const& lPt,
+    LighthouseModel const& lighthouse,
+    bool correction) {
+    Eigen::Vector3d lPs = lRt * tPs + lPt;
+    if (lPs(2) <= 0.0) return INFINITY;
+    double x = lPs(0) / lPs(2);
+    double y = lPs(1) / lPs(2);
+    if (axis == HORIZONTAL)
+      return angle - LighthouseModel::Angle(x, y,
+        lighthouse.motors[HORIZONTAL], correction);
+    return angle - LighthouseModel::Angle(y, x,
+      lighthouse.motors[VERTICAL], correction);
+  }
+
+  size_t SweepFilter::Score(LightFrame const& frame,
+    LightFrame const& partner,
+    TrackerSnapshot const& tracker,
+    Eigen::Matrix3d const& lRt,
+    Eigen::Vector3d const& lPt,
+    LighthouseModel const& lighthouse,
+    bool correction,
+    bool * inliers) const {
+    size_t score = 0;
+    LightFrame const* sweeps[2] = {&frame, &partner};
+    size_t k = 0;
+    for (size_t j = 0; j < 2; j++) {
+      LightFrame const& sweep = *sweeps[j];
+      for (size_t i = 0; i < sweep.size; i++, k++) {
+        uint8_t sensor = sweep.sensors[i];
+        inliers[k] = tracker.HasSensor(sensor) && fabs(Residual(sweep.axis,
+          sweep.angles[i], tracker.tPs[sensor], lRt, lPt,
+          lighthouse, correction)) < threshold;
+        if (inliers[k]) score++;
+      }
+    }
+    return score;
+  }
+
+  bool SweepFilter::Filter(LightFrame * frame,
+    LightFrame const& partner,
+    TrackerSnapshot const& tracker,
+    LighthouseModel const& lighthouse,
+    bool correction) {
+    if (frame->axis == partner.axis
+      || (frame->axis != HORIZONTAL && frame->axis != VERTICAL)
+      || (partner.axis != HORIZONTAL && partner.axis != VERTICAL)) {
+      counters_.unchecked++;
+      return false;
+    }
+    // Samples are scored frame first, then partner
+    LightFrame const& horizontal =
+      (frame->axis == HORIZONTAL) ? *frame : partner;
+    LightFrame const& vertical =
+      (frame->axis == VERTICAL) ? *frame : partner;
+    size_t h_offset = (frame->axis == HORIZONTAL) ? 0 : frame->size;
+    size_t v_offset = (frame->axis == VERTICAL) ? 0 : frame->size;
+    // Bearings of the sensors seen by both sweeps
+    int match[TRACKER_SENSORS_NUMBER];
+    for (size_t s = 0; s < TRACKER_SENSORS_NUMBER; s++) match[s] = -1;
+    for (size_t i = 0; i < vertical.size; i++)
+      if (tracker.HasSensor(vertical.sensors[i]))
+        match[vertical.sensors[i]] = i;
+    Eigen::Vector3d bPs[TRACKER_SENSORS_NUMBER];
+    Eigen::Vector2d xy[TRACKER_SENSORS_NUMBER];
+    size_t pairs[TRACKER_SENSORS_NUMBER][2];
+    size_t n = 0;
+    for (size_t i = 0; i < horizontal.size; i++) {
+      uint8_t sensor = horizontal.sensors[i];
+      if (!tracker.HasSensor(sensor) || match[sensor] < 0) continue;
+      bPs[n] = tracker.tPs[sensor];
+      xy[n] = lighthouse.Unproject(horizontal.angles[i],
+        vertical.angles[match[sensor]], correction);
+      pairs[n][0] = h_offset + i;
+      pairs[n][1] = v_offset + match[sensor];
+      match[sensor] = -1;
+      n++;
+    }
+    // A minimal set alone cannot be checked
+    if (n <= RANSAC_SAMPLE) {
+      counters_.unchecked++;
+      return false;
+    }
+    // Hypotheses from minimal sets, as many as the inlier share asks for
+    size_t total = frame->size + partner.size;
+    bool inliers[2 * TRACKER_SENSORS_NUMBER];
+    bool best_inliers[2 * TRACKER_SENSORS_NUMBER];
+    size_t best = 0;
+    size_t hypotheses = max_hypotheses;
+    size_t tried = 0;
+    Eigen::Matrix3d lRt;
+    Eigen::Vector3d lPt;
+    for (size_t h = 0; h < hypotheses; h++) {
+      Eigen::Vector3d sPs[RANSAC_SAMPLE];
+      Eigen::Vector2d sxy[RANSAC_SAMPLE];
+      size_t set[RANSAC_SAMPLE];
+      for (size_t k = 0; k < RANSAC_SAMPLE; k++) {
+        bool repeated = true;
+        while (repeated) {
+          set[k] = Random() % n;
+          repeated = false;
+          for (size_t j = 0; j < k; j++)
+            repeated = repeated || set[j] == set[k];
+        }
+        sPs[k] = bPs[set[k]];
+        sxy[k] = xy[set[k]];
+      }
+      tried++;
+      if (!pnp::EPnP(sPs, sxy, RANSAC_SAMPLE, &lRt, &lPt)) continue;
+      size_t score = Score(*frame, partner, tracker, lRt, lPt,
+        lighthouse, correction, inliers);
+      if (score <= best) continue;
+      best = score;
+      for (size_t k = 0; k < total; k++) best_inliers[k] = inliers[k];
+      double miss = 1.0 - pow(static_cast<double>(best) / total,
+        RANSAC_SAMPLE);
+      if (miss <= 0.0) break;
+      hypotheses = std::min(max_hypotheses, static_cast<size_t>(
+        ceil(log(1.0 - confidence) / log(miss))));
+    }
+    // Refit on the sensors with both samples inside
+    if (best > 0) {
+      size_t m = 0;
+      for (size_t j = 0; j < n; j++) {
+        if (!best_inliers[pairs[j][0]] || !best_inliers[pairs[j][1]])
+          continue;
+        bPs[m] = bPs[j];
+        xy[m] = xy[j];
+        m++;
+      }
+      if (m > RANSAC_SAMPLE && pnp::EPnP(bPs, xy, m, &lRt, &lPt)) {
+        size_t score = Score(*frame, partner, tracker, lRt, lPt,
+          lighthouse, correction, inliers);
+        if (score >= best) {
+          best = score;
+          for (size_t k = 0; k < total; k++) best_inliers[k] = inliers[k];
+        }
+      }
+    }
+    counters_.hypotheses += tried;
+    // Without a clear majority the labels are not trusted
+    if (best < RANSAC_MIN_SUPPORT * total) {
+      counters_.unchecked++;
+      return false;
+    }
+    // Keep the inliers of the frame
+    size_t size = 0;
+    for (size_t i = 0; i < frame->size; i++) {
+      if (!best_inliers[i]) continue;
+      frame->sensors[size] = frame->sensors[i];
+      frame->angles[size] = frame->angles[i];
+      size++;
+    }
+    counters_.sweeps++;
+    counters_.samples += frame->size;
+    counters_.outliers += frame->size - size;
+    frame->size = size;
+    return true;
+  }
+} // namespace ransac
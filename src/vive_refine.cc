@@ -8,281 +8,6 @@ typedef std::map<std::string, std::pair<hive::ViveLight*,
   hive::ViveLight*>> LightMap;
 
 namespace refine {
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveHorizontalCost
-  {
-  public:
-    // Constructor
-    ViveHorizontalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl, // vive to lighthouse
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveHorizontalCost();
-    // Ceres operator
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-    geometry_msgs::Transform vTl_;
-  };
-
-  ViveHorizontalCost::ViveHorizontalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    vTl_ = vTl;
-    return;
-  }
-
-  ViveHorizontalCost::~ViveHorizontalCost() {
-    // Do nothing
-    return;
-  }
-
-  template <typename T>
-  bool ViveHorizontalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-    // std::cout << "vPi"
-      // << vPi(0) << ", "
-      // << vPi(1) << ", "
-      // << vPi(2) << std::endl;
-    // std::cout << "vRi"
-      // << vRi(0,0) << ", "
-      // << vRi(0,1) << ", "
-      // << vRi(0,2) << std::endl;
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << T(vTl_.translation.x),
-      T(vTl_.translation.y),
-      T(vTl_.translation.z);
-    Eigen::Quaternion<T> vQl(
-      T(vTl_.rotation.w),
-      T(vTl_.rotation.x),
-      T(vTl_.rotation.y),
-      T(vTl_.rotation.z));
-    Eigen::Matrix<T, 3, 3> vRl;
-    vRl = vQl.toRotationMatrix();
-    // std::cout << "vPl"
-      // << vPl(0) << ", "
-      // << vPl(1) << ", "
-      // << vPl(2) << std::endl;
-    // std::cout << "vRl"
-      // << vRl(0,0) << ", "
-      // << vRl(0,1) << ", "
-      // << vRl(0,2) << std::endl;
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-    // std::cout << "vPi"
-      // << vPi(0) << ", "
-      // << vPi(1) << ", "
-      // << vPi(2) << std::endl;
-    // std::cout << "vRi"
-      // << vRi(0,0) << ", "
-      // << vRi(0,1) << ", "
-      // << vRi(0,2) << std::endl;
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
-    return true;
-  }
-
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveVerticalCost
-  {
-  public:
-    // Constructor
-    ViveVerticalCost(hive::ViveLight data,
-      geometry_msgs::Transform vTl, // Vive to lighthouse
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveVerticalCost();
-    // Ceres operator
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-    geometry_msgs::Transform vTl_;
-  };
-
-  ViveVerticalCost::ViveVerticalCost(hive::ViveLight data,
-    geometry_msgs::Transform vTl,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    vTl_ = vTl;
-    return;
-  }
-
-  ViveVerticalCost::~ViveVerticalCost() {
-    // Do nothing
-    return;
-  }
-
-  template <typename T>
-  bool ViveVerticalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << T(vTl_.translation.x),
-      T(vTl_.translation.y),
-      T(vTl_.translation.z);
-    Eigen::Quaternion<T> vQl(
-      T(vTl_.rotation.w),
-      T(vTl_.rotation.x),
-      T(vTl_.rotation.y),
-      T(vTl_.rotation.z));
-    Eigen::Matrix<T, 3, 3> vRl;
-    vRl = vQl.toRotationMatrix();
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
-
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
-    return true;
-  }
-
   // Inertial cost function
   class InertialCost {
   public:
@@ -475,241 +200,6 @@ namespace refine {
     return true;
   }
 
-
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveCalibrationHorizontalCost
-  {
-  public:
-    // Constructor
-    ViveCalibrationHorizontalCost(hive::ViveLight data,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveCalibrationHorizontalCost();
-    // Ceres operator - First parameters are Vive Pose, second are lighthouse pose
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-  };
-
-  ViveCalibrationHorizontalCost::ViveCalibrationHorizontalCost(hive::ViveLight data,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    return;
-  }
-
-  ViveCalibrationHorizontalCost::~ViveCalibrationHorizontalCost() {
-    // Do nothing
-    return;
-  }
-
-  template <typename T>
-  bool ViveCalibrationHorizontalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << parameters[1][0],
-      parameters[1][1],
-      parameters[1][2];
-    Eigen::Matrix<T, 3, 3> vRl;
-    ceres::AngleAxisToRotationMatrix(&parameters[1][3], vRl.data());
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
-    return true;
-  }
-
-  // Light cost - Cost using the poses from the imu frame to the vive frame
-  class ViveCalibrationVerticalCost
-  {
-  public:
-    // Constructor
-    ViveCalibrationVerticalCost(hive::ViveLight data,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-    // Destructor
-    ~ViveCalibrationVerticalCost();
-    // Ceres operator - First parameters are Vive Pose, second are lighthouse pose
-    template <typename T>
-    bool operator()(const T* const * parameters, T* residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-  };
-
-  ViveCalibrationVerticalCost::ViveCalibrationVerticalCost(hive::ViveLight data,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction) {
-    lighthouse_ = lighthouse;
-    correction_ = correction;
-    tracker_ = tracker;
-    data_ = data;
-    return;
-  }
-
-  ViveCalibrationVerticalCost::~ViveCalibrationVerticalCost() {
-    // Do nothing
-    return;
-  }
-
-  template <typename T>
-  bool ViveCalibrationVerticalCost::operator()(const T* const * parameters,
-    T* residual) const {
-    // Optimization parameters
-    Eigen::Matrix<T, 3, 1> vPi;
-    vPi << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRi;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][6], vRi.data());
-
-    // Lighthouse pose
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << parameters[1][0],
-      parameters[1][1],
-      parameters[1][2];
-    Eigen::Matrix<T, 3, 3> vRl;
-    ceres::AngleAxisToRotationMatrix(&parameters[1][3], vRl.data());
-
-    // Inertial transform
-    Eigen::Matrix<T,3,1> tPi;
-    tPi << T(tracker_.imu_transform.translation.x),
-      T(tracker_.imu_transform.translation.y),
-      T(tracker_.imu_transform.translation.z);
-    Eigen::Quaternion<T> tQi(
-      T(tracker_.imu_transform.rotation.w),
-      T(tracker_.imu_transform.rotation.x),
-      T(tracker_.imu_transform.rotation.y),
-      T(tracker_.imu_transform.rotation.z));
-    Eigen::Matrix<T, 3, 3> tRi;
-    tRi = tQi.toRotationMatrix();
-
-    // Invert inertial transform
-    Eigen::Matrix<T,3,1> iPt = - tRi.transpose() * tPi;
-    Eigen::Matrix<T,3,3> iRt = tRi.transpose();
-
-    // Vive and IMU frame to lighthouse and tracker
-    Eigen::Matrix<T, 3, 1> lPv;
-    lPv = - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRv;
-    lRv = vRl.transpose();
-    Eigen::Matrix<T, 3, 1> lPt;
-    lPt = lRv * (vRi * iPt + vPi) + lPv;
-    Eigen::Matrix<T, 3, 3> lRt;
-    lRt = lRv * vRi * iRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
-
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
-    return true;
-  }
-
-
   // How close the poses should be to each other
   class SmoothingCost {
   public:
@@ -877,252 +367,6 @@ namespace refine {
       sqrt(1e-3 + aa[0] * aa[0] + aa[1] * aa[1] + aa[2] * aa[2]);
     return true;
   }
-
-
-  class PoseHorizontalCost {
-  public:
-    explicit PoseHorizontalCost(hive::ViveLight data,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-
-    template <typename T> bool operator()(const T* const * parameters,
-      T * residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-  };
-
-  class PoseVerticalCost {
-  public:
-    explicit PoseVerticalCost(hive::ViveLight data,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction);
-
-    template <typename T> bool operator()(const T* const * parameters,
-      T * residual) const;
-  private:
-    bool correction_;
-    Tracker tracker_;
-    Motor lighthouse_;
-    hive::ViveLight data_;
-  };
-
-  PoseHorizontalCost::PoseHorizontalCost(hive::ViveLight data,
-      Tracker tracker,
-      Motor lighthouse,
-      bool correction) {
-      data_ = data;
-      correction_ = correction;
-      tracker_ = tracker;
-      lighthouse_ = lighthouse;
-    }
-
-  template <typename T> bool PoseHorizontalCost::operator()(const T* const * parameters,
-    T * residual) const {
-    // Pose of the tracker in the vive frame
-    Eigen::Matrix<T, 3, 1> vPt;
-    vPt << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRt;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][3], vRt.data());
-    // Pose of the lighthouse in the vive frame
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << parameters[1][0],
-      parameters[1][1],
-      parameters[1][2];
-    Eigen::Matrix<T, 3, 3> vRl;
-    ceres::AngleAxisToRotationMatrix(&parameters[1][3], vRl.data());
-
-    Eigen::Matrix<T, 3, 1> lPt = vRl.transpose() * vPt - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRt = vRl.transpose() * vRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
-
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
-    return true;
-  }
-
-  // template <typename T> bool PoseHorizontalCost::operator()(const T* const * parameters,
-  //   T * residual) const {
-  //   Eigen::Matrix<T, 3, 1> lPt;
-  //   lPt << parameters[0][0],
-  //     parameters[0][1],
-  //     parameters[0][2];
-  //   Eigen::Matrix<T, 3, 3> lRt;
-  //   ceres::AngleAxisToRotationMatrix(&parameters[0][3], lRt.data());
-
-  //   size_t counter = 0;
-  //   for (auto li_it = data_.samples.begin();
-  //     li_it != data_.samples.end(); li_it++) {
-  //     auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-  //     if (sensor_it == tracker_.sensors.end()) return false;
-  //     Eigen::Matrix<T, 3, 1> tPs;
-  //     tPs << T(sensor_it->second.position.x),
-  //       T(sensor_it->second.position.y),
-  //       T(sensor_it->second.position.z);
-
-  //     Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-  //     T ang; // The final angle
-  //     T x = (lPs(0)/lPs(2)); // Horizontal angle
-  //     T y = (lPs(1)/lPs(2)); // Vertical angle
-  //     T phase = T(lighthouse_.phase);
-  //     T tilt = T(lighthouse_.tilt);
-  //     T gib_phase = T(lighthouse_.gib_phase);
-  //     T gib_mag = T(lighthouse_.gib_magnitude);
-  //     T curve = T(lighthouse_.curve);
-
-  //     if (correction_) {
-  //       ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-  //     } else {
-  //       ang = atan(x);
-  //     }
-
-
-  //     residual[counter] = T(li_it->angle) - ang;
-  //     counter++;
-  //   }
-  //   return true;
-  // }
-
-  PoseVerticalCost::PoseVerticalCost(hive::ViveLight data,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction) {
-    data_ = data;
-    correction_ = correction;
-    tracker_ = tracker;
-    lighthouse_ = lighthouse;
-  }
-
-  template <typename T> bool PoseVerticalCost::operator()(const T* const * parameters,
-    T * residual) const {
-    // Pose of the tracker in the vive frame
-    Eigen::Matrix<T, 3, 1> vPt;
-    vPt << parameters[0][0],
-      parameters[0][1],
-      parameters[0][2];
-    Eigen::Matrix<T, 3, 3> vRt;
-    ceres::AngleAxisToRotationMatrix(&parameters[0][3], vRt.data());
-    // Pose of the lighthouse in the vive frame
-    Eigen::Matrix<T, 3, 1> vPl;
-    vPl << parameters[1][0],
-      parameters[1][1],
-      parameters[1][2];
-    Eigen::Matrix<T, 3, 3> vRl;
-    ceres::AngleAxisToRotationMatrix(&parameters[1][3], vRl.data());
-
-    Eigen::Matrix<T, 3, 1> lPt = vRl.transpose() * vPt - vRl.transpose() * vPl;
-    Eigen::Matrix<T, 3, 3> lRt = vRl.transpose() * vRt;
-
-    size_t counter = 0;
-    for (auto li_it = data_.samples.begin();
-      li_it != data_.samples.end(); li_it++) {
-      auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-      if (sensor_it == tracker_.sensors.end()) return false;
-      Eigen::Matrix<T, 3, 1> tPs;
-      tPs << T(sensor_it->second.position.x),
-        T(sensor_it->second.position.y),
-        T(sensor_it->second.position.z);
-
-      Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE * lighthouse_.phase);
-      T tilt = T(SCALE_TILT * lighthouse_.tilt);
-      T curve = T(SCALE_CURVE * lighthouse_.curve);
-      T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-      T gib_phase = T(lighthouse_.gib_phase);
-
-      if (correction_) {
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
-
-      residual[counter] = T(li_it->angle) - ang;
-      counter++;
-    }
-    return true;
-  }
-
-  // template <typename T> bool PoseVerticalCost::operator()(const T* const * parameters,
-  //   T * residual) const {
-  //   Eigen::Matrix<T, 3, 1> lPt;
-  //   lPt << parameters[0][0],
-  //     parameters[0][1],
-  //     parameters[0][2];
-  //   Eigen::Matrix<T, 3, 3> lRt;
-  //   ceres::AngleAxisToRotationMatrix(&parameters[0][3], lRt.data());
-
-  //   size_t counter = 0;
-  //   for (auto li_it = data_.samples.begin();
-  //     li_it != data_.samples.end(); li_it++) {
-  //     auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-  //     if (sensor_it == tracker_.sensors.end()) return false;
-  //     Eigen::Matrix<T, 3, 1> tPs;
-  //     tPs << T(sensor_it->second.position.x),
-  //       T(sensor_it->second.position.y),
-  //       T(sensor_it->second.position.z);
-
-  //     Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-  //     T ang; // The final angle
-  //     T x = (lPs(0)/lPs(2)); // Horizontal angle
-  //     T y = (lPs(1)/lPs(2)); // Vertical angle
-  //     T phase = T(lighthouse_.phase);
-  //     T tilt = T(lighthouse_.tilt);
-  //     T gib_phase = T(lighthouse_.gib_phase);
-  //     T gib_mag = T(lighthouse_.gib_magnitude);
-  //     T curve = T(lighthouse_.curve);
-
-  //     if (correction_) {
-  //       ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-  //     } else {
-  //       ang = atan(y);
-  //     }
-
-  //     residual[counter] = T(li_it->angle) - ang;
-  //     counter++;
-  //   }
-  //   return true;
-  // }
-
 }
 
 Refinery::Refinery(Calibration & calibration) {
@@ -1247,6 +491,12 @@ bool Refinery::SolveInertial() {
     lighthouses[lighthouse.first][5] = vAAl.angle() * vAAl.axis()(2);
   }
 
+  // Compiled calibration shared by the cost functions
+  CalibrationSnapshot::Ptr snapshot = CalibrationSnapshot::Create(
+    calibration_.environment,
+    calibration_.lighthouses,
+    calibration_.trackers);
+
   std::cout << "Reading...\n" << std::flush;
   for (auto tracker_data : data_) {
     // std::cout << "Tracker " << tracker_data.first << std::endl;
@@ -1374,35 +624,22 @@ bool Refinery::SolveInertial() {
 
         // Horizontal data
         double sample_counter = 0.0;
-        for (auto light : pre_data) {
-          geometry_msgs::Transform lighthouse;
-          lighthouse.translation =
-            calibration_.environment.lighthouses[light.lighthouse].translation;
-          lighthouse.rotation =
-            calibration_.environment.lighthouses[light.lighthouse].rotation;
+        for (auto const& light : pre_data) {
           if (light.axis == HORIZONTAL) {
-            ceres::DynamicAutoDiffCostFunction<refine::ViveHorizontalCost, 4> * hcost =
-              new ceres::DynamicAutoDiffCostFunction<refine::ViveHorizontalCost, 4>
-              (new refine::ViveHorizontalCost(light,
-                lighthouse,
-                tracker,
-                calibration_.lighthouses[light.lighthouse].horizontal_motor,
-                correction_));
-            hcost->AddParameterBlock(9);
-            hcost->SetNumResiduals(light.samples.size());
+            ceres::CostFunction * hcost = new cost::ViveLightCost(light,
+              snapshot,
+              tracker_data.first,
+              cost::POSE_IMU,
+              correction_);
             pre_problem.AddResidualBlock(hcost, NULL, poses[tracker.serial].back());
             sample_counter += light.samples.size();
           } else if (light.axis == VERTICAL) {
             // Vertical data
-            ceres::DynamicAutoDiffCostFunction<refine::ViveVerticalCost, 4> * vcost =
-              new ceres::DynamicAutoDiffCostFunction<refine::ViveVerticalCost, 4>
-              (new refine::ViveVerticalCost(light,
-                lighthouse,
-                tracker,
-                calibration_.lighthouses[light.lighthouse].vertical_motor,
-                correction_));
-            vcost->AddParameterBlock(9);
-            vcost->SetNumResiduals(light.samples.size());
+            ceres::CostFunction * vcost = new cost::ViveLightCost(light,
+              snapshot,
+              tracker_data.first,
+              cost::POSE_IMU,
+              correction_);
             pre_problem.AddResidualBlock(vcost, NULL, poses[tracker.serial].back());
             sample_counter += light.samples.size();
           }
@@ -1454,30 +691,24 @@ bool Refinery::SolveInertial() {
 
       // Cost related to light measurements
       if (li_it->axis == HORIZONTAL) {
-        // std::cout << "ViveCalibrationHorizontalCost " << next_counter << std::endl;
-        ceres::DynamicAutoDiffCostFunction<refine::ViveCalibrationHorizontalCost, 4> * hcost =
-          new ceres::DynamicAutoDiffCostFunction<refine::ViveCalibrationHorizontalCost, 4>
-          (new refine::ViveCalibrationHorizontalCost(*li_it,
-            tracker,
-            calibration_.lighthouses[li_it->lighthouse].horizontal_motor,
-            correction_));
-        hcost->AddParameterBlock(9);
-        hcost->AddParameterBlock(6);
-        hcost->SetNumResiduals(li_it->samples.size());
+        // Lighthouse pose is optimized - the snapshot pose is ignored
+        ceres::CostFunction * hcost = new cost::ViveLightCost(*li_it,
+          snapshot,
+          tracker_data.first,
+          cost::POSE_IMU,
+          correction_,
+          cost::LH_POSE);
         problem.AddResidualBlock(hcost, new ceres::CauchyLoss(0.5),
           poses[tracker.serial][poses[tracker.serial].size()-1],
           lighthouses[li_it->lighthouse]);
       } else if (li_it->axis == VERTICAL) {
-        // std::cout << "ViveCalibrationVerticalCost " << next_counter << std::endl;
-        ceres::DynamicAutoDiffCostFunction<refine::ViveCalibrationVerticalCost, 4> * vcost =
-          new ceres::DynamicAutoDiffCostFunction<refine::ViveCalibrationVerticalCost, 4>
-          (new refine::ViveCalibrationVerticalCost(*li_it,
-            tracker,
-            calibration_.lighthouses[li_it->lighthouse].vertical_motor,
-            correction_));
-        vcost->AddParameterBlock(9);
-        vcost->AddParameterBlock(6);
-        vcost->SetNumResiduals(li_it->samples.size());
+        // Lighthouse pose is optimized - the snapshot pose is ignored
+        ceres::CostFunction * vcost = new cost::ViveLightCost(*li_it,
+          snapshot,
+          tracker_data.first,
+          cost::POSE_IMU,
+          correction_,
+          cost::LH_POSE);
         problem.AddResidualBlock(vcost, new ceres::CauchyLoss(0.5),
           poses[tracker.serial][poses[tracker.serial].size()-1],
           lighthouses[li_it->lighthouse]);
@@ -1617,6 +848,13 @@ bool Refinery::SolveStatic() {
     vTl[lh_it->first][4] = vAl.axis()(1) * vAl.angle();
     vTl[lh_it->first][5] = vAl.axis()(2) * vAl.angle();
   }
+  // Compiled calibration shared by the cost functions. The lighthouse
+  // poses are optimized, so the snapshot poses are ignored.
+  CalibrationSnapshot::Ptr snapshot = CalibrationSnapshot::Create(
+    calibration_.environment,
+    calibration_.lighthouses,
+    calibration_.trackers);
+
   // first -- horizontal observations
   // second -- vertical observations
   // Vector to save the poses
@@ -1657,27 +895,23 @@ bool Refinery::SolveStatic() {
         poses.back()[5] = 0;
         ceres::Problem pre_problem;
         // Horizontal
-        ceres::DynamicAutoDiffCostFunction<refine::PoseHorizontalCost, 4> * hcost =
-          new ceres::DynamicAutoDiffCostFunction<refine::PoseHorizontalCost, 4>
-          (new refine::PoseHorizontalCost(*observations[li_it->lighthouse].first,
-            calibration_.trackers[tr_it->first],
-            calibration_.lighthouses[li_it->lighthouse].horizontal_motor,
-            correction_));
-        hcost->AddParameterBlock(6);
-        hcost->AddParameterBlock(6);
-        hcost->SetNumResiduals(observations[li_it->lighthouse].first->samples.size());
+        ceres::CostFunction * hcost = new cost::ViveLightCost(
+          *observations[li_it->lighthouse].first,
+          snapshot,
+          tr_it->first,
+          cost::POSE_TRACKER,
+          correction_,
+          cost::LH_POSE);
         pre_problem.AddResidualBlock(hcost, new ceres::CauchyLoss(0.05), poses.back(),
           vTl[li_it->lighthouse]);
         // Vertical
-        ceres::DynamicAutoDiffCostFunction<refine::PoseVerticalCost, 4> * vcost =
-          new ceres::DynamicAutoDiffCostFunction<refine::PoseVerticalCost, 4>
-          (new refine::PoseVerticalCost(*observations[li_it->lighthouse].second,
-            calibration_.trackers[tr_it->first],
-            calibration_.lighthouses[li_it->lighthouse].vertical_motor,
-            correction_));
-        vcost->AddParameterBlock(6);
-        vcost->AddParameterBlock(6);
-        vcost->SetNumResiduals(observations[li_it->lighthouse].second->samples.size());
+        ceres::CostFunction * vcost = new cost::ViveLightCost(
+          *observations[li_it->lighthouse].second,
+          snapshot,
+          tr_it->first,
+          cost::POSE_TRACKER,
+          correction_,
+          cost::LH_POSE);
         pre_problem.AddResidualBlock(vcost, new ceres::CauchyLoss(0.05), poses.back(),
           vTl[li_it->lighthouse]);
         // Not solving for lighthouses
@@ -1716,29 +950,23 @@ bool Refinery::SolveStatic() {
       // Horizontal cost
       if (li_it->axis == HORIZONTAL) {
         // std::cout << "Light H " << li_it->lighthouse << std::endl;
-        ceres::DynamicAutoDiffCostFunction<refine::PoseHorizontalCost, 4> * hcost =
-          new ceres::DynamicAutoDiffCostFunction<refine::PoseHorizontalCost, 4>
-          (new refine::PoseHorizontalCost(*li_it,
-            calibration_.trackers[tr_it->first],
-            calibration_.lighthouses[li_it->lighthouse].horizontal_motor,
-            correction_));
-        hcost->AddParameterBlock(6);
-        hcost->AddParameterBlock(6);
-        hcost->SetNumResiduals(li_it->samples.size());
+        ceres::CostFunction * hcost = new cost::ViveLightCost(*li_it,
+          snapshot,
+          tr_it->first,
+          cost::POSE_TRACKER,
+          correction_,
+          cost::LH_POSE);
         problem.AddResidualBlock(hcost, new ceres::CauchyLoss(0.05), poses.back(),
           vTl[li_it->lighthouse]);
       // Vertical cost
       } else if (li_it->axis == VERTICAL) {
         // std::cout << "Light V " << li_it->lighthouse << std::endl;
-        ceres::DynamicAutoDiffCostFunction<refine::PoseVerticalCost, 4> * vcost =
-          new ceres::DynamicAutoDiffCostFunction<refine::PoseVerticalCost, 4>
-          (new refine::PoseVerticalCost(*li_it,
-            calibration_.trackers[tr_it->first],
-            calibration_.lighthouses[li_it->lighthouse].vertical_motor,
-            correction_));
-        vcost->AddParameterBlock(6);
-        vcost->AddParameterBlock(6);
-        vcost->SetNumResiduals(li_it->samples.size());
+        ceres::CostFunction * vcost = new cost::ViveLightCost(*li_it,
+          snapshot,
+          tr_it->first,
+          cost::POSE_TRACKER,
+          correction_,
+          cost::LH_POSE);
         problem.AddResidualBlock(vcost, new ceres::CauchyLoss(0.05), poses.back(),
           vTl[li_it->lighthouse]);
       }
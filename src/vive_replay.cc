@@ -0,0 +1,275 @@
+// Hive imports
+#include <hive/vive_replay.h>
+#include <hive/vive_general.h>
+
+// Libsurvive interface
+extern "C" {
+  #include <deepdive/deepdive.h>
+}
+
+// ROS includes
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+// ROS messages
+#include <hive/ViveLight.h>
+#include <sensor_msgs/Imu.h>
+
+// C includes
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+// C++11 includes
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Inverse of the bridge's imu scaling
+#define REPLAY_GRAVITY 9.80665
+#define REPLAY_GYRO_SCALE 32.768
+#define REPLAY_ACC_SCALE 4096.0
+// Sensors per replayed sweep
+#define REPLAY_SENSORS 32
+
+// Recorded light or imu message, as the deepdive callbacks would see it
+struct ReplayEvent {
+  enum {LIGHT, IMU} type;
+  double time;                   // Since the first message (s)
+  size_t tracker;
+  size_t lighthouse;
+  uint8_t axis;
+  uint16_t num_sensors;
+  uint16_t sensors[REPLAY_SENSORS];
+  uint32_t angles[REPLAY_SENSORS];
+  uint16_t lengths[REPLAY_SENSORS];
+  uint32_t timecode;
+  int16_t acc[3];
+  int16_t gyr[3];
+};
+
+struct Driver {
+  light_fn light;
+  imu_fn imu;
+  lighthouse_fn lighthouse;
+  tracker_fn tracker;
+  size_t context;
+  size_t next;                   // Next event of the context to fire
+  bool started;
+  double cpu;                    // Cpu time of the poll thread so far (s)
+};
+
+// Loaded by Open(), one replay per process like the real driver
+static std::vector<ReplayEvent> events_;
+static std::vector<std::vector<size_t>> contexts_; // Events of each context
+static std::vector<struct Tracker> trackers_;
+static std::vector<std::vector<struct Lighthouse>> lighthouses_; // By context
+static double rate_ = 1.0;
+static std::mutex mutex_;        // Guards the members below
+static replay::Stats stats_;
+static size_t opened_ = 0;       // Contexts handed out
+static size_t finished_ = 0;     // Contexts replayed to the end
+static bool started_ = false;
+static std::chrono::steady_clock::time_point start_; // First poll of all
+
+namespace replay {
+  bool Open(std::string const& bag, double rate, size_t contexts) {
+    if (rate <= 0.0 || contexts == 0) return false;
+    rosbag::Bag rbag;
+    rbag.open(bag, rosbag::bagmode::Read);
+    events_.clear();
+    trackers_.clear();
+    lighthouses_.clear();
+    rate_ = rate;
+    std::map<std::string, size_t> trackers, lighthouses;
+    // Same handles for the same serial, as the driver does
+    auto tracker_index = [&trackers](std::string const& serial) {
+      auto it = trackers.find(serial);
+      if (it != trackers.end()) return it->second;
+      struct Tracker tracker;
+      memset(&tracker, 0, sizeof(tracker));
+      strncpy(tracker.serial, serial.c_str(), sizeof(tracker.serial) - 1);
+      trackers_.push_back(tracker);
+      return trackers[serial] = trackers_.size() - 1;
+    };
+    std::vector<struct Lighthouse> found;
+    auto lighthouse_index = [&lighthouses, &found](std::string const& serial) {
+      auto it = lighthouses.find(serial);
+      if (it != lighthouses.end()) return it->second;
+      struct Lighthouse lighthouse;
+      memset(&lighthouse, 0, sizeof(lighthouse));
+      strncpy(lighthouse.serial, serial.c_str(),
+        sizeof(lighthouse.serial) - 1);
+      found.push_back(lighthouse);
+      return lighthouses[serial] = found.size() - 1;
+    };
+
+    std::vector<std::string> topics;
+    topics.push_back(std::string("/") + TOPIC_HIVE_LIGHT);
+    topics.push_back(std::string("/") + TOPIC_HIVE_IMU);
+    rosbag::View view(rbag, rosbag::TopicQuery(topics));
+    ros::Time first;
+    for (auto bag_it = view.begin(); bag_it != view.end(); bag_it++) {
+      if (events_.empty()) first = bag_it->getTime();
+      ReplayEvent event;
+      event.time = (bag_it->getTime() - first).toSec();
+      // 48 MHz device clock
+      event.timecode = static_cast<uint32_t>(
+        static_cast<uint64_t>(event.time * 48e6));
+      const hive::ViveLight::ConstPtr vl =
+        bag_it->instantiate<hive::ViveLight>();
+      if (vl != NULL) {
+        event.type = ReplayEvent::LIGHT;
+        event.tracker = tracker_index(vl->header.frame_id);
+        event.lighthouse = lighthouse_index(vl->lighthouse);
+        event.axis = vl->axis;
+        event.num_sensors = std::min<size_t>(vl->samples.size(),
+          REPLAY_SENSORS);
+        for (uint16_t i = 0; i < event.num_sensors; i++) {
+          event.sensors[i] = vl->samples[i].sensor;
+          event.angles[i] = lround(vl->samples[i].angle / LIGHT_TICK_ANGLE
+            + LIGHT_TICK_CENTER);
+          event.lengths[i] = lround(vl->samples[i].length /
+            LIGHT_TICK_LENGTH);
+        }
+        events_.push_back(event);
+      }
+      const sensor_msgs::Imu::ConstPtr vi =
+        bag_it->instantiate<sensor_msgs::Imu>();
+      if (vi != NULL) {
+        event.type = ReplayEvent::IMU;
+        event.tracker = tracker_index(vi->header.frame_id);
+        double acc = REPLAY_ACC_SCALE / REPLAY_GRAVITY;
+        double gyr = REPLAY_GYRO_SCALE * 180.0 / M_PI;
+        event.acc[0] = lround(vi->linear_acceleration.x * acc);
+        event.acc[1] = lround(vi->linear_acceleration.y * acc);
+        event.acc[2] = lround(vi->linear_acceleration.z * acc);
+        event.gyr[0] = lround(vi->angular_velocity.x * gyr);
+        event.gyr[1] = lround(vi->angular_velocity.y * gyr);
+        event.gyr[2] = lround(vi->angular_velocity.z * gyr);
+        events_.push_back(event);
+      }
+    }
+    rbag.close();
+    // Each context numbers the lighthouses in its own order of discovery, as
+    // the driver does, so the contexts disagree on the ids
+    lighthouses_.assign(contexts, found);
+    for (size_t c = 0; c < contexts; c++)
+      for (size_t i = 0; i < found.size(); i++)
+        lighthouses_[c][i].id = (i + c) % found.size();
+    // Trackers dealt over the contexts like devices over USB controllers
+    contexts_.assign(contexts, std::vector<size_t>());
+    for (size_t i = 0; i < events_.size(); i++)
+      contexts_[events_[i].tracker % contexts].push_back(i);
+    ROS_INFO("Replay: %zu events of %zu trackers and %zu lighthouses"
+      " over %zu contexts", events_.size(), trackers_.size(),
+      found.size(), contexts);
+    std::lock_guard<std::mutex> lock(mutex_);
+    memset(&stats_, 0, sizeof(stats_));
+    opened_ = 0;
+    finished_ = 0;
+    started_ = false;
+    return !events_.empty();
+  }
+
+  Stats GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+}
+
+extern "C" {
+
+struct Driver * deepdive_init() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (opened_ == contexts_.size()) return NULL;
+  struct Driver * drv = new struct Driver();
+  drv->context = opened_++;
+  drv->cpu = 0.0;
+  drv->light = NULL;
+  drv->imu = NULL;
+  drv->lighthouse = NULL;
+  drv->tracker = NULL;
+  drv->next = 0;
+  drv->started = false;
+  return drv;
+}
+
+void deepdive_install_light_fn(struct Driver * drv, light_fn fn) {
+  drv->light = fn;
+}
+
+void deepdive_install_imu_fn(struct Driver * drv, imu_fn fn) {
+  drv->imu = fn;
+}
+
+void deepdive_install_lighthouse_fn(struct Driver * drv, lighthouse_fn fn) {
+  drv->lighthouse = fn;
+}
+
+void deepdive_install_tracker_fn(struct Driver * drv, tracker_fn fn) {
+  drv->tracker = fn;
+}
+
+int deepdive_poll(struct Driver * drv) {
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  std::vector<size_t> const& schedule = contexts_[drv->context];
+  // Devices announce themselves before sending data
+  if (!drv->started) {
+    drv->started = true;
+    mutex_.lock();
+    if (!started_) start_ = now;
+    started_ = true;
+    mutex_.unlock();
+    for (auto & lighthouse : lighthouses_[drv->context])
+      if (drv->lighthouse) drv->lighthouse(&lighthouse);
+    for (size_t i = drv->context; i < trackers_.size(); i += contexts_.size())
+      if (drv->tracker) drv->tracker(&trackers_[i]);
+  }
+  double elapsed = std::chrono::duration<double>(now - start_).count();
+  size_t callbacks = 0;
+  double sum_delay = 0.0, max_delay = 0.0;
+  // Fire everything that is due
+  while (drv->next < schedule.size() &&
+    events_[schedule[drv->next]].time <= elapsed * rate_) {
+    ReplayEvent & event = events_[schedule[drv->next++]];
+    double delay = elapsed - event.time / rate_;
+    callbacks++;
+    sum_delay += delay;
+    max_delay = std::max(max_delay, delay);
+    struct Tracker * tracker = &trackers_[event.tracker];
+    if (event.type == ReplayEvent::LIGHT && drv->light) {
+      drv->light(tracker, &lighthouses_[drv->context][event.lighthouse],
+        event.axis, event.timecode, event.num_sensors, event.sensors, NULL,
+        event.angles, event.lengths);
+    } else if (event.type == ReplayEvent::IMU && drv->imu) {
+      int16_t mag[3] = {0, 0, 0};
+      drv->imu(tracker, event.timecode, event.acc, event.gyr, mag);
+    }
+  }
+  struct timespec cpu;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  double thread_cpu = cpu.tv_sec + 1e-9 * cpu.tv_nsec;
+  bool done = drv->next == schedule.size();
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.callbacks += callbacks;
+  stats_.sum_delay += sum_delay;
+  stats_.max_delay = std::max(stats_.max_delay, max_delay);
+  stats_.wall = std::max(stats_.wall, elapsed);
+  stats_.poll_cpu += thread_cpu - drv->cpu;
+  drv->cpu = thread_cpu;
+  if (done) finished_++;
+  stats_.finished = finished_ == contexts_.size();
+  // Like a device that unplugs at the end of the bag
+  return done ? -1 : 0;
+}
+
+void deepdive_close(struct Driver * drv) {
+  delete drv;
+}
+
+}
@@ -17,82 +17,29 @@
  */
 
 // This package code
-#include <hive/vive_general.h>
-#include <hive/vive.h>
-#include <hive/vive_solve.h>
-#include <hive/vive_calibrate.h>
-#include <hive/vive_visualization.h>
+#include <hive/vive_server.h>
 
 // Standard C includes
 #include <stdio.h>
 #include <stdlib.h>
 
 // ROS includes
-#include <ros/ros.h>
 #include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
 #include <tf2_ros/transform_broadcaster.h>
 
 // Standard C++ includes
 #include <iostream>
 
-// Services
-#include <hive/ViveConfig.h>
-
-// Messages
-#include <sensor_msgs/Imu.h>
-#include <hive/ViveLight.h>
-#include <hive/ViveCalibration.h>
-#include <hive/ViveCalibrationGeneral.h>
-#include <hive/ViveCalibrationTrackerArray.h>
-#include <hive/ViveCalibrationLighthouseArray.h>
-
-typedef std::map<std::string, ViveSolve> TrackerMap;
-typedef std::map<std::string, Visualization> VisualMap;
-
-size_t counter = 0;
-
-class Hive {
- public:
-  Hive(int argc, char ** argv);
-  ~Hive();
-  void LightCallback(const hive::ViveLight::ConstPtr& msg);
-  void ImuCallback(const sensor_msgs::Imu::ConstPtr& msg);
-  void LighthouseCallback(const hive::ViveCalibrationLighthouseArray::ConstPtr& msg);
-  void TrackerCallback(const hive::ViveCalibrationTrackerArray::ConstPtr& msg);
-  void LightSpecsCallback(const hive::ViveCalibrationGeneral::ConstPtr& msg);
-  void TimerCallback(const ros::TimerEvent&);
-  void CalibrationCallback(Calibration const& calibration);
-  bool ConfigureCallback(hive::ViveConfig::Request & req, hive::ViveConfig::Response & res );
-  void Spin();
- private:
-  bool ready_;
-  std::string calib_file_;              // Name of the calibration file
-  Calibration calibration_;        // Structure with all the data
-  // Solvers
-  std::string solver_;                  // Active solver
-  TrackerMap trackers_;                 // Tracker solvers
-  VisualMap vive_visualization_;        // visualization objects
-  ViveCalibrate calibrator_;            // Calibrator
-  // Publishers and Subscribers
-  ros::Subscriber sub_imu_;
-  ros::Subscriber sub_light_;
-  ros::Subscriber sub_lighthouses_;
-  ros::Subscriber sub_trackers_;
-  ros::Subscriber sub_general_;
-  ros::ServiceServer service_;          // Service
-  ros::Timer timer_;                    // Tracking timer
-  ros::Publisher pub_imu_markers_;      // Imu visualization marker
-  ros::Publisher pub_light_markers_;    // light visualization markers
-  ros::Publisher pub_tracker_markers_;  // tracker visualization markers
-  // State Machine
-  StateMachine fsm_;
-};
+static size_t counter = 0;
 
 enum STATES {TRACKING = 1, RECORDING = 2, CALIBRATING = 3};
 enum EVENTS {START = 1, STOP = 2, DONE = 3};
 
-Hive::Hive(int argc, char ** argv) : calibrator_(std::bind(&Hive::CalibrationCallback, this, std::placeholders::_1)){
+Hive::Hive(ros::NodeHandle & nh, ros::NodeHandle & pnh) : calibrator_(std::bind(&Hive::CalibrationCallback, this, std::placeholders::_1)){
   ready_ = false;
+  for (size_t i = 0; i <= UINT8_MAX; i++) bridge_ids_[i] = -1;
+  report_ = ros::WallTime::now();
   // State machine
   fsm_.AddTransition(TRACKING,START,RECORDING);
   fsm_.AddTransition(TRACKING,STOP,TRACKING);
@@ -107,14 +54,35 @@ Hive::Hive(int argc, char ** argv) : calibrator_(std::bind(&Hive::CalibrationCal
   fsm_.SetState(RECORDING);
   // fsm_.SetState(TRACKING);
 
-  ros::init(argc, argv, "server");
-  ros::NodeHandle nh;
-
-  // Subscribers for light measurements
-  sub_light_ = nh.subscribe(TOPIC_HIVE_LIGHT, 1000,
-    &Hive::LightCallback, this);
-  sub_imu_ = nh.subscribe(TOPIC_HIVE_IMU, 1000,
-    &Hive::ImuCallback, this);
+  // Subscribers for light measurements, the compact ones from the bridge
+  // unless replaying older data
+  bool raw_light;
+  pnh.param("raw_light", raw_light, true);
+  if (raw_light)
+    sub_light_ = nh.subscribe(TOPIC_HIVE_LIGHT_RAW, 1000,
+      &Hive::LightRawCallback, this);
+  else
+    sub_light_ = nh.subscribe(TOPIC_HIVE_LIGHT, 1000,
+      &Hive::LightCallback, this);
+  // Same for the imu, batches from the bridge unless replaying older data
+  bool imu_batch;
+  pnh.param("imu_batch", imu_batch, true);
+  if (imu_batch)
+    sub_imu_ = nh.subscribe(TOPIC_HIVE_IMU_BATCH, 1000,
+      &Hive::ImuBatchCallback, this);
+  else
+    sub_imu_ = nh.subscribe(TOPIC_HIVE_IMU, 1000,
+      &Hive::ImuCallback, this);
+
+  // Solver of the trackers
+  pnh.param("solver", solver_, std::string(HIVE_SOLVER_VIVE));
+  pnh.param("correction", correction_, true);
+  if (solver_ != HIVE_SOLVER_VIVE && solver_ != HIVE_SOLVER_PGO) {
+    ROS_WARN("Unknown solver %s, using %s", solver_.c_str(),
+      HIVE_SOLVER_VIVE);
+    solver_ = HIVE_SOLVER_VIVE;
+  }
+  ROS_INFO("Tracking with the %s solver", solver_.c_str());
 
   // Subscribers to calibration stuff
   sub_lighthouses_ = nh.subscribe(TOPIC_HIVE_LIGHTHOUSES, 1000,
@@ -135,6 +103,10 @@ Hive::Hive(int argc, char ** argv) : calibrator_(std::bind(&Hive::CalibrationCal
   // Start JSON parser
   JsonParser jp = JsonParser(HIVE_CONFIG_FILE);
 
+  // Trackers run in parallel, each one in order on its own strand
+  pool_.reset(new WorkPool(jp.GetThreads()));
+  ROS_INFO("Solving on %zu threads", pool_->Size());
+
   // Periodic timer to query and send pose
   timer_ = nh.createTimer(ros::Rate(jp.GetRate()),
       &Hive::TimerCallback, this, false, true);
@@ -150,6 +122,8 @@ Hive::Hive(int argc, char ** argv) : calibrator_(std::bind(&Hive::CalibrationCal
     jp.GetBody(&calibration_);
   }
 
+  lighthouse_ids_ = ViveUtils::GetLighthouseIds(calibration_.lighthouses);
+  IndexTrackers();
   calibrator_.Reset();
   calibrator_.Initialize(calibration_);
 
@@ -160,10 +134,20 @@ Hive::Hive(int argc, char ** argv) : calibrator_(std::bind(&Hive::CalibrationCal
 }
 
 Hive::~Hive() {
-  // pass
+  // Finish the queued work
+  pool_->Wait();
+  // Frames handled by each tracker's solver
+  for (auto & tracker : trackers_) {
+    SolveCounters counters = tracker.second.GetCounters();
+    ROS_INFO("%s: %zu solved, %zu failed, %zu dropped frames",
+      tracker.first.c_str(), counters.solved, counters.failed,
+      counters.dropped);
+  }
 }
 
 void Hive::LightCallback(const hive::ViveLight::ConstPtr& msg) {
+  Solver * solver;
+  int id;
   // Check the current state of the system
   counter++;
   switch(fsm_.GetState()) {
@@ -171,13 +155,17 @@ void Hive::LightCallback(const hive::ViveLight::ConstPtr& msg) {
       // In the case where the calibration is not available
       if (!ready_) return;
       // Check if tracker is registred
-      if (trackers_.find(msg->header.frame_id) == trackers_.end()) {
+      id = calibration_.tracker_ids.Find(msg->header.frame_id);
+      if (id < 0 || solvers_[id] == NULL) {
         ROS_FATAL("Can't find tracker");
         return;
       }
       // Add data to solver
-      trackers_[msg->header.frame_id].ProcessLight(msg);
-      vive_visualization_[msg->header.frame_id].AddLight(msg);
+      solver = solvers_[id];
+      pool_->Post(strands_[id], [solver, msg] {
+        solver->ProcessLight(msg);
+      });
+      visuals_[id]->AddLight(msg);
       break;
     case RECORDING:
       calibrator_.AddLight(msg);
@@ -193,18 +181,62 @@ void Hive::LightCallback(const hive::ViveLight::ConstPtr& msg) {
   }
 }
 
+void Hive::LightRawCallback(const hive::ViveLightRaw::ConstPtr& msg) {
+  Solver * solver;
+  int id;
+  hive::ViveLight::Ptr light;
+  // Check the current state of the system
+  counter++;
+  switch(fsm_.GetState()) {
+    case TRACKING:
+      // In the case where the calibration is not available
+      if (!ready_) return;
+      // Check if tracker is registred
+      id = bridge_ids_[msg->tracker];
+      if (id < 0 || solvers_[id] == NULL) {
+        ROS_FATAL("Can't find tracker");
+        return;
+      }
+      // The solver takes the compact sweep as it is
+      solver = solvers_[id];
+      pool_->Post(strands_[id], [solver, msg] {
+        solver->ProcessLight(msg);
+      });
+      // Full sweep only while someone looks at the markers
+      if (pub_light_markers_.getNumSubscribers() == 0) break;
+      light.reset(new hive::ViveLight());
+      if (ViveUtils::ConvertLight(*msg, lighthouse_ids_, light.get()))
+        visuals_[id]->AddLight(light);
+      break;
+    case RECORDING:
+      // The calibrator keeps full sweeps
+      light.reset(new hive::ViveLight());
+      if (ViveUtils::ConvertLight(*msg, lighthouse_ids_, light.get()))
+        calibrator_.AddLight(light);
+      break;
+    default:
+      break;
+  }
+}
+
 void Hive::ImuCallback(const sensor_msgs::Imu::ConstPtr& msg) {
+  Solver * solver;
+  int id;
   switch(fsm_.GetState()) {
     case TRACKING:
       // In the case where the calibration is not available
       if (!ready_) return;
       // Check if tracker is registred
-      if (trackers_.find(msg->header.frame_id) == trackers_.end()) {
+      id = calibration_.tracker_ids.Find(msg->header.frame_id);
+      if (id < 0 || solvers_[id] == NULL) {
         ROS_FATAL("Can't find tracker");
         return;
       }
       // Add data to solver
-      trackers_[msg->header.frame_id].ProcessImu(msg);
+      solver = solvers_[id];
+      pool_->Post(strands_[id], [solver, msg] {
+        solver->ProcessImu(msg);
+      });
       break;
     case RECORDING:
       calibrator_.AddImu(msg);
@@ -214,25 +246,78 @@ void Hive::ImuCallback(const sensor_msgs::Imu::ConstPtr& msg) {
   }
 }
 
+void Hive::ImuBatchCallback(const hive::ViveImuBatch::ConstPtr& msg) {
+  Solver * solver;
+  int id;
+  switch(fsm_.GetState()) {
+    case TRACKING:
+      // In the case where the calibration is not available
+      if (!ready_) return;
+      // Check if tracker is registred
+      id = bridge_ids_[msg->tracker];
+      if (id < 0 || solvers_[id] == NULL) {
+        ROS_FATAL("Can't find tracker");
+        return;
+      }
+      // One task for the whole batch
+      solver = solvers_[id];
+      pool_->Post(strands_[id], [solver, msg] {
+        solver->ProcessImu(msg);
+      });
+      break;
+    case RECORDING:
+      // The calibrator stores single samples
+      for (size_t i = 0; i < msg->stamps.size(); i++) {
+        sensor_msgs::Imu::Ptr imu(new sensor_msgs::Imu());
+        ViveUtils::ConvertImu(*msg, i, imu.get());
+        calibrator_.AddImu(imu);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
 void Hive::LighthouseCallback(const hive::ViveCalibrationLighthouseArray::ConstPtr& msg) {
   calibration_.SetLighthouses(*msg);
+  lighthouse_ids_ = ViveUtils::GetLighthouseIds(calibration_.lighthouses);
   for (auto tr_it = trackers_.begin(); tr_it !=  trackers_.end(); tr_it++) {
     // Update Solver
     tr_it->second.Update(calibration_.lighthouses);
   }
+  // Pose graphs compile the lighthouses when they are built
+  for (auto & graph : graphs_)
+    BuildSolver(graph.first);
+  IndexTrackers();
   calibrator_.Update(calibration_.lighthouses);
 }
 
 void Hive::TrackerCallback(const hive::ViveCalibrationTrackerArray::ConstPtr& msg) {
   calibration_.SetTrackers(*msg);
+  // The light and imu messages name the tracker by its bridge id
+  for (auto const& tracker : msg->trackers)
+    bridge_ids_[tracker.id] = calibration_.tracker_ids.Find(tracker.serial);
   for (std::map<std::string, Tracker>::const_iterator tr_it = calibration_.trackers.begin();
     tr_it != calibration_.trackers.end(); tr_it++) {
     // Update Solver
-    trackers_[tr_it->first].Initialize(calibration_.environment,
-      tr_it->second);
+    size_t count;
+    if (solver_ == HIVE_SOLVER_PGO) {
+      BuildSolver(tr_it->first);
+      count = graphs_.size();
+    } else {
+      TrackerMap::iterator tracker = trackers_.find(tr_it->first);
+      if (tracker == trackers_.end())
+        tracker = trackers_.emplace(std::piecewise_construct,
+          std::forward_as_tuple(tr_it->first),
+          std::forward_as_tuple(pool_.get())).first;
+      tracker->second.Initialize(calibration_.environment,
+        tr_it->second);
+      count = trackers_.size();
+    }
     // Update Visualization tools
-    vive_visualization_[tr_it->first].Initialize(tr_it->second, trackers_.size()-1);
+    vive_visualization_[tr_it->first].Initialize(tr_it->second, count-1);
   }
+  IndexTrackers();
 }
 
 void Hive::LightSpecsCallback(const hive::ViveCalibrationGeneral::ConstPtr& msg) {
@@ -243,30 +328,89 @@ void Hive::TimerCallback(const ros::TimerEvent&) {
   // Ignore if not in tracking mode
   if (fsm_.GetState() != TRACKING) return;
   // Iterate over all trackers that we are solving for, and send their pose
-  for (TrackerMap::iterator tr_it = trackers_.begin();
-    tr_it != trackers_.end(); tr_it++) {
+  for (size_t id = 0; id < solvers_.size(); id++) {
+    if (solvers_[id] == NULL) continue;
     // Get the transform
     geometry_msgs::TransformStamped tf;
-    if (tr_it->second.GetTransform(tf)) {
+    if (solvers_[id]->GetTransform(tf)) {
       static tf2_ros::TransformBroadcaster br;
       br.sendTransform(tf);
       // IMU
       visualization_msgs::Marker arrow;
-      if (vive_visualization_[tr_it->first].GetImu(&arrow)) {
+      if (visuals_[id]->GetImu(&arrow)) {
         pub_imu_markers_.publish(arrow);
       }
       // LIGHTS
       visualization_msgs::MarkerArray directions;
-      if (vive_visualization_[tr_it->first].GetLight(&directions)) {
+      if (visuals_[id]->GetLight(&directions)) {
         pub_light_markers_.publish(directions);
       }
       // SENSORS
       visualization_msgs::MarkerArray sensors;
-      if (vive_visualization_[tr_it->first].GetSensors(&sensors)) {
+      if (visuals_[id]->GetSensors(&sensors)) {
         pub_tracker_markers_.publish(sensors);
       }
     }
   }
+  // Periodic report of the solvers
+  if ((ros::WallTime::now() - report_).toSec() < HIVE_REPORT) return;
+  report_ = ros::WallTime::now();
+  // Solves that did not fit their time budget
+  for (size_t id = 0; id < solvers_.size(); id++) {
+    BudgetCounters counters;
+    if (solvers_[id] == NULL || !solvers_[id]->GetBudget(&counters)) continue;
+    ROS_INFO("%s: %zu solves, %zu over budget, %zu truncated, worst %.1f ms",
+      calibration_.tracker_ids.Serial(id).c_str(),
+      counters.solves, counters.overruns, counters.truncated,
+      1e3 * counters.worst);
+  }
+  // Samples left out by the sweep filter
+  for (size_t id = 0; id < solvers_.size(); id++) {
+    InlierCounters counters;
+    if (solvers_[id] == NULL || !solvers_[id]->GetInliers(&counters)) continue;
+    ROS_INFO("%s: %zu of %zu samples left out, %zu sweeps unchecked",
+      calibration_.tracker_ids.Serial(id).c_str(),
+      counters.outliers, counters.samples, counters.unchecked);
+  }
+  return;
+}
+
+void Hive::IndexTrackers() {
+  solvers_.assign(calibration_.tracker_ids.Size(), NULL);
+  strands_.assign(calibration_.tracker_ids.Size(), NULL);
+  visuals_.assign(calibration_.tracker_ids.Size(), NULL);
+  for (auto & tracker : trackers_) {
+    int id = calibration_.tracker_ids.Find(tracker.first);
+    if (id < 0) continue;
+    // Map nodes do not move, the pointers stay valid
+    solvers_[id] = &tracker.second;
+    strands_[id] = tracker.second.GetStrand();
+    visuals_[id] = &vive_visualization_[tracker.first];
+  }
+  for (auto & graph : graphs_) {
+    int id = calibration_.tracker_ids.Find(graph.first);
+    if (id < 0 || !graph.second.solver) continue;
+    solvers_[id] = graph.second.solver.get();
+    strands_[id] = graph.second.strand;
+    visuals_[id] = &vive_visualization_[graph.first];
+  }
+  return;
+}
+
+void Hive::BuildSolver(std::string const& serial) {
+  auto tracker = calibration_.trackers.find(serial);
+  if (tracker == calibration_.trackers.end()) return;
+  TrackerSolver & graph = graphs_[serial];
+  if (!graph.strand) graph.strand = pool_->NewStrand();
+  // Queued work points to the old solver
+  pool_->Wait(graph.strand);
+  // The timer reads the pose while the pool feeds the graph, so the window
+  // is optimized on the graph's own thread
+  graph.solver.reset(new PoseGraph(calibration_.environment,
+    tracker->second,
+    calibration_.lighthouses,
+    HIVE_PGO_WINDOW, HIVE_PGO_TRUST, HIVE_PGO_FIRST,
+    correction_, true));
   return;
 }
 
@@ -280,6 +424,10 @@ void Hive::CalibrationCallback(Calibration const& calibration) {
     tr_it->second.Update(calibration.environment);
   }
   calibration_ = calibration;
+  lighthouse_ids_ = ViveUtils::GetLighthouseIds(calibration_.lighthouses);
+  for (auto & graph : graphs_)
+    BuildSolver(graph.first);
+  IndexTrackers();
   calibrator_.Reset();
   ready_ = true;
   fsm_.Update(DONE);
@@ -318,14 +466,18 @@ bool Hive::ConfigureCallback(hive::ViveConfig::Request & req,
   return true;
 }
 
-void Hive::Spin() {
-  ROS_INFO("Spinning");
-  ros::spin();
+// Server loaded into a nodelet manager, takes the bridge's messages as
+// pointers when both share the manager
+namespace hive {
+class ServerNodelet : public nodelet::Nodelet {
+ protected:
+  void onInit() {
+    hive_.reset(new Hive(getNodeHandle(), getPrivateNodeHandle()));
+  }
+
+ private:
+  std::unique_ptr<Hive> hive_;
+};
 }
 
-int main(int argc, char **argv) {
-  // Initializing Hive
-  Hive hive = Hive(argc, argv);
-  hive.Spin();
-  return 0;
-}
\ No newline at end of file
+PLUGINLIB_EXPORT_CLASS(hive::ServerNodelet, nodelet::Nodelet)
@@ -0,0 +1,114 @@
+#include <hive/vive_snapshot.h>
+
+CalibrationSnapshot::CalibrationSnapshot() {
+  for (size_t i = 0; i <= UINT8_MAX; i++) raw_lighthouse_ids_[i] = -1;
+}
+
+CalibrationSnapshot::Ptr CalibrationSnapshot::Create(
+  Environment const& environment,
+  LighthouseMap const& lighthouses,
+  std::map<std::string, Tracker> const& trackers) {
+  std::shared_ptr<CalibrationSnapshot> snapshot(new CalibrationSnapshot());
+  snapshot->trackers_.reserve(trackers.size());
+  for (auto const& tracker : trackers)
+    snapshot->AddTracker(tracker.first, tracker.second);
+  snapshot->lighthouses_.reserve(lighthouses.size());
+  for (auto const& lighthouse : lighthouses)
+    snapshot->AddLighthouse(lighthouse.first, lighthouse.second,
+      environment);
+  return snapshot;
+}
+
+CalibrationSnapshot::Ptr CalibrationSnapshot::Create(
+  Environment const& environment,
+  LighthouseMap const& lighthouses,
+  Tracker const& tracker) {
+  std::map<std::string, Tracker> trackers;
+  trackers[tracker.serial] = tracker;
+  return Create(environment, lighthouses, trackers);
+}
+
+TrackerSnapshot const* CalibrationSnapshot::GetTracker(
+  std::string const& serial) const {
+  return GetTracker(TrackerId(serial));
+}
+
+LighthouseModel const* CalibrationSnapshot::GetLighthouse(
+  std::string const& serial) const {
+  return GetLighthouse(LighthouseId(serial));
+}
+
+int CalibrationSnapshot::TrackerId(std::string const& serial) const {
+  return tracker_ids_.Find(serial);
+}
+
+int CalibrationSnapshot::LighthouseId(std::string const& serial) const {
+  return lighthouse_ids_.Find(serial);
+}
+
+TrackerSnapshot const* CalibrationSnapshot::GetTracker(int id) const {
+  if (id < 0 || static_cast<size_t>(id) >= trackers_.size()) return NULL;
+  return &trackers_[id];
+}
+
+LighthouseModel const* CalibrationSnapshot::GetLighthouse(int id) const {
+  if (id < 0 || static_cast<size_t>(id) >= lighthouses_.size()) return NULL;
+  return &lighthouses_[id];
+}
+
+void CalibrationSnapshot::AddTracker(std::string const& serial,
+  Tracker const& tracker) {
+  TrackerSnapshot compiled;
+  compiled.serial = serial;
+  // Inertial transform and its inverse
+  compiled.tPi = Eigen::Vector3d(tracker.imu_transform.translation.x,
+    tracker.imu_transform.translation.y,
+    tracker.imu_transform.translation.z);
+  compiled.tRi = Eigen::Quaterniond(tracker.imu_transform.rotation.w,
+    tracker.imu_transform.rotation.x,
+    tracker.imu_transform.rotation.y,
+    tracker.imu_transform.rotation.z).toRotationMatrix();
+  Eigen::Matrix3d iRt = compiled.tRi.transpose();
+  Eigen::Vector3d iPt = - iRt * compiled.tPi;
+  // Sensors
+  for (size_t i = 0; i < TRACKER_SENSORS_NUMBER; i++) {
+    compiled.valid[i] = false;
+    compiled.tPs[i].setZero();
+    compiled.tNs[i].setZero();
+    compiled.iPs[i].setZero();
+  }
+  for (auto const& sensor : tracker.sensors) {
+    if (sensor.first >= TRACKER_SENSORS_NUMBER) continue;
+    compiled.valid[sensor.first] = true;
+    compiled.tPs[sensor.first] = Eigen::Vector3d(sensor.second.position.x,
+      sensor.second.position.y,
+      sensor.second.position.z);
+    compiled.tNs[sensor.first] = Eigen::Vector3d(sensor.second.normal.x,
+      sensor.second.normal.y,
+      sensor.second.normal.z);
+    compiled.iPs[sensor.first] = iRt * compiled.tPs[sensor.first] + iPt;
+  }
+  tracker_ids_.Intern(serial);
+  trackers_.push_back(compiled);
+  return;
+}
+
+void CalibrationSnapshot::AddLighthouse(std::string const& serial,
+  Lighthouse const& lighthouse,
+  Environment const& environment) {
+  auto env_it = environment.lighthouses.find(serial);
+  int id = lighthouse_ids_.Intern(serial);
+  // Light with an id two lighthouses claim cannot be told apart
+  if (raw_lighthouse_ids_[lighthouse.id] >= 0) {
+    ROS_ERROR("Lighthouses %s and %s share the id %d, ignoring its light",
+      lighthouse_ids_.Serial(raw_lighthouse_ids_[lighthouse.id]).c_str(),
+      serial.c_str(), lighthouse.id);
+    raw_collisions_[lighthouse.id] = true;
+  }
+  raw_lighthouse_ids_[lighthouse.id] = raw_collisions_[lighthouse.id] ? -1 : id;
+  if (env_it != environment.lighthouses.end())
+    lighthouses_.push_back(LighthouseModel(serial, lighthouse, env_it->second));
+  else
+    lighthouses_.push_back(LighthouseModel(serial, lighthouse));
+  return;
+}
@@ -29,29 +29,79 @@ namespace solve{
   double start_pose[6] = {0, 0, 1, 0, 0, 0};
 }
 
-ViveSolve::ViveSolve() {
-  solveMutex_ = new std::mutex();
+ViveSolve::ViveSolve() : ViveSolve(NULL) {
   // Do nothing
 }
 
+ViveSolve::ViveSolve(WorkPool * pool) {
+  solveMutex_ = new std::mutex();
+  correction_ = false;
+  tracker_pose_.valid = false;
+  pending_ = false;
+  counters_.solved = 0;
+  counters_.failed = 0;
+  counters_.dropped = 0;
+  // Private worker if not sharing a pool
+  if (pool == NULL) {
+    own_pool_.reset(new WorkPool(1));
+    pool = own_pool_.get();
+  }
+  pool_ = pool;
+  strand_ = pool_->NewStrand();
+}
+
 ViveSolve::ViveSolve(Tracker & tracker,
     Environment & environment,
     LighthouseMap & lighthouses,
-    bool correction) {
-  // Solver mutex
-  solveMutex_ = new std::mutex();
-
+    bool correction) : ViveSolve() {
   // Call older methods
   Initialize(environment, tracker);
   Update(lighthouses);
   correction_ = correction;
-
   return;
 }
 
 ViveSolve::~ViveSolve() {
+  // Queued work points to this solver
+  pool_->Wait(strand_);
+  own_pool_.reset();
   delete solveMutex_;
-  // Do nothing
+}
+
+void ViveSolve::Solve() {
+  std::unique_lock<std::mutex> lock(*solveMutex_);
+  if (!pending_) return;
+  // Take the frame and the calibration it is solved with
+  LightData observations;
+  observations.swap(mailbox_);
+  pending_ = false;
+  Extrinsics extrinsics = extrinsics_;
+  Environment environment = environment_;
+  LighthouseMap lighthouses = lh_extrinsics_;
+  bool correction = correction_;
+  lock.unlock();
+  bool valid = ComputeTransformBundle(observations,
+    &tracker_pose_,
+    &extrinsics,
+    &environment,
+    solveMutex_,
+    &lighthouses,
+    correction);
+  lock.lock();
+  if (valid)
+    counters_.solved++;
+  else
+    counters_.failed++;
+  return;
+}
+
+SolveCounters ViveSolve::GetCounters() {
+  std::lock_guard<std::mutex> lock(*solveMutex_);
+  return counters_;
+}
+
+std::shared_ptr<pool::Strand> const& ViveSolve::GetStrand() const {
+  return strand_;
 }
 
 void ViveSolve::ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) {
@@ -61,19 +111,19 @@ void ViveSolve::ProcessImu(const sensor_msgs::Imu::ConstPtr& msg) {
   }
 }
 
-void ViveSolve::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
+void ViveSolve::ProcessImu(const hive::ViveImuBatch::ConstPtr& msg) {
+  // Light only, nothing to expand
   if (msg == NULL) {
     return;
   }
+}
 
-  // Check if this is a new lighthouse
-  if (poses_.find(msg->lighthouse) == poses_.end()) {
-    // Set structures
-    observations_[msg->lighthouse].lighthouse = msg->lighthouse;
+void ViveSolve::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
+  if (msg == NULL) {
+    return;
   }
 
-  // Clear the axis with old data - should only do this if the new data is good
-  observations_[msg->lighthouse].axis[msg->axis].lights.clear();
+  LightVec & lights = BeginSweep(msg->lighthouse, msg->axis);
 
   // Iterate all sweep data
   // std::cout << msg->lighthouse << "-" << static_cast<int>(msg->axis) << " ";
@@ -96,36 +146,92 @@ void ViveSolve::ProcessLight(const hive::ViveLight::ConstPtr& msg) {
     // std::cout << li_it->sensor << ":" << li_it->angle << " ";
 
     // Add data to the axis
-    observations_[msg->lighthouse].axis[msg->axis].lights.push_back(light);
-    observations_[msg->lighthouse].axis[msg->axis].stamp = msg->header.stamp;
+    lights.push_back(light);
   }
   // std::cout << std::endl;
 
+  EndSweep(msg->lighthouse, msg->axis, msg->header.stamp);
+  return;
+}
+
+void ViveSolve::ProcessLight(const hive::ViveLightRaw::ConstPtr& msg) {
+  if (msg == NULL) {
+    return;
+  }
+
+  // The lighthouse ids change with the calibration
+  solveMutex_->lock();
+  CalibrationSnapshot::Ptr calibration = calibration_;
+  solveMutex_->unlock();
+  if (calibration == NULL) return;
+  LighthouseModel const* lighthouse = calibration->GetLighthouse(
+    calibration->RawLighthouseId(msg->lighthouse));
+  if (lighthouse == NULL) return;
+
+  LightVec & lights = BeginSweep(lighthouse->serial, msg->axis);
+
+  // Samples straight from the ticks, the bridge already dropped the
+  // invalid sensors
+  for (size_t i = 0; i < msg->sensors.size(); i++) {
+    Light light;
+    light.sensor_id = msg->sensors[i];
+    light.angle = LIGHT_TICK_ANGLE *
+      (static_cast<double>(msg->ticks[i]) - LIGHT_TICK_CENTER);
+    if (light.angle > M_PI/3 || light.angle < -M_PI/3) continue;
+    light.timecode = msg->timecode;
+    light.length = LIGHT_TICK_LENGTH * msg->lengths[i];
+    lights.push_back(light);
+  }
+
+  EndSweep(lighthouse->serial, msg->axis, msg->header.stamp);
+  return;
+}
+
+LightVec & ViveSolve::BeginSweep(std::string const& lighthouse,
+  uint8_t axis) {
+  // Check if this is a new lighthouse
+  if (poses_.find(lighthouse) == poses_.end()) {
+    // Set structures
+    observations_[lighthouse].lighthouse = lighthouse;
+  }
+
+  // Clear the axis with old data - should only do this if the new data is good
+  LightVec & lights = observations_[lighthouse].axis[axis].lights;
+  lights.clear();
+  return lights;
+}
+
+void ViveSolve::EndSweep(std::string const& lighthouse,
+  uint8_t axis,
+  ros::Time const& stamp) {
+  // An empty sweep keeps the stamp of the previous one
+  if (!observations_[lighthouse].axis[axis].lights.empty())
+    observations_[lighthouse].axis[axis].stamp = stamp;
+
   // Remove old data
   for (LightData::iterator lh_it = observations_.begin();
     lh_it != observations_.end(); lh_it++) {
     for (std::map<uint8_t, LightVecStamped>::iterator ax_it = lh_it->second.axis.begin();
       ax_it != lh_it->second.axis.end(); ax_it++) {
-      ros::Duration elapsed = ax_it->second.stamp - msg->header.stamp;
+      ros::Duration elapsed = ax_it->second.stamp - stamp;
       if (elapsed.toNSec() >= 50e6)
         ax_it->second.lights.clear();
     }
   }
 
   // Solve if we have data
-  ros::Duration elapsed = observations_[msg->lighthouse].axis[VERTICAL].stamp -
-    observations_[msg->lighthouse].axis[HORIZONTAL].stamp;
-  if (observations_[msg->lighthouse].axis[HORIZONTAL].lights.size() > 3
-    && observations_[msg->lighthouse].axis[VERTICAL].lights.size() > 3) {
-    std::thread poseSolver(&ComputeTransformBundle,
-      observations_,
-      &tracker_pose_,
-      &extrinsics_,
-      &environment_,
-      solveMutex_,
-      &lh_extrinsics_,
-      correction_);
-    poseSolver.detach();
+  ros::Duration elapsed = observations_[lighthouse].axis[VERTICAL].stamp -
+    observations_[lighthouse].axis[HORIZONTAL].stamp;
+  if (observations_[lighthouse].axis[HORIZONTAL].lights.size() > 3
+    && observations_[lighthouse].axis[VERTICAL].lights.size() > 3) {
+    // Hand the frame to the strand - only the latest one is worth solving
+    solveMutex_->lock();
+    bool post = !pending_;
+    if (pending_) counters_.dropped++;
+    mailbox_ = observations_;
+    pending_ = true;
+    solveMutex_->unlock();
+    if (post) pool_->Post(strand_, std::bind(&ViveSolve::Solve, this));
   }
   return;
 }
@@ -167,6 +273,7 @@ bool ViveSolve::GetTransform(geometry_msgs::TransformStamped &msg) {
 }
 
 bool ViveSolve::Initialize(Tracker const& tracker) {
+  std::lock_guard<std::mutex> lock(*solveMutex_);
   for (std::map<uint8_t, Sensor>::const_iterator sn_it = tracker.sensors.begin();
     sn_it != tracker.sensors.end(); sn_it++) {
     if (unsigned(sn_it->first) >= TRACKER_SENSORS_NUMBER
@@ -184,11 +291,13 @@ bool ViveSolve::Initialize(Tracker const& tracker) {
   extrinsics_.size = tracker.sensors.size();
   extrinsics_.radius = 0.005;
   tracker_ = tracker;
+  Compile();
   return true;
 }
 
 bool ViveSolve::Initialize(Environment const& environment,
   Tracker const& tracker) {
+  std::lock_guard<std::mutex> lock(*solveMutex_);
   for (std::map<uint8_t, Sensor>::const_iterator sn_it = tracker.sensors.begin();
     sn_it != tracker.sensors.end(); sn_it++) {
     if (unsigned(sn_it->first) >= TRACKER_SENSORS_NUMBER
@@ -208,130 +317,40 @@ bool ViveSolve::Initialize(Environment const& environment,
   tracker_ = tracker;
   environment_ = environment;
   for (size_t i = 0; i < 6; i++) tracker_pose_.transform[i] = solve::start_pose[i];
+  Compile();
   return true;
 }
 
 bool ViveSolve::Update(Environment const& environment) {
+  std::lock_guard<std::mutex> lock(*solveMutex_);
   environment_ = environment;
   return true;
 }
 
 bool ViveSolve::Update(std::map<std::string, Lighthouse> const& lh_extrinsics) {
+  std::lock_guard<std::mutex> lock(*solveMutex_);
   lh_extrinsics_ = lh_extrinsics;
+  Compile();
   return true;
 }
 
-PoseHorizontalCost::PoseHorizontalCost(hive::ViveLight data,
-    Tracker tracker,
-    Motor lighthouse,
-    bool correction) {
-    data_ = data;
-    correction_ = correction;
-    tracker_ = tracker;
-    lighthouse_ = lighthouse;
-  }
-
-template <typename T> bool PoseHorizontalCost::operator()(const T* const * parameters,
-  T * residual) const {
-  Eigen::Matrix<T, 3, 1> lPt;
-  lPt << parameters[0][0],
-    parameters[0][1],
-    parameters[0][2];
-  Eigen::Matrix<T, 3, 3> lRt;
-  ceres::AngleAxisToRotationMatrix(&parameters[0][3], lRt.data());
-
-  size_t counter = 0;
-  for (auto li_it = data_.samples.begin();
-    li_it != data_.samples.end(); li_it++) {
-    auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-    if (sensor_it == tracker_.sensors.end()) return false;
-    Eigen::Matrix<T, 3, 1> tPs;
-    tPs << T(sensor_it->second.position.x),
-      T(sensor_it->second.position.y),
-      T(sensor_it->second.position.z);
-
-    Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-    T ang; // The final angle
-    T x = (lPs(0)/lPs(2)); // Horizontal angle
-    T y = (lPs(1)/lPs(2)); // Vertical angle
-    T phase = T(SCALE_PHASE * lighthouse_.phase);
-    T tilt = T(SCALE_TILT * lighthouse_.tilt);
-    T curve = T(SCALE_CURVE * lighthouse_.curve);
-    T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-    T gib_phase = T(lighthouse_.gib_phase);
-
-    if (correction_) {
-      ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-    } else {
-      ang = atan(x);
-    }
-
-
-    residual[counter] = T(li_it->angle) - ang;
-    counter++;
-  }
-  return true;
-}
-
-PoseVerticalCost::PoseVerticalCost(hive::ViveLight data,
-  Tracker tracker,
-  Motor lighthouse,
-  bool correction) {
-  data_ = data;
-  correction_ = correction;
-  tracker_ = tracker;
-  lighthouse_ = lighthouse;
-}
-
-template <typename T> bool PoseVerticalCost::operator()(const T* const * parameters,
-  T * residual) const {
-  Eigen::Matrix<T, 3, 1> lPt;
-  lPt << parameters[0][0],
-    parameters[0][1],
-    parameters[0][2];
-  Eigen::Matrix<T, 3, 3> lRt;
-  ceres::AngleAxisToRotationMatrix(&parameters[0][3], lRt.data());
-
-  size_t counter = 0;
-  for (auto li_it = data_.samples.begin();
-    li_it != data_.samples.end(); li_it++) {
-    auto sensor_it = tracker_.sensors.find((uint8_t)li_it->sensor);
-    if (sensor_it == tracker_.sensors.end()) return false;
-    Eigen::Matrix<T, 3, 1> tPs;
-    tPs << T(sensor_it->second.position.x),
-      T(sensor_it->second.position.y),
-      T(sensor_it->second.position.z);
-
-    Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
-
-    T ang; // The final angle
-    T x = (lPs(0)/lPs(2)); // Horizontal angle
-    T y = (lPs(1)/lPs(2)); // Vertical angle
-    T phase = T(SCALE_PHASE * lighthouse_.phase);
-    T tilt = T(SCALE_TILT * lighthouse_.tilt);
-    T curve = T(SCALE_CURVE * lighthouse_.curve);
-    T gib_mag = T(SCALE_GIB * lighthouse_.gib_magnitude);
-    T gib_phase = T(lighthouse_.gib_phase);
-
-    if (correction_) {
-      ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-    } else {
-      ang = atan(y);
-    }
-
-    residual[counter] = T(li_it->angle) - ang;
-    counter++;
-  }
-  return true;
+void ViveSolve::Compile() {
+  // The poses are solved in the frame of each lighthouse
+  Environment lighthouse_frame;
+  for (auto const& lighthouse : lh_extrinsics_)
+    lighthouse_frame.lighthouses[lighthouse.first].rotation.w = 1.0;
+  calibration_ = CalibrationSnapshot::Create(lighthouse_frame,
+    lh_extrinsics_, tracker_);
+  return;
 }
 
 bool ViveSolve::SolvePose(hive::ViveLight & horizontal_observations,
   hive::ViveLight & vertical_observations,
   geometry_msgs::TransformStamped & tf,
-  Tracker & tracker,
-  Lighthouse & lighthouse,
-  bool correction) {
+  CalibrationSnapshot::Ptr const& calibration,
+  int tracker,
+  bool correction,
+  solve::backend backend) {
   // Initializations
   double pose[6];
 
@@ -350,34 +369,58 @@ bool ViveSolve::SolvePose(hive::ViveLight & horizontal_observations,
   pose[4] = AA.axis()(1) * AA.angle();
   pose[5] = AA.axis()(2) * AA.angle();
 
-  ceres::DynamicAutoDiffCostFunction<PoseHorizontalCost, 4> * hcost =
-    new ceres::DynamicAutoDiffCostFunction<PoseHorizontalCost, 4>
-    (new PoseHorizontalCost(horizontal_observations, tracker, lighthouse.horizontal_motor,
-      correction));
-  hcost->AddParameterBlock(6);
-  hcost->SetNumResiduals(horizontal_observations.samples.size());
-  problem.AddResidualBlock(hcost,
-    NULL,
-    pose);
-
-  ceres::DynamicAutoDiffCostFunction<PoseVerticalCost, 4> * vcost =
-    new ceres::DynamicAutoDiffCostFunction<PoseVerticalCost, 4>
-    (new PoseVerticalCost(vertical_observations, tracker, lighthouse.vertical_motor,
-      correction));
-  vcost->AddParameterBlock(6);
-  vcost->SetNumResiduals(vertical_observations.samples.size());
-  problem.AddResidualBlock(vcost,
-    NULL,
-    pose);
+  // The pose is already in the lighthouse frame
+  TrackerSnapshot const* lm_tracker = calibration->GetTracker(tracker);
+  int horizontal = calibration->LighthouseId(horizontal_observations.lighthouse);
+  int vertical = calibration->LighthouseId(vertical_observations.lighthouse);
+  LighthouseModel const* lm_horizontal = calibration->GetLighthouse(horizontal);
+  LighthouseModel const* lm_vertical = calibration->GetLighthouse(vertical);
+  if (lm_tracker == NULL || lm_horizontal == NULL || lm_vertical == NULL)
+    return false;
 
-  ceres::Solver::Options options;
   ceres::Solver::Summary summary;
-
-  options.minimizer_progress_to_stdout = false;
-  options.linear_solver_type = ceres::DENSE_SCHUR;
-  options.max_solver_time_in_seconds = 1.0;
-
-  ceres::Solve(options, &problem, &summary);
+  if (backend == solve::LM) {
+    lm::PoseSolver solver;
+    lm::Summary lm_summary;
+    if (!solver.AddLight(horizontal_observations, *lm_tracker,
+        *lm_horizontal, correction)
+      || !solver.AddLight(vertical_observations, *lm_tracker,
+        *lm_vertical, correction)
+      || !solver.Solve(pose, &lm_summary)) {
+      return false;
+    }
+    summary.final_cost = lm_summary.final_cost;
+    summary.num_residual_blocks = 2;
+    summary.num_residuals = solver.NumResiduals();
+  } else {
+    ceres::CostFunction * hcost = new cost::ViveLightCost(horizontal_observations,
+      calibration,
+      tracker,
+      horizontal,
+      cost::POSE_TRACKER,
+      correction);
+    problem.AddResidualBlock(hcost,
+      NULL,
+      pose);
+
+    ceres::CostFunction * vcost = new cost::ViveLightCost(vertical_observations,
+      calibration,
+      tracker,
+      vertical,
+      cost::POSE_TRACKER,
+      correction);
+    problem.AddResidualBlock(vcost,
+      NULL,
+      pose);
+
+    ceres::Solver::Options options;
+
+    options.minimizer_progress_to_stdout = false;
+    options.linear_solver_type = ceres::DENSE_SCHUR;
+    options.max_solver_time_in_seconds = 1.0;
+
+    ceres::Solve(options, &problem, &summary);
+  }
 
   // Obtain the angles again and compare the results
   {
@@ -439,8 +482,8 @@ bool ViveSolve::SolvePose(hive::ViveLight & horizontal_observations,
     tf.transform.rotation.z = Q.z();
   }
 
-  tf.header.frame_id = lighthouse.serial;
-  tf.child_frame_id = tracker.serial;
+  tf.header.frame_id = lm_horizontal->serial;
+  tf.child_frame_id = lm_tracker->serial;
 
   return true;
 }
@@ -467,21 +510,9 @@ struct RayVerticalAngle{
       parameters[EXTRINSICS][3*vertical_observations_[i].sensor_id + 2];
       Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
 
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE) * parameters[LH_EXTRINSICS][PHASE];
-      T tilt = T(SCALE_TILT) * parameters[LH_EXTRINSICS][TILT];
-      T curve = T(SCALE_CURVE) * parameters[LH_EXTRINSICS][CURVE];
-      T gib_mag = T(SCALE_GIB) * parameters[LH_EXTRINSICS][GIB_MAG];
-      T gib_phase = parameters[LH_EXTRINSICS][GIB_PHASE];
-
-
-      if (correction_) {
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
+      // Shared projection kernel
+      MotorModel<T> motor = LighthouseModel::Scale(parameters[LH_EXTRINSICS]);
+      T ang = LighthouseModel::ProjectVertical(lPs.data(), motor, correction_);
       // std::cout << "V " << vertical_observations_[i].sensor_id << " - "
       // << lPs(0) << ", " << lPs(1) << ", " << lPs(2)
       // << " - " << ang << " " << vertical_observations_[i].angle << std::endl;
@@ -525,21 +556,9 @@ struct RayHorizontalAngle{
       parameters[EXTRINSICS][3*horizontal_observations_[i].sensor_id + 2];
       Eigen::Matrix<T, 3, 1> lPs = lRt * tPs + lPt;
 
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE) * parameters[LH_EXTRINSICS][PHASE];
-      T tilt = T(SCALE_TILT) * parameters[LH_EXTRINSICS][TILT];
-      T curve = T(SCALE_CURVE) * parameters[LH_EXTRINSICS][CURVE];
-      T gib_mag = T(SCALE_GIB) * parameters[LH_EXTRINSICS][GIB_MAG];
-      T gib_phase = parameters[LH_EXTRINSICS][GIB_PHASE];
-
-
-      if (correction_) {
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
+      // Shared projection kernel
+      MotorModel<T> motor = LighthouseModel::Scale(parameters[LH_EXTRINSICS]);
+      T ang = LighthouseModel::ProjectHorizontal(lPs.data(), motor, correction_);
       // std::cout << "H " << horizontal_observations_[i].sensor_id << " - "
       // << lPs(0) << ", " << lPs(1) << ", " << lPs(2)
       // << " - " << ang << " " << horizontal_observations_[i].angle << std::endl;
@@ -850,20 +869,9 @@ struct BundleHorizontalAngle{
       Eigen::Matrix<T, 3, 1> lPs = lRv * vRt * tPs + (lRv * vPt + lPv);
       // residual[i] = T(-horizontal_observations_[i].angle) - atan(lPs(1)/lPs(2));
 
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE) * parameters[LH_EXTRINSICS][PHASE];
-      T tilt = T(SCALE_TILT) * parameters[LH_EXTRINSICS][TILT];
-      T curve = T(SCALE_CURVE) * parameters[LH_EXTRINSICS][CURVE];
-      T gib_mag = T(SCALE_GIB) * parameters[LH_EXTRINSICS][GIB_MAG];
-      T gib_phase = parameters[LH_EXTRINSICS][GIB_PHASE];
-      if (correction_) {
-        // Distortion correction
-        ang = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
-      } else {
-        ang = atan(x);
-      }
+      // Shared projection kernel
+      MotorModel<T> motor = LighthouseModel::Scale(parameters[LH_EXTRINSICS]);
+      T ang = LighthouseModel::ProjectHorizontal(lPs.data(), motor, correction_);
 
       residual[i] = T(horizontal_observations_[i].angle) - ang;
     }
@@ -907,20 +915,9 @@ struct BundleVerticalAngle{
       Eigen::Matrix<T, 3, 1> lPs = lRv * vRt * tPs + (lRv * vPt + lPv);
       // residual[i] = T(vertical_observations_[i].angle) - atan(lPs(0)/lPs(2));
 
-      T ang; // The final angle
-      T x = (lPs(0)/lPs(2)); // Horizontal angle
-      T y = (lPs(1)/lPs(2)); // Vertical angle
-      T phase = T(SCALE_PHASE) * parameters[LH_EXTRINSICS][PHASE];
-      T tilt = T(SCALE_TILT) * parameters[LH_EXTRINSICS][TILT];
-      T curve = T(SCALE_CURVE) * parameters[LH_EXTRINSICS][CURVE];
-      T gib_mag = T(SCALE_GIB) * parameters[LH_EXTRINSICS][GIB_MAG];
-      T gib_phase = parameters[LH_EXTRINSICS][GIB_PHASE];
-      if (correction_) {
-        // Distortion correction
-        ang = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
-      } else {
-        ang = atan(y);
-      }
+      // Shared projection kernel
+      MotorModel<T> motor = LighthouseModel::Scale(parameters[LH_EXTRINSICS]);
+      T ang = LighthouseModel::ProjectVertical(lPs.data(), motor, correction_);
 
       residual[i] = T(vertical_observations_[i].angle) - ang;
     }
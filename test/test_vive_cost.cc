@@ -0,0 +1,334 @@
+// Hive includes
+#include <hive/vive.h>
+#include <hive/vive_cost.h>
+#include <hive/vive_lighthouse.h>
+#include <hive/vive_snapshot.h>
+
+// Incoming measurements
+#include <hive/ViveLight.h>
+
+// Ceres
+#include <ceres/ceres.h>
+#include <ceres/rotation.h>
+
+// Google test
+#include <gtest/gtest.h>
+
+// STD C includes
+#include <math.h>
+
+// STD C++ includes
+#include <memory>
+#include <string>
+#include <vector>
+
+#define TEST_TRACKER "LHR-TEST0001"
+#define TEST_LIGHTHOUSE "LHB-TEST0001"
+#define TEST_SENSORS 8
+#define TEST_TOLERANCE 1e-9
+
+// Reference residuals written against the lighthouse model kernels only, so
+// that ceres can differentiate them. A NULL block uses the calibration.
+class LightKernel {
+ public:
+  LightKernel(CalibrationSnapshot::Ptr const& calibration,
+    hive::ViveLight const& data,
+    cost::PoseBlock pose_block,
+    int extra_blocks,
+    bool correction) : calibration_(calibration),
+      pose_block_(pose_block),
+      extra_blocks_(extra_blocks),
+      correction_(correction) {
+    tracker_ = calibration_->GetTracker(TEST_TRACKER);
+    lighthouse_ = calibration_->GetLighthouse(data.lighthouse);
+    axis_ = data.axis;
+    for (auto const& sample : data.samples) {
+      sensors_.push_back(sample.sensor);
+      angles_.push_back(sample.angle);
+    }
+  }
+
+  template <typename T>
+  bool operator()(T const* pose, T * residuals) const {
+    return Residuals(pose, static_cast<T const*>(NULL),
+      static_cast<T const*>(NULL), residuals);
+  }
+
+  // One extra block, either the lighthouse pose or the motor
+  template <typename T>
+  bool operator()(T const* pose, T const* extra, T * residuals) const {
+    if (extra_blocks_ == cost::LH_POSE)
+      return Residuals(pose, extra, static_cast<T const*>(NULL), residuals);
+    return Residuals(pose, static_cast<T const*>(NULL), extra, residuals);
+  }
+
+  template <typename T>
+  bool operator()(T const* pose,
+    T const* lighthouse,
+    T const* motor,
+    T * residuals) const {
+    return Residuals(pose, lighthouse, motor, residuals);
+  }
+
+  size_t Size() const {
+    return sensors_.size();
+  }
+
+  int ExtraBlocks() const {
+    return extra_blocks_;
+  }
+
+ private:
+  template <typename T>
+  bool Residuals(T const* pose,
+    T const* lighthouse,
+    T const* motor,
+    T * residuals) const {
+    // Pose of the lighthouse in the vive frame
+    T vPl[3], vAl[3];
+    if (lighthouse != NULL) {
+      for (size_t j = 0; j < 3; j++) {
+        vPl[j] = lighthouse[j];
+        vAl[j] = lighthouse[3 + j];
+      }
+    } else {
+      Eigen::AngleAxisd aa(lighthouse_->vRl);
+      for (size_t j = 0; j < 3; j++) {
+        vPl[j] = T(lighthouse_->vPl(j));
+        vAl[j] = T(aa.angle() * aa.axis()(j));
+      }
+    }
+    T lAv[3] = {-vAl[0], -vAl[1], -vAl[2]};
+    // Sensors in the frame of the pose block
+    Eigen::Vector3d const* points = (pose_block_ == cost::POSE_IMU) ?
+      tracker_->iPs : tracker_->tPs;
+    for (size_t i = 0; i < sensors_.size(); i++) {
+      T bPs[3], vPs[3], lPs[3];
+      for (size_t j = 0; j < 3; j++)
+        bPs[j] = T(points[sensors_[i]](j));
+      ceres::AngleAxisRotatePoint(pose + pose_block_ - 3, bPs, vPs);
+      for (size_t j = 0; j < 3; j++)
+        vPs[j] += pose[j] - vPl[j];
+      ceres::AngleAxisRotatePoint(lAv, vPs, lPs);
+      if (motor != NULL) {
+        MotorModel<T> scaled = LighthouseModel::Scale(motor);
+        residuals[i] = T(angles_[i]) - ((axis_ == HORIZONTAL) ?
+          LighthouseModel::ProjectHorizontal(lPs, scaled, correction_) :
+          LighthouseModel::ProjectVertical(lPs, scaled, correction_));
+      } else {
+        MotorModel<double> const& fixed = lighthouse_->motors[axis_];
+        residuals[i] = T(angles_[i]) - ((axis_ == HORIZONTAL) ?
+          LighthouseModel::ProjectHorizontal(lPs, fixed, correction_) :
+          LighthouseModel::ProjectVertical(lPs, fixed, correction_));
+      }
+    }
+    return true;
+  }
+
+ private:
+  CalibrationSnapshot::Ptr calibration_;
+  TrackerSnapshot const* tracker_;
+  LighthouseModel const* lighthouse_;
+  std::vector<uint8_t> sensors_;
+  std::vector<double> angles_;
+  uint8_t axis_;
+  cost::PoseBlock pose_block_;
+  int extra_blocks_;
+  bool correction_;
+};
+
+// Autodiff cost of the kernel with the blocks of the analytic cost
+template <int P>
+ceres::CostFunction * AutoDiffCost(LightKernel * kernel) {
+  switch (kernel->ExtraBlocks()) {
+  case cost::NO_BLOCK:
+    return new ceres::AutoDiffCostFunction<LightKernel,
+      ceres::DYNAMIC, P>(kernel, kernel->Size());
+  case cost::LH_POSE:
+    return new ceres::AutoDiffCostFunction<LightKernel,
+      ceres::DYNAMIC, P, 6>(kernel, kernel->Size());
+  case cost::LH_MOTOR:
+    return new ceres::AutoDiffCostFunction<LightKernel,
+      ceres::DYNAMIC, P, 5>(kernel, kernel->Size());
+  default:
+    return new ceres::AutoDiffCostFunction<LightKernel,
+      ceres::DYNAMIC, P, 6, 5>(kernel, kernel->Size());
+  }
+}
+
+// Calibration with one tracker, seen by one registered lighthouse
+CalibrationSnapshot::Ptr TestCalibration() {
+  Tracker tracker;
+  tracker.serial = TEST_TRACKER;
+  for (size_t i = 0; i < TEST_SENSORS; i++) {
+    Sensor sensor;
+    sensor.position.x = 0.04 * cos(0.8 * i);
+    sensor.position.y = 0.04 * sin(0.8 * i);
+    sensor.position.z = 0.01 * (i % 3);
+    sensor.normal.x = 0.0;
+    sensor.normal.y = 0.0;
+    sensor.normal.z = 1.0;
+    tracker.sensors[2 * i + 1] = sensor;
+  }
+  Eigen::Quaterniond tQi(Eigen::AngleAxisd(0.3,
+    Eigen::Vector3d(1.0, -2.0, 0.5).normalized()));
+  tracker.imu_transform.translation.x = 0.01;
+  tracker.imu_transform.translation.y = -0.02;
+  tracker.imu_transform.translation.z = 0.03;
+  tracker.imu_transform.rotation.w = tQi.w();
+  tracker.imu_transform.rotation.x = tQi.x();
+  tracker.imu_transform.rotation.y = tQi.y();
+  tracker.imu_transform.rotation.z = tQi.z();
+  std::map<std::string, Tracker> trackers;
+  trackers[TEST_TRACKER] = tracker;
+
+  Lighthouse lighthouse;
+  lighthouse.serial = TEST_LIGHTHOUSE;
+  lighthouse.id = 0;
+  lighthouse.horizontal_motor.phase = 0.02;
+  lighthouse.horizontal_motor.tilt = 0.4;
+  lighthouse.horizontal_motor.gib_phase = 0.3;
+  lighthouse.horizontal_motor.gib_magnitude = 0.1;
+  lighthouse.horizontal_motor.curve = 0.2;
+  lighthouse.vertical_motor.phase = -0.01;
+  lighthouse.vertical_motor.tilt = -0.3;
+  lighthouse.vertical_motor.gib_phase = 1.2;
+  lighthouse.vertical_motor.gib_magnitude = 0.05;
+  lighthouse.vertical_motor.curve = -0.1;
+  LighthouseMap lighthouses;
+  lighthouses[TEST_LIGHTHOUSE] = lighthouse;
+
+  // Lighthouse in front of the tracker, looking back at it
+  Environment environment;
+  Eigen::Quaterniond vQl(Eigen::AngleAxisd(0.2,
+    Eigen::Vector3d(0.3, 1.0, -0.2).normalized()));
+  Transform vTl;
+  vTl.translation.x = 0.1;
+  vTl.translation.y = 0.2;
+  vTl.translation.z = -2.0;
+  vTl.rotation.w = vQl.w();
+  vTl.rotation.x = vQl.x();
+  vTl.rotation.y = vQl.y();
+  vTl.rotation.z = vQl.z();
+  environment.lighthouses[TEST_LIGHTHOUSE] = vTl;
+  return CalibrationSnapshot::Create(environment, lighthouses, trackers);
+}
+
+// Compare residuals and jacobians of both costs at the same parameters
+void CheckJacobians(cost::PoseBlock pose_block,
+  int extra_blocks,
+  uint8_t axis,
+  bool correction) {
+  CalibrationSnapshot::Ptr calibration = TestCalibration();
+  hive::ViveLight data;
+  data.lighthouse = TEST_LIGHTHOUSE;
+  data.axis = axis;
+  for (size_t i = 0; i < TEST_SENSORS; i++) {
+    hive::ViveLightSample sample;
+    sample.sensor = 2 * i + 1;
+    sample.angle = 0.01 * i - 0.02;
+    data.samples.push_back(sample);
+  }
+
+  // Parameter blocks in the order of the analytic cost
+  double pose[9] = {0.05, -0.1, 0.2, 0.3, -0.2, 0.1, 0.3, -0.2, 0.1};
+  double lighthouse[6] = {0.12, 0.18, -1.9, 0.05, 0.15, -0.03};
+  double motor[5] = {0.03, 0.5, 0.4, 0.2, 0.1};
+  std::vector<double*> parameters;
+  std::vector<size_t> sizes;
+  parameters.push_back(pose);
+  sizes.push_back(pose_block);
+  if (extra_blocks & cost::LH_POSE) {
+    parameters.push_back(lighthouse);
+    sizes.push_back(6);
+  }
+  if (extra_blocks & cost::LH_MOTOR) {
+    parameters.push_back(motor);
+    sizes.push_back(5);
+  }
+
+  std::unique_ptr<ceres::CostFunction> analytic(new cost::ViveLightCost(
+    data, calibration, TEST_TRACKER, pose_block, correction, extra_blocks));
+  LightKernel * kernel =
+    new LightKernel(calibration, data, pose_block, extra_blocks, correction);
+  std::unique_ptr<ceres::CostFunction> autodiff((pose_block == cost::POSE_IMU)
+    ? AutoDiffCost<cost::POSE_IMU>(kernel)
+    : AutoDiffCost<cost::POSE_TRACKER>(kernel));
+  ASSERT_EQ(analytic->num_residuals(), autodiff->num_residuals());
+  ASSERT_EQ(analytic->parameter_block_sizes(),
+    autodiff->parameter_block_sizes());
+
+  size_t n = TEST_SENSORS;
+  std::vector<double> r_analytic(n), r_autodiff(n);
+  std::vector<std::vector<double>> j_analytic, j_autodiff;
+  std::vector<double*> jacobians_analytic, jacobians_autodiff;
+  for (size_t b = 0; b < sizes.size(); b++) {
+    j_analytic.push_back(std::vector<double>(n * sizes[b], 0.0));
+    j_autodiff.push_back(std::vector<double>(n * sizes[b], 0.0));
+  }
+  for (size_t b = 0; b < sizes.size(); b++) {
+    jacobians_analytic.push_back(j_analytic[b].data());
+    jacobians_autodiff.push_back(j_autodiff[b].data());
+  }
+  ASSERT_TRUE(analytic->Evaluate(parameters.data(),
+    r_analytic.data(), jacobians_analytic.data()));
+  ASSERT_TRUE(autodiff->Evaluate(parameters.data(),
+    r_autodiff.data(), jacobians_autodiff.data()));
+
+  for (size_t i = 0; i < n; i++)
+    EXPECT_NEAR(r_analytic[i], r_autodiff[i], TEST_TOLERANCE)
+      << "residual " << i;
+  for (size_t b = 0; b < sizes.size(); b++)
+    for (size_t k = 0; k < n * sizes[b]; k++)
+      EXPECT_NEAR(j_analytic[b][k], j_autodiff[b][k], TEST_TOLERANCE)
+        << "block " << b << " residual " << k / sizes[b]
+        << " parameter " << k % sizes[b];
+}
+
+// Every axis with and without the motor correction
+void CheckLayout(cost::PoseBlock pose_block, int extra_blocks) {
+  for (uint8_t axis = HORIZONTAL; axis <= VERTICAL; axis++) {
+    for (int correction = 0; correction < 2; correction++) {
+      SCOPED_TRACE(::testing::Message() << "axis " << static_cast<int>(axis)
+        << " correction " << correction);
+      CheckJacobians(pose_block, extra_blocks, axis, correction != 0);
+    }
+  }
+}
+
+TEST(ViveLightCost, TrackerPose) {
+  CheckLayout(cost::POSE_TRACKER, cost::NO_BLOCK);
+}
+
+TEST(ViveLightCost, TrackerPoseLighthousePose) {
+  CheckLayout(cost::POSE_TRACKER, cost::LH_POSE);
+}
+
+TEST(ViveLightCost, TrackerPoseMotor) {
+  CheckLayout(cost::POSE_TRACKER, cost::LH_MOTOR);
+}
+
+TEST(ViveLightCost, TrackerPoseLighthousePoseMotor) {
+  CheckLayout(cost::POSE_TRACKER, cost::LH_POSE | cost::LH_MOTOR);
+}
+
+TEST(ViveLightCost, ImuPose) {
+  CheckLayout(cost::POSE_IMU, cost::NO_BLOCK);
+}
+
+TEST(ViveLightCost, ImuPoseLighthousePose) {
+  CheckLayout(cost::POSE_IMU, cost::LH_POSE);
+}
+
+TEST(ViveLightCost, ImuPoseMotor) {
+  CheckLayout(cost::POSE_IMU, cost::LH_MOTOR);
+}
+
+TEST(ViveLightCost, ImuPoseLighthousePoseMotor) {
+  CheckLayout(cost::POSE_IMU, cost::LH_POSE | cost::LH_MOTOR);
+}
+
+int main(int argc, char ** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
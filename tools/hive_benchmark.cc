@@ -0,0 +1,158 @@
+// Includes
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+// Hive imports
+#include <hive/hive_solver.h>
+#include <hive/vive_general.h>
+
+// Incoming measurements
+#include <geometry_msgs/TransformStamped.h>
+#include <hive/ViveLight.h>
+#include <hive/ViveCalibration.h>
+
+// Eigen
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// C++11 includes
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <string>
+
+// Timing and agreement of one backend
+struct Stats {
+  double seconds = 0.0;
+  size_t calls = 0;
+  size_t valid = 0;
+};
+
+// Main function
+int main(int argc, char ** argv) {
+  // Data
+  Calibration calibration;
+  std::map<std::string, HiveSolver*> ceres_solver;
+  std::map<std::string, HiveSolver*> lm_solver;
+
+  // Read bag with data
+  if (argc < 2) {
+    std::cout << "Usage: ... hive_benchmark read.bag" << std::endl;
+    return -1;
+  }
+  rosbag::Bag rbag;
+  rbag.open(std::string(argv[1]), rosbag::bagmode::Read);
+
+  ViveUtils::ReadConfig(HIVE_CALIBRATION_FILE,
+    &calibration);
+
+  // Lighthouses
+  rosbag::View view_lh(rbag, rosbag::TopicQuery("/loc/vive/lighthouses"));
+  for (auto bag_it = view_lh.begin(); bag_it != view_lh.end(); bag_it++) {
+    const hive::ViveCalibrationLighthouseArray::ConstPtr vl =
+      bag_it->instantiate<hive::ViveCalibrationLighthouseArray>();
+    calibration.SetLighthouses(*vl);
+  }
+  ROS_INFO("Lighthouses' setup complete.");
+
+  // Trackers
+  rosbag::View view_tr(rbag, rosbag::TopicQuery("/loc/vive/trackers"));
+  for (auto bag_it = view_tr.begin(); bag_it != view_tr.end(); bag_it++) {
+    const hive::ViveCalibrationTrackerArray::ConstPtr vt =
+      bag_it->instantiate<hive::ViveCalibrationTrackerArray>();
+    calibration.SetTrackers(*vt);
+  }
+  for (auto tracker : calibration.trackers) {
+    ceres_solver[tracker.first] = new HiveSolver(calibration.trackers[tracker.first],
+      calibration.lighthouses,
+      calibration.environment,
+      true, false, solve::CERES);
+    lm_solver[tracker.first] = new HiveSolver(calibration.trackers[tracker.first],
+      calibration.lighthouses,
+      calibration.environment,
+      true, false, solve::LM);
+  }
+  ROS_INFO("Trackers' setup complete.");
+
+  // Replay the light through both backends
+  Stats ceres_stats, lm_stats;
+  double max_translation = 0.0, sum_translation = 0.0;
+  double max_rotation = 0.0, sum_rotation = 0.0;
+  size_t compared = 0;
+  std::vector<std::string> topics;
+  topics.push_back("/loc/vive/light");
+  topics.push_back("/loc/vive/light/");
+  rosbag::View view_li(rbag, rosbag::TopicQuery(topics));
+  for (auto bag_it = view_li.begin(); bag_it != view_li.end(); bag_it++) {
+    const hive::ViveLight::ConstPtr vl = bag_it->instantiate<hive::ViveLight>();
+    if (vl == NULL) continue;
+    auto ceres_it = ceres_solver.find(vl->header.frame_id);
+    auto lm_it = lm_solver.find(vl->header.frame_id);
+    if (ceres_it == ceres_solver.end() || lm_it == lm_solver.end()) continue;
+
+    // Ceres
+    auto start = std::chrono::steady_clock::now();
+    ceres_it->second->ProcessLight(vl);
+    ceres_stats.seconds += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    ceres_stats.calls++;
+    // Fixed size LM
+    start = std::chrono::steady_clock::now();
+    lm_it->second->ProcessLight(vl);
+    lm_stats.seconds += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    lm_stats.calls++;
+
+    // Agreement between the two
+    geometry_msgs::TransformStamped ceres_tf, lm_tf;
+    bool ceres_valid = ceres_it->second->GetTransform(ceres_tf);
+    bool lm_valid = lm_it->second->GetTransform(lm_tf);
+    if (ceres_valid) ceres_stats.valid++;
+    if (lm_valid) lm_stats.valid++;
+    if (!ceres_valid || !lm_valid) continue;
+    Eigen::Vector3d ceres_P(ceres_tf.transform.translation.x,
+      ceres_tf.transform.translation.y,
+      ceres_tf.transform.translation.z);
+    Eigen::Vector3d lm_P(lm_tf.transform.translation.x,
+      lm_tf.transform.translation.y,
+      lm_tf.transform.translation.z);
+    Eigen::Quaterniond ceres_Q(ceres_tf.transform.rotation.w,
+      ceres_tf.transform.rotation.x,
+      ceres_tf.transform.rotation.y,
+      ceres_tf.transform.rotation.z);
+    Eigen::Quaterniond lm_Q(lm_tf.transform.rotation.w,
+      lm_tf.transform.rotation.x,
+      lm_tf.transform.rotation.y,
+      lm_tf.transform.rotation.z);
+    double translation = (ceres_P - lm_P).norm();
+    double rotation = ceres_Q.angularDistance(lm_Q);
+    max_translation = std::max(max_translation, translation);
+    max_rotation = std::max(max_rotation, rotation);
+    sum_translation += translation;
+    sum_rotation += rotation;
+    compared++;
+  }
+  rbag.close();
+
+  // Report
+  std::cout << "Backend, light messages, valid poses, mean time (us)" << std::endl;
+  std::cout << "CERES, " << ceres_stats.calls << ", " << ceres_stats.valid
+    << ", " << 1e6 * ceres_stats.seconds / std::max<size_t>(ceres_stats.calls, 1)
+    << std::endl;
+  std::cout << "LM, " << lm_stats.calls << ", " << lm_stats.valid
+    << ", " << 1e6 * lm_stats.seconds / std::max<size_t>(lm_stats.calls, 1)
+    << std::endl;
+  if (compared > 0) {
+    std::cout << "Translation difference (m): mean "
+      << sum_translation / compared << ", max " << max_translation << std::endl;
+    std::cout << "Rotation difference (rad): mean "
+      << sum_rotation / compared << ", max " << max_rotation << std::endl;
+  }
+
+  for (auto solver : ceres_solver) delete solver.second;
+  for (auto solver : lm_solver) delete solver.second;
+
+  return 0;
+}
@@ -0,0 +1,59 @@
+// ROS includes
+#include <ros/ros.h>
+
+// Hive imports
+#include <hive/vive_bridge.h>
+#include <hive/vive_replay.h>
+
+// C++11 includes
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// Main function
+int main(int argc, char ** argv) {
+  ros::init(argc, argv, "hive_bridge_benchmark");
+  if (argc < 2) {
+    std::cout << "Usage: ... hive_bridge_benchmark <bag> [spin|backoff] [rate]"
+      " [contexts]" << std::endl;
+    return -1;
+  }
+  std::string mode = argc > 2 ? argv[2] : "backoff";
+  double rate = argc > 3 ? std::stod(argv[3]) : 1.0;
+  int contexts = argc > 4 ? std::stoi(argv[4]) : 1;
+  if (mode != "spin" && mode != "backoff") {
+    std::cout << "Unknown poll mode " << mode << std::endl;
+    return -1;
+  }
+  if (contexts < 1) {
+    std::cout << "At least one context is needed" << std::endl;
+    return -1;
+  }
+  if (!replay::Open(argv[1], rate, contexts)) return -1;
+
+  ros::NodeHandle nh, pnh("~");
+  pnh.setParam("poll_backoff", mode == "backoff");
+  pnh.setParam("contexts", contexts);
+  HiveBridge bridge;
+  bridge.Initialize(&nh, &pnh);
+  while (ros::ok() && !replay::GetStats().finished)
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  // Let the publisher drain the ring
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  replay::Stats stats = replay::GetStats();
+  BridgeStats bridge_stats = bridge.GetStats();
+  std::cout << "Mode: " << mode << ", " << contexts << " contexts"
+    << std::endl;
+  std::cout << "Callbacks: " << stats.callbacks << " in "
+    << stats.wall << " s" << std::endl;
+  std::cout << "Poll threads cpu: " << 100.0 * stats.poll_cpu / stats.wall
+    << " %" << std::endl;
+  std::cout << "Callback delay: "
+    << 1e6 * stats.sum_delay / std::max<size_t>(stats.callbacks, 1)
+    << " us mean, " << 1e6 * stats.max_delay << " us max" << std::endl;
+  std::cout << "Overruns since the last report: " << bridge_stats.overruns
+    << std::endl;
+  return 0;
+}
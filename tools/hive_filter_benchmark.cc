@@ -0,0 +1,175 @@
+// Includes
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+// Hive imports
+#include <hive/vive_filter.h>
+#include <hive/vive_general.h>
+
+// Incoming measurements
+#include <geometry_msgs/TransformStamped.h>
+#include <sensor_msgs/Imu.h>
+#include <hive/ViveLight.h>
+#include <hive/ViveCalibration.h>
+
+// Eigen
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+// C++11 includes
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <map>
+#include <string>
+
+// Timing and validity of one update mode
+struct Stats {
+  double seconds = 0.0;
+  size_t calls = 0;
+  size_t valid = 0;
+};
+
+// Main function
+int main(int argc, char ** argv) {
+  // Data
+  Calibration calibration;
+  std::map<std::string, ViveFilter*> batch_filter;
+  std::map<std::string, ViveFilter*> sequential_filter;
+
+  // Read bag with data
+  if (argc < 2) {
+    std::cout << "Usage: ... hive_filter_benchmark read.bag [ekf|iekf]"
+      << std::endl;
+    return -1;
+  }
+  filter::type ftype = filter::ekf;
+  if (argc > 2 && std::string(argv[2]) == "iekf") ftype = filter::iekf;
+  rosbag::Bag rbag;
+  rbag.open(std::string(argv[1]), rosbag::bagmode::Read);
+
+  ViveUtils::ReadConfig(HIVE_CALIBRATION_FILE,
+    &calibration);
+
+  // Lighthouses
+  rosbag::View view_lh(rbag, rosbag::TopicQuery("/loc/vive/lighthouses"));
+  for (auto bag_it = view_lh.begin(); bag_it != view_lh.end(); bag_it++) {
+    const hive::ViveCalibrationLighthouseArray::ConstPtr vl =
+      bag_it->instantiate<hive::ViveCalibrationLighthouseArray>();
+    calibration.SetLighthouses(*vl);
+  }
+  ROS_INFO("Lighthouses' setup complete.");
+
+  // Trackers
+  rosbag::View view_tr(rbag, rosbag::TopicQuery("/loc/vive/trackers"));
+  for (auto bag_it = view_tr.begin(); bag_it != view_tr.end(); bag_it++) {
+    const hive::ViveCalibrationTrackerArray::ConstPtr vt =
+      bag_it->instantiate<hive::ViveCalibrationTrackerArray>();
+    calibration.SetTrackers(*vt);
+  }
+  for (auto tracker : calibration.trackers) {
+    batch_filter[tracker.first] = new ViveFilter(
+      calibration.trackers[tracker.first],
+      calibration.lighthouses,
+      calibration.environment,
+      1e0, 1e-6, true, ftype, filter::batch);
+    sequential_filter[tracker.first] = new ViveFilter(
+      calibration.trackers[tracker.first],
+      calibration.lighthouses,
+      calibration.environment,
+      1e0, 1e-6, true, ftype, filter::sequential);
+  }
+  ROS_INFO("Trackers' setup complete.");
+
+  // Replay the data through both update modes
+  Stats batch_stats, sequential_stats;
+  double max_translation = 0.0, sum_translation = 0.0;
+  double max_rotation = 0.0, sum_rotation = 0.0;
+  size_t compared = 0;
+  std::vector<std::string> topics;
+  topics.push_back("/loc/vive/light");
+  topics.push_back("/loc/vive/light/");
+  topics.push_back("/loc/vive/imu");
+  topics.push_back("/loc/vive/imu/");
+  rosbag::View view_li(rbag, rosbag::TopicQuery(topics));
+  for (auto bag_it = view_li.begin(); bag_it != view_li.end(); bag_it++) {
+    const sensor_msgs::Imu::ConstPtr vi = bag_it->instantiate<sensor_msgs::Imu>();
+    if (vi != NULL) {
+      auto batch_it = batch_filter.find(vi->header.frame_id);
+      auto sequential_it = sequential_filter.find(vi->header.frame_id);
+      if (batch_it == batch_filter.end()) continue;
+      batch_it->second->ProcessImu(vi);
+      sequential_it->second->ProcessImu(vi);
+      continue;
+    }
+    const hive::ViveLight::ConstPtr vl = bag_it->instantiate<hive::ViveLight>();
+    if (vl == NULL) continue;
+    auto batch_it = batch_filter.find(vl->header.frame_id);
+    auto sequential_it = sequential_filter.find(vl->header.frame_id);
+    if (batch_it == batch_filter.end()) continue;
+
+    // Whole sweep
+    auto start = std::chrono::steady_clock::now();
+    batch_it->second->ProcessLight(vl);
+    batch_stats.seconds += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    batch_stats.calls++;
+    // One sample at a time
+    start = std::chrono::steady_clock::now();
+    sequential_it->second->ProcessLight(vl);
+    sequential_stats.seconds += std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    sequential_stats.calls++;
+
+    // Agreement between the two
+    geometry_msgs::TransformStamped batch_tf, sequential_tf;
+    bool batch_valid = batch_it->second->GetTransform(batch_tf);
+    bool sequential_valid = sequential_it->second->GetTransform(sequential_tf);
+    if (batch_valid) batch_stats.valid++;
+    if (sequential_valid) sequential_stats.valid++;
+    if (!batch_valid || !sequential_valid) continue;
+    Eigen::Vector3d batch_P(batch_tf.transform.translation.x,
+      batch_tf.transform.translation.y,
+      batch_tf.transform.translation.z);
+    Eigen::Vector3d sequential_P(sequential_tf.transform.translation.x,
+      sequential_tf.transform.translation.y,
+      sequential_tf.transform.translation.z);
+    Eigen::Quaterniond batch_Q(batch_tf.transform.rotation.w,
+      batch_tf.transform.rotation.x,
+      batch_tf.transform.rotation.y,
+      batch_tf.transform.rotation.z);
+    Eigen::Quaterniond sequential_Q(sequential_tf.transform.rotation.w,
+      sequential_tf.transform.rotation.x,
+      sequential_tf.transform.rotation.y,
+      sequential_tf.transform.rotation.z);
+    double translation = (batch_P - sequential_P).norm();
+    double rotation = batch_Q.angularDistance(sequential_Q);
+    max_translation = std::max(max_translation, translation);
+    max_rotation = std::max(max_rotation, rotation);
+    sum_translation += translation;
+    sum_rotation += rotation;
+    compared++;
+  }
+  rbag.close();
+
+  // Report
+  std::cout << "Update, light messages, valid poses, mean time (us)" << std::endl;
+  std::cout << "BATCH, " << batch_stats.calls << ", " << batch_stats.valid
+    << ", " << 1e6 * batch_stats.seconds / std::max<size_t>(batch_stats.calls, 1)
+    << std::endl;
+  std::cout << "SEQUENTIAL, " << sequential_stats.calls << ", "
+    << sequential_stats.valid << ", " << 1e6 * sequential_stats.seconds /
+    std::max<size_t>(sequential_stats.calls, 1) << std::endl;
+  if (compared > 0) {
+    std::cout << "Translation difference (m): mean "
+      << sum_translation / compared << ", max " << max_translation << std::endl;
+    std::cout << "Rotation difference (rad): mean "
+      << sum_rotation / compared << ", max " << max_rotation << std::endl;
+  }
+
+  for (auto solver : batch_filter) delete solver.second;
+  for (auto solver : sequential_filter) delete solver.second;
+
+  return 0;
+}
@@ -0,0 +1,117 @@
+// Hive imports
+#include <hive/vive_pool.h>
+
+// Eigen
+#include <Eigen/Dense>
+
+// C++11 includes
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Sensors seen by the lighthouse in one synthetic frame
+#define BENCHMARK_SENSORS 16
+// Gauss-Newton iterations of one synthetic solve
+#define BENCHMARK_ITERATIONS 200
+
+// Synthetic tracker: sensor layout and the frames it has solved
+struct SyntheticTracker {
+  Eigen::Matrix<double, 3, BENCHMARK_SENSORS> sensors;
+  size_t solved = 0;
+  bool ordered = true;
+  double checksum = 0.0;
+};
+
+// Recovers the tracker position from the angles of its sensors to a
+// lighthouse at the origin, about as heavy as a light frame solve
+static void SolveFrame(SyntheticTracker * tracker, size_t frame) {
+  // Out of order frames would break the per tracker strand
+  if (frame != tracker->solved) tracker->ordered = false;
+  tracker->solved++;
+  Eigen::Vector3d truth(0.1 * (frame % 7), 0.1 * (frame % 5), 2.0);
+  Eigen::Matrix<double, 2 * BENCHMARK_SENSORS, 1> angles;
+  for (size_t i = 0; i < BENCHMARK_SENSORS; i++) {
+    Eigen::Vector3d lPs = truth + tracker->sensors.col(i);
+    angles(2 * i) = atan(lPs(0) / lPs(2));
+    angles(2 * i + 1) = atan(lPs(1) / lPs(2));
+  }
+  Eigen::Vector3d position(0.0, 0.0, 1.0);
+  for (size_t it = 0; it < BENCHMARK_ITERATIONS; it++) {
+    Eigen::Matrix<double, 2 * BENCHMARK_SENSORS, 1> residuals;
+    Eigen::Matrix<double, 2 * BENCHMARK_SENSORS, 3> jacobian;
+    for (size_t i = 0; i < BENCHMARK_SENSORS; i++) {
+      Eigen::Vector3d lPs = position + tracker->sensors.col(i);
+      double u = lPs(0) / lPs(2), v = lPs(1) / lPs(2);
+      residuals(2 * i) = atan(u) - angles(2 * i);
+      residuals(2 * i + 1) = atan(v) - angles(2 * i + 1);
+      double du = 1.0 / (1.0 + u * u), dv = 1.0 / (1.0 + v * v);
+      jacobian.row(2 * i) << du / lPs(2), 0.0, - du * u / lPs(2);
+      jacobian.row(2 * i + 1) << 0.0, dv / lPs(2), - dv * v / lPs(2);
+    }
+    position -= (jacobian.transpose() * jacobian).ldlt().solve(
+      jacobian.transpose() * residuals);
+  }
+  tracker->checksum += (position - truth).norm();
+  return;
+}
+
+// Main function
+int main(int argc, char ** argv) {
+  size_t trackers = 16, frames = 2000;
+  size_t cores = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  if (argc > 1) trackers = std::stoul(argv[1]);
+  if (argc > 2) frames = std::stoul(argv[2]);
+  if (argc > 3) cores = std::stoul(argv[3]);
+  if (trackers == 0 || frames == 0 || cores == 0) {
+    std::cout << "Usage: ... hive_pool_benchmark [trackers] [frames] [threads]"
+      << std::endl;
+    return -1;
+  }
+
+  // Pool sizes to compare, doubling up to the number of cores
+  std::vector<size_t> sizes;
+  for (size_t threads = 1; threads < cores; threads *= 2)
+    sizes.push_back(threads);
+  sizes.push_back(cores);
+
+  std::cout << "Threads, poses, seconds, poses/s, speedup, stolen, ordered"
+    << std::endl;
+  double baseline = 0.0;
+  for (size_t threads : sizes) {
+    std::vector<SyntheticTracker> data(trackers);
+    for (size_t t = 0; t < trackers; t++)
+      data[t].sensors = 0.05 * Eigen::Matrix<double, 3, BENCHMARK_SENSORS>::Random();
+    WorkPool pool(threads);
+    std::vector<std::shared_ptr<pool::Strand>> strands;
+    for (size_t t = 0; t < trackers; t++)
+      strands.push_back(pool.NewStrand());
+
+    // Frames arrive interleaved across trackers, as from the bridge
+    auto start = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < frames; f++) {
+      for (size_t t = 0; t < trackers; t++) {
+        SyntheticTracker * tracker = &data[t];
+        pool.Post(strands[t], [tracker, f] { SolveFrame(tracker, f); });
+      }
+    }
+    pool.Wait();
+    double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+    size_t poses = 0;
+    bool ordered = true;
+    for (auto const& tracker : data) {
+      poses += tracker.solved;
+      ordered = ordered && tracker.ordered;
+    }
+    if (threads == 1) baseline = poses / seconds;
+    std::cout << threads << ", " << poses << ", " << seconds << ", "
+      << poses / seconds << ", " << poses / seconds / baseline << ", "
+      << pool.GetCounters().stolen << ", " << (ordered ? "yes" : "no")
+      << std::endl;
+  }
+  return 0;
+}
@@ -10,6 +10,7 @@
 #include <hive/vive_general.h>
 #include <hive/hive_calibrator.h>
 #include <hive/vive_refine.h>
+#include <hive/vive_lighthouse.h>
 
 // Incoming measurements
 #include <geometry_msgs/TransformStamped.h>
@@ -54,6 +55,7 @@ private:
   Tracker tracker_;
   std::map<std::string, Transform> lh_poses_;
   std::map<std::string, Lighthouse> lh_specs_;
+  std::map<std::string, LighthouseModel> lh_models_;
   geometry_msgs::Vector3 gravity_;
   size_t axis_;
   TransformIterator lh_pointer_;
@@ -98,6 +100,10 @@ Trajectory::Trajectory(TrajectoryFunction tfun,
   lh_poses_ = lh_poses;
   lh_specs_ = lh_specs;
   lh_pointer_ = lh_poses_.begin();
+  // Same projection as the solvers
+  for (auto const& lh_pose : lh_poses_)
+    lh_models_[lh_pose.first] = LighthouseModel(lh_pose.first,
+      lh_specs_[lh_pose.first], lh_pose.second);
   precision_ = 1e-6;
   // acc_distribution_ = std::normal_distribution<double>(0,1e-10);
   // gyr_distribution_ = std::normal_distribution<double>(0,1e-10);
@@ -160,39 +166,12 @@ hive::ViveLight::ConstPtr Trajectory::GetLight() {
   Eigen::Vector3d vPt = vRi * (-tRi.transpose() * tPi) + vPi;
   Eigen::Matrix3d vRt = vRi * tRi.transpose();
 
-  // Pose of the lighthouse in the vive frame
-  Eigen::Vector3d vPl(lh_poses_[lh_pointer_->first].translation.x,
-    lh_poses_[lh_pointer_->first].translation.y,
-    lh_poses_[lh_pointer_->first].translation.z);
-  Eigen::Quaterniond vQl(lh_poses_[lh_pointer_->first].rotation.w,
-    lh_poses_[lh_pointer_->first].rotation.x,
-    lh_poses_[lh_pointer_->first].rotation.y,
-    lh_poses_[lh_pointer_->first].rotation.z);
-  Eigen::Matrix3d vRl = vQl.toRotationMatrix();
+  // Compiled lighthouse
+  LighthouseModel const& lighthouse = lh_models_[lh_pointer_->first];
 
   // Convert poses
-  Eigen::Vector3d lPt = vRl.transpose() * vPt - vRl.transpose() * vPl;
-  Eigen::Matrix3d lRt = vRl.transpose() * vRt;
-
-  // Extrinsics
-  double phase;
-  double tilt;
-  double gib_phase;
-  double gib_mag;
-  double curve;
-  if (axis_ == HORIZONTAL) {
-    phase = lh_specs_[lh_pointer_->first].horizontal_motor.phase;
-    tilt = lh_specs_[lh_pointer_->first].horizontal_motor.tilt;
-    gib_phase = lh_specs_[lh_pointer_->first].horizontal_motor.gib_phase;
-    gib_mag = lh_specs_[lh_pointer_->first].horizontal_motor.gib_magnitude;
-    curve = lh_specs_[lh_pointer_->first].horizontal_motor.curve;
-  } else {
-    phase = lh_specs_[lh_pointer_->first].vertical_motor.phase;
-    tilt = lh_specs_[lh_pointer_->first].vertical_motor.tilt;
-    gib_phase = lh_specs_[lh_pointer_->first].vertical_motor.gib_phase;
-    gib_mag = lh_specs_[lh_pointer_->first].vertical_motor.gib_magnitude;
-    curve = lh_specs_[lh_pointer_->first].vertical_motor.curve;
-  }
+  Eigen::Vector3d lPt = lighthouse.lRv * (vPt - lighthouse.vPl);
+  Eigen::Matrix3d lRt = lighthouse.lRv * vRt;
 
   VectorTriplet data;
   for (auto sensor : tracker_.sensors) {
@@ -207,13 +186,12 @@ hive::ViveLight::ConstPtr Trajectory::GetLight() {
     double dproduct = lPs.normalized().transpose() * (lRt * tNs.normalized());
 
     double angle;
-    double x = (lPs(0)/lPs(2)); // Horizontal angle
-    double y = (lPs(1)/lPs(2)); // Vertical angle
-
     if (axis_ == HORIZONTAL) {
-      angle = atan(x) - phase - tan(tilt) * y - curve * y * y - sin(gib_phase + atan(x)) * gib_mag;
+      angle = LighthouseModel::ProjectHorizontal(lPs.data(),
+        lighthouse.motors[HORIZONTAL], true);
     } else {
-      angle = atan(y) - phase - tan(tilt) * x - curve * x * x - sin(gib_phase + atan(y)) * gib_mag;
+      angle = LighthouseModel::ProjectVertical(lPs.data(),
+        lighthouse.motors[VERTICAL], true);
     }
 
     if (angle > M_PI/3 || angle < -M_PI/3)
@@ -554,9 +532,11 @@ int main(int argc, char ** argv) {
 
   // Read bag with data
   if (argc < 2) {
-    std::cout << "Usage: ... hive_calibrator read.bag" << std::endl;
+    std::cout << "Usage: ... hive_simulate read.bag [async]" << std::endl;
     return -1;
   }
+  // Optimize the pose graph in the background, as the server does
+  bool async = (argc > 2 && std::string(argv[2]) == "async");
   rosbag::Bag rbag, wbag;
   rosbag::View view;
   std::string read_bag(argv[1]);
@@ -863,7 +843,7 @@ int main(int argc, char ** argv) {
   Solver * solver_pgo = new PoseGraph(calibration.environment,
     tracker,
     calibration.lighthouses,
-    4, 7e-4, 1e0, true);
+    4, 7e-4, 1e0, true, async);
   std::vector<Eigen::Vector3d> pgo_positions;
   std::vector<Eigen::Vector3d> pgo_attitudes;
   std::vector<double> pgo_distances;
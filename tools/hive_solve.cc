@@ -33,14 +33,17 @@
 int main(int argc, char ** argv) {
   // Data
   Calibration calibration;
-  std::map<std::string, Solver*> solver;
-  std::map<std::string, Solver*> aux_solver;
+  // Solvers by tracker id
+  std::vector<Solver*> solver;
+  std::vector<Solver*> aux_solver;
 
   // Read bag with data
   if (argc < 3) {
-    std::cout << "Usage: ... hive_calibrator read.bag write.bag" << std::endl;
+    std::cout << "Usage: ... hive_solve read.bag write.bag [async]" << std::endl;
     return -1;
   }
+  // Optimize the pose graph in the background, as the server does
+  bool async = (argc > 3 && std::string(argv[3]) == "async");
   rosbag::Bag rbag, wbag;
   rosbag::View view;
   std::string read_bag(argv[1]);
@@ -67,9 +70,12 @@ int main(int argc, char ** argv) {
       bag_it->instantiate<hive::ViveCalibrationTrackerArray>();
     calibration.SetTrackers(*vt);
   }
+  solver.resize(calibration.tracker_ids.Size(), NULL);
+  aux_solver.resize(calibration.tracker_ids.Size(), NULL);
   for (auto tracker : calibration.trackers) {
+    size_t id = calibration.tracker_ids.Find(tracker.first);
     // Aux solver
-    aux_solver[tracker.first] = new HiveSolver(calibration.trackers[tracker.first],
+    aux_solver[id] = new HiveSolver(calibration.trackers[tracker.first],
       calibration.lighthouses,
       calibration.environment,
       true);
@@ -99,10 +105,10 @@ int main(int argc, char ** argv) {
     //   calibration.environment,
     //   1.0e0, 1e-6, true, filter::ukf);
     // PGO
-    solver[tracker.first] = new PoseGraph(calibration.environment,
+    solver[id] = new PoseGraph(calibration.environment,
       calibration.trackers[tracker.first],
       calibration.lighthouses,
-      4, 7e-4, 1e0, true);
+      4, 7e-4, 1e0, true, async);
   }
   ROS_INFO("Trackers' setup complete.");
 
@@ -140,15 +146,18 @@ int main(int argc, char ** argv) {
   for (auto bag_it = view_li.begin(); bag_it != view_li.end(); bag_it++) {
     const hive::ViveLight::ConstPtr vl = bag_it->instantiate<hive::ViveLight>();
     if (vl != NULL) {
+      // Serials are resolved once per message
+      int id = calibration.tracker_ids.Find(vl->header.frame_id);
+      if (id < 0 || solver[id] == NULL) continue;
       // if (vl->header.stamp.toSec() > 1559054399.0) exit(0);
       // counter++;
       // if (counter < 1400) continue;
       // if (counter == 1701) break;
       // ROS_INFO("LIGHT");
-      // aux_solver[vl->header.frame_id]->ProcessLight(vl);
-      solver[vl->header.frame_id]->ProcessLight(vl);
+      // aux_solver[id]->ProcessLight(vl);
+      solver[id]->ProcessLight(vl);
       geometry_msgs::TransformStamped msg;
-      if (solver[vl->header.frame_id]->GetTransform(msg)) {
+      if (solver[id]->GetTransform(msg)) {
         std::cout << "Vive: " <<
           msg.header.stamp << " - " <<
           msg.transform.translation.x << ", " <<
@@ -160,7 +169,7 @@ int main(int argc, char ** argv) {
           msg.transform.rotation.z << std::endl;
         wbag.write("/tf", vl->header.stamp, msg);
       }
-      if (aux_solver[vl->header.frame_id]->GetTransform(msg)) {
+      if (aux_solver[id]->GetTransform(msg)) {
         std::cout << "ViveAux: " <<
           msg.header.stamp << " - " <<
           msg.transform.translation.x << ", " <<
@@ -178,10 +187,29 @@ int main(int argc, char ** argv) {
     if (vi != NULL) {
       // if (counter < 1400) continue;
       // ROS_INFO("IMU");
-      solver[vi->header.frame_id]->ProcessImu(vi);
+      int id = calibration.tracker_ids.Find(vi->header.frame_id);
+      if (id < 0 || solver[id] == NULL) continue;
+      solver[id]->ProcessImu(vi);
     }
   }
   ROS_INFO("Light read complete.");
+  // Solves that did not fit their time budget
+  for (size_t id = 0; id < solver.size(); id++) {
+    BudgetCounters counters;
+    if (solver[id] == NULL || !solver[id]->GetBudget(&counters)) continue;
+    ROS_INFO("%s: %zu solves, %zu over budget, %zu truncated, worst %.1f ms",
+      calibration.tracker_ids.Serial(id).c_str(),
+      counters.solves, counters.overruns, counters.truncated,
+      1e3 * counters.worst);
+  }
+  // Samples left out by the sweep filter
+  for (size_t id = 0; id < solver.size(); id++) {
+    InlierCounters counters;
+    if (solver[id] == NULL || !solver[id]->GetInliers(&counters)) continue;
+    ROS_INFO("%s: %zu of %zu samples left out, %zu sweeps unchecked",
+      calibration.tracker_ids.Serial(id).c_str(),
+      counters.outliers, counters.samples, counters.unchecked);
+  }
   rbag.close();
   wbag.close();
 